@@ -0,0 +1,325 @@
+/*
+ * NDArray
+ *
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2020, Hunter Belanger (hunter.belanger@gmail.com)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * */
+
+// Benchmarks of the hot paths of NDArray, built as the ndarray_bench target
+// when NDARRAY_BUILD_BENCHMARKS is ON. Run the ndarray_bench_json target, or
+// pass --benchmark_out=<file> --benchmark_out_format=json, to record the
+// results as JSON. Files for the I/O benchmarks are written to the directory
+// given by the NDARRAY_BENCH_DIR environment variable, or the current
+// directory, and are removed afterwards.
+#include <ndarray.hpp>
+
+#include <benchmark/benchmark.h>
+
+#include <complex>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Largest file written by the I/O benchmarks, which may be raised to tens of
+// GB with the NDARRAY_BENCH_MAX_IO_BYTES CMake variable
+#ifndef NDARRAY_BENCH_MAX_IO_BYTES
+#define NDARRAY_BENCH_MAX_IO_BYTES (int64_t(1) << 30)
+#endif
+
+namespace {
+
+const size_t n_index = 128;
+
+std::string bench_file(const std::string& name) {
+  const char* dir = std::getenv("NDARRAY_BENCH_DIR");
+  return std::string(dir != nullptr ? dir : ".") + "/" + name;
+}
+
+template <class T>
+NDArray<T> make_array(const std::vector<size_t>& shape,
+                      bool c_continuous = true) {
+  NDArray<T> a(shape, c_continuous);
+  for (size_t i = 0; i < a.size(); i++) a[i] = static_cast<T>(i % 127);
+  return a;
+}
+
+//==============================================================================
+// Indexing
+//
+// Each benchmark sums a 3D array in C order of its indices, so that the
+// Fortran ordered arrays (range 1) are read with a large stride.
+
+void BM_IndexVariadic(benchmark::State& state) {
+  const NDArray<double> a =
+      make_array<double>({n_index, n_index, n_index}, state.range(0) == 0);
+  for (auto _ : state) {
+    double sum = 0.;
+    for (size_t i = 0; i < n_index; i++)
+      for (size_t j = 0; j < n_index; j++)
+        for (size_t k = 0; k < n_index; k++) sum += a(i, j, k);
+    benchmark::DoNotOptimize(sum);
+  }
+  state.SetItemsProcessed(state.iterations() * a.size());
+}
+BENCHMARK(BM_IndexVariadic)->ArgName("fortran")->Arg(0)->Arg(1);
+
+void BM_IndexVector(benchmark::State& state) {
+  const NDArray<double> a =
+      make_array<double>({n_index, n_index, n_index}, state.range(0) == 0);
+  std::vector<size_t> indices(3);
+  for (auto _ : state) {
+    double sum = 0.;
+    for (indices[0] = 0; indices[0] < n_index; indices[0]++)
+      for (indices[1] = 0; indices[1] < n_index; indices[1]++)
+        for (indices[2] = 0; indices[2] < n_index; indices[2]++)
+          sum += a(indices);
+    benchmark::DoNotOptimize(sum);
+  }
+  state.SetItemsProcessed(state.iterations() * a.size());
+}
+BENCHMARK(BM_IndexVector)->ArgName("fortran")->Arg(0)->Arg(1);
+
+void BM_IndexStaticVector(benchmark::State& state) {
+  const NDArray<double> a =
+      make_array<double>({n_index, n_index, n_index}, state.range(0) == 0);
+  boost::container::static_vector<size_t, 3> indices(3);
+  for (auto _ : state) {
+    double sum = 0.;
+    for (indices[0] = 0; indices[0] < n_index; indices[0]++)
+      for (indices[1] = 0; indices[1] < n_index; indices[1]++)
+        for (indices[2] = 0; indices[2] < n_index; indices[2]++)
+          sum += a(indices);
+    benchmark::DoNotOptimize(sum);
+  }
+  state.SetItemsProcessed(state.iterations() * a.size());
+}
+BENCHMARK(BM_IndexStaticVector)->ArgName("fortran")->Arg(0)->Arg(1);
+
+void BM_IndexLinear(benchmark::State& state) {
+  const NDArray<double> a = make_array<double>({n_index, n_index, n_index});
+  for (auto _ : state) {
+    double sum = 0.;
+    for (size_t i = 0; i < a.size(); i++) sum += a[i];
+    benchmark::DoNotOptimize(sum);
+  }
+  state.SetItemsProcessed(state.iterations() * a.size());
+}
+BENCHMARK(BM_IndexLinear);
+
+//==============================================================================
+// Compound Operators
+//
+// Range 0 is the number of elements. The operand is an array of type U, or
+// a constant of type U.
+
+struct Add {
+  template <class A, class B>
+  static void apply(A& a, const B& b) {
+    a += b;
+  }
+};
+
+struct Subtract {
+  template <class A, class B>
+  static void apply(A& a, const B& b) {
+    a -= b;
+  }
+};
+
+struct Multiply {
+  template <class A, class B>
+  static void apply(A& a, const B& b) {
+    a *= b;
+  }
+};
+
+struct Divide {
+  template <class A, class B>
+  static void apply(A& a, const B& b) {
+    a /= b;
+  }
+};
+
+template <class Op, class T, class U>
+void BM_CompoundArray(benchmark::State& state) {
+  const size_t n = static_cast<size_t>(state.range(0));
+  NDArray<T> a = make_array<T>({n});
+  a += T(1);
+  const NDArray<U> b = make_array<U>({n}) + U(1);
+  for (auto _ : state) {
+    Op::apply(a, b);
+    benchmark::DoNotOptimize(a.data());
+    benchmark::ClobberMemory();
+  }
+  state.SetBytesProcessed(state.iterations() * n * (sizeof(T) + sizeof(U)));
+}
+
+template <class Op, class T, class U>
+void BM_CompoundConstant(benchmark::State& state) {
+  const size_t n = static_cast<size_t>(state.range(0));
+  NDArray<T> a = make_array<T>({n});
+  const U c(1);
+  for (auto _ : state) {
+    Op::apply(a, c);
+    benchmark::DoNotOptimize(a.data());
+    benchmark::ClobberMemory();
+  }
+  state.SetBytesProcessed(state.iterations() * n * sizeof(T));
+}
+
+#define NDARRAY_BENCH_COMPOUND(Op, T, U)                                  \
+  BENCHMARK_TEMPLATE(BM_CompoundArray, Op, T, U)->Range(1 << 10, 1 << 24); \
+  BENCHMARK_TEMPLATE(BM_CompoundConstant, Op, T, U)->Range(1 << 10, 1 << 24)
+
+#define NDARRAY_BENCH_COMPOUND_TYPES(T, U) \
+  NDARRAY_BENCH_COMPOUND(Add, T, U);       \
+  NDARRAY_BENCH_COMPOUND(Subtract, T, U);  \
+  NDARRAY_BENCH_COMPOUND(Multiply, T, U);  \
+  NDARRAY_BENCH_COMPOUND(Divide, T, U)
+
+NDARRAY_BENCH_COMPOUND_TYPES(float, float);
+NDARRAY_BENCH_COMPOUND_TYPES(double, double);
+NDARRAY_BENCH_COMPOUND_TYPES(int32_t, int32_t);
+NDARRAY_BENCH_COMPOUND_TYPES(double, float);
+NDARRAY_BENCH_COMPOUND_TYPES(std::complex<double>, std::complex<double>);
+
+//==============================================================================
+// Conversion
+
+template <class T, class C>
+void BM_Astype(benchmark::State& state) {
+  const size_t n = static_cast<size_t>(state.range(0));
+  const NDArray<T> a = make_array<T>({n});
+  for (auto _ : state) {
+    NDArray<C> b = a.template astype<C>();
+    benchmark::DoNotOptimize(b.data());
+  }
+  state.SetBytesProcessed(state.iterations() * n * (sizeof(T) + sizeof(C)));
+}
+BENCHMARK_TEMPLATE(BM_Astype, double, float)->Range(1 << 10, 1 << 24);
+BENCHMARK_TEMPLATE(BM_Astype, float, double)->Range(1 << 10, 1 << 24);
+BENCHMARK_TEMPLATE(BM_Astype, int32_t, double)->Range(1 << 10, 1 << 24);
+BENCHMARK_TEMPLATE(BM_Astype, float, Float16)->Range(1 << 10, 1 << 24);
+BENCHMARK_TEMPLATE(BM_Astype, Float16, float)->Range(1 << 10, 1 << 24);
+
+void BM_SwapBytes(benchmark::State& state) {
+  const size_t element_size = static_cast<size_t>(state.range(0));
+  const size_t n = static_cast<size_t>(state.range(1));
+  std::vector<char> data(n * element_size, 1);
+  for (auto _ : state) {
+    swap_bytes(data.data(), n, element_size);
+    benchmark::ClobberMemory();
+  }
+  state.SetBytesProcessed(state.iterations() * data.size());
+}
+BENCHMARK(BM_SwapBytes)
+    ->ArgNames({"element_size", "n"})
+    ->ArgsProduct({{2, 4, 8, 16}, {1 << 10, 1 << 20, 1 << 24}});
+
+//==============================================================================
+// Save and Load
+//
+// Range 0 is the size of the file in bytes, excluding its header.
+
+void BM_Save(benchmark::State& state) {
+  const size_t n = static_cast<size_t>(state.range(0)) / sizeof(double);
+  const NDArray<double> a = make_array<double>({n});
+  const std::string fname = bench_file("ndarray_bench_save.npy");
+  for (auto _ : state) a.save(fname);
+  std::remove(fname.c_str());
+  state.SetBytesProcessed(state.iterations() * n * sizeof(double));
+}
+BENCHMARK(BM_Save)
+    ->RangeMultiplier(32)
+    ->Range(1 << 10, NDARRAY_BENCH_MAX_IO_BYTES)
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+void BM_Load(benchmark::State& state) {
+  const size_t n = static_cast<size_t>(state.range(0)) / sizeof(double);
+  const std::string fname = bench_file("ndarray_bench_load.npy");
+  make_array<double>({n}).save(fname);
+  for (auto _ : state) {
+    NDArray<double> a = NDArray<double>::load(fname);
+    benchmark::DoNotOptimize(a.data());
+  }
+  std::remove(fname.c_str());
+  state.SetBytesProcessed(state.iterations() * n * sizeof(double));
+}
+BENCHMARK(BM_Load)
+    ->RangeMultiplier(32)
+    ->Range(1 << 10, NDARRAY_BENCH_MAX_IO_BYTES)
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+// Loads a file whose byte order differs from that of the system, so that
+// every element is swapped as it is read
+void BM_LoadSwapped(benchmark::State& state) {
+  const size_t n = static_cast<size_t>(state.range(0)) / sizeof(double);
+  const std::string fname = bench_file("ndarray_bench_swapped.npy");
+  {
+    NDArray<double> a = make_array<double>({n});
+    swap_bytes(reinterpret_cast<char*>(a.data()), a.size(), sizeof(double));
+    write_npy(fname, reinterpret_cast<const char*>(a.data()), a.shape(),
+              DType::DOUBLE64, true);
+  }
+
+  // Flip the byte order marker of the descr in the header
+  {
+    std::fstream file(fname, std::ios::in | std::ios::out | std::ios::binary);
+    std::string header(128, '\0');
+    file.read(&header[0], 128);
+    const size_t marker =
+        header.find(system_is_little_endian() ? "<f8" : ">f8");
+    file.seekp(static_cast<std::streamoff>(marker));
+    file.put(system_is_little_endian() ? '>' : '<');
+  }
+
+  for (auto _ : state) {
+    NDArray<double> a = NDArray<double>::load(fname);
+    benchmark::DoNotOptimize(a.data());
+  }
+  std::remove(fname.c_str());
+  state.SetBytesProcessed(state.iterations() * n * sizeof(double));
+}
+BENCHMARK(BM_LoadSwapped)
+    ->RangeMultiplier(32)
+    ->Range(1 << 10, NDARRAY_BENCH_MAX_IO_BYTES)
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+}  // namespace
+
+BENCHMARK_MAIN();
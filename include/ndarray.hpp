@@ -38,16 +38,85 @@
 #include <iostream>
 #include <algorithm>
 #include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
 #include <complex>
+#include <condition_variable>
+#include <cstddef>
 #include <cstdint>
+#include <cstdlib>
 #include <cstring>
+#include <deque>
+#include <exception>
 #include <fstream>
+#include <functional>
+#include <future>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <new>
 #include <stdexcept>
 #include <string>
-#include <typeinfo>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 #include <boost/container/static_vector.hpp>
 
+#if defined(_WIN32)
+#include <malloc.h>
+#endif
+
+// Compressed .npz archives are only supported with zlib
+#if defined(NDARRAY_USE_ZLIB)
+#include <zlib.h>
+#endif
+
+// Matrix products of float, double and complex numbers may be computed by a
+// BLAS library. A header other than cblas.h, such as mkl_cblas.h, may be
+// given by NDARRAY_CBLAS_HEADER.
+#if defined(NDARRAY_USE_BLAS)
+#if defined(NDARRAY_CBLAS_HEADER)
+#include NDARRAY_CBLAS_HEADER
+#else
+#include <cblas.h>
+#endif
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define NDARRAY_HAS_MMAP
+#endif
+
+// Instruction sets for which explicit SIMD kernels are compiled. On x86 the
+// kernels are compiled for AVX2 and AVX-512 with target attributes, and
+// selected at runtime.
+#if !defined(NDARRAY_NO_SIMD)
+#if (defined(__x86_64__) || defined(__i386__)) && \
+    (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define NDARRAY_SIMD_X86
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define NDARRAY_SIMD_NEON
+#endif
+#endif
+
+// Bounds checking of indices given to operator() and linear_index is skipped
+// if NDARRAY_NO_BOUNDS_CHECK is defined, which is the default for release
+// builds (NDEBUG) unless NDARRAY_BOUNDS_CHECK is defined. The at() methods
+// always check their indices.
+#if defined(NDEBUG) && !defined(NDARRAY_BOUNDS_CHECK) && \
+    !defined(NDARRAY_NO_BOUNDS_CHECK)
+#define NDARRAY_NO_BOUNDS_CHECK
+#endif
+
 // Macro to force function to be inlined. This is done for speed and to try and
 // force the compiler to vectorize operatrions.
 #if defined(_MSC_VER)
@@ -59,10 +128,159 @@
 #endif
 
 //==============================================================================
-// Template Class NDArray
+// Forward Declarations
+enum class DType;
+
+template <class T, size_t Alignment = 64>
+class AlignedAllocator;
+
+template <class T, class Allocator = AlignedAllocator<T>>
+class NDArray;
+
+template <class T>
+class NDArrayView;
+
+template <class T, size_t N>
+class FixedNDArray;
+
+template <class E>
+class NDExpression;
+
+template <class T>
+class MappedNDArray;
+
+template <class T>
+class StencilPoint;
+
+template <class T>
+class ChunkedNDArray;
+
+template <class T, class Allocator = AlignedAllocator<T>>
+class SharedNDArray;
+
+class NpyWriter;
+
+class NpyReader;
+
+class NpzWriter;
+
+class NpzReader;
+
+template <class T>
+class NpyBatchLoader;
+
+// Modes in which a .npy file may be memory mapped by NDArray<T>::load_mmap.
+enum class MMapMode {
+  ReadOnly,    // Pages are shared with the file, and elements are const
+  CopyOnWrite  // Pages may be written to, but changes never reach the file
+};
+
+// Modes in which the elements of an array are converted by NDArray::astype.
+enum class ConversionMode {
+  Cast,     // As by assignment of each element
+  Saturate  // Values beyond the range of an integer type are clamped to it
+};
+
+// Values given by NDArray::stencil to neighbours beyond the edges of an array.
+enum class BoundaryMode {
+  Clamp,     // The nearest element on the edge
+  Periodic,  // The element on the opposite side, as if the array repeats
+  Constant   // A constant value
+};
+
+// Type of the mean of elements of type T, where integers are averaged as
+// doubles.
+template <class T>
+struct NDMeanType {
+  typedef typename std::conditional<std::is_integral<T>::value, double,
+                                    T>::type type;
+};
+
+// Type of the variance and norm of elements of type T, which is real.
 template <class T>
+struct NDRealType {
+  typedef typename NDMeanType<T>::type type;
+};
+
+template <class R>
+struct NDRealType<std::complex<R>> {
+  typedef R type;
+};
+
+// Type of the elements of the result of a stencil, which is the type
+// returned by the kernel f for a StencilPoint<T>.
+template <class T, class F>
+struct NDStencilResult {
+  typedef typename std::decay<decltype(std::declval<F&>()(
+      std::declval<const StencilPoint<T>&>()))>::type type;
+};
+
+//==============================================================================
+// Template Class AlignedAllocator
+//
+// Allocator whose memory is aligned to Alignment bytes, which must be a power
+// of two. It is the default allocator of NDArray, so that arrays begin on a
+// cache line and aligned vector loads never split one. Any other standard
+// allocator (for huge pages, NUMA local memory or an arena) may be given to
+// NDArray instead.
+template <class T, size_t Alignment>
+class AlignedAllocator {
+  static_assert(Alignment > 0 && (Alignment & (Alignment - 1)) == 0,
+                "Alignment of AlignedAllocator must be a power of two.");
+
+ public:
+  typedef T value_type;
+
+  template <class U>
+  struct rebind {
+    typedef AlignedAllocator<U, Alignment> other;
+  };
+
+  AlignedAllocator() noexcept {}
+
+  template <class U>
+  AlignedAllocator(const AlignedAllocator<U, Alignment>&) noexcept {}
+
+  // Allocates memory for n elements, throwing std::bad_alloc on failure
+  T* allocate(size_t n);
+
+  // Frees memory returned by allocate
+  void deallocate(T* p, size_t n) noexcept;
+
+  // Elements constructed without arguments are default initialized, so that
+  // resizing a vector of numbers does not first write zeros to memory which
+  // is about to be overwritten. NDArray zeroes the elements of new arrays.
+  template <class U>
+  void construct(U* p) {
+    ::new (static_cast<void*>(p)) U;
+  }
+
+  template <class U, class... Args>
+  void construct(U* p, Args&&... args) {
+    ::new (static_cast<void*>(p)) U(std::forward<Args>(args)...);
+  }
+};
+
+template <class T, class U, size_t Alignment>
+bool operator==(const AlignedAllocator<T, Alignment>&,
+                const AlignedAllocator<U, Alignment>&) {
+  return true;
+}
+
+template <class T, class U, size_t Alignment>
+bool operator!=(const AlignedAllocator<T, Alignment>&,
+                const AlignedAllocator<U, Alignment>&) {
+  return false;
+}
+
+//==============================================================================
+// Template Class NDArray
+template <class T, class Allocator>
 class NDArray {
  public:
+  typedef T value_type;
+  typedef Allocator allocator_type;
+
   //==========================================================================
   // Constructors and Destructors
   NDArray();
@@ -72,23 +290,63 @@ class NDArray {
   NDArray(boost::container::static_vector<std::size_t, N_dimension_>& init_shape, bool c_continuous = true);
 
 
-  NDArray(const std::vector<T>& data, const std::vector<size_t>& init_shape,
+  NDArray(const std::vector<T, Allocator>& data,
+          const std::vector<size_t>& init_shape, bool c_continuous = true);
+  NDArray(std::vector<T, Allocator>&& data,
+          const std::vector<size_t>& init_shape, bool c_continuous = true);
+
+  // Copies data held by a vector with a different allocator
+  template <class A>
+  NDArray(const std::vector<T, A>& data, const std::vector<size_t>& init_shape,
           bool c_continuous = true);
-  NDArray(std::vector<T>&& data, const std::vector<size_t>& init_shape,
+
+  // Moves the elements of a vector with a different allocator, such as a
+  // std::vector<T>, into new storage, and frees the storage of data. Its
+  // buffer can not be adopted, so the data is still copied once.
+  template <class A>
+  NDArray(std::vector<T, A>&& data, const std::vector<size_t>& init_shape,
           bool c_continuous = true);
 
+  // Evaluates the expression into a new array, with the storage order of
+  // the first array in the expression
+  template <class E>
+  NDArray(const NDExpression<E>& expression);
 
   ~NDArray() = default;
-  NDArray(const NDArray&) = default;
+  NDArray(const NDArray& other);
   NDArray(NDArray&&) = default;
 
   // Assignment Operator
-  NDArray& operator=(const NDArray&) = default;
+  NDArray& operator=(const NDArray& other);
   NDArray& operator=(NDArray&&) = default;
 
+  // Evaluates the expression into this array. The array takes the shape and
+  // storage order of the expression, and is only reallocated if they differ.
+  template <class E>
+  NDArray& operator=(const NDExpression<E>& expression);
+
   // Static load function
   static NDArray load(const std::string& fname);
 
+  // Static load function which reads the file on a background I/O thread
+  static std::future<NDArray> load_async(const std::string& fname);
+
+  // Static load function which reads the file into array, reusing its
+  // storage. The array takes the shape and storage order of the file, and is
+  // only reallocated if the data does not fit in its current capacity. The
+  // array is unchanged if the file can not be opened or its header is
+  // rejected. Since the data is read over the old contents, the array is
+  // left empty, keeping its capacity, if reading the data fails.
+  static void load_into(const std::string& fname, NDArray& array);
+
+  // Static load functions which memory map the file instead of reading it,
+  // so that no copy of the data is made. The data is only copied into
+  // memory if the byte order of the file differs from that of the system.
+  // The first maps the file with MMapMode::ReadOnly, so its elements are
+  // const. The second throws if mode is MMapMode::ReadOnly.
+  static MappedNDArray<const T> load_mmap(const std::string& fname);
+  static MappedNDArray<T> load_mmap(const std::string& fname, MMapMode mode);
+
   //==========================================================================
   // Indexing
 
@@ -111,16 +369,70 @@ class NDArray {
   template <typename... INDS>
   const T& operator()(INDS... inds) const;
 
+  // Indexing methods which always check that the indices are valid,
+  // regardless of NDARRAY_NO_BOUNDS_CHECK
+  T& at(const std::vector<size_t>& indices);
+  const T& at(const std::vector<size_t>& indices) const;
+
+  template <typename... INDS>
+  T& at(INDS... inds);
+  template <typename... INDS>
+  const T& at(INDS... inds) const;
+
   // Linear Indexing operators
   T& operator[](size_t i);
   const T& operator[](size_t i) const;
 
+  //==========================================================================
+  // Iteration
+
+  // Iterators over the elements in the order they are stored, which is
+  // row-major for C order arrays and column-major for fortran order arrays
+  typedef T* iterator;
+  typedef const T* const_iterator;
+
+  iterator begin();
+  iterator end();
+  const_iterator begin() const;
+  const_iterator end() const;
+
+  // Calls f(index, element) for every element, in the order they are stored.
+  // The vector index holds the indices of the element, and is updated in
+  // place as the elements are visited.
+  template <class F>
+  void for_each_index(F f);
+  template <class F>
+  void for_each_index(F f) const;
+
+  // Calls f(p, n, stride) for every lane along axis, whose n elements are
+  // p[0], p[stride], ..., p[(n - 1) * stride]. Lanes may be divided between
+  // threads according to the execution policy, so f must be safe to call
+  // concurrently for different lanes.
+  template <class F>
+  void apply_along_axis(size_t axis, F f);
+  template <class F>
+  void apply_along_axis(size_t axis, F f) const;
+
+  // Returns a new array in C order, whose element at each index is f(p) for
+  // the StencilPoint p at that index of this array. The kernel may read
+  // neighbours up to radius elements away along each axis, where those
+  // beyond the edges of the array are given by mode. Tiles of the array are
+  // divided between threads according to the execution policy, so f must be
+  // safe to call concurrently.
+  template <class F>
+  NDArray<typename NDStencilResult<T, F>::type> stencil(
+      size_t radius, F f, BoundaryMode mode = BoundaryMode::Clamp,
+      const T& constant = T()) const;
+
   //==========================================================================
   // Constant Methods
 
-  // Return underlying data vector
-  std::vector<T>& data_vector();
-  const std::vector<T>& data_vector() const;
+  // Return underlying data vector, which is a std::vector<T, Allocator>
+  // rather than a std::vector<T>. With the default AlignedAllocator,
+  // elements added to it without a value, as by resize(n) or emplace_back(),
+  // are default initialized, so numbers are left indeterminate, not zeroed.
+  std::vector<T, Allocator>& data_vector();
+  const std::vector<T, Allocator>& data_vector() const;
 
   // Return pointer to beginning of data
   T* data();
@@ -129,6 +441,9 @@ class NDArray {
   // Return vector describing shape of array
   const std::vector<size_t>& shape() const;
 
+  // Return vector with the stride of each axis, as a number of elements
+  const std::vector<size_t>& strides() const;
+
   // Return number of elements in array
   size_t size() const;
 
@@ -141,9 +456,80 @@ class NDArray {
   // and false if fortran continuous (column-major order)
   bool c_continuous() const;
 
+  // Returns a non-owning view of the whole array. The view is invalidated
+  // if the array is reallocated.
+  NDArrayView<T> view();
+  NDArrayView<const T> view() const;
+
+  // Returns a copy of the array stored in C order (row-major) or in fortran
+  // order (column-major). The elements are moved by a tiled transpose, which
+  // is divided between threads.
+  NDArray to_c_order() const;
+  NDArray to_fortran_order() const;
+
+  // Returns a new array in C order which holds the transpose of this array,
+  // with the order of the axes reversed, or with axis i of the result being
+  // axis axes[i] of this array.
+  NDArray transpose() const;
+  NDArray transpose(const std::vector<size_t>& axes) const;
+
   // Save array to the file fname.npy
   void save(const std::string& fname) const;
 
+  // Saves the array to the file fname on a background I/O thread, returning
+  // a future which becomes ready once the file is written. The data is
+  // copied first, so the array may be modified immediately. The data of an
+  // rvalue, as in std::move(array).save_async(fname), is moved instead.
+  std::future<void> save_async(const std::string& fname) const&;
+  std::future<void> save_async(const std::string& fname) &&;
+
+  //==========================================================================
+  // Reductions
+  //
+  // Each reduction may be taken over all elements, or along an axis. The
+  // result along an axis has the shape of this array without that axis (or
+  // a shape of {1} for a 1D array), and the same storage order.
+
+  // Returns the sum of the elements
+  T sum() const;
+  NDArray<T> sum(size_t axis) const;
+
+  // Returns the product of the elements
+  T prod() const;
+  NDArray<T> prod(size_t axis) const;
+
+  // Returns the smallest element, or NaN if there is one. An exception is
+  // thrown if there are no elements.
+  T min() const;
+  NDArray<T> min(size_t axis) const;
+
+  // Returns the largest element, or NaN if there is one. An exception is
+  // thrown if there are no elements.
+  T max() const;
+  NDArray<T> max(size_t axis) const;
+
+  // Returns the linear index of the first smallest element, which along an
+  // axis is the index along that axis
+  size_t argmin() const;
+  NDArray<size_t> argmin(size_t axis) const;
+
+  // Returns the linear index of the first largest element, which along an
+  // axis is the index along that axis
+  size_t argmax() const;
+  NDArray<size_t> argmax(size_t axis) const;
+
+  // Returns the mean of the elements
+  typename NDMeanType<T>::type mean() const;
+  NDArray<typename NDMeanType<T>::type> mean(size_t axis) const;
+
+  // Returns the population variance, which is the mean of |x - mean()|^2
+  typename NDRealType<T>::type var() const;
+  NDArray<typename NDRealType<T>::type> var(size_t axis) const;
+
+  // Returns the Euclidean norm, which is the square root of the sum of |x|^2
+  typename NDRealType<T>::type norm() const;
+  NDArray<typename NDRealType<T>::type> norm(size_t axis) const;
+
   //==========================================================================
   // Non-Constant Methods
 
@@ -162,14 +548,25 @@ class NDArray {
 
   //==========================================================================
   // Operators for Any Type (Same or Different)
+  template <class C, class A>
+  NDArray& operator+=(const NDArray<C, A>& a);
+  template <class C, class A>
+  NDArray& operator-=(const NDArray<C, A>& a);
+  template <class C, class A>
+  NDArray& operator*=(const NDArray<C, A>& a);
+  template <class C, class A>
+  NDArray& operator/=(const NDArray<C, A>& a);
+
+  // A view which overlaps this array, other than element for element, such
+  // as a transposed or broadcast view of it, is copied before it is applied
   template <class C>
-  NDArray& operator+=(const NDArray<C>& a);
+  NDArray& operator+=(const NDArrayView<C>& a);
   template <class C>
-  NDArray& operator-=(const NDArray<C>& a);
+  NDArray& operator-=(const NDArrayView<C>& a);
   template <class C>
-  NDArray& operator*=(const NDArray<C>& a);
+  NDArray& operator*=(const NDArrayView<C>& a);
   template <class C>
-  NDArray& operator/=(const NDArray<C>& a);
+  NDArray& operator/=(const NDArrayView<C>& a);
 
   //==========================================================================
   // Operators for Constants
@@ -183,1100 +580,11017 @@ class NDArray {
   NDArray& operator/=(const C& c);
 
   //==========================================================================
-  // Conversion Operator
-  template <class C>
-  operator NDArray<C>() const;
+  // Conversion
+  // Returns a copy of the array with its elements converted to C, in the same
+  // storage order. With ConversionMode::Saturate, values beyond the range of
+  // an integer type C are clamped to it, and NaN becomes zero.
+  template <class C, class A = AlignedAllocator<C>>
+  NDArray<C, A> astype(ConversionMode mode = ConversionMode::Cast) const;
+
+  // Conversion Operator, which is the same as astype<C, A>()
+  template <class C, class A>
+  operator NDArray<C, A>() const;
 
  private:
-  std::vector<T> data_;
+  std::vector<T, Allocator> data_;
   std::vector<size_t> shape_;
+  std::vector<size_t> strides_;
   bool c_continuous_;
   size_t dimensions_;
 
-  template <class C>
+  template <class C, class A>
   friend class NDArray;
 
-  size_t c_continuous_index(const std::vector<size_t>& indices) const;
+  template <class C>
+  friend class MappedNDArray;
 
-  size_t fortran_continuous_index(const std::vector<size_t>& indices) const;
+  template <class C>
+  friend class ChunkedNDArray;
 
-  template <size_t D>
-  inline size_t c_continuous_index(const std::array<size_t, D>& indices) const;
+  template <class C, class A>
+  friend class SharedNDArray;
 
-  template <size_t D>
-  inline size_t fortran_continuous_index(
-      const std::array<size_t, D>& indices) const;
-};
+  template <class C, size_t M>
+  friend class FixedNDArray;
 
-//==============================================================================
-// Declarations for NPY functions
+  template <class C>
+  friend class NDArrayView;
 
-// Enum of possible data types handeled by this implementation.
-enum class DType {
-  CHAR,
-  UCHAR,
-  INT16,
-  INT32,
-  INT64,
-  UINT16,
-  UINT32,
-  UINT64,
-  FLOAT32,
-  DOUBLE64,
-  COMPLEX64,
-  COMPLEX128
-};
+  friend class NpyWriter;
 
-// Function which opens file fname, and loads in the binary data into 1D
-// array of chars, which must latter be type cast be the user. The char* to
-// the data is returned as a reference, along with the number of elements,
-// continuits, and element size in bytes. Returned is a vector for the shape.
-void load_npy(const std::string& fname, char*& data_ptr, std::vector<size_t>& shape,
-              DType& dtype, bool& c_contiguous);
+  friend class NpyReader;
 
-// Function which writes binary data to a Numpy .npy file.
-void write_npy(const std::string& fname, const char* data_ptr,
-               const std::vector<size_t>& shape, DType dtype, bool c_contiguous);
+  friend class NpzWriter;
 
-// Returns the proper DType for a given Numpy dtype.descr string.
-DType descr_to_DType(const std::string& dtype);
+  friend class NpzReader;
 
-// Returns Numpy descr string for given DType
-std::string DType_to_descr(DType dtype);
+  template <class C>
+  friend class NpyBatchLoader;
 
-// Returns the number of bytes used to represent the provided DType.
-size_t size_of_DType(DType dtype);
+  // Returns the DType which corresponds to T, for reading and writing .npy
+  // files. It is a compile time error if T has no DType.
+  static constexpr DType npy_dtype();
 
-// Function to check wether or not host system is little-endian or not
-bool system_is_little_endian();
+  // Sets strides_ from shape_ and c_continuous_
+  void compute_strides();
 
-// Function to switch bye order of data for an array which contains
-// n_elements, each with element_size bytes. The size of data should
-// therefore be n_elements*element_size; if not, this is undefined behavior.
-void swap_bytes(char* data, uint64_t n_elements, size_t element_size);
+  // Reallocates the array to the given shape, without initializing the
+  // elements, which must all be written by the caller
+  void allocate_for_overwrite(const std::vector<size_t>& new_shape);
 
-// Swaps the first and second byte pointed to by char* bytes.
-void swap_two_bytes(char* bytes);
+  // Writes the value of every element of the expression e, which must have
+  // the same shape as this array
+  template <class E>
+  void evaluate(const E& e);
 
-// Swaps the first four bytes pointed to by char* bytes.
-void swap_four_bytes(char* bytes);
+  // Returns the linear index for the given indices, which are checked unless
+  // NDARRAY_NO_BOUNDS_CHECK is defined
+  template <class INDICES>
+  size_t element_index(const INDICES& indices) const;
 
-// Swaps the first eight bytes pointed to by char* bytes.
-void swap_eight_bytes(char* bytes);
+  // Returns the linear index for the given indices, throwing an exception if
+  // they are not valid
+  template <class INDICES>
+  size_t checked_index(const INDICES& indices) const;
 
-// Swaps the first sixteen bytes pointed to by char* bytes.
-void swap_sixteen_bytes(char* bytes);
+  // Returns the linear index for the given indices, without any checks
+  template <class INDICES>
+  size_t unchecked_index(const INDICES& indices) const;
+
+  template <class I, size_t D>
+  size_t unchecked_index(const std::array<I, D>& indices) const;
+};
 
 //==============================================================================
-// NDArray Implementation
+// Template Class NDArrayView
+//
+// Non-owning view of the elements of an NDArray (or any other block of
+// memory), described by a pointer, a shape, and the stride of every axis in
+// elements. Slicing, transposing and squeezing a view produce new views of the
+// same elements, without copying any data. A view of const T only permits
+// reading. The viewed memory must outlive the view. An operand of compound
+// assignment which overlaps the view, other than element for element, is
+// copied before it is applied, as in Numpy.
 template <class T>
-NDArray<T>::NDArray():data_{}, shape_{}, c_continuous_{true}, dimensions_{0} {}
+class NDArrayView {
+ public:
+  typedef typename std::remove_const<T>::type value_type;
 
-template <class T>
-NDArray<T>::NDArray(const std::vector<size_t>& init_shape, bool c_continuous) {
-  if (init_shape.size() > 0) {
-    shape_ = init_shape;
-    dimensions_ = shape_.size();
+  //==========================================================================
+  // Constructors and Destructors
+  NDArrayView();
+  NDArrayView(T* data, const std::vector<size_t>& shape,
+              const std::vector<size_t>& strides);
+  NDArrayView(T* data, const std::vector<size_t>& shape,
+              bool c_continuous = true);
 
-    size_t ne = init_shape[0];
-    for (size_t i = 1; i < dimensions_; i++) {
-      ne *= init_shape[i];
-    }
+  // Allows a view of T to be used as a view of const T
+  template <class C, typename = typename std::enable_if<
+                         std::is_same<const C, T>::value>::type>
+  NDArrayView(const NDArrayView<C>& other);
 
-    data_.resize(ne);
+  ~NDArrayView() = default;
+  NDArrayView(const NDArrayView&) = default;
+  NDArrayView(NDArrayView&&) = default;
 
-    c_continuous_ = c_continuous;
+  // Assignment Operator
+  NDArrayView& operator=(const NDArrayView&) = default;
+  NDArrayView& operator=(NDArrayView&&) = default;
 
-  } else {
-    std::string mssg = "NDArray shape vector must have at least one element.";
-    throw std::runtime_error(mssg);
-  }
-}
+  //==========================================================================
+  // Indexing
 
-template <class T>
-template <std::size_t N_dimension_>
-NDArray<T>::NDArray(boost::container::static_vector<std::size_t, N_dimension_>& init_shape, bool c_continuous) {
-  if (init_shape.size() > 0) {
-    shape_.clear();
-    shape_.reserve( init_shape.size() );
+  // Indexing operators for indexing with vector
+  T& operator()(const std::vector<size_t>& indices) const;
 
-    for (std::size_t c : init_shape) {
-        shape_.push_back(c);
-    }
+  template <typename std::size_t ND_>
+  T& operator()(
+      const boost::container::static_vector<size_t, ND_>& indices) const;
 
-    dimensions_ = shape_.size();
+  // Variadic indexing operators
+  // Access data with array indices.
+  template <typename... INDS>
+  T& operator()(INDS... inds) const;
 
-    std::size_t ne = init_shape[0];
-    for (std::size_t i = 1; i < dimensions_; i++) {
-        ne *= init_shape[i];
-    }
+  // Indexing methods which always check that the indices are valid,
+  // regardless of NDARRAY_NO_BOUNDS_CHECK
+  T& at(const std::vector<size_t>& indices) const;
 
-    data_.resize(ne);
+  template <typename... INDS>
+  T& at(INDS... inds) const;
 
-    c_continuous_ = c_continuous;
-  } else {
-    std::string mssg = "NDArray shape vector must have at least one element.";
-    throw std::runtime_error(mssg);
-  }
-}
+  //==========================================================================
+  // Iteration
+
+  // Forward iterator over the viewed elements in row-major order
+  class iterator;
+
+  iterator begin() const;
+  iterator end() const;
+
+  // Calls f(index, element) for every viewed element, in the order they are
+  // stored in memory (the axis with the smallest stride varies fastest). The
+  // vector index holds the indices of the element, and is updated in place
+  // as the elements are visited.
+  template <class F>
+  void for_each_index(F f) const;
+
+  // Calls f(p, n, stride) for every lane along axis, whose n elements are
+  // p[0], p[stride], ..., p[(n - 1) * stride]. Lanes may be divided between
+  // threads according to the execution policy, so f must be safe to call
+  // concurrently for different lanes.
+  template <class F>
+  void apply_along_axis(size_t axis, F f) const;
+
+  // Returns a new array in C order, whose element at each index is f(p) for
+  // the StencilPoint p at that index of this view, as NDArray::stencil.
+  template <class F>
+  NDArray<typename NDStencilResult<value_type, F>::type> stencil(
+      size_t radius, F f, BoundaryMode mode = BoundaryMode::Clamp,
+      const value_type& constant = value_type()) const;
 
-template <class T>
-NDArray<T>::NDArray(const std::vector<T>& data, const std::vector<size_t>& init_shape,
-                    bool c_continuous) {
-  if (init_shape.size() > 0) {
-    shape_ = init_shape;
-    dimensions_ = shape_.size();
+  //==========================================================================
+  // Constant Methods
 
-    size_t ne = init_shape[0];
-    for (size_t i = 1; i < dimensions_; i++) {
-      ne *= init_shape[i];
-    }
+  // Return pointer to the first element of the view
+  T* data() const;
 
-    if (ne != data.size()) {
-      std::string mssg =
-          "Shape is incompatible with number of elements provided for NDArray.";
-      throw std::runtime_error(mssg);
-    }
+  // Return vector describing shape of view
+  const std::vector<size_t>& shape() const;
 
-    data_ = data;
+  // Return vector with the stride of each axis, as a number of elements
+  const std::vector<size_t>& strides() const;
 
-    c_continuous_ = c_continuous;
+  // Return number of elements in view
+  size_t size() const;
 
-  } else {
-    std::string mssg =
-        "Shape vector must have at least one element for NDArray.";
-    throw std::runtime_error(mssg);
-  }
-}
+  // Returns the offset from data() of the element at the given indices
+  size_t linear_index(const std::vector<size_t>& indices) const;
 
-template <class T>
-NDArray<T>::NDArray(std::vector<T>&& data, const std::vector<size_t>& init_shape,
-                    bool c_continuous) {
-  if (init_shape.size() > 0) {
-    shape_ = init_shape;
-    dimensions_ = shape_.size();
+  template <typename... INDS>
+  size_t linear_index(INDS... inds) const;
 
-    size_t ne = init_shape[0];
-    for (size_t i = 1; i < dimensions_; i++) {
-      ne *= init_shape[i];
-    }
+  // Returns true if the elements of the view are contiguous in memory in
+  // row-major order
+  bool c_continuous() const;
 
-    if (ne != data.size()) {
-      std::string mssg =
-          "Shape is incompatible with number of elements provided for NDArray.";
-      throw std::runtime_error(mssg);
-    }
+  // Returns true if the elements of the view are contiguous in memory in
+  // column-major order
+  bool fortran_continuous() const;
 
-    data_ = std::move(data);
+  // Returns a view of the elements start, start + step, ... < stop along
+  // the given axis
+  NDArrayView slice(size_t axis, size_t start, size_t stop,
+                    size_t step = 1) const;
 
-    c_continuous_ = c_continuous;
+  // Returns a view with the order of the axes reversed
+  NDArrayView transpose() const;
 
-  } else {
-    std::string mssg =
-        "Shape vector must have at least one element for NDArray.";
-    throw std::runtime_error(mssg);
-  }
-}
+  // Returns a view with the axes permuted, so that axis i of the new view
+  // is axis axes[i] of this view
+  NDArrayView transpose(const std::vector<size_t>& axes) const;
 
+  // Returns a view with all axes of length one removed
+  NDArrayView squeeze() const;
 
-template <class T>
-NDArray<T> NDArray<T>::load(const std::string &fname) {
-  // Get expected DType according to T
-  DType expected_dtype;
-  const char* T_type_name = typeid(T).name();
-
-  if (T_type_name == typeid(char).name())
-    expected_dtype = DType::CHAR;
-  else if (T_type_name == typeid(unsigned char).name())
-    expected_dtype = DType::UCHAR;
-  else if (T_type_name == typeid(uint16_t).name())
-    expected_dtype = DType::UINT16;
-  else if (T_type_name == typeid(uint32_t).name())
-    expected_dtype = DType::UINT32;
-  else if (T_type_name == typeid(uint64_t).name())
-    expected_dtype = DType::UINT64;
-  else if (T_type_name == typeid(int16_t).name())
-    expected_dtype = DType::INT16;
-  else if (T_type_name == typeid(int32_t).name())
-    expected_dtype = DType::INT32;
-  else if (T_type_name == typeid(int64_t).name())
-    expected_dtype = DType::INT64;
-  else if (T_type_name == typeid(float).name())
-    expected_dtype = DType::FLOAT32;
-  else if (T_type_name == typeid(double).name())
-    expected_dtype = DType::DOUBLE64;
-  else if (T_type_name == typeid(std::complex<float>).name())
-    expected_dtype = DType::COMPLEX64;
-  else if (T_type_name == typeid(std::complex<double>).name())
-    expected_dtype = DType::COMPLEX128;
-  else {
-    std::string mssg = "The datatype is not supported for NDArray.";
-    throw std::runtime_error(mssg);
-  }
+  // Returns a view of the elements as an array of the given shape, following
+  // the broadcasting rules of Numpy. Stretched axes have a stride of zero, so
+  // that nothing is copied, and several indices may refer to one element.
+  NDArrayView broadcast_to(const std::vector<size_t>& shape) const;
 
-  // Variables to send to npy function
-  char* data_ptr;
-  std::vector<T> data_vector;
-  std::vector<size_t> data_shape;
-  DType data_dtype;
-  bool data_c_continuous;
+  // Returns a new row-major NDArray holding a copy of the viewed elements
+  NDArray<typename std::remove_const<T>::type> copy() const;
 
-  // Load data into variables
-  load_npy(fname, data_ptr, data_shape, data_dtype, data_c_continuous);
+  //==========================================================================
+  // Reductions
+  //
+  // Each reduction may be taken over all elements, or along an axis. The
+  // result along an axis has the shape of this view without that axis (or
+  // a shape of {1} for a 1D array), and the same storage order.
+
+  // Returns the sum of the elements
+  value_type sum() const;
+  NDArray<value_type> sum(size_t axis) const;
+
+  // Returns the product of the elements
+  value_type prod() const;
+  NDArray<value_type> prod(size_t axis) const;
+
+  // Returns the smallest element, or NaN if there is one. An exception is
+  // thrown if there are no elements.
+  value_type min() const;
+  NDArray<value_type> min(size_t axis) const;
+
+  // Returns the largest element, or NaN if there is one. An exception is
+  // thrown if there are no elements.
+  value_type max() const;
+  NDArray<value_type> max(size_t axis) const;
+
+  // Returns the linear index of the first smallest element, in the storage
+  // order of the view (row-major if it is not contiguous). Along an axis,
+  // the index along that axis is returned.
+  size_t argmin() const;
+  NDArray<size_t> argmin(size_t axis) const;
+
+  // Returns the linear index of the first largest element, in the same way
+  // as argmin
+  size_t argmax() const;
+  NDArray<size_t> argmax(size_t axis) const;
+
+  // Returns the mean of the elements
+  typename NDMeanType<value_type>::type mean() const;
+  NDArray<typename NDMeanType<value_type>::type> mean(size_t axis) const;
+
+  // Returns the population variance, which is the mean of |x - mean()|^2
+  typename NDRealType<value_type>::type var() const;
+  NDArray<typename NDRealType<value_type>::type> var(size_t axis) const;
+
+  // Returns the Euclidean norm, which is the square root of the sum of |x|^2
+  typename NDRealType<value_type>::type norm() const;
+  NDArray<typename NDRealType<value_type>::type> norm(size_t axis) const;
 
-  // Ensure DType variables match
-  if (expected_dtype != data_dtype) {
-    std::string mssg =
-        "NDArray template datatype does not match specified datatype in npy "
+  //==========================================================================
+  // Non-Constant Methods
+
+  // Fills all viewed elements with the value provided
+  void fill(const T& val);
+
+  //==========================================================================
+  // Operators for Any Type (Same or Different)
+  template <class C>
+  NDArrayView& operator+=(const NDArrayView<C>& a);
+  template <class C>
+  NDArrayView& operator-=(const NDArrayView<C>& a);
+  template <class C>
+  NDArrayView& operator*=(const NDArrayView<C>& a);
+  template <class C>
+  NDArrayView& operator/=(const NDArrayView<C>& a);
+
+  template <class C, class A>
+  NDArrayView& operator+=(const NDArray<C, A>& a);
+  template <class C, class A>
+  NDArrayView& operator-=(const NDArray<C, A>& a);
+  template <class C, class A>
+  NDArrayView& operator*=(const NDArray<C, A>& a);
+  template <class C, class A>
+  NDArrayView& operator/=(const NDArray<C, A>& a);
+
+  //==========================================================================
+  // Operators for Constants
+  template <class C>
+  NDArrayView& operator+=(const C& c);
+  template <class C>
+  NDArrayView& operator-=(const C& c);
+  template <class C>
+  NDArrayView& operator*=(const C& c);
+  template <class C>
+  NDArrayView& operator/=(const C& c);
+
+ private:
+  T* data_;
+  std::vector<size_t> shape_;
+  std::vector<size_t> strides_;
+  size_t dimensions_;
+
+  template <class C>
+  friend class NDArrayView;
+
+  // Returns the offset for the given indices, which are checked unless
+  // NDARRAY_NO_BOUNDS_CHECK is defined
+  template <class INDICES>
+  size_t element_index(const INDICES& indices) const;
+
+  // Returns the offset for the given indices, throwing an exception if they
+  // are not valid
+  template <class INDICES>
+  size_t checked_index(const INDICES& indices) const;
+
+  // Returns the offset for the given indices, without any checks
+  template <class INDICES>
+  size_t unchecked_index(const INDICES& indices) const;
+
+  template <class I, size_t D>
+  size_t unchecked_index(const std::array<I, D>& indices) const;
+
+  // Returns a broadcast to the shape of this view, for the named operation.
+  // If a overlaps this view, other than element for element, a is first
+  // copied into copy, so that no element is read after it is written.
+  template <class C>
+  NDArrayView<C> broadcast_operand(
+      const NDArrayView<C>& a, const std::string& operation,
+      NDArray<typename std::remove_const<C>::type>& copy) const;
+
+  // Applies an elementwise operation with a, which has the shape of this
+  // view, in blocks of consecutive elements along which a is either a
+  // contiguous row (array_op(p, q, n)) or a single value (constant_op(p, c,
+  // n)). Returns false, without doing anything, if this view is not
+  // contiguous or a has no such blocks.
+  template <class C, class ArrayOp, class ConstantOp>
+  bool broadcast_apply(const NDArrayView<C>& a, ArrayOp array_op,
+                       ConstantOp constant_op);
+
+  // Returns true if the viewed elements are a single run of memory
+  bool contiguous() const;
+
+  // Returns true if this view and a are contiguous with the same storage
+  // order, so that corresponding elements have the same linear index
+  template <class C>
+  bool contiguous_with(const NDArrayView<C>& a) const;
+
+  // Throws an exception if axis is not a valid axis
+  void check_axis(size_t axis) const;
+
+  // Throws an exception if the view is empty, for the named reduction
+  void check_not_empty(const std::string& operation) const;
+
+  // Returns the shape of the result of a reduction along axis
+  std::vector<size_t> reduced_shape(size_t axis) const;
+
+  // Returns true if results of reductions along an axis are row-major
+  bool reduced_c_continuous() const;
+
+  // Returns the offsets of the first elements of all rows along axis, which
+  // are ordered like the elements of the result of a reduction along axis
+  std::vector<size_t> row_offsets(size_t axis, bool c_order) const;
+
+  // Reduces all values f(element, j) with OP, as the type R
+  template <class R, class OP, class F>
+  R reduce(const F& f) const;
+
+  // Reduces the values f(element, j) along axis with OP, where j is the
+  // linear index of the result. Rows of length zero give the value empty.
+  template <class R, class OP, class F>
+  NDArray<R> reduce(size_t axis, const R& empty, const F& f) const;
+
+  // Returns the linear index of the first best element according to OP
+  template <class OP>
+  size_t arg_search(const std::string& operation) const;
+
+  template <class OP>
+  NDArray<size_t> arg_search(size_t axis, const std::string& operation) const;
+
+  // Calls op(element) for every viewed element
+  template <class OP>
+  void for_each(OP op);
+
+  // Calls op(element, a_element) for every pair of corresponding elements
+  template <class C, class OP>
+  void for_each(const NDArrayView<C>& a, OP op);
+};
+
+// Iterator over the elements of an NDArrayView in row-major order, which
+// advances its indices like an odometer instead of computing the offset of
+// each element. It holds its own copy of the shape and strides, so it
+// remains valid after the view is destroyed.
+template <class T>
+class NDArrayView<T>::iterator {
+ public:
+  typedef std::forward_iterator_tag iterator_category;
+  typedef typename std::remove_const<T>::type value_type;
+  typedef std::ptrdiff_t difference_type;
+  typedef T* pointer;
+  typedef T& reference;
+
+  iterator();
+
+  // Returns an iterator to the first element of view, or one which is past
+  // its end
+  static iterator first(const NDArrayView& view);
+  static iterator past_end(const NDArrayView& view);
+
+  T& operator*() const;
+  T* operator->() const;
+  iterator& operator++();
+  iterator operator++(int);
+
+  // Returns the indices of the current element
+  const std::vector<size_t>& index() const;
+
+  bool operator==(const iterator& other) const;
+  bool operator!=(const iterator& other) const;
+
+ private:
+  T* p_;
+  std::vector<size_t> shape_;
+  std::vector<size_t> strides_;
+  std::vector<size_t> index_;
+  size_t position_;
+
+  // Moves to the next element once the index along the last axis has
+  // passed its end
+  void carry();
+};
+
+//==============================================================================
+// Template Class StencilPoint
+//
+// Element of an array at which a stencil is evaluated, which is given to the
+// kernel of NDArray::stencil. Neighbours are read at displacements from the
+// element along each axis, as p(-1, 0, 0) for the previous element along the
+// first axis of a 3D array. Away from the edges of the array, a neighbour is
+// read directly at an offset from the element computed from the strides.
+// Near an edge, the rows around the points are first gathered into a small
+// buffer according to the boundary mode, and read in the same way.
+// Displacements are checked against the radius unless NDARRAY_NO_BOUNDS_CHECK
+// is defined.
+template <class T>
+class StencilPoint {
+ public:
+  // Returns the element at the given displacement along each axis
+  template <typename... DISPS>
+  const T& operator()(DISPS... disps) const;
+
+  // Returns the element itself
+  const T& center() const;
+
+  // Returns the indices of the element in the array
+  const std::vector<size_t>& index() const;
+
+ private:
+  const T* p_;
+  const ptrdiff_t* strides_;
+  std::vector<size_t> index_;
+  size_t radius_;
+
+  // Array in which the stencil is evaluated
+  const T* data_;
+  const std::vector<size_t>& shape_;
+  const std::vector<ptrdiff_t>& data_strides_;
+  BoundaryMode mode_;
+  const T* constant_;
+
+  // Offset of the source of each index along each axis in the coordinates
+  // of the array with a halo, or -1 for the constant
+  std::vector<ptrdiff_t> sources_;
+  std::vector<size_t> sources_begin_;
+
+  // Rows along the last axis around the point, with their halo
+  std::vector<T> rows_;
+  std::vector<ptrdiff_t> rows_strides_;
+  ptrdiff_t rows_centre_;
+  std::vector<size_t> digits_;
+
+  template <class C>
+  friend class NDArrayView;
+
+  StencilPoint(const T* data, const std::vector<size_t>& shape,
+               const std::vector<ptrdiff_t>& strides, size_t radius,
+               BoundaryMode mode, const T* constant);
+
+  // Moves to the element at p, which is at least radius from every edge
+  void move_interior(const T* p);
+
+  // Gathers the rows around the points from begin to end along the last
+  // axis, whose other indices are given by index_
+  void gather(size_t begin, size_t end);
+
+  // Moves to the gathered point at index k along the last axis
+  void move_gathered(size_t k);
+};
+
+//==============================================================================
+// Template Class FixedNDArray
+//
+// Array with a number of dimensions N which is fixed at compile time. The
+// shape and strides are held in std::arrays instead of on the heap, and all
+// index calculations are unrolled. It may be converted to and from an
+// NDArray<T> of the same number of dimensions.
+template <class T, size_t N>
+class FixedNDArray {
+  static_assert(N > 0, "FixedNDArray must have at least one dimension.");
+
+ public:
+  typedef T value_type;
+
+  // Same allocator as the default of NDArray, so that data may be moved
+  // between the two
+  typedef AlignedAllocator<T> allocator_type;
+
+  //==========================================================================
+  // Constructors and Destructors
+  FixedNDArray();
+  FixedNDArray(const std::array<size_t, N>& init_shape,
+               bool c_continuous = true);
+  FixedNDArray(const std::vector<T, allocator_type>& data,
+               const std::array<size_t, N>& init_shape,
+               bool c_continuous = true);
+  FixedNDArray(std::vector<T, allocator_type>&& data,
+               const std::array<size_t, N>& init_shape,
+               bool c_continuous = true);
+
+  // Copies data held by a vector with a different allocator
+  template <class A>
+  FixedNDArray(const std::vector<T, A>& data,
+               const std::array<size_t, N>& init_shape,
+               bool c_continuous = true);
+
+  // Moves the elements of a vector with a different allocator into new
+  // storage, and frees the storage of data
+  template <class A>
+  FixedNDArray(std::vector<T, A>&& data,
+               const std::array<size_t, N>& init_shape,
+               bool c_continuous = true);
+
+  // Conversion from a dynamic-rank array. An exception is thrown if the
+  // array does not have N dimensions.
+  explicit FixedNDArray(const NDArray<T>& a);
+  explicit FixedNDArray(NDArray<T>&& a);
+
+  ~FixedNDArray() = default;
+  FixedNDArray(const FixedNDArray&) = default;
+  FixedNDArray(FixedNDArray&&) = default;
+
+  // Assignment Operator
+  FixedNDArray& operator=(const FixedNDArray&) = default;
+  FixedNDArray& operator=(FixedNDArray&&) = default;
+
+  // Static load function
+  static FixedNDArray load(const std::string& fname);
+
+  //==========================================================================
+  // Indexing
+
+  // Indexing operators for indexing with array
+  T& operator()(const std::array<size_t, N>& indices);
+  const T& operator()(const std::array<size_t, N>& indices) const;
+
+  // Variadic indexing operators
+  // Access data with array indices.
+  template <typename... INDS>
+  T& operator()(INDS... inds);
+  template <typename... INDS>
+  const T& operator()(INDS... inds) const;
+
+  // Indexing methods which always check that the indices are valid,
+  // regardless of NDARRAY_NO_BOUNDS_CHECK
+  T& at(const std::array<size_t, N>& indices);
+  const T& at(const std::array<size_t, N>& indices) const;
+
+  template <typename... INDS>
+  T& at(INDS... inds);
+  template <typename... INDS>
+  const T& at(INDS... inds) const;
+
+  // Linear Indexing operators
+  T& operator[](size_t i);
+  const T& operator[](size_t i) const;
+
+  //==========================================================================
+  // Constant Methods
+
+  // Return underlying data vector
+  std::vector<T, allocator_type>& data_vector();
+  const std::vector<T, allocator_type>& data_vector() const;
+
+  // Return pointer to beginning of data
+  T* data();
+  const T* data() const;
+
+  // Return array describing shape of array
+  const std::array<size_t, N>& shape() const;
+
+  // Return array with the stride of each axis, as a number of elements
+  const std::array<size_t, N>& strides() const;
+
+  // Return number of elements in array
+  size_t size() const;
+
+  size_t linear_index(const std::array<size_t, N>& indices) const;
+
+  template <typename... INDS>
+  size_t linear_index(INDS... inds) const;
+
+  // Returns true if data is stored as c continuous (row-major order),
+  // and false if fortran continuous (column-major order)
+  bool c_continuous() const;
+
+  // Returns a non-owning view of the whole array. The view is invalidated
+  // if the array is reallocated.
+  NDArrayView<T> view();
+  NDArrayView<const T> view() const;
+
+  // Save array to the file fname.npy
+  void save(const std::string& fname) const;
+
+  //==========================================================================
+  // Non-Constant Methods
+
+  // Fills entire array with the value provided
+  void fill(const T& val);
+
+  // Will reshape the array to the given dimensions
+  void reshape(const std::array<size_t, N>& new_shape);
+
+  // Realocates array to fit the new size.
+  // DATA CAN BE LOST IF ARRAY IS SHRUNK
+  void reallocate(const std::array<size_t, N>& new_shape);
+
+  //==========================================================================
+  // Operators for Any Type (Same or Different)
+  template <class C>
+  FixedNDArray& operator+=(const FixedNDArray<C, N>& a);
+  template <class C>
+  FixedNDArray& operator-=(const FixedNDArray<C, N>& a);
+  template <class C>
+  FixedNDArray& operator*=(const FixedNDArray<C, N>& a);
+  template <class C>
+  FixedNDArray& operator/=(const FixedNDArray<C, N>& a);
+
+  //==========================================================================
+  // Operators for Constants
+  template <class C>
+  FixedNDArray& operator+=(const C& c);
+  template <class C>
+  FixedNDArray& operator-=(const C& c);
+  template <class C>
+  FixedNDArray& operator*=(const C& c);
+  template <class C>
+  FixedNDArray& operator/=(const C& c);
+
+  //==========================================================================
+  // Conversion Operator
+  operator NDArray<T>() const&;
+  operator NDArray<T>() &&;
+
+ private:
+  std::vector<T, allocator_type> data_;
+  std::array<size_t, N> shape_;
+  std::array<size_t, N> strides_;
+  bool c_continuous_;
+
+  template <class C, size_t M>
+  friend class FixedNDArray;
+
+  // Sets shape_ and strides_ from shape, returning the number of elements
+  size_t set_shape(const std::array<size_t, N>& shape);
+
+  // Ensures a has the same shape as this array, for the named operation
+  template <class C>
+  void check_shape(const FixedNDArray<C, N>& a,
+                   const std::string& operation) const;
+
+  // Returns the linear index for the given indices, which are checked unless
+  // NDARRAY_NO_BOUNDS_CHECK is defined
+  size_t element_index(const std::array<size_t, N>& indices) const;
+
+  // Returns the linear index for the given indices, throwing an exception if
+  // they are not valid
+  size_t checked_index(const std::array<size_t, N>& indices) const;
+
+  // Dot product of the first I indices and strides, expanded at compile time
+  template <size_t I>
+  static size_t dot(const std::array<size_t, N>& indices,
+                    const std::array<size_t, N>& strides,
+                    std::integral_constant<size_t, I>);
+  static size_t dot(const std::array<size_t, N>& indices,
+                    const std::array<size_t, N>& strides,
+                    std::integral_constant<size_t, 0>);
+};
+
+namespace ndarray_detail {
+
+// Sets shape to the shape to which a and b broadcast, following the rules of
+// Numpy. The shapes are aligned at their last axes, and axes of length one
+// (or missing axes) are stretched to match the other shape. Returns false if
+// the shapes do not broadcast.
+inline bool broadcast_shape(const std::vector<size_t>& a,
+                            const std::vector<size_t>& b,
+                            std::vector<size_t>& shape) {
+  const size_t n = std::max(a.size(), b.size());
+  shape.assign(n, 1);
+  for (size_t i = 0; i < n; i++) {
+    const size_t a_i = i < a.size() ? a[a.size() - 1 - i] : 1;
+    const size_t b_i = i < b.size() ? b[b.size() - 1 - i] : 1;
+    if (a_i != b_i && a_i != 1 && b_i != 1) return false;
+    shape[n - 1 - i] = a_i == 1 ? b_i : a_i;
+  }
+  return true;
+}
+
+// Sets to_strides to the strides with which elements of the given shape and
+// strides are viewed with the shape to, where stretched axes have a stride of
+// zero. Returns false if shape does not broadcast to to.
+inline bool broadcast_strides(const std::vector<size_t>& shape,
+                              const std::vector<size_t>& strides,
+                              const std::vector<size_t>& to,
+                              std::vector<size_t>& to_strides) {
+  if (shape.size() > to.size()) return false;
+  const size_t offset = to.size() - shape.size();
+  to_strides.assign(to.size(), 0);
+  for (size_t i = 0; i < shape.size(); i++) {
+    if (shape[i] == to[offset + i]) {
+      to_strides[offset + i] = strides[i];
+    } else if (shape[i] != 1) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Returns true if an elementwise operation, which writes the elements at a
+// while reading the elements at b, could read an element of b after it has
+// been written. Both have the given shape, and elements of the given sizes
+// at the given strides in elements. This is the case if their memory
+// overlaps, unless every element of b lies exactly at that of a.
+inline bool overlaps_differently(const void* a, size_t a_size,
+                                 const std::vector<size_t>& a_strides,
+                                 const void* b, size_t b_size,
+                                 const std::vector<size_t>& b_strides,
+                                 const std::vector<size_t>& shape) {
+  uintptr_t a_extent = a_size, b_extent = b_size;
+  for (size_t i = 0; i < shape.size(); i++) {
+    if (shape[i] == 0) return false;
+    a_extent += (shape[i] - 1) * a_strides[i] * a_size;
+    b_extent += (shape[i] - 1) * b_strides[i] * b_size;
+  }
+
+  const uintptr_t a_begin = reinterpret_cast<uintptr_t>(a);
+  const uintptr_t b_begin = reinterpret_cast<uintptr_t>(b);
+  if (a_begin + a_extent <= b_begin || b_begin + b_extent <= a_begin) {
+    return false;
+  }
+  return a != b || a_size != b_size || a_strides != b_strides;
+}
+
+}  // namespace ndarray_detail
+
+//==============================================================================
+// Expression Templates
+//
+// Arithmetic operators and math functions applied to NDArrays, NDArrayViews
+// and constants do not compute anything. They instead build a lightweight
+// expression, which refers to its array operands, and is only evaluated once
+// assigned to an NDArray. The evaluation is done in a single pass over memory,
+// without any temporary arrays. As operands are referenced and not copied, an
+// expression must be assigned before its operands are destroyed, and should
+// therefore not be stored with auto.
+//
+// All expressions provide the following methods, which are used when they are
+// evaluated:
+//   - shape() returns the shape of the result.
+//   - c_continuous() returns the storage order to use for the result, which is
+//     that of the first array operand.
+//   - contiguous(c_order) returns true if all array operands are contiguous in
+//     the given storage order, in which case linear_value may be used.
+//   - linear_value(i) returns element i of the result.
+//   - indexed_value(indices) returns the element of the result at the given
+//     array of indices.
+//   - broadcast(shape) makes the array operands appear to have the given
+//     shape, to which they must broadcast. Stretched axes have a stride of
+//     zero, and the operands are then no longer contiguous.
+//   - overlaps(data, element_size, strides) returns true if an array operand
+//     shares memory with the elements of the result's shape at data, other
+//     than by lying exactly at the same elements, in which case the result
+//     cannot be written to them while the expression is evaluated.
+//
+// Operands of a binary expression with different shapes are broadcast to a
+// common shape, following the rules of Numpy.
+
+// Base class of all expressions, where E is the type of the expression.
+template <class E>
+class NDExpression {
+ public:
+  const E& self() const;
+};
+
+// Expression which refers to the elements of an NDArray or NDArrayView.
+template <class T>
+class NDArrayTerminal : public NDExpression<NDArrayTerminal<T>> {
+ public:
+  typedef T value_type;
+
+  template <class A>
+  NDArrayTerminal(const NDArray<T, A>& a);
+
+  template <class U>
+  NDArrayTerminal(const NDArrayView<U>& a);
+
+  const std::vector<size_t>& shape() const;
+  bool c_continuous() const;
+  bool contiguous(bool c_order) const;
+  const T& linear_value(size_t i) const;
+  const T& indexed_value(const size_t* indices) const;
+  void broadcast(const std::vector<size_t>& shape);
+  bool overlaps(const void* data, size_t element_size,
+                const std::vector<size_t>& strides) const;
+
+ private:
+  const T* data_;
+  const std::vector<size_t>* shape_;
+  const std::vector<size_t>* strides_;
+  bool c_order_;
+  bool c_continuous_;
+  bool fortran_continuous_;
+  // Shape and strides of the operand once it has been broadcast, which are
+  // held by value as expressions are copied into the expressions using them
+  bool broadcast_;
+  std::vector<size_t> broadcast_shape_;
+  std::vector<size_t> broadcast_strides_;
+};
+
+// Expression which applies the function f to every element of e.
+template <class F, class E>
+class NDUnaryExpression : public NDExpression<NDUnaryExpression<F, E>> {
+ public:
+  typedef decltype(std::declval<const F&>()(
+      std::declval<typename E::value_type>())) value_type;
+
+  NDUnaryExpression(const F& f, const E& e);
+
+  const std::vector<size_t>& shape() const;
+  bool c_continuous() const;
+  bool contiguous(bool c_order) const;
+  value_type linear_value(size_t i) const;
+  value_type indexed_value(const size_t* indices) const;
+  void broadcast(const std::vector<size_t>& shape);
+  bool overlaps(const void* data, size_t element_size,
+                const std::vector<size_t>& strides) const;
+
+ private:
+  F f_;
+  E e_;
+};
+
+// Expression which applies the function f to every pair of corresponding
+// elements of l and r, which are broadcast to a common shape.
+template <class F, class L, class R>
+class NDBinaryExpression : public NDExpression<NDBinaryExpression<F, L, R>> {
+ public:
+  typedef decltype(std::declval<const F&>()(
+      std::declval<typename L::value_type>(),
+      std::declval<typename R::value_type>())) value_type;
+
+  NDBinaryExpression(const F& f, const L& l, const R& r);
+
+  const std::vector<size_t>& shape() const;
+  bool c_continuous() const;
+  bool contiguous(bool c_order) const;
+  value_type linear_value(size_t i) const;
+  value_type indexed_value(const size_t* indices) const;
+  void broadcast(const std::vector<size_t>& shape);
+  bool overlaps(const void* data, size_t element_size,
+                const std::vector<size_t>& strides) const;
+
+ private:
+  F f_;
+  L l_;
+  R r_;
+};
+
+// Provides the expression type for an operand of an arithmetic operator or
+// math function, and make(), which builds the expression from the operand.
+// Only NDArray, NDArrayView and expressions are operands.
+template <class X, class Enable = void>
+struct NDExpressionOf {};
+
+template <class T, class A>
+struct NDExpressionOf<NDArray<T, A>> {
+  typedef NDArrayTerminal<T> type;
+  static type make(const NDArray<T, A>& a) { return type(a); }
+};
+
+template <class T>
+struct NDExpressionOf<NDArrayView<T>> {
+  typedef NDArrayTerminal<typename std::remove_const<T>::type> type;
+  static type make(const NDArrayView<T>& a) { return type(a); }
+};
+
+template <class X>
+struct NDExpressionOf<
+    X, typename std::enable_if<std::is_base_of<NDExpression<X>, X>::value>::type> {
+  typedef X type;
+  static const X& make(const X& x) { return x; }
+};
+
+// Type trait which is true for types which may be used as constants in
+// expressions.
+template <class S>
+struct NDIsConstant : std::is_arithmetic<S> {};
+
+template <class S>
+struct NDIsConstant<std::complex<S>> : std::true_type {};
+
+//==============================================================================
+// Expression Functions
+struct NDAdd {
+  static const char* name() { return "add"; }
+  template <class A, class B>
+  auto operator()(const A& a, const B& b) const -> decltype(a + b) {
+    return a + b;
+  }
+};
+
+struct NDSubtract {
+  static const char* name() { return "subtract"; }
+  template <class A, class B>
+  auto operator()(const A& a, const B& b) const -> decltype(a - b) {
+    return a - b;
+  }
+};
+
+struct NDMultiply {
+  static const char* name() { return "multiply"; }
+  template <class A, class B>
+  auto operator()(const A& a, const B& b) const -> decltype(a * b) {
+    return a * b;
+  }
+};
+
+struct NDDivide {
+  static const char* name() { return "divide"; }
+  template <class A, class B>
+  auto operator()(const A& a, const B& b) const -> decltype(a / b) {
+    return a / b;
+  }
+};
+
+struct NDNegate {
+  template <class A>
+  auto operator()(const A& a) const -> decltype(-a) {
+    return -a;
+  }
+};
+
+// Binds the constant c to the right hand argument of the binary function f.
+template <class F, class S>
+struct NDBindRight {
+  F f;
+  S c;
+  template <class A>
+  auto operator()(const A& a) const
+      -> decltype(std::declval<const F&>()(a, std::declval<const S&>())) {
+    return f(a, c);
+  }
+};
+
+// Binds the constant c to the left hand argument of the binary function f.
+template <class F, class S>
+struct NDBindLeft {
+  F f;
+  S c;
+  template <class A>
+  auto operator()(const A& a) const
+      -> decltype(std::declval<const F&>()(std::declval<const S&>(), a)) {
+    return f(c, a);
+  }
+};
+
+// Defines a function object NAME which calls std::FUNC on its argument.
+#define NDARRAY_MATH_FUNCTION(NAME, FUNC)                            \
+  struct NAME {                                                      \
+    template <class A>                                               \
+    auto operator()(const A& a) const -> decltype(std::FUNC(a)) {    \
+      return std::FUNC(a);                                           \
+    }                                                                \
+  };
+
+NDARRAY_MATH_FUNCTION(NDAbs, abs)
+NDARRAY_MATH_FUNCTION(NDExp, exp)
+NDARRAY_MATH_FUNCTION(NDLog, log)
+NDARRAY_MATH_FUNCTION(NDLog10, log10)
+NDARRAY_MATH_FUNCTION(NDSqrt, sqrt)
+NDARRAY_MATH_FUNCTION(NDSin, sin)
+NDARRAY_MATH_FUNCTION(NDCos, cos)
+NDARRAY_MATH_FUNCTION(NDTan, tan)
+NDARRAY_MATH_FUNCTION(NDSinh, sinh)
+NDARRAY_MATH_FUNCTION(NDCosh, cosh)
+NDARRAY_MATH_FUNCTION(NDTanh, tanh)
+NDARRAY_MATH_FUNCTION(NDFloor, floor)
+NDARRAY_MATH_FUNCTION(NDCeil, ceil)
+#undef NDARRAY_MATH_FUNCTION
+
+struct NDPow {
+  static const char* name() { return "raise"; }
+  template <class A, class B>
+  auto operator()(const A& a, const B& b) const -> decltype(std::pow(a, b)) {
+    return std::pow(a, b);
+  }
+};
+
+//==============================================================================
+// Expression Operators
+
+// Defines the operator OP for two operands, and for an operand and a
+// constant, which build expressions with the function object FUNC.
+#define NDARRAY_BINARY_OPERATOR(OP, FUNC)                                    \
+  template <class L, class R>                                               \
+  NDBinaryExpression<FUNC, typename NDExpressionOf<L>::type,                \
+                     typename NDExpressionOf<R>::type>                      \
+  OP(const L& l, const R& r) {                                              \
+    return NDBinaryExpression<FUNC, typename NDExpressionOf<L>::type,       \
+                              typename NDExpressionOf<R>::type>(            \
+        FUNC(), NDExpressionOf<L>::make(l), NDExpressionOf<R>::make(r));    \
+  }                                                                         \
+                                                                            \
+  template <class L, class S>                                               \
+  typename std::enable_if<                                                  \
+      NDIsConstant<S>::value,                                               \
+      NDUnaryExpression<NDBindRight<FUNC, S>,                               \
+                        typename NDExpressionOf<L>::type>>::type            \
+  OP(const L& l, const S& c) {                                              \
+    return NDUnaryExpression<NDBindRight<FUNC, S>,                          \
+                             typename NDExpressionOf<L>::type>(             \
+        NDBindRight<FUNC, S>{FUNC(), c}, NDExpressionOf<L>::make(l));       \
+  }                                                                         \
+                                                                            \
+  template <class S, class R>                                               \
+  typename std::enable_if<                                                  \
+      NDIsConstant<S>::value,                                               \
+      NDUnaryExpression<NDBindLeft<FUNC, S>,                                \
+                        typename NDExpressionOf<R>::type>>::type            \
+  OP(const S& c, const R& r) {                                              \
+    return NDUnaryExpression<NDBindLeft<FUNC, S>,                           \
+                             typename NDExpressionOf<R>::type>(             \
+        NDBindLeft<FUNC, S>{FUNC(), c}, NDExpressionOf<R>::make(r));        \
+  }
+
+NDARRAY_BINARY_OPERATOR(operator+, NDAdd)
+NDARRAY_BINARY_OPERATOR(operator-, NDSubtract)
+NDARRAY_BINARY_OPERATOR(operator*, NDMultiply)
+NDARRAY_BINARY_OPERATOR(operator/, NDDivide)
+NDARRAY_BINARY_OPERATOR(pow, NDPow)
+#undef NDARRAY_BINARY_OPERATOR
+
+// Defines the function NAME for a single operand, which builds an expression
+// with the function object FUNC.
+#define NDARRAY_UNARY_FUNCTION(NAME, FUNC)                                 \
+  template <class E>                                                      \
+  NDUnaryExpression<FUNC, typename NDExpressionOf<E>::type> NAME(         \
+      const E& e) {                                                       \
+    return NDUnaryExpression<FUNC, typename NDExpressionOf<E>::type>(     \
+        FUNC(), NDExpressionOf<E>::make(e));                              \
+  }
+
+NDARRAY_UNARY_FUNCTION(operator-, NDNegate)
+NDARRAY_UNARY_FUNCTION(abs, NDAbs)
+NDARRAY_UNARY_FUNCTION(exp, NDExp)
+NDARRAY_UNARY_FUNCTION(log, NDLog)
+NDARRAY_UNARY_FUNCTION(log10, NDLog10)
+NDARRAY_UNARY_FUNCTION(sqrt, NDSqrt)
+NDARRAY_UNARY_FUNCTION(sin, NDSin)
+NDARRAY_UNARY_FUNCTION(cos, NDCos)
+NDARRAY_UNARY_FUNCTION(tan, NDTan)
+NDARRAY_UNARY_FUNCTION(sinh, NDSinh)
+NDARRAY_UNARY_FUNCTION(cosh, NDCosh)
+NDARRAY_UNARY_FUNCTION(tanh, NDTanh)
+NDARRAY_UNARY_FUNCTION(floor, NDFloor)
+NDARRAY_UNARY_FUNCTION(ceil, NDCeil)
+#undef NDARRAY_UNARY_FUNCTION
+
+//==============================================================================
+// Linear Algebra
+
+// Returns the matrix product of a and b in C order, as numpy.matmul. The
+// last two axes of each operand hold its matrices, and the leading axes are
+// broadcast against each other (such as a stack of matrices multiplied by a
+// single matrix). A 1D operand is taken as a row of a or a column of b, and
+// that axis is removed from the result, except that the product of two 1D
+// arrays has a shape of {1}. The operands may have any strides, and are
+// never copied.
+template <class T, class A, class B>
+NDArray<T> matmul(const NDArray<T, A>& a, const NDArray<T, B>& b);
+
+template <class T1, class T2>
+NDArray<typename NDArrayView<T1>::value_type> matmul(const NDArrayView<T1>& a,
+                                                     const NDArrayView<T2>& b);
+
+// Returns the inner product sum(a[i] * b[i]) of two 1D arrays of the same
+// length. Complex numbers are not conjugated.
+template <class T, class A, class B>
+T dot(const NDArray<T, A>& a, const NDArray<T, B>& b);
+
+template <class T1, class T2>
+typename NDArrayView<T1>::value_type dot(const NDArrayView<T1>& a,
+                                         const NDArrayView<T2>& b);
+
+//==============================================================================
+// Declarations for NPY functions
+
+// Enum of possible data types handeled by this implementation.
+enum class DType {
+  CHAR,
+  UCHAR,
+  INT16,
+  INT32,
+  INT64,
+  UINT16,
+  UINT32,
+  UINT64,
+  FLOAT32,
+  DOUBLE64,
+  COMPLEX64,
+  COMPLEX128,
+  FLOAT16,
+  BFLOAT16,
+  BOOL,
+  VOID16
+};
+
+namespace ndarray_detail {
+
+// Conversions between float and the bits of the 16 bit floating point types,
+// rounding to the nearest value with ties to even. They give the same results
+// as the SIMD conversion kernels.
+inline uint16_t float_to_half_bits(float value) {
+  uint32_t x;
+  std::memcpy(&x, &value, sizeof(x));
+  const uint16_t sign = static_cast<uint16_t>((x >> 16) & 0x8000);
+  const uint32_t magnitude = x & 0x7FFFFFFF;
+
+  if (magnitude >= 0x7F800000) {
+    // Infinity stays infinite, and NaN is quieted and keeps its payload
+    if (magnitude == 0x7F800000) return sign | 0x7C00;
+    return static_cast<uint16_t>(sign | 0x7E00 | ((magnitude >> 13) & 0x3FF));
+  }
+  if (magnitude >= 0x477FF000) {
+    // Rounds to beyond the largest half, 65504
+    return sign | 0x7C00;
+  }
+  if (magnitude >= 0x38800000) {
+    // Normal half, with the exponent rebiased from 127 to 15
+    const uint32_t rounded = magnitude + 0xFFF + ((magnitude >> 13) & 1);
+    return static_cast<uint16_t>(sign | ((rounded - 0x38000000) >> 13));
+  }
+
+  // Subnormal half or zero. Adding 0.5, whose last bit is worth 2^-24, lets
+  // the FPU round the magnitude to a multiple of the smallest half.
+  float absolute;
+  std::memcpy(&absolute, &magnitude, sizeof(absolute));
+  absolute += 0.5f;
+  uint32_t y;
+  std::memcpy(&y, &absolute, sizeof(y));
+  return static_cast<uint16_t>(sign | (y - 0x3F000000));
+}
+
+inline float half_bits_to_float(uint16_t bits) {
+  const uint32_t sign = static_cast<uint32_t>(bits & 0x8000) << 16;
+  const uint32_t exponent = (bits >> 10) & 0x1F;
+  const uint32_t mantissa = bits & 0x3FF;
+
+  uint32_t x;
+  if (exponent == 0x1F) {
+    x = sign | 0x7F800000 | (mantissa << 13);
+    if (mantissa != 0) x |= 0x00400000;
+  } else if (exponent != 0) {
+    x = sign | ((exponent + 112) << 23) | (mantissa << 13);
+  } else {
+    // Zero or subnormal, which is exactly mantissa*2^-24
+    float value = static_cast<float>(mantissa) * 5.9604644775390625e-8f;
+    std::memcpy(&x, &value, sizeof(x));
+    x |= sign;
+  }
+
+  float value;
+  std::memcpy(&value, &x, sizeof(value));
+  return value;
+}
+
+inline uint16_t float_to_bfloat16_bits(float value) {
+  uint32_t x;
+  std::memcpy(&x, &value, sizeof(x));
+  if ((x & 0x7FFFFFFF) > 0x7F800000) {
+    return static_cast<uint16_t>((x >> 16) | 0x0040);
+  }
+  return static_cast<uint16_t>((x + 0x7FFF + ((x >> 16) & 1)) >> 16);
+}
+
+inline float bfloat16_bits_to_float(uint16_t bits) {
+  const uint32_t x = static_cast<uint32_t>(bits) << 16;
+  float value;
+  std::memcpy(&value, &x, sizeof(value));
+  return value;
+}
+
+}  // namespace ndarray_detail
+
+// IEEE 754 half precision number, stored as in a .npy file of dtype f2.
+// Arithmetic is done by converting to float.
+class Float16 {
+ public:
+  Float16() = default;
+  Float16(float value) : bits_{ndarray_detail::float_to_half_bits(value)} {}
+
+  operator float() const { return ndarray_detail::half_bits_to_float(bits_); }
+
+  static Float16 from_bits(uint16_t bits) {
+    Float16 value;
+    value.bits_ = bits;
+    return value;
+  }
+
+  uint16_t bits() const { return bits_; }
+
+  Float16& operator+=(float c) { return *this = float(*this) + c; }
+  Float16& operator-=(float c) { return *this = float(*this) - c; }
+  Float16& operator*=(float c) { return *this = float(*this) * c; }
+  Float16& operator/=(float c) { return *this = float(*this) / c; }
+
+ private:
+  uint16_t bits_;
+};
+
+// Brain floating point number, which is the upper half of a float. Numpy has
+// no such dtype, so it is stored as V2, and may be viewed as
+// ml_dtypes.bfloat16 in Python. V2 is any two byte void or struct type, so a
+// V2 file is read as DType::VOID16, and is only taken to be BFloat16 when it
+// is loaded into an array of BFloat16.
+class BFloat16 {
+ public:
+  BFloat16() = default;
+  BFloat16(float value)
+      : bits_{ndarray_detail::float_to_bfloat16_bits(value)} {}
+
+  operator float() const {
+    return ndarray_detail::bfloat16_bits_to_float(bits_);
+  }
+
+  static BFloat16 from_bits(uint16_t bits) {
+    BFloat16 value;
+    value.bits_ = bits;
+    return value;
+  }
+
+  uint16_t bits() const { return bits_; }
+
+  BFloat16& operator+=(float c) { return *this = float(*this) + c; }
+  BFloat16& operator-=(float c) { return *this = float(*this) - c; }
+  BFloat16& operator*=(float c) { return *this = float(*this) * c; }
+  BFloat16& operator/=(float c) { return *this = float(*this) / c; }
+
+ private:
+  uint16_t bits_;
+};
+
+// Boolean stored in one byte, as in a .npy file of dtype b1. It is used in
+// place of bool, for which std::vector does not store contiguous elements.
+class Bool {
+ public:
+  Bool() = default;
+  Bool(bool value) : value_{static_cast<uint8_t>(value)} {}
+
+  operator bool() const { return value_ != 0; }
+
+ private:
+  uint8_t value_;
+};
+
+// Trait giving the DType with which elements of type T are stored. It is
+// resolved at compile time, and types without a DType have supported set to
+// false. Other types with the same representation as one of the DTypes, such
+// as enums or wrappers of a single number, may be used by specializing
+// dtype_of for them and deriving from dtype_constant.
+template <DType D>
+struct dtype_constant {
+  static constexpr bool supported = true;
+  static constexpr DType value = D;
+};
+
+template <DType D>
+constexpr bool dtype_constant<D>::supported;
+
+template <DType D>
+constexpr DType dtype_constant<D>::value;
+
+template <class T>
+struct dtype_of {
+  static constexpr bool supported = false;
+};
+
+template <class T>
+constexpr bool dtype_of<T>::supported;
+
+namespace ndarray_detail {
+
+// DType of an integer by its size and signedness, so that every integer type
+// of a supported width is mapped, whichever of them the fixed width typedefs
+// refer to on a given platform.
+template <size_t Size, bool Signed>
+struct integer_dtype {
+  static constexpr bool supported = false;
+};
+
+template <size_t Size, bool Signed>
+constexpr bool integer_dtype<Size, Signed>::supported;
+
+template <>
+struct integer_dtype<2, true> : dtype_constant<DType::INT16> {};
+template <>
+struct integer_dtype<4, true> : dtype_constant<DType::INT32> {};
+template <>
+struct integer_dtype<8, true> : dtype_constant<DType::INT64> {};
+template <>
+struct integer_dtype<2, false> : dtype_constant<DType::UINT16> {};
+template <>
+struct integer_dtype<4, false> : dtype_constant<DType::UINT32> {};
+template <>
+struct integer_dtype<8, false> : dtype_constant<DType::UINT64> {};
+
+}  // namespace ndarray_detail
+
+template <>
+struct dtype_of<char> : dtype_constant<DType::CHAR> {};
+// int8_t, which is signed char, has the same representation as CHAR (i1)
+template <>
+struct dtype_of<signed char> : dtype_constant<DType::CHAR> {};
+template <>
+struct dtype_of<unsigned char> : dtype_constant<DType::UCHAR> {};
+template <>
+struct dtype_of<short> : ndarray_detail::integer_dtype<sizeof(short), true> {};
+template <>
+struct dtype_of<int> : ndarray_detail::integer_dtype<sizeof(int), true> {};
+template <>
+struct dtype_of<long> : ndarray_detail::integer_dtype<sizeof(long), true> {};
+template <>
+struct dtype_of<long long>
+    : ndarray_detail::integer_dtype<sizeof(long long), true> {};
+template <>
+struct dtype_of<unsigned short>
+    : ndarray_detail::integer_dtype<sizeof(unsigned short), false> {};
+template <>
+struct dtype_of<unsigned int>
+    : ndarray_detail::integer_dtype<sizeof(unsigned int), false> {};
+template <>
+struct dtype_of<unsigned long>
+    : ndarray_detail::integer_dtype<sizeof(unsigned long), false> {};
+template <>
+struct dtype_of<unsigned long long>
+    : ndarray_detail::integer_dtype<sizeof(unsigned long long), false> {};
+template <>
+struct dtype_of<float> : dtype_constant<DType::FLOAT32> {};
+template <>
+struct dtype_of<double> : dtype_constant<DType::DOUBLE64> {};
+template <>
+struct dtype_of<std::complex<float>> : dtype_constant<DType::COMPLEX64> {};
+template <>
+struct dtype_of<std::complex<double>> : dtype_constant<DType::COMPLEX128> {};
+template <>
+struct dtype_of<Float16> : dtype_constant<DType::FLOAT16> {};
+template <>
+struct dtype_of<BFloat16> : dtype_constant<DType::BFLOAT16> {};
+template <>
+struct dtype_of<Bool> : dtype_constant<DType::BOOL> {};
+
+// Function which opens file fname, and loads in the binary data into 1D
+// array of chars, which must latter be type cast be the user. The char* to
+// the data is returned as a reference, along with the number of elements,
+// continuits, and element size in bytes. Returned is a vector for the shape.
+void load_npy(const std::string& fname, char*& data_ptr, std::vector<size_t>& shape,
+              DType& dtype, bool& c_contiguous);
+
+// Callback used by load_npy to obtain the destination of the data. It is
+// given the shape, data type and continuity from the header, and must return
+// a buffer of at least n_elements*element_size bytes. It may throw to reject
+// the file before any data is read.
+typedef std::function<char*(const std::vector<size_t>& shape, DType dtype,
+                            bool c_contiguous)>
+    NPYAllocate;
+
+// Function which opens file fname, and reads the binary data directly into
+// the buffer returned by allocate, so that the data is only read once.
+void load_npy(const std::string& fname, const NPYAllocate& allocate,
+              std::vector<size_t>& shape, DType& dtype, bool& c_contiguous);
+
+// Function which reads the header of a .npy file from the stream file, which
+// must be positioned at the beginning of the file. The shape, data type,
+// continuity and endianness of the data are returned by reference, and the
+// stream is left at the beginning of the data. Returned is the byte offset of
+// the data from the beginning of the file.
+size_t read_npy_header(std::istream& file, const std::string& fname,
+                       std::vector<size_t>& shape, DType& dtype,
+                       bool& c_contiguous, bool& little_endian);
+
+// Function which reads n_elements of type dtype from the stream file, which
+// must be positioned at the beginning of the data, into data. The bytes are
+// swapped as they are read if little_endian differs from the system.
+void read_npy_data(std::istream& file, const std::string& fname, char* data,
+                   uint64_t n_elements, DType dtype, bool little_endian);
+
+// Description of the array in a .npy file, as given by its header.
+struct NpyHeaderInfo {
+  std::vector<size_t> shape;
+  DType dtype;
+  bool fortran_order;
+  bool little_endian;
+  size_t data_offset;
+};
+
+// Function which reads only the header of the .npy file fname.
+NpyHeaderInfo npy_header_info(const std::string& fname);
+
+// Function which writes binary data to a Numpy .npy file.
+void write_npy(const std::string& fname, const char* data_ptr,
+               const std::vector<size_t>& shape, DType dtype, bool c_contiguous);
+
+// Returns everything in a .npy file which precedes the data (the magic
+// string, version, header length and header) for an array of the given
+// shape, data type and continuity. The header is padded so the data is 64
+// byte aligned, and so that the returned string is at least min_length bytes.
+std::string npy_preamble(const std::vector<size_t>& shape, DType dtype,
+                         bool c_contiguous, size_t min_length = 0);
+
+// Returns the proper DType for a given Numpy dtype.descr string.
+DType descr_to_DType(const std::string& dtype);
+
+// Returns true if data of DType stored, from a .npy file, may be read into
+// an array of DType expected. Data of DType::VOID16 may only be read as
+// DType::BFLOAT16.
+bool npy_dtype_matches(DType expected, DType stored);
+
+// Returns Numpy descr string for given DType
+std::string DType_to_descr(DType dtype);
+
+// Returns the number of bytes used to represent the provided DType.
+size_t size_of_DType(DType dtype);
+
+// Returns the number of bytes of each scalar in the provided DType, which is
+// the unit whose byte order differs between systems. For complex types this
+// is the size of the real and imaginary parts.
+size_t scalar_size_of_DType(DType dtype);
+
+// Function to check wether or not host system is little-endian or not
+bool system_is_little_endian();
+
+// Function to switch bye order of data for an array which contains
+// n_elements, each with element_size bytes. The size of data should
+// therefore be n_elements*element_size; if not, this is undefined behavior.
+void swap_bytes(char* data, uint64_t n_elements, size_t element_size);
+
+// Swaps the first and second byte pointed to by char* bytes.
+void swap_two_bytes(char* bytes);
+
+// Swaps the first four bytes pointed to by char* bytes.
+void swap_four_bytes(char* bytes);
+
+// Swaps the first eight bytes pointed to by char* bytes.
+void swap_eight_bytes(char* bytes);
+
+// Swaps the first sixteen bytes pointed to by char* bytes.
+void swap_sixteen_bytes(char* bytes);
+
+//==============================================================================
+// Class NpyWriter
+//
+// Writes a C continuous .npy file one chunk at a time, for arrays which are
+// produced in slabs or are too large to hold in memory. The header is written
+// on construction, and each call to append adds the next rows along the
+// leading axis. An open ended writer counts the rows as they are appended,
+// and writes the length of the leading axis into the header on close.
+class NpyWriter {
+ public:
+  //==========================================================================
+  // Constructors and Destructors
+
+  // Opens fname and writes the header for an array of the given shape and
+  // data type.
+  NpyWriter(const std::string& fname, const std::vector<size_t>& shape,
+            DType dtype);
+
+  // Returns a writer for an array whose leading axis has an unknown length,
+  // where row_shape is the shape of the remaining axes.
+  static NpyWriter open_ended(const std::string& fname,
+                              const std::vector<size_t>& row_shape,
+                              DType dtype);
+
+  // Closes the file if close has not been called. Since errors cannot be
+  // reported here, close should be called explicitly.
+  ~NpyWriter();
+  NpyWriter(const NpyWriter&) = delete;
+  NpyWriter(NpyWriter&&) = default;
+
+  // Assignment Operator
+  NpyWriter& operator=(const NpyWriter&) = delete;
+  NpyWriter& operator=(NpyWriter&&) = default;
+
+  //==========================================================================
+  // Methods
+
+  // Appends n_rows rows along the leading axis, read from data in C order.
+  void append(const char* data, size_t n_rows);
+
+  // Appends the chunk, which must have the same data type and dimensions as
+  // the file, and the same shape except along the leading axis. A chunk
+  // which is not C continuous is copied into C order first.
+  template <class T>
+  void append(const NDArrayView<T>& chunk);
+
+  template <class T, class A>
+  void append(const NDArray<T, A>& chunk);
+
+  // Closes the file, after ensuring that the number of rows appended matches
+  // the shape, or writing the number of rows into the header of an open
+  // ended file.
+  void close();
+
+  // Returns the number of rows appended so far
+  size_t rows_written() const;
+
+  // Returns true if the file has not yet been closed
+  bool is_open() const;
+
+ private:
+  std::ofstream file_;
+  std::string fname_;
+  std::vector<size_t> shape_;
+  DType dtype_;
+  size_t row_bytes_;
+  size_t rows_written_;
+  size_t preamble_length_;
+  bool open_ended_;
+
+  NpyWriter(const std::string& fname, const std::vector<size_t>& shape,
+            DType dtype, bool open_ended);
+};
+
+//==============================================================================
+// Class NpyReader
+//
+// Reads parts of a .npy file without loading all of it. The header is parsed
+// once on construction, and read_slab then reads only the bytes of a range of
+// indices along the slowest varying axis of the file, which is the leading
+// axis for C continuous files and the last axis for Fortran ordered files.
+// The data is byte swapped as it is read if required.
+class NpyReader {
+ public:
+  template <class T>
+  class ChunkIterator;
+
+  template <class T>
+  class Chunks;
+
+  //==========================================================================
+  // Constructors and Destructors
+  explicit NpyReader(const std::string& fname);
+
+  ~NpyReader();
+  NpyReader(const NpyReader&) = delete;
+  NpyReader(NpyReader&& other);
+
+  // Assignment Operator
+  NpyReader& operator=(const NpyReader&) = delete;
+  NpyReader& operator=(NpyReader&& other);
+
+  //==========================================================================
+  // Constant Methods
+
+  // Return vector describing shape of the array in the file
+  const std::vector<size_t>& shape() const;
+
+  // Return the data type of the array in the file
+  DType dtype() const;
+
+  // Returns true if the array in the file is stored in column-major order
+  bool fortran_order() const;
+
+  // Return number of elements in the file
+  size_t size() const;
+
+  // Returns the axis along which slabs are read
+  size_t slab_axis() const;
+
+  // Returns the length of the slab axis
+  size_t n_rows() const;
+
+  // Returns the offset in bytes of the data from the beginning of the file
+  size_t data_offset() const;
+
+  //==========================================================================
+  // Reading
+
+  // Reads the count rows along the slab axis beginning with row start into
+  // data, which must hold count times the size of a row in bytes.
+  void read_slab(size_t start, size_t count, char* data) const;
+
+  // Reads the count rows along the slab axis beginning with row start into
+  // array, which takes the shape and storage order of the slab. Its storage
+  // is only reallocated if the slab does not fit in its current capacity.
+  template <class T, class A>
+  void read_slab(size_t start, size_t count, NDArray<T, A>& array) const;
+
+  template <class T>
+  NDArray<T> read_slab(size_t start, size_t count) const;
+
+  // Returns a range over consecutive slabs of chunk_rows rows, where the
+  // last one may be shorter. The reader must outlive the range.
+  template <class T>
+  Chunks<T> chunks(size_t chunk_rows) const;
+
+ private:
+  std::string fname_;
+  std::vector<size_t> shape_;
+  DType dtype_;
+  bool c_contiguous_;
+  bool little_endian_;
+  size_t data_offset_;
+  size_t row_bytes_;
+#if defined(NDARRAY_HAS_MMAP)
+  int fd_;
+#else
+  mutable std::ifstream file_;
+#endif
+
+  // Reads n_bytes beginning offset bytes into the data
+  void read_bytes(char* data, uint64_t offset, uint64_t n_bytes) const;
+
+  // Returns the shape of a slab of count rows
+  std::vector<size_t> slab_shape(size_t count) const;
+
+  void close();
+};
+
+// Input iterator over the slabs of an NpyReader, which reads each slab when
+// it is first dereferenced.
+template <class T>
+class NpyReader::ChunkIterator {
+ public:
+  typedef std::input_iterator_tag iterator_category;
+  typedef NDArray<T> value_type;
+  typedef std::ptrdiff_t difference_type;
+  typedef const NDArray<T>* pointer;
+  typedef const NDArray<T>& reference;
+
+  ChunkIterator(const NpyReader* reader, size_t position, size_t chunk_rows);
+
+  const NDArray<T>& operator*() const;
+  const NDArray<T>* operator->() const;
+  ChunkIterator& operator++();
+
+  // Returns the first row of the current slab
+  size_t position() const;
+
+  bool operator==(const ChunkIterator& other) const;
+  bool operator!=(const ChunkIterator& other) const;
+
+ private:
+  const NpyReader* reader_;
+  size_t position_;
+  size_t chunk_rows_;
+  mutable NDArray<T> chunk_;
+  mutable bool loaded_;
+};
+
+template <class T>
+class NpyReader::Chunks {
+ public:
+  Chunks(const NpyReader* reader, size_t chunk_rows);
+
+  ChunkIterator<T> begin() const;
+  ChunkIterator<T> end() const;
+
+ private:
+  const NpyReader* reader_;
+  size_t chunk_rows_;
+};
+
+//==============================================================================
+// Class NpzWriter
+//
+// Writes a Numpy .npz archive, which is a zip file holding one .npy file for
+// each array. Arrays are added by name, and the archive is written by close,
+// which computes the checksums and compresses the members in parallel.
+// Compression requires NDARRAY_USE_ZLIB.
+
+// Methods by which the members of an .npz archive may be stored.
+enum class NpzCompression { Stored, Deflate };
+
+class NpzWriter {
+ public:
+  //==========================================================================
+  // Constructors and Destructors
+  explicit NpzWriter(const std::string& fname,
+                     NpzCompression compression = NpzCompression::Stored);
+
+  // Writes the archive if close has not been called. Since errors cannot be
+  // reported here, close should be called explicitly.
+  ~NpzWriter();
+  NpzWriter(const NpzWriter&) = delete;
+
+  // Assignment Operator
+  NpzWriter& operator=(const NpzWriter&) = delete;
+
+  //==========================================================================
+  // Methods
+
+  // Adds array to the archive as name.npy. The data of the array is only
+  // read by close, and the array must remain unchanged until then.
+  template <class T, class A>
+  void add(const std::string& name, const NDArray<T, A>& array);
+
+  // Writes the archive to the file
+  void close();
+
+ private:
+  struct Member {
+    std::string name;
+    std::string preamble;
+    const char* data;
+    uint64_t n_bytes;
+  };
+
+  std::string fname_;
+  NpzCompression compression_;
+  std::vector<Member> members_;
+  std::unordered_set<std::string> member_names_;
+  bool open_;
+};
+
+//==============================================================================
+// Class NpzReader
+//
+// Reads the arrays of a Numpy .npz archive. The directory of the archive is
+// read on construction, and each array is then read from its member when it
+// is loaded. Loading several arrays at once decompresses them in parallel.
+class NpzReader {
+ public:
+  //==========================================================================
+  // Constructors and Destructors
+  explicit NpzReader(const std::string& fname);
+
+  //==========================================================================
+  // Constant Methods
+
+  // Returns the names of the arrays in the archive
+  const std::vector<std::string>& names() const;
+
+  // Returns true if the archive holds an array called name
+  bool contains(const std::string& name) const;
+
+  //==========================================================================
+  // Loading
+
+  // Loads the array called name
+  template <class T>
+  NDArray<T> load(const std::string& name) const;
+
+  // Loads the array called name into array, like NDArray<T>::load_into
+  template <class T, class A>
+  void load_into(const std::string& name, NDArray<T, A>& array) const;
+
+  // Loads the arrays with the given names, in parallel
+  template <class T>
+  std::vector<NDArray<T>> load(const std::vector<std::string>& names) const;
+
+ private:
+  struct Member {
+    uint16_t method;
+    uint32_t crc;
+    uint64_t compressed_size;
+    uint64_t uncompressed_size;
+    uint64_t offset;
+  };
+
+  std::string fname_;
+  std::vector<std::string> names_;
+  std::vector<Member> members_;
+  std::unordered_map<std::string, size_t> index_;
+
+  const Member& member(const std::string& name) const;
+};
+
+//==============================================================================
+// Template Struct NpyBatchResult
+//
+// Result of loading one file of a batch. If the file could not be opened,
+// parsed or read, error holds the exception which was thrown, and array is
+// empty.
+template <class T>
+struct NpyBatchResult {
+  std::string fname;
+  size_t index;  // Position of fname in the list of files
+  NDArray<T> array;
+  std::exception_ptr error;
+
+  bool ok() const { return !error; }
+};
+
+//==============================================================================
+// Template Class NpyBatchLoader
+//
+// Loads a list of .npy files concurrently on a bounded pool of I/O threads.
+// The headers of all files are read on construction, so that the shapes and
+// the total size of the batch are known before any data is read. Files are
+// then loaded at most readahead files ahead of the consumer, and next
+// returns the results in the order in which they complete. An error in one
+// file is returned with its result, and does not stop the rest of the batch.
+template <class T>
+class NpyBatchLoader {
+ public:
+  //==========================================================================
+  // Constructors and Destructors
+
+  // A value of zero for n_threads selects four threads, or the number of
+  // hardware threads if that is greater, and a value of zero for readahead
+  // selects twice the number of threads. If readahead covers every file,
+  // the arrays of all files are allocated once their headers are read.
+  NpyBatchLoader(const std::vector<std::string>& fnames, size_t n_threads = 0,
+                 size_t readahead = 0);
+
+  // Waits for the files which are being read, and discards the rest
+  ~NpyBatchLoader();
+
+  NpyBatchLoader(const NpyBatchLoader&) = delete;
+  NpyBatchLoader& operator=(const NpyBatchLoader&) = delete;
+
+  //==========================================================================
+  // Constant Methods
+
+  // Returns the number of files in the batch
+  size_t size() const;
+
+  // Returns the name of file i
+  const std::string& fname(size_t i) const;
+
+  // Returns false if file i has already failed, as its header could not be
+  // read or does not match T
+  bool ok(size_t i) const;
+
+  // Returns the header of file i, or rethrows the error if it has failed
+  const NpyHeaderInfo& header(size_t i) const;
+
+  // Returns the number of bytes of data in the files which have not failed
+  uint64_t total_bytes() const;
+
+  //==========================================================================
+  // Loading
+
+  // Moves the next result to complete into result, waiting for it if
+  // necessary. Returns false once every result has been returned.
+  bool next(NpyBatchResult<T>& result);
+
+ private:
+  std::vector<std::string> fnames_;
+  std::vector<NpyHeaderInfo> headers_;
+  std::vector<std::exception_ptr> errors_;
+  std::vector<NDArray<T>> arrays_;
+  std::vector<std::thread> workers_;
+  std::mutex mutex_;
+  std::condition_variable ready_;
+  std::condition_variable space_;
+  std::deque<NpyBatchResult<T>> done_;
+  size_t readahead_;
+  size_t next_file_;
+  size_t pending_;
+  size_t returned_;
+  bool stop_;
+
+  void read_headers(size_t n_threads, bool allocate);
+  void work();
+};
+
+// Loads the .npy files fnames concurrently with NpyBatchLoader, returning
+// the results in the order of fnames. The arrays of all files are allocated
+// from their headers before any data is read.
+template <class T>
+std::vector<NpyBatchResult<T>> load_npy_batch(
+    const std::vector<std::string>& fnames, size_t n_threads = 0);
+
+//==============================================================================
+// Template Class MappedNDArray
+//
+// Array whose data is memory mapped from a .npy file, as returned by
+// NDArray<T>::load_mmap. Pages are only read from the file once they are
+// accessed, and the data is never copied. If the byte order of the file
+// differs from that of the system, or if memory mapping is not available,
+// the data is instead loaded into memory, and the array behaves the same.
+// A MMapMode::ReadOnly mapping must have const elements, as in
+// MappedNDArray<const double>, so that they can not be written to.
+template <class T>
+class MappedNDArray {
+ public:
+  typedef typename std::remove_const<T>::type value_type;
+
+  //==========================================================================
+  // Constructors and Destructors
+  MappedNDArray();
+  // Throws if mode is MMapMode::ReadOnly and T is not const
+  MappedNDArray(const std::string& fname, MMapMode mode);
+
+  ~MappedNDArray();
+  MappedNDArray(const MappedNDArray&) = delete;
+  MappedNDArray(MappedNDArray&& other);
+
+  // Assignment Operator
+  MappedNDArray& operator=(const MappedNDArray&) = delete;
+  MappedNDArray& operator=(MappedNDArray&& other);
+
+  //==========================================================================
+  // Indexing
+
+  // Indexing operators for indexing with vector
+  T& operator()(const std::vector<size_t>& indices);
+  const T& operator()(const std::vector<size_t>& indices) const;
+
+  // Variadic indexing operators
+  template <typename... INDS>
+  T& operator()(INDS... inds);
+  template <typename... INDS>
+  const T& operator()(INDS... inds) const;
+
+  // Indexing methods which always check that the indices are valid,
+  // regardless of NDARRAY_NO_BOUNDS_CHECK
+  T& at(const std::vector<size_t>& indices);
+  const T& at(const std::vector<size_t>& indices) const;
+
+  template <typename... INDS>
+  T& at(INDS... inds);
+  template <typename... INDS>
+  const T& at(INDS... inds) const;
+
+  // Linear Indexing operators
+  T& operator[](size_t i);
+  const T& operator[](size_t i) const;
+
+  //==========================================================================
+  // Constant Methods
+
+  // Return pointer to beginning of data
+  T* data();
+  const T* data() const;
+
+  // Return vector describing shape of array
+  const std::vector<size_t>& shape() const;
+
+  // Return number of elements in array
+  size_t size() const;
+
+  size_t linear_index(const std::vector<size_t>& indices) const;
+
+  template <typename... INDS>
+  size_t linear_index(INDS... inds) const;
+
+  // Returns true if data is stored as c continuous (row-major order),
+  // and false if fortran continuous (column-major order)
+  bool c_continuous() const;
+
+  // Returns true if the data is memory mapped, and false if it had to be
+  // loaded into memory
+  bool is_mapped() const;
+
+  // Returns the mode with which the file was opened
+  MMapMode mode() const;
+
+  // Returns a non-owning view of the whole array, which remains valid for
+  // the lifetime of the mapping
+  NDArrayView<T> view();
+  NDArrayView<const T> view() const;
+
+ private:
+  void* map_base_;
+  size_t map_length_;
+  // Only holds the data if it could not be mapped
+  std::vector<value_type, AlignedAllocator<value_type>> data_;
+  NDArrayView<T> view_;
+  size_t size_;
+  bool c_continuous_;
+  MMapMode mode_;
+
+  void unmap();
+};
+
+//==============================================================================
+// Template Class ChunkedNDArray
+//
+// Array for large grids holding mostly a single value, such as sparse tallies
+// over a fine mesh, which would not fit in memory as an NDArray. Elements are
+// held in chunks, which are blocks in C order whose extent along each axis is
+// a power of two, and a chunk is only allocated once one of its elements is
+// written. Every element of an unallocated chunk has the fill value, so the
+// memory used scales with the chunks which are touched, plus a pointer for
+// every chunk of the grid. Since an element may be written through the
+// reference returned by non-constant indexing, that allocates the chunk of
+// the element, and reads which should not allocate must go through a
+// constant array. Allocating chunks is not thread safe, but elements of
+// allocated chunks may be written concurrently.
+template <class T>
+class ChunkedNDArray {
+ public:
+  //==========================================================================
+  // Constructors and Destructors
+  ChunkedNDArray();
+
+  // Array of the given shape with every element equal to fill_value, using
+  // default_chunk_shape limited to the extent of each axis
+  ChunkedNDArray(const std::vector<size_t>& shape, const T& fill_value = T());
+
+  // Array of the given shape with every element equal to fill_value, where
+  // each entry of chunk_shape must be a power of two
+  ChunkedNDArray(const std::vector<size_t>& shape,
+                 const std::vector<size_t>& chunk_shape,
+                 const T& fill_value = T());
+
+  ChunkedNDArray(const ChunkedNDArray& other);
+  ChunkedNDArray(ChunkedNDArray&&) = default;
+
+  // Assignment Operator
+  ChunkedNDArray& operator=(const ChunkedNDArray& other);
+  ChunkedNDArray& operator=(ChunkedNDArray&&) = default;
+
+  //==========================================================================
+  // Indexing
+  // Non-constant indexing allocates the chunk of the element if required.
+
+  // Indexing operators for indexing with vector
+  T& operator()(const std::vector<size_t>& indices);
+  const T& operator()(const std::vector<size_t>& indices) const;
+
+  // Variadic indexing operators
+  template <typename... INDS>
+  T& operator()(INDS... inds);
+  template <typename... INDS>
+  const T& operator()(INDS... inds) const;
+
+  // Indexing methods which always check that the indices are valid,
+  // regardless of NDARRAY_NO_BOUNDS_CHECK
+  T& at(const std::vector<size_t>& indices);
+  const T& at(const std::vector<size_t>& indices) const;
+
+  template <typename... INDS>
+  T& at(INDS... inds);
+  template <typename... INDS>
+  const T& at(INDS... inds) const;
+
+  // Linear Indexing operators, where i is the index of the element in C
+  // order
+  T& operator[](size_t i);
+  const T& operator[](size_t i) const;
+
+  //==========================================================================
+  // Methods
+
+  // Sets every element to val, releasing all of the chunks
+  void fill(const T& val);
+
+  // Writes the array to the .npy file fname in C order. The file is written
+  // through NpyWriter in slabs along the leading axis, so that only a few
+  // rows are ever held densely in memory.
+  void save(const std::string& fname) const;
+
+  //==========================================================================
+  // Constant Methods
+
+  // Return vector describing shape of array
+  const std::vector<size_t>& shape() const;
+
+  // Return number of elements in array
+  size_t size() const;
+
+  // Return vector describing shape of each chunk
+  const std::vector<size_t>& chunk_shape() const;
+
+  // Returns the value of every element of an unallocated chunk
+  const T& fill_value() const;
+
+  // Returns the number of chunks in the grid
+  size_t n_chunks() const;
+
+  // Returns the number of chunks which have been allocated
+  size_t n_allocated_chunks() const;
+
+  // Returns the number of bytes held by the allocated chunks and the table
+  // of chunks
+  size_t allocated_bytes() const;
+
+  // Returns the shape of a chunk of about 32768 elements, with the same
+  // power of two extent along each of the given number of axes
+  static std::vector<size_t> default_chunk_shape(size_t dimensions);
+
+ private:
+  std::vector<size_t> shape_;
+  std::vector<size_t> chunk_shape_;
+  // Base two logarithm of the extent of a chunk along each axis
+  std::vector<size_t> chunk_bits_;
+  // Strides of the chunks in the grid, and of the elements in a chunk
+  std::vector<size_t> grid_strides_;
+  std::vector<size_t> chunk_strides_;
+  std::vector<std::unique_ptr<T[]>> chunks_;
+  size_t size_;
+  size_t chunk_size_;
+  size_t n_allocated_;
+  size_t dimensions_;
+  T fill_value_;
+
+  // Finds the chunk and the offset within it for the given indices, which
+  // are checked unless NDARRAY_NO_BOUNDS_CHECK is defined
+  template <class INDICES>
+  void locate(const INDICES& indices, size_t& chunk, size_t& offset) const;
+
+  // Finds the chunk and the offset within it for the given indices, throwing
+  // an exception if they are not valid
+  template <class INDICES>
+  void checked_locate(const INDICES& indices, size_t& chunk,
+                      size_t& offset) const;
+
+  // Finds the chunk and the offset within it for the given indices, without
+  // any checks
+  template <class INDICES>
+  void unchecked_locate(const INDICES& indices, size_t& chunk,
+                        size_t& offset) const;
+
+  // Returns the element at offset in chunk, allocating the chunk if required
+  T& element(size_t chunk, size_t offset);
+  const T& element(size_t chunk, size_t offset) const;
+
+  // Writes rows begin to end along the leading axis to out in C order
+  void densify_rows(size_t begin, size_t end, T* out) const;
+};
+
+//==============================================================================
+// Template Class SharedNDArray
+//
+// Array whose copies share a single reference counted NDArray, for handing
+// large read-only arrays to several consumers or threads without copying.
+// Constant methods read the shared array, and the first mutating access
+// through a copy (non-constant indexing, data, view, fill or a compound
+// assignment) gives that copy its own array first. The reference count is
+// atomic, so copies may be made, destroyed and detached concurrently from
+// different threads, as long as each SharedNDArray object is only used by
+// one thread at a time. A pointer or view from a non-constant method must
+// not be used to write after the array has been copied.
+template <class T, class Allocator>
+class SharedNDArray {
+ public:
+  //==========================================================================
+  // Constructors and Destructors
+  SharedNDArray();
+
+  // Copies the array once, so that it may then be shared
+  explicit SharedNDArray(const NDArray<T, Allocator>& a);
+
+  // Takes the data of the array without copying it
+  explicit SharedNDArray(NDArray<T, Allocator>&& a);
+
+  ~SharedNDArray() = default;
+  SharedNDArray(const SharedNDArray&) = default;
+  SharedNDArray(SharedNDArray&&) = default;
+
+  // Assignment Operator
+  SharedNDArray& operator=(const SharedNDArray&) = default;
+  SharedNDArray& operator=(SharedNDArray&&) = default;
+
+  //==========================================================================
+  // Indexing
+  // Non-constant indexing detaches the array if it is shared.
+
+  // Indexing operators for indexing with vector
+  T& operator()(const std::vector<size_t>& indices);
+  const T& operator()(const std::vector<size_t>& indices) const;
+
+  // Variadic indexing operators
+  template <typename... INDS>
+  T& operator()(INDS... inds);
+  template <typename... INDS>
+  const T& operator()(INDS... inds) const;
+
+  // Indexing methods which always check that the indices are valid,
+  // regardless of NDARRAY_NO_BOUNDS_CHECK
+  T& at(const std::vector<size_t>& indices);
+  const T& at(const std::vector<size_t>& indices) const;
+
+  template <typename... INDS>
+  T& at(INDS... inds);
+  template <typename... INDS>
+  const T& at(INDS... inds) const;
+
+  // Linear Indexing operators
+  T& operator[](size_t i);
+  const T& operator[](size_t i) const;
+
+  //==========================================================================
+  // Compound Assignment Operators
+  // Detaches the array if it is shared, and then applies the operator of
+  // NDArray with the same operand.
+  template <class C>
+  SharedNDArray& operator+=(const C& c);
+  template <class C>
+  SharedNDArray& operator-=(const C& c);
+  template <class C>
+  SharedNDArray& operator*=(const C& c);
+  template <class C>
+  SharedNDArray& operator/=(const C& c);
+
+  template <class C, class A>
+  SharedNDArray& operator+=(const SharedNDArray<C, A>& a);
+  template <class C, class A>
+  SharedNDArray& operator-=(const SharedNDArray<C, A>& a);
+  template <class C, class A>
+  SharedNDArray& operator*=(const SharedNDArray<C, A>& a);
+  template <class C, class A>
+  SharedNDArray& operator/=(const SharedNDArray<C, A>& a);
+
+  //==========================================================================
+  // Methods
+
+  // Sets every element to val. A shared array is not copied first, as all
+  // of its elements are overwritten.
+  void fill(const T& val);
+
+  // Returns the array for modification, detaching it if it is shared
+  NDArray<T, Allocator>& mutable_array();
+
+  // Return pointer to beginning of data, detaching the array if it is shared
+  T* data();
+
+  // Returns a view of the whole array, detaching it if it is shared
+  NDArrayView<T> view();
+
+  //==========================================================================
+  // Constant Methods
+
+  // Returns the shared array
+  const NDArray<T, Allocator>& array() const;
+
+  // Return pointer to beginning of data
+  const T* data() const;
+
+  // Returns a view of the whole array
+  NDArrayView<const T> view() const;
+
+  // Return vector describing shape of array
+  const std::vector<size_t>& shape() const;
+
+  // Return number of elements in array
+  size_t size() const;
+
+  // Return vector of strides for each dimension
+  const std::vector<size_t>& strides() const;
+
+  // Returns true if data is stored as c continuous (row-major order),
+  // and false if fortran continuous (column-major order)
+  bool c_continuous() const;
+
+  // Returns the number of SharedNDArray objects sharing the array
+  size_t use_count() const;
+
+  // Returns true if the array is shared with another SharedNDArray
+  bool is_shared() const;
+
+  // Saves the array to the .npy file fname
+  void save(const std::string& fname) const;
+
+ private:
+  std::shared_ptr<NDArray<T, Allocator>> array_;
+
+  // Gives this object its own copy of the array if it is shared
+  void detach();
+};
+
+//==============================================================================
+// SIMD Kernels
+//
+// Kernels used by the compound assignment operators and fill when both
+// operands hold the same type (or a complex array is scaled by a real
+// constant), and are contiguous in memory. They process whole vectors of
+// elements, and then finish the remaining elements one at a time. The
+// instruction set is selected at runtime, according to what the CPU supports.
+// Note that a constant of a different type than the array, such as a double
+// added to an NDArray<float>, uses the scalar loop to preserve its semantics.
+
+// Instruction sets which may be used by the kernels of NDArray.
+enum class SIMDLevel { Scalar, NEON, AVX2, AVX512 };
+
+// Returns the instruction set used by the kernels of NDArray, which is the
+// widest one supported by the CPU. The kernels may be disabled entirely by
+// defining NDARRAY_NO_SIMD.
+SIMDLevel simd_level();
+
+inline SIMDLevel simd_level() {
+  struct Detector {
+    static SIMDLevel detect() {
+#if defined(NDARRAY_SIMD_X86)
+      __builtin_cpu_init();
+      if (__builtin_cpu_supports("avx512f")) return SIMDLevel::AVX512;
+      if (__builtin_cpu_supports("avx2")) return SIMDLevel::AVX2;
+      return SIMDLevel::Scalar;
+#elif defined(NDARRAY_SIMD_NEON)
+      return SIMDLevel::NEON;
+#else
+      return SIMDLevel::Scalar;
+#endif
+    }
+  };
+
+  static const SIMDLevel level = Detector::detect();
+  return level;
+}
+
+namespace ndarray_detail {
+
+//==============================================================================
+// Generic Kernels
+//
+// Used for any combination of types without a SIMD kernel.
+template <class T, class C>
+void array_add(T* a, const C* b, size_t n) {
+  for (size_t i = 0; i < n; i++) a[i] += b[i];
+}
+
+template <class T, class C>
+void array_subtract(T* a, const C* b, size_t n) {
+  for (size_t i = 0; i < n; i++) a[i] -= b[i];
+}
+
+template <class T, class C>
+void array_multiply(T* a, const C* b, size_t n) {
+  for (size_t i = 0; i < n; i++) a[i] *= b[i];
+}
+
+template <class T, class C>
+void array_divide(T* a, const C* b, size_t n) {
+  for (size_t i = 0; i < n; i++) a[i] /= b[i];
+}
+
+template <class T, class C>
+void constant_add(T* a, const C& c, size_t n) {
+  for (size_t i = 0; i < n; i++) a[i] += c;
+}
+
+template <class T, class C>
+void constant_subtract(T* a, const C& c, size_t n) {
+  for (size_t i = 0; i < n; i++) a[i] -= c;
+}
+
+template <class T, class C>
+void constant_multiply(T* a, const C& c, size_t n) {
+  for (size_t i = 0; i < n; i++) a[i] *= c;
+}
+
+template <class T, class C>
+void constant_divide(T* a, const C& c, size_t n) {
+  for (size_t i = 0; i < n; i++) a[i] /= c;
+}
+
+template <class T, class C>
+void fill(T* a, const C& val, size_t n) {
+  std::fill(a, a + n, val);
+}
+
+//==============================================================================
+// Kernel Generators
+
+// Defines NAME(T* a, const T* b, size_t n), which computes a[i] OP b[i] with
+// vectors of WIDTH elements, combined with the vector operation VOP.
+#define NDARRAY_SIMD_ARRAY_KERNEL(NAME, TARGET, T, WIDTH, LOAD, STORE, VOP, \
+                                  OP)                                       \
+  TARGET inline void NAME(T* a, const T* b, size_t n) {                     \
+    size_t i = 0;                                                           \
+    for (; i + WIDTH <= n; i += WIDTH) {                                    \
+      STORE(a + i, VOP(LOAD(a + i), LOAD(b + i)));                          \
+    }                                                                       \
+    for (; i < n; i++) a[i] OP b[i];                                        \
+  }
+
+// Defines NAME(T* a, const T& c, size_t n), which computes a[i] OP c with
+// vectors of WIDTH elements, where BROADCAST(c) fills a vector with c.
+#define NDARRAY_SIMD_CONSTANT_KERNEL(NAME, TARGET, T, VEC, WIDTH, LOAD,     \
+                                     STORE, BROADCAST, VOP, OP)             \
+  TARGET inline void NAME(T* a, const T& c, size_t n) {                     \
+    const VEC vc = BROADCAST(c);                                            \
+    size_t i = 0;                                                           \
+    for (; i + WIDTH <= n; i += WIDTH) {                                    \
+      STORE(a + i, VOP(LOAD(a + i), vc));                                   \
+    }                                                                       \
+    for (; i < n; i++) a[i] OP c;                                           \
+  }
+
+// Defines NAME(T* a, const T& val, size_t n), which sets every element to val.
+#define NDARRAY_SIMD_FILL_KERNEL(NAME, TARGET, T, VEC, WIDTH, STORE,        \
+                                 BROADCAST)                                 \
+  TARGET inline void NAME(T* a, const T& val, size_t n) {                   \
+    const VEC vval = BROADCAST(val);                                        \
+    size_t i = 0;                                                           \
+    for (; i + WIDTH <= n; i += WIDTH) {                                    \
+      STORE(a + i, vval);                                                   \
+    }                                                                       \
+    for (; i < n; i++) a[i] = val;                                          \
+  }
+
+// Defines all kernels for the type T on one instruction set, prefixed by
+// ISA, apart from division which is defined separately.
+#define NDARRAY_SIMD_KERNELS(ISA, TARGET, T, VEC, WIDTH, LOAD, STORE,       \
+                             BROADCAST, ADD, SUB, MUL)                      \
+  NDARRAY_SIMD_ARRAY_KERNEL(ISA##_array_add, TARGET, T, WIDTH, LOAD, STORE, \
+                            ADD, +=)                                        \
+  NDARRAY_SIMD_ARRAY_KERNEL(ISA##_array_subtract, TARGET, T, WIDTH, LOAD,   \
+                            STORE, SUB, -=)                                 \
+  NDARRAY_SIMD_ARRAY_KERNEL(ISA##_array_multiply, TARGET, T, WIDTH, LOAD,   \
+                            STORE, MUL, *=)                                 \
+  NDARRAY_SIMD_CONSTANT_KERNEL(ISA##_constant_add, TARGET, T, VEC, WIDTH,   \
+                               LOAD, STORE, BROADCAST, ADD, +=)             \
+  NDARRAY_SIMD_CONSTANT_KERNEL(ISA##_constant_subtract, TARGET, T, VEC,     \
+                               WIDTH, LOAD, STORE, BROADCAST, SUB, -=)      \
+  NDARRAY_SIMD_CONSTANT_KERNEL(ISA##_constant_multiply, TARGET, T, VEC,     \
+                               WIDTH, LOAD, STORE, BROADCAST, MUL, *=)      \
+  NDARRAY_SIMD_FILL_KERNEL(ISA##_fill, TARGET, T, VEC, WIDTH, STORE,        \
+                           BROADCAST)
+
+#define NDARRAY_SIMD_DIVIDE_KERNELS(ISA, TARGET, T, VEC, WIDTH, LOAD,       \
+                                    STORE, BROADCAST, DIV)                  \
+  NDARRAY_SIMD_ARRAY_KERNEL(ISA##_array_divide, TARGET, T, WIDTH, LOAD,     \
+                            STORE, DIV, /=)                                 \
+  NDARRAY_SIMD_CONSTANT_KERNEL(ISA##_constant_divide, TARGET, T, VEC,       \
+                               WIDTH, LOAD, STORE, BROADCAST, DIV, /=)
+
+#if defined(NDARRAY_SIMD_X86)
+//==============================================================================
+// AVX2 Kernels
+#define NDARRAY_TARGET_AVX2 __attribute__((target("avx2")))
+
+#define NDARRAY_AVX2_LOAD_I32(p) \
+  _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p))
+#define NDARRAY_AVX2_STORE_I32(p, v) \
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), v)
+#define NDARRAY_AVX2_LOAD_C64(p) \
+  _mm256_loadu_ps(reinterpret_cast<const float*>(p))
+#define NDARRAY_AVX2_STORE_C64(p, v) \
+  _mm256_storeu_ps(reinterpret_cast<float*>(p), v)
+#define NDARRAY_AVX2_LOAD_C128(p) \
+  _mm256_loadu_pd(reinterpret_cast<const double*>(p))
+#define NDARRAY_AVX2_STORE_C128(p, v) \
+  _mm256_storeu_pd(reinterpret_cast<double*>(p), v)
+#define NDARRAY_AVX2_BROADCAST_C64(c)                                   \
+  _mm256_setr_ps(c.real(), c.imag(), c.real(), c.imag(), c.real(),      \
+                 c.imag(), c.real(), c.imag())
+#define NDARRAY_AVX2_BROADCAST_C128(c) \
+  _mm256_setr_pd(c.real(), c.imag(), c.real(), c.imag())
+
+// Multiplies the pairs of interleaved complex numbers in a and b
+NDARRAY_TARGET_AVX2 inline __m256 avx2_complex_mul_ps(__m256 a, __m256 b) {
+  const __m256 b_re = _mm256_moveldup_ps(b);
+  const __m256 b_im = _mm256_movehdup_ps(b);
+  const __m256 a_swap = _mm256_permute_ps(a, 0xB1);
+  return _mm256_addsub_ps(_mm256_mul_ps(a, b_re), _mm256_mul_ps(a_swap, b_im));
+}
+
+NDARRAY_TARGET_AVX2 inline __m256d avx2_complex_mul_pd(__m256d a,
+                                                       __m256d b) {
+  const __m256d b_re = _mm256_movedup_pd(b);
+  const __m256d b_im = _mm256_permute_pd(b, 0xF);
+  const __m256d a_swap = _mm256_permute_pd(a, 0x5);
+  return _mm256_addsub_pd(_mm256_mul_pd(a, b_re), _mm256_mul_pd(a_swap, b_im));
+}
+
+NDARRAY_SIMD_KERNELS(avx2, NDARRAY_TARGET_AVX2, float, __m256, 8,
+                     _mm256_loadu_ps, _mm256_storeu_ps, _mm256_set1_ps,
+                     _mm256_add_ps, _mm256_sub_ps, _mm256_mul_ps)
+NDARRAY_SIMD_DIVIDE_KERNELS(avx2, NDARRAY_TARGET_AVX2, float, __m256, 8,
+                            _mm256_loadu_ps, _mm256_storeu_ps,
+                            _mm256_set1_ps, _mm256_div_ps)
+NDARRAY_SIMD_KERNELS(avx2, NDARRAY_TARGET_AVX2, double, __m256d, 4,
+                     _mm256_loadu_pd, _mm256_storeu_pd, _mm256_set1_pd,
+                     _mm256_add_pd, _mm256_sub_pd, _mm256_mul_pd)
+NDARRAY_SIMD_DIVIDE_KERNELS(avx2, NDARRAY_TARGET_AVX2, double, __m256d, 4,
+                            _mm256_loadu_pd, _mm256_storeu_pd,
+                            _mm256_set1_pd, _mm256_div_pd)
+NDARRAY_SIMD_KERNELS(avx2, NDARRAY_TARGET_AVX2, int32_t, __m256i, 8,
+                     NDARRAY_AVX2_LOAD_I32, NDARRAY_AVX2_STORE_I32,
+                     _mm256_set1_epi32, _mm256_add_epi32, _mm256_sub_epi32,
+                     _mm256_mullo_epi32)
+NDARRAY_SIMD_KERNELS(avx2, NDARRAY_TARGET_AVX2, std::complex<float>, __m256,
+                     4, NDARRAY_AVX2_LOAD_C64, NDARRAY_AVX2_STORE_C64,
+                     NDARRAY_AVX2_BROADCAST_C64, _mm256_add_ps,
+                     _mm256_sub_ps, avx2_complex_mul_ps)
+NDARRAY_SIMD_KERNELS(avx2, NDARRAY_TARGET_AVX2, std::complex<double>,
+                     __m256d, 2, NDARRAY_AVX2_LOAD_C128,
+                     NDARRAY_AVX2_STORE_C128, NDARRAY_AVX2_BROADCAST_C128,
+                     _mm256_add_pd, _mm256_sub_pd, avx2_complex_mul_pd)
+
+#undef NDARRAY_AVX2_LOAD_I32
+#undef NDARRAY_AVX2_STORE_I32
+#undef NDARRAY_AVX2_LOAD_C64
+#undef NDARRAY_AVX2_STORE_C64
+#undef NDARRAY_AVX2_LOAD_C128
+#undef NDARRAY_AVX2_STORE_C128
+#undef NDARRAY_AVX2_BROADCAST_C64
+#undef NDARRAY_AVX2_BROADCAST_C128
+#undef NDARRAY_TARGET_AVX2
+
+//==============================================================================
+// AVX-512 Kernels
+#define NDARRAY_TARGET_AVX512 __attribute__((target("avx512f")))
+
+#define NDARRAY_AVX512_LOAD_C64(p) \
+  _mm512_loadu_ps(reinterpret_cast<const float*>(p))
+#define NDARRAY_AVX512_STORE_C64(p, v) \
+  _mm512_storeu_ps(reinterpret_cast<float*>(p), v)
+#define NDARRAY_AVX512_LOAD_C128(p) \
+  _mm512_loadu_pd(reinterpret_cast<const double*>(p))
+#define NDARRAY_AVX512_STORE_C128(p, v) \
+  _mm512_storeu_pd(reinterpret_cast<double*>(p), v)
+#define NDARRAY_AVX512_BROADCAST_C64(c) \
+  _mm512_setr4_ps(c.real(), c.imag(), c.real(), c.imag())
+#define NDARRAY_AVX512_BROADCAST_C128(c) \
+  _mm512_setr4_pd(c.real(), c.imag(), c.real(), c.imag())
+
+// Multiplies the interleaved complex numbers in a and b. There is no addsub
+// instruction, so the real parts are subtracted with a mask of even lanes.
+// The shuffles are written with full masks, as the unmasked forms cause
+// spurious uninitialized warnings with some compilers.
+NDARRAY_TARGET_AVX512 inline __m512 avx512_complex_mul_ps(__m512 a,
+                                                          __m512 b) {
+  const __m512 b_re = _mm512_mask_moveldup_ps(b, 0xFFFF, b);
+  const __m512 b_im = _mm512_mask_movehdup_ps(b, 0xFFFF, b);
+  const __m512 a_swap = _mm512_mask_permute_ps(a, 0xFFFF, a, 0xB1);
+  const __m512 t1 = _mm512_mul_ps(a, b_re);
+  const __m512 t2 = _mm512_mul_ps(a_swap, b_im);
+  return _mm512_mask_sub_ps(_mm512_add_ps(t1, t2), 0x5555, t1, t2);
+}
+
+NDARRAY_TARGET_AVX512 inline __m512d avx512_complex_mul_pd(__m512d a,
+                                                           __m512d b) {
+  const __m512d b_re = _mm512_mask_movedup_pd(b, 0xFF, b);
+  const __m512d b_im = _mm512_mask_permute_pd(b, 0xFF, b, 0xFF);
+  const __m512d a_swap = _mm512_mask_permute_pd(a, 0xFF, a, 0x55);
+  const __m512d t1 = _mm512_mul_pd(a, b_re);
+  const __m512d t2 = _mm512_mul_pd(a_swap, b_im);
+  return _mm512_mask_sub_pd(_mm512_add_pd(t1, t2), 0x55, t1, t2);
+}
+
+NDARRAY_SIMD_KERNELS(avx512, NDARRAY_TARGET_AVX512, float, __m512, 16,
+                     _mm512_loadu_ps, _mm512_storeu_ps, _mm512_set1_ps,
+                     _mm512_add_ps, _mm512_sub_ps, _mm512_mul_ps)
+NDARRAY_SIMD_DIVIDE_KERNELS(avx512, NDARRAY_TARGET_AVX512, float, __m512, 16,
+                            _mm512_loadu_ps, _mm512_storeu_ps,
+                            _mm512_set1_ps, _mm512_div_ps)
+NDARRAY_SIMD_KERNELS(avx512, NDARRAY_TARGET_AVX512, double, __m512d, 8,
+                     _mm512_loadu_pd, _mm512_storeu_pd, _mm512_set1_pd,
+                     _mm512_add_pd, _mm512_sub_pd, _mm512_mul_pd)
+NDARRAY_SIMD_DIVIDE_KERNELS(avx512, NDARRAY_TARGET_AVX512, double, __m512d, 8,
+                            _mm512_loadu_pd, _mm512_storeu_pd,
+                            _mm512_set1_pd, _mm512_div_pd)
+NDARRAY_SIMD_KERNELS(avx512, NDARRAY_TARGET_AVX512, int32_t, __m512i, 16,
+                     _mm512_loadu_si512, _mm512_storeu_si512,
+                     _mm512_set1_epi32, _mm512_add_epi32, _mm512_sub_epi32,
+                     _mm512_mullo_epi32)
+NDARRAY_SIMD_KERNELS(avx512, NDARRAY_TARGET_AVX512, std::complex<float>,
+                     __m512, 8, NDARRAY_AVX512_LOAD_C64,
+                     NDARRAY_AVX512_STORE_C64, NDARRAY_AVX512_BROADCAST_C64,
+                     _mm512_add_ps, _mm512_sub_ps, avx512_complex_mul_ps)
+NDARRAY_SIMD_KERNELS(avx512, NDARRAY_TARGET_AVX512, std::complex<double>,
+                     __m512d, 4, NDARRAY_AVX512_LOAD_C128,
+                     NDARRAY_AVX512_STORE_C128,
+                     NDARRAY_AVX512_BROADCAST_C128, _mm512_add_pd,
+                     _mm512_sub_pd, avx512_complex_mul_pd)
+
+#undef NDARRAY_AVX512_LOAD_C64
+#undef NDARRAY_AVX512_STORE_C64
+#undef NDARRAY_AVX512_LOAD_C128
+#undef NDARRAY_AVX512_STORE_C128
+#undef NDARRAY_AVX512_BROADCAST_C64
+#undef NDARRAY_AVX512_BROADCAST_C128
+#undef NDARRAY_TARGET_AVX512
+
+// Defines NAME(T* a, ARG b, size_t n), which calls the widest kernel
+// supported by the CPU, or otherwise the generic kernel.
+#define NDARRAY_SIMD_DISPATCH(NAME, T, ARG)            \
+  inline void NAME(T* a, ARG b, size_t n) {            \
+    switch (simd_level()) {                            \
+      case SIMDLevel::AVX512:                          \
+        avx512_##NAME(a, b, n);                        \
+        return;                                        \
+      case SIMDLevel::AVX2:                            \
+        avx2_##NAME(a, b, n);                          \
+        return;                                        \
+      default:                                         \
+        NAME<T, T>(a, b, n);                           \
+        return;                                        \
+    }                                                  \
+  }
+
+#elif defined(NDARRAY_SIMD_NEON)
+//==============================================================================
+// NEON Kernels
+#define NDARRAY_TARGET_NEON
+
+NDARRAY_SIMD_KERNELS(neon, NDARRAY_TARGET_NEON, float, float32x4_t, 4,
+                     vld1q_f32, vst1q_f32, vdupq_n_f32, vaddq_f32, vsubq_f32,
+                     vmulq_f32)
+NDARRAY_SIMD_DIVIDE_KERNELS(neon, NDARRAY_TARGET_NEON, float, float32x4_t, 4,
+                            vld1q_f32, vst1q_f32, vdupq_n_f32, vdivq_f32)
+NDARRAY_SIMD_KERNELS(neon, NDARRAY_TARGET_NEON, double, float64x2_t, 2,
+                     vld1q_f64, vst1q_f64, vdupq_n_f64, vaddq_f64, vsubq_f64,
+                     vmulq_f64)
+NDARRAY_SIMD_DIVIDE_KERNELS(neon, NDARRAY_TARGET_NEON, double, float64x2_t, 2,
+                            vld1q_f64, vst1q_f64, vdupq_n_f64, vdivq_f64)
+NDARRAY_SIMD_KERNELS(neon, NDARRAY_TARGET_NEON, int32_t, int32x4_t, 4,
+                     vld1q_s32, vst1q_s32, vdupq_n_s32, vaddq_s32, vsubq_s32,
+                     vmulq_s32)
+
+#undef NDARRAY_TARGET_NEON
+
+// NEON has no kernels for complex numbers, which use the generic kernels
+// apart from the real valued operations below.
+#define NDARRAY_SIMD_DISPATCH(NAME, T, ARG) \
+  inline void NAME(T* a, ARG b, size_t n) { \
+    neon_##NAME(a, b, n);                   \
+  }
+#endif
+
+#if defined(NDARRAY_SIMD_DISPATCH)
+NDARRAY_SIMD_DISPATCH(array_add, float, const float*)
+NDARRAY_SIMD_DISPATCH(array_subtract, float, const float*)
+NDARRAY_SIMD_DISPATCH(array_multiply, float, const float*)
+NDARRAY_SIMD_DISPATCH(array_divide, float, const float*)
+NDARRAY_SIMD_DISPATCH(constant_add, float, const float&)
+NDARRAY_SIMD_DISPATCH(constant_subtract, float, const float&)
+NDARRAY_SIMD_DISPATCH(constant_multiply, float, const float&)
+NDARRAY_SIMD_DISPATCH(constant_divide, float, const float&)
+NDARRAY_SIMD_DISPATCH(fill, float, const float&)
+
+NDARRAY_SIMD_DISPATCH(array_add, double, const double*)
+NDARRAY_SIMD_DISPATCH(array_subtract, double, const double*)
+NDARRAY_SIMD_DISPATCH(array_multiply, double, const double*)
+NDARRAY_SIMD_DISPATCH(array_divide, double, const double*)
+NDARRAY_SIMD_DISPATCH(constant_add, double, const double&)
+NDARRAY_SIMD_DISPATCH(constant_subtract, double, const double&)
+NDARRAY_SIMD_DISPATCH(constant_multiply, double, const double&)
+NDARRAY_SIMD_DISPATCH(constant_divide, double, const double&)
+NDARRAY_SIMD_DISPATCH(fill, double, const double&)
+
+NDARRAY_SIMD_DISPATCH(array_add, int32_t, const int32_t*)
+NDARRAY_SIMD_DISPATCH(array_subtract, int32_t, const int32_t*)
+NDARRAY_SIMD_DISPATCH(array_multiply, int32_t, const int32_t*)
+NDARRAY_SIMD_DISPATCH(constant_add, int32_t, const int32_t&)
+NDARRAY_SIMD_DISPATCH(constant_subtract, int32_t, const int32_t&)
+NDARRAY_SIMD_DISPATCH(constant_multiply, int32_t, const int32_t&)
+NDARRAY_SIMD_DISPATCH(fill, int32_t, const int32_t&)
+
+#if defined(NDARRAY_SIMD_X86)
+NDARRAY_SIMD_DISPATCH(array_add, std::complex<float>,
+                      const std::complex<float>*)
+NDARRAY_SIMD_DISPATCH(array_subtract, std::complex<float>,
+                      const std::complex<float>*)
+NDARRAY_SIMD_DISPATCH(array_multiply, std::complex<float>,
+                      const std::complex<float>*)
+NDARRAY_SIMD_DISPATCH(constant_add, std::complex<float>,
+                      const std::complex<float>&)
+NDARRAY_SIMD_DISPATCH(constant_subtract, std::complex<float>,
+                      const std::complex<float>&)
+NDARRAY_SIMD_DISPATCH(constant_multiply, std::complex<float>,
+                      const std::complex<float>&)
+NDARRAY_SIMD_DISPATCH(fill, std::complex<float>, const std::complex<float>&)
+
+NDARRAY_SIMD_DISPATCH(array_add, std::complex<double>,
+                      const std::complex<double>*)
+NDARRAY_SIMD_DISPATCH(array_subtract, std::complex<double>,
+                      const std::complex<double>*)
+NDARRAY_SIMD_DISPATCH(array_multiply, std::complex<double>,
+                      const std::complex<double>*)
+NDARRAY_SIMD_DISPATCH(constant_add, std::complex<double>,
+                      const std::complex<double>&)
+NDARRAY_SIMD_DISPATCH(constant_subtract, std::complex<double>,
+                      const std::complex<double>&)
+NDARRAY_SIMD_DISPATCH(constant_multiply, std::complex<double>,
+                      const std::complex<double>&)
+NDARRAY_SIMD_DISPATCH(fill, std::complex<double>,
+                      const std::complex<double>&)
+#endif
+
+// A complex array scaled by a real constant is an array of twice as many
+// real numbers scaled by the constant.
+inline void constant_multiply(std::complex<float>* a, const float& c,
+                              size_t n) {
+  constant_multiply(reinterpret_cast<float*>(a), c, 2 * n);
+}
+
+inline void constant_divide(std::complex<float>* a, const float& c,
+                            size_t n) {
+  constant_divide(reinterpret_cast<float*>(a), c, 2 * n);
+}
+
+inline void constant_multiply(std::complex<double>* a, const double& c,
+                              size_t n) {
+  constant_multiply(reinterpret_cast<double*>(a), c, 2 * n);
+}
+
+inline void constant_divide(std::complex<double>* a, const double& c,
+                            size_t n) {
+  constant_divide(reinterpret_cast<double*>(a), c, 2 * n);
+}
+
+#undef NDARRAY_SIMD_DISPATCH
+#endif
+
+#undef NDARRAY_SIMD_ARRAY_KERNEL
+#undef NDARRAY_SIMD_CONSTANT_KERNEL
+#undef NDARRAY_SIMD_FILL_KERNEL
+#undef NDARRAY_SIMD_KERNELS
+#undef NDARRAY_SIMD_DIVIDE_KERNELS
+
+//==============================================================================
+// Byte Swap Kernels
+//
+// Reverse the byte order of each of n words of Width bytes. The kernel for a
+// given width is selected once by byte_swap_kernel, and then applied to the
+// whole array (or each chunk of it as it is read).
+typedef void (*ByteSwapKernel)(char* data, uint64_t n);
+
+// Number of bytes read from a file between swaps of the byte order, so that
+// the data is swapped while it is still in cache.
+const size_t byte_swap_chunk = 1 << 18;
+
+#if defined(_MSC_VER)
+inline uint16_t byte_swap(uint16_t x) { return _byteswap_ushort(x); }
+inline uint32_t byte_swap(uint32_t x) { return _byteswap_ulong(x); }
+inline uint64_t byte_swap(uint64_t x) { return _byteswap_uint64(x); }
+#else
+inline uint16_t byte_swap(uint16_t x) { return __builtin_bswap16(x); }
+inline uint32_t byte_swap(uint32_t x) { return __builtin_bswap32(x); }
+inline uint64_t byte_swap(uint64_t x) { return __builtin_bswap64(x); }
+#endif
+
+template <class U>
+void scalar_byte_swap(char* data, uint64_t n) {
+  for (uint64_t i = 0; i < n; i++) {
+    U word;
+    std::memcpy(&word, data + i * sizeof(U), sizeof(U));
+    word = byte_swap(word);
+    std::memcpy(data + i * sizeof(U), &word, sizeof(U));
+  }
+}
+
+// Sixteen byte words are swapped as two eight byte halves, which also trade
+// places.
+inline void scalar_byte_swap_sixteen(char* data, uint64_t n) {
+  for (uint64_t i = 0; i < n; i++) {
+    uint64_t half[2];
+    std::memcpy(half, data + 16 * i, 16);
+    uint64_t low = byte_swap(half[1]);
+    half[1] = byte_swap(half[0]);
+    half[0] = low;
+    std::memcpy(data + 16 * i, half, 16);
+  }
+}
+
+inline void no_byte_swap(char*, uint64_t) {}
+
+template <size_t Width>
+void scalar_byte_swap_width(char* data, uint64_t n);
+
+template <>
+inline void scalar_byte_swap_width<2>(char* data, uint64_t n) {
+  scalar_byte_swap<uint16_t>(data, n);
+}
+
+template <>
+inline void scalar_byte_swap_width<4>(char* data, uint64_t n) {
+  scalar_byte_swap<uint32_t>(data, n);
+}
+
+template <>
+inline void scalar_byte_swap_width<8>(char* data, uint64_t n) {
+  scalar_byte_swap<uint64_t>(data, n);
+}
+
+template <>
+inline void scalar_byte_swap_width<16>(char* data, uint64_t n) {
+  scalar_byte_swap_sixteen(data, n);
+}
+
+#if defined(NDARRAY_SIMD_X86)
+// Words never cross a 128 bit lane, so a single in-lane byte shuffle
+// reverses every word of the vector.
+template <size_t Width>
+__attribute__((target("avx2"))) void avx2_byte_swap(char* data, uint64_t n) {
+  char pattern[32];
+  for (int j = 0; j < 32; j++) {
+    int k = j % 16;
+    pattern[j] = static_cast<char>(k - k % Width + (Width - 1 - k % Width));
+  }
+  const __m256i mask =
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pattern));
+
+  const uint64_t n_bytes = n * Width;
+  uint64_t i = 0;
+  for (; i + 128 <= n_bytes; i += 128) {
+    __m256i* p = reinterpret_cast<__m256i*>(data + i);
+    __m256i v0 = _mm256_loadu_si256(p);
+    __m256i v1 = _mm256_loadu_si256(p + 1);
+    __m256i v2 = _mm256_loadu_si256(p + 2);
+    __m256i v3 = _mm256_loadu_si256(p + 3);
+    _mm256_storeu_si256(p, _mm256_shuffle_epi8(v0, mask));
+    _mm256_storeu_si256(p + 1, _mm256_shuffle_epi8(v1, mask));
+    _mm256_storeu_si256(p + 2, _mm256_shuffle_epi8(v2, mask));
+    _mm256_storeu_si256(p + 3, _mm256_shuffle_epi8(v3, mask));
+  }
+  for (; i + 32 <= n_bytes; i += 32) {
+    __m256i* p = reinterpret_cast<__m256i*>(data + i);
+    _mm256_storeu_si256(p, _mm256_shuffle_epi8(_mm256_loadu_si256(p), mask));
+  }
+  scalar_byte_swap_width<Width>(data + i, (n_bytes - i) / Width);
+}
+#elif defined(NDARRAY_SIMD_NEON)
+template <size_t Width>
+uint8x16_t neon_reverse(uint8x16_t v);
+
+template <>
+inline uint8x16_t neon_reverse<2>(uint8x16_t v) {
+  return vrev16q_u8(v);
+}
+
+template <>
+inline uint8x16_t neon_reverse<4>(uint8x16_t v) {
+  return vrev32q_u8(v);
+}
+
+template <>
+inline uint8x16_t neon_reverse<8>(uint8x16_t v) {
+  return vrev64q_u8(v);
+}
+
+template <>
+inline uint8x16_t neon_reverse<16>(uint8x16_t v) {
+  v = vrev64q_u8(v);
+  return vextq_u8(v, v, 8);
+}
+
+template <size_t Width>
+void neon_byte_swap(char* data, uint64_t n) {
+  const uint64_t n_bytes = n * Width;
+  uint64_t i = 0;
+  for (; i + 16 <= n_bytes; i += 16) {
+    uint8_t* p = reinterpret_cast<uint8_t*>(data + i);
+    vst1q_u8(p, neon_reverse<Width>(vld1q_u8(p)));
+  }
+  scalar_byte_swap_width<Width>(data + i, (n_bytes - i) / Width);
+}
+#endif
+
+template <size_t Width>
+ByteSwapKernel select_byte_swap() {
+#if defined(NDARRAY_SIMD_X86)
+  if (simd_level() != SIMDLevel::Scalar) return &avx2_byte_swap<Width>;
+#elif defined(NDARRAY_SIMD_NEON)
+  if (simd_level() == SIMDLevel::NEON) return &neon_byte_swap<Width>;
+#endif
+  return &scalar_byte_swap_width<Width>;
+}
+
+// Returns the kernel which swaps the byte order of words of element_size
+// bytes.
+inline ByteSwapKernel byte_swap_kernel(size_t element_size) {
+  switch (element_size) {
+    case 1:
+      return &no_byte_swap;
+    case 2:
+      return select_byte_swap<2>();
+    case 4:
+      return select_byte_swap<4>();
+    case 8:
+      return select_byte_swap<8>();
+    case 16:
+      return select_byte_swap<16>();
+    default: {
+      std::string mssg = "Cannot swap bytes for data types of size " +
+                         std::to_string(element_size);
+      throw std::runtime_error(mssg);
+    }
+  }
+}
+
+//==============================================================================
+// Conversion Kernels
+//
+// Convert n elements of b to the type of a. Kernels for the common pairs of
+// arithmetic types use the SIMD conversion instructions, which give the same
+// results as the scalar conversions for every value that can be represented.
+template <class T, class C>
+void convert(T* a, const C* b, size_t n) {
+  for (size_t i = 0; i < n; i++) a[i] = b[i];
+}
+
+template <class T>
+void convert(T* a, const T* b, size_t n) {
+  std::copy(b, b + n, a);
+}
+
+#define NDARRAY_SIMD_CONVERT_KERNEL(NAME, TARGET, T, C, WIDTH, CONVERT) \
+  TARGET inline void NAME(T* a, const C* b, size_t n) {                 \
+    size_t i = 0;                                                       \
+    for (; i + WIDTH <= n; i += WIDTH) CONVERT(a + i, b + i);           \
+    for (; i < n; i++) a[i] = static_cast<T>(b[i]);                     \
+  }
+
+#if defined(NDARRAY_SIMD_X86)
+#define NDARRAY_TARGET_AVX2 __attribute__((target("avx2")))
+#define NDARRAY_AVX2_LOAD_I32(p) \
+  _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p))
+#define NDARRAY_AVX2_STORE_I32(p, v) \
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), v)
+#define NDARRAY_AVX2_PD_TO_PS(a, b) \
+  _mm_storeu_ps(a, _mm256_cvtpd_ps(_mm256_loadu_pd(b)))
+#define NDARRAY_AVX2_PS_TO_PD(a, b) \
+  _mm256_storeu_pd(a, _mm256_cvtps_pd(_mm_loadu_ps(b)))
+#define NDARRAY_AVX2_EPI32_TO_PS(a, b) \
+  _mm256_storeu_ps(a, _mm256_cvtepi32_ps(NDARRAY_AVX2_LOAD_I32(b)))
+#define NDARRAY_AVX2_PS_TO_EPI32(a, b) \
+  NDARRAY_AVX2_STORE_I32(a, _mm256_cvttps_epi32(_mm256_loadu_ps(b)))
+#define NDARRAY_AVX2_EPI32_TO_PD(a, b) \
+  _mm256_storeu_pd(                    \
+      a, _mm256_cvtepi32_pd(_mm_loadu_si128(reinterpret_cast<const __m128i*>(b))))
+#define NDARRAY_AVX2_PD_TO_EPI32(a, b)            \
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(a), \
+                   _mm256_cvttpd_epi32(_mm256_loadu_pd(b)))
+
+NDARRAY_SIMD_CONVERT_KERNEL(avx2_convert, NDARRAY_TARGET_AVX2, float, double,
+                            4, NDARRAY_AVX2_PD_TO_PS)
+NDARRAY_SIMD_CONVERT_KERNEL(avx2_convert, NDARRAY_TARGET_AVX2, double, float,
+                            4, NDARRAY_AVX2_PS_TO_PD)
+NDARRAY_SIMD_CONVERT_KERNEL(avx2_convert, NDARRAY_TARGET_AVX2, float, int32_t,
+                            8, NDARRAY_AVX2_EPI32_TO_PS)
+NDARRAY_SIMD_CONVERT_KERNEL(avx2_convert, NDARRAY_TARGET_AVX2, int32_t, float,
+                            8, NDARRAY_AVX2_PS_TO_EPI32)
+NDARRAY_SIMD_CONVERT_KERNEL(avx2_convert, NDARRAY_TARGET_AVX2, double,
+                            int32_t, 4, NDARRAY_AVX2_EPI32_TO_PD)
+NDARRAY_SIMD_CONVERT_KERNEL(avx2_convert, NDARRAY_TARGET_AVX2, int32_t,
+                            double, 4, NDARRAY_AVX2_PD_TO_EPI32)
+
+#undef NDARRAY_AVX2_PD_TO_PS
+#undef NDARRAY_AVX2_PS_TO_PD
+#undef NDARRAY_AVX2_EPI32_TO_PS
+#undef NDARRAY_AVX2_PS_TO_EPI32
+#undef NDARRAY_AVX2_EPI32_TO_PD
+#undef NDARRAY_AVX2_PD_TO_EPI32
+#undef NDARRAY_AVX2_LOAD_I32
+#undef NDARRAY_AVX2_STORE_I32
+#undef NDARRAY_TARGET_AVX2
+
+// The masked forms are used, as the unmasked ones warn of an uninitialized
+// value in the headers of GCC
+#define NDARRAY_TARGET_AVX512 __attribute__((target("avx512f")))
+#define NDARRAY_AVX512_PD_TO_PS(a, b) \
+  _mm256_storeu_ps(a, _mm512_maskz_cvtpd_ps(0xFF, _mm512_loadu_pd(b)))
+#define NDARRAY_AVX512_PS_TO_PD(a, b) \
+  _mm512_storeu_pd(a, _mm512_maskz_cvtps_pd(0xFF, _mm256_loadu_ps(b)))
+#define NDARRAY_AVX512_EPI32_TO_PS(a, b) \
+  _mm512_storeu_ps(a, _mm512_maskz_cvtepi32_ps(0xFFFF, _mm512_loadu_si512(b)))
+#define NDARRAY_AVX512_PS_TO_EPI32(a, b) \
+  _mm512_storeu_si512(a, _mm512_maskz_cvttps_epi32(0xFFFF, _mm512_loadu_ps(b)))
+#define NDARRAY_AVX512_EPI32_TO_PD(a, b)                    \
+  _mm512_storeu_pd(                                         \
+      a, _mm512_maskz_cvtepi32_pd(                          \
+             0xFF, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b))))
+#define NDARRAY_AVX512_PD_TO_EPI32(a, b)                 \
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(a),     \
+                      _mm512_maskz_cvttpd_epi32(0xFF, _mm512_loadu_pd(b)))
+
+NDARRAY_SIMD_CONVERT_KERNEL(avx512_convert, NDARRAY_TARGET_AVX512, float,
+                            double, 8, NDARRAY_AVX512_PD_TO_PS)
+NDARRAY_SIMD_CONVERT_KERNEL(avx512_convert, NDARRAY_TARGET_AVX512, double,
+                            float, 8, NDARRAY_AVX512_PS_TO_PD)
+NDARRAY_SIMD_CONVERT_KERNEL(avx512_convert, NDARRAY_TARGET_AVX512, float,
+                            int32_t, 16, NDARRAY_AVX512_EPI32_TO_PS)
+NDARRAY_SIMD_CONVERT_KERNEL(avx512_convert, NDARRAY_TARGET_AVX512, int32_t,
+                            float, 16, NDARRAY_AVX512_PS_TO_EPI32)
+NDARRAY_SIMD_CONVERT_KERNEL(avx512_convert, NDARRAY_TARGET_AVX512, double,
+                            int32_t, 8, NDARRAY_AVX512_EPI32_TO_PD)
+NDARRAY_SIMD_CONVERT_KERNEL(avx512_convert, NDARRAY_TARGET_AVX512, int32_t,
+                            double, 8, NDARRAY_AVX512_PD_TO_EPI32)
+
+#undef NDARRAY_AVX512_PD_TO_PS
+#undef NDARRAY_AVX512_PS_TO_PD
+#undef NDARRAY_AVX512_EPI32_TO_PS
+#undef NDARRAY_AVX512_PS_TO_EPI32
+#undef NDARRAY_AVX512_EPI32_TO_PD
+#undef NDARRAY_AVX512_PD_TO_EPI32
+#undef NDARRAY_TARGET_AVX512
+
+#define NDARRAY_SIMD_CONVERT_DISPATCH(T, C)        \
+  inline void convert(T* a, const C* b, size_t n) { \
+    switch (simd_level()) {                        \
+      case SIMDLevel::AVX512:                      \
+        avx512_convert(a, b, n);                   \
+        return;                                    \
+      case SIMDLevel::AVX2:                        \
+        avx2_convert(a, b, n);                     \
+        return;                                    \
+      default:                                     \
+        convert<T, C>(a, b, n);                    \
+        return;                                    \
+    }                                              \
+  }
+
+#elif defined(NDARRAY_SIMD_NEON)
+#define NDARRAY_TARGET_NEON
+#define NDARRAY_NEON_F64_TO_F32(a, b) vst1_f32(a, vcvt_f32_f64(vld1q_f64(b)))
+#define NDARRAY_NEON_F32_TO_F64(a, b) vst1q_f64(a, vcvt_f64_f32(vld1_f32(b)))
+#define NDARRAY_NEON_S32_TO_F32(a, b) vst1q_f32(a, vcvtq_f32_s32(vld1q_s32(b)))
+#define NDARRAY_NEON_F32_TO_S32(a, b) vst1q_s32(a, vcvtq_s32_f32(vld1q_f32(b)))
+#define NDARRAY_NEON_S32_TO_F64(a, b) \
+  vst1q_f64(a, vcvtq_f64_s64(vmovl_s32(vld1_s32(b))))
+#define NDARRAY_NEON_F64_TO_S32(a, b) \
+  vst1_s32(a, vmovn_s64(vcvtq_s64_f64(vld1q_f64(b))))
+
+NDARRAY_SIMD_CONVERT_KERNEL(neon_convert, NDARRAY_TARGET_NEON, float, double,
+                            2, NDARRAY_NEON_F64_TO_F32)
+NDARRAY_SIMD_CONVERT_KERNEL(neon_convert, NDARRAY_TARGET_NEON, double, float,
+                            2, NDARRAY_NEON_F32_TO_F64)
+NDARRAY_SIMD_CONVERT_KERNEL(neon_convert, NDARRAY_TARGET_NEON, float, int32_t,
+                            4, NDARRAY_NEON_S32_TO_F32)
+NDARRAY_SIMD_CONVERT_KERNEL(neon_convert, NDARRAY_TARGET_NEON, int32_t, float,
+                            4, NDARRAY_NEON_F32_TO_S32)
+NDARRAY_SIMD_CONVERT_KERNEL(neon_convert, NDARRAY_TARGET_NEON, double,
+                            int32_t, 2, NDARRAY_NEON_S32_TO_F64)
+NDARRAY_SIMD_CONVERT_KERNEL(neon_convert, NDARRAY_TARGET_NEON, int32_t,
+                            double, 2, NDARRAY_NEON_F64_TO_S32)
+
+#undef NDARRAY_NEON_F64_TO_F32
+#undef NDARRAY_NEON_F32_TO_F64
+#undef NDARRAY_NEON_S32_TO_F32
+#undef NDARRAY_NEON_F32_TO_S32
+#undef NDARRAY_NEON_S32_TO_F64
+#undef NDARRAY_NEON_F64_TO_S32
+#undef NDARRAY_TARGET_NEON
+
+#define NDARRAY_SIMD_CONVERT_DISPATCH(T, C)        \
+  inline void convert(T* a, const C* b, size_t n) { \
+    neon_convert(a, b, n);                         \
+  }
+#endif
+
+#if defined(NDARRAY_SIMD_CONVERT_DISPATCH)
+NDARRAY_SIMD_CONVERT_DISPATCH(float, double)
+NDARRAY_SIMD_CONVERT_DISPATCH(double, float)
+NDARRAY_SIMD_CONVERT_DISPATCH(float, int32_t)
+NDARRAY_SIMD_CONVERT_DISPATCH(int32_t, float)
+NDARRAY_SIMD_CONVERT_DISPATCH(double, int32_t)
+NDARRAY_SIMD_CONVERT_DISPATCH(int32_t, double)
+#undef NDARRAY_SIMD_CONVERT_DISPATCH
+#endif
+
+#undef NDARRAY_SIMD_CONVERT_KERNEL
+
+// Saturating conversion of a single value to the integer type T
+template <class C>
+bool is_negative(C value, std::true_type) {
+  return value < 0;
+}
+
+template <class C>
+bool is_negative(C, std::false_type) {
+  return false;
+}
+
+template <class T, class C>
+T saturate_integer(C value, std::true_type) {
+  typedef std::numeric_limits<T> limits;
+  // Both integers are compared in the widest integer with their sign
+  if (is_negative(value, std::is_signed<C>())) {
+    if (static_cast<intmax_t>(value) < static_cast<intmax_t>(limits::min())) {
+      return limits::min();
+    }
+  } else if (static_cast<uintmax_t>(value) >
+             static_cast<uintmax_t>(limits::max())) {
+    return limits::max();
+  }
+  return static_cast<T>(value);
+}
+
+template <class T, class C>
+T saturate_integer(C value, std::false_type) {
+  typedef std::numeric_limits<T> limits;
+  // Floating point types with a class, like Float16, are compared as floats
+  typedef typename std::conditional<std::is_floating_point<C>::value, C,
+                                    float>::type F;
+  const F x = value;
+  if (x != x) return 0;
+  if (x <= static_cast<F>(limits::min())) return limits::min();
+  if (x >= static_cast<F>(limits::max())) return limits::max();
+  return static_cast<T>(x);
+}
+
+template <class T, class C>
+void saturate(T* a, const C* b, size_t n, std::true_type) {
+  for (size_t i = 0; i < n; i++) {
+    a[i] = saturate_integer<T>(b[i], std::is_integral<C>());
+  }
+}
+
+// Types other than integers saturate with their usual conversion
+template <class T, class C>
+void saturate(T* a, const C* b, size_t n, std::false_type) {
+  convert(a, b, n);
+}
+
+//==============================================================================
+// 16 Bit Float Conversion Kernels
+//
+// Convert arrays of Float16 and BFloat16 to and from float. On x86 the half
+// precision kernels use the F16C and AVX-512 conversion instructions, and the
+// bfloat16 kernels round with AVX2 integer arithmetic. The results are the
+// same as the scalar conversions.
+inline void scalar_half_to_float(float* a, const Float16* b, size_t n) {
+  for (size_t i = 0; i < n; i++) a[i] = half_bits_to_float(b[i].bits());
+}
+
+inline void scalar_float_to_half(Float16* a, const float* b, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    a[i] = Float16::from_bits(float_to_half_bits(b[i]));
+  }
+}
+
+inline void scalar_bfloat16_to_float(float* a, const BFloat16* b, size_t n) {
+  for (size_t i = 0; i < n; i++) a[i] = bfloat16_bits_to_float(b[i].bits());
+}
+
+inline void scalar_float_to_bfloat16(BFloat16* a, const float* b, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    a[i] = BFloat16::from_bits(float_to_bfloat16_bits(b[i]));
+  }
+}
+
+#if defined(NDARRAY_SIMD_X86)
+// F16C is not implied by the AVX2 kernels, though every AVX2 CPU has it
+inline bool cpu_has_f16c() {
+  static const bool has_f16c =
+      (__builtin_cpu_init(), __builtin_cpu_supports("f16c") != 0);
+  return has_f16c;
+}
+
+__attribute__((target("avx2,f16c"))) inline void avx2_half_to_float(
+    float* a, const Float16* b, size_t n) {
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+    _mm256_storeu_ps(a + i, _mm256_cvtph_ps(v));
+  }
+  scalar_half_to_float(a + i, b + i, n - i);
+}
+
+__attribute__((target("avx2,f16c"))) inline void avx2_float_to_half(
+    Float16* a, const float* b, size_t n) {
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m128i v =
+        _mm256_cvtps_ph(_mm256_loadu_ps(b + i), _MM_FROUND_TO_NEAREST_INT);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(a + i), v);
+  }
+  scalar_float_to_half(a + i, b + i, n - i);
+}
+
+__attribute__((target("avx512f"))) inline void avx512_half_to_float(
+    float* a, const Float16* b, size_t n) {
+  // The unmasked conversions warn of an uninitialized value in GCC's headers
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+    _mm512_storeu_ps(a + i, _mm512_maskz_cvtph_ps(0xFFFF, v));
+  }
+  scalar_half_to_float(a + i, b + i, n - i);
+}
+
+__attribute__((target("avx512f"))) inline void avx512_float_to_half(
+    Float16* a, const float* b, size_t n) {
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m256i v = _mm512_maskz_cvtps_ph(0xFFFF, _mm512_loadu_ps(b + i),
+                                      _MM_FROUND_TO_NEAREST_INT);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(a + i), v);
+  }
+  scalar_float_to_half(a + i, b + i, n - i);
+}
+
+__attribute__((target("avx2"))) inline void avx2_bfloat16_to_float(
+    float* a, const BFloat16* b, size_t n) {
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+    __m256i x = _mm256_slli_epi32(_mm256_cvtepu16_epi32(v), 16);
+    _mm256_storeu_ps(a + i, _mm256_castsi256_ps(x));
+  }
+  scalar_bfloat16_to_float(a + i, b + i, n - i);
+}
+
+__attribute__((target("avx2"))) inline void avx2_float_to_bfloat16(
+    BFloat16* a, const float* b, size_t n) {
+  const __m256i bias = _mm256_set1_epi32(0x7FFF);
+  const __m256i one = _mm256_set1_epi32(1);
+  const __m256i quiet = _mm256_set1_epi32(0x00400000);
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256 f = _mm256_loadu_ps(b + i);
+    __m256i x = _mm256_castps_si256(f);
+    __m256i lsb = _mm256_and_si256(_mm256_srli_epi32(x, 16), one);
+    __m256i rounded = _mm256_add_epi32(x, _mm256_add_epi32(bias, lsb));
+    __m256i nan = _mm256_castps_si256(_mm256_cmp_ps(f, f, _CMP_UNORD_Q));
+    rounded = _mm256_blendv_epi8(rounded, _mm256_or_si256(x, quiet), nan);
+    rounded = _mm256_srli_epi32(rounded, 16);
+    // Packing works within each 128 bit lane, so the halves are gathered
+    __m256i packed = _mm256_packus_epi32(rounded, rounded);
+    packed = _mm256_permute4x64_epi64(packed, 0x08);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(a + i),
+                     _mm256_castsi256_si128(packed));
+  }
+  scalar_float_to_bfloat16(a + i, b + i, n - i);
+}
+#elif defined(NDARRAY_SIMD_NEON)
+inline void neon_half_to_float(float* a, const Float16* b, size_t n) {
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    uint16x4_t v = vld1_u16(reinterpret_cast<const uint16_t*>(b + i));
+    vst1q_f32(a + i, vcvt_f32_f16(vreinterpret_f16_u16(v)));
+  }
+  scalar_half_to_float(a + i, b + i, n - i);
+}
+
+inline void neon_float_to_half(Float16* a, const float* b, size_t n) {
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    float16x4_t v = vcvt_f16_f32(vld1q_f32(b + i));
+    vst1_u16(reinterpret_cast<uint16_t*>(a + i), vreinterpret_u16_f16(v));
+  }
+  scalar_float_to_half(a + i, b + i, n - i);
+}
+
+inline void neon_bfloat16_to_float(float* a, const BFloat16* b, size_t n) {
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    uint16x4_t v = vld1_u16(reinterpret_cast<const uint16_t*>(b + i));
+    vst1q_f32(a + i, vreinterpretq_f32_u32(vshll_n_u16(v, 16)));
+  }
+  scalar_bfloat16_to_float(a + i, b + i, n - i);
+}
+
+inline void neon_float_to_bfloat16(BFloat16* a, const float* b, size_t n) {
+  const uint32x4_t bias = vdupq_n_u32(0x7FFF);
+  const uint32x4_t one = vdupq_n_u32(1);
+  const uint32x4_t quiet = vdupq_n_u32(0x00400000);
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    float32x4_t f = vld1q_f32(b + i);
+    uint32x4_t x = vreinterpretq_u32_f32(f);
+    uint32x4_t lsb = vandq_u32(vshrq_n_u32(x, 16), one);
+    uint32x4_t rounded = vaddq_u32(x, vaddq_u32(bias, lsb));
+    uint32x4_t nan = vmvnq_u32(vceqq_f32(f, f));
+    rounded = vbslq_u32(nan, vorrq_u32(x, quiet), rounded);
+    vst1_u16(reinterpret_cast<uint16_t*>(a + i), vshrn_n_u32(rounded, 16));
+  }
+  scalar_float_to_bfloat16(a + i, b + i, n - i);
+}
+#endif
+
+inline void convert(float* a, const Float16* b, size_t n) {
+#if defined(NDARRAY_SIMD_X86)
+  switch (simd_level()) {
+    case SIMDLevel::AVX512:
+      avx512_half_to_float(a, b, n);
+      return;
+    case SIMDLevel::AVX2:
+      if (cpu_has_f16c()) {
+        avx2_half_to_float(a, b, n);
+        return;
+      }
+      break;
+    default:
+      break;
+  }
+#elif defined(NDARRAY_SIMD_NEON)
+  neon_half_to_float(a, b, n);
+  return;
+#endif
+  scalar_half_to_float(a, b, n);
+}
+
+inline void convert(Float16* a, const float* b, size_t n) {
+#if defined(NDARRAY_SIMD_X86)
+  switch (simd_level()) {
+    case SIMDLevel::AVX512:
+      avx512_float_to_half(a, b, n);
+      return;
+    case SIMDLevel::AVX2:
+      if (cpu_has_f16c()) {
+        avx2_float_to_half(a, b, n);
+        return;
+      }
+      break;
+    default:
+      break;
+  }
+#elif defined(NDARRAY_SIMD_NEON)
+  neon_float_to_half(a, b, n);
+  return;
+#endif
+  scalar_float_to_half(a, b, n);
+}
+
+inline void convert(float* a, const BFloat16* b, size_t n) {
+#if defined(NDARRAY_SIMD_X86)
+  if (simd_level() != SIMDLevel::Scalar) {
+    avx2_bfloat16_to_float(a, b, n);
+    return;
+  }
+#elif defined(NDARRAY_SIMD_NEON)
+  neon_bfloat16_to_float(a, b, n);
+  return;
+#endif
+  scalar_bfloat16_to_float(a, b, n);
+}
+
+inline void convert(BFloat16* a, const float* b, size_t n) {
+#if defined(NDARRAY_SIMD_X86)
+  if (simd_level() != SIMDLevel::Scalar) {
+    avx2_float_to_bfloat16(a, b, n);
+    return;
+  }
+#elif defined(NDARRAY_SIMD_NEON)
+  neon_float_to_bfloat16(a, b, n);
+  return;
+#endif
+  scalar_float_to_bfloat16(a, b, n);
+}
+
+}  // namespace ndarray_detail
+
+//==============================================================================
+// Parallel Execution
+//
+// Elementwise operations (compound assignment, fill and type conversion) and
+// reductions run serially by default. When the execution policy is set to
+// Parallel, those on at least parallel_threshold() elements are split among
+// the threads of a pool owned by the library. Each thread is given one
+// contiguous chunk of the array, made of whole pages, and a given thread
+// always receives the same chunk of an array of a given size. An array first
+// filled in parallel therefore has its pages placed on the NUMA node of the
+// thread which later processes them. Operations started from within a
+// parallel operation, or while the pool is busy with another one, run
+// serially.
+
+// Policies for the execution of elementwise operations and reductions.
+enum class ExecutionPolicy { Serial, Parallel };
+
+// Sets the execution policy, which applies to all threads.
+void set_execution_policy(ExecutionPolicy policy);
+
+// Returns the current execution policy.
+ExecutionPolicy execution_policy();
+
+// Sets the minimum number of elements for an operation to run in parallel.
+void set_parallel_threshold(size_t n_elements);
+
+// Returns the minimum number of elements for an operation to run in parallel.
+size_t parallel_threshold();
+
+// Sets the number of threads used for parallel operations, including the
+// calling thread. A value of zero selects the number of hardware threads.
+// Throws if called from within a parallel operation.
+void set_num_threads(size_t n_threads);
+
+// Returns the number of threads used for parallel operations.
+size_t num_threads();
+
+namespace ndarray_detail {
+
+// Pool of worker threads, which all run the same task when started
+class ThreadPool {
+ public:
+  ThreadPool(size_t n_threads);
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  // Returns the number of threads, including the calling thread
+  size_t size() const;
+
+  // Replaces the workers with n_threads - 1 new ones. Throws if called from
+  // a parallel task.
+  void resize(size_t n_threads);
+
+  // Calls task(t, n) for every thread t in [0, n), where n is the number of
+  // threads of the pool while it runs the task and the calling thread is
+  // thread 0, and returns once all calls have finished. The first exception
+  // thrown by a call is rethrown. Returns false without calling task if the
+  // pool is already running a task.
+  bool run(const std::function<void(size_t, size_t)>& task);
+
+ private:
+  std::vector<std::thread> workers_;
+  std::mutex run_mutex_;
+  std::mutex mutex_;
+  std::condition_variable start_;
+  std::condition_variable done_;
+  const std::function<void(size_t, size_t)>* task_;
+  size_t task_threads_;
+  std::exception_ptr error_;
+  std::atomic<size_t> size_;
+  size_t generation_;
+  size_t pending_;
+  bool stop_;
+
+  void start_workers(size_t n_threads);
+  void stop_workers();
+  void work(size_t thread, size_t generation);
+};
+
+// Global settings of parallel execution
+struct ParallelSettings {
+  std::atomic<ExecutionPolicy> policy;
+  std::atomic<size_t> threshold;
+};
+
+ParallelSettings& parallel_settings();
+
+// Returns the thread pool, which is created on first use
+ThreadPool& thread_pool();
+
+// Returns true on a thread which is running part of a parallel operation
+bool& in_parallel_region();
+
+// Thread which runs file input and output in the background. Tasks run one
+// at a time, in the order they are submitted, and any remaining tasks are
+// finished before the thread is destroyed.
+class IOThread {
+ public:
+  IOThread();
+  ~IOThread();
+
+  IOThread(const IOThread&) = delete;
+  IOThread& operator=(const IOThread&) = delete;
+
+  // Queues task, returning a future for its result
+  template <class R>
+  std::future<R> submit(std::function<R()> task);
+
+ private:
+  std::thread thread_;
+  std::mutex mutex_;
+  std::condition_variable ready_;
+  std::deque<std::function<void()>> tasks_;
+  bool stop_;
+
+  void work();
+};
+
+// Returns the I/O thread, which is created on first use
+IOThread& io_thread();
+
+// Calls f(begin, count) on chunks covering n items, where every chunk
+// but the last is a multiple of grain items. The chunks are processed in
+// parallel according to the execution policy, if the operation touches at
+// least parallel_threshold() elements in total, and otherwise f(0, n) is
+// called once on the calling thread.
+template <class F>
+void parallel_chunks(size_t n, size_t grain, size_t n_elements, F f);
+
+// Calls parallel_chunks for an elementwise operation on n elements, which
+// are element_size bytes, with chunks of whole pages.
+template <class F>
+void parallel_for(size_t n, size_t element_size, F f);
+
+// Calls f(i) for every i in [0, n), for tasks of uneven size which touch
+// n_elements in total. Each thread takes the next task once it finishes
+// its last, subject to the same conditions as parallel_chunks.
+template <class F>
+void parallel_tasks(size_t n, size_t n_elements, F f);
+
+}  // namespace ndarray_detail
+
+//==============================================================================
+// Parallel Execution Implementation
+namespace ndarray_detail {
+
+inline ThreadPool::ThreadPool(size_t n_threads)
+    : workers_(),
+      run_mutex_(),
+      mutex_(),
+      start_(),
+      done_(),
+      task_(nullptr),
+      task_threads_(1),
+      error_(),
+      size_(1),
+      generation_(0),
+      pending_(0),
+      stop_(false) {
+  start_workers(n_threads);
+}
+
+inline ThreadPool::~ThreadPool() { stop_workers(); }
+
+inline size_t ThreadPool::size() const { return size_.load(); }
+
+inline void ThreadPool::resize(size_t n_threads) {
+  // The pool can not be resized while it runs the calling thread's task
+  if (in_parallel_region()) {
+    std::string mssg = "Number of threads can not be set in a parallel task.";
+    throw std::runtime_error(mssg);
+  }
+
+  std::lock_guard<std::mutex> run_lock(run_mutex_);
+  stop_workers();
+  start_workers(n_threads);
+}
+
+inline bool ThreadPool::run(const std::function<void(size_t, size_t)>& task) {
+  std::unique_lock<std::mutex> run_lock(run_mutex_, std::try_to_lock);
+  if (!run_lock.owns_lock()) return false;
+
+  // The pool can not be resized until run_lock is released, so every thread
+  // is given the same number of threads
+  const size_t n_threads = workers_.size() + 1;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    task_ = &task;
+    task_threads_ = n_threads;
+    error_ = nullptr;
+    pending_ = workers_.size();
+    generation_++;
+  }
+  start_.notify_all();
+
+  // The calling thread does the first part of the work
+  in_parallel_region() = true;
+  try {
+    task(0, n_threads);
+  } catch (...) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!error_) error_ = std::current_exception();
+  }
+  in_parallel_region() = false;
+
+  std::exception_ptr error;
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_.wait(lock, [this] { return pending_ == 0; });
+    task_ = nullptr;
+    error = error_;
+    error_ = nullptr;
+  }
+
+  if (error) std::rethrow_exception(error);
+  return true;
+}
+
+inline void ThreadPool::start_workers(size_t n_threads) {
+  if (n_threads == 0) n_threads = std::thread::hardware_concurrency();
+  if (n_threads == 0) n_threads = 1;
+
+  // No task is running, so new workers only wait for the next generation
+  stop_ = false;
+  for (size_t t = 1; t < n_threads; t++) {
+    workers_.emplace_back(&ThreadPool::work, this, t, generation_);
+  }
+  size_.store(n_threads);
+}
+
+inline void ThreadPool::stop_workers() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  start_.notify_all();
+
+  for (size_t i = 0; i < workers_.size(); i++) {
+    workers_[i].join();
+  }
+  workers_.clear();
+  size_.store(1);
+}
+
+inline void ThreadPool::work(size_t thread, size_t generation) {
+  in_parallel_region() = true;
+
+  while (true) {
+    const std::function<void(size_t, size_t)>* task = nullptr;
+    size_t n_threads = 1;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      start_.wait(lock,
+                  [&] { return stop_ || generation_ != generation; });
+      if (stop_) return;
+      generation = generation_;
+      task = task_;
+      n_threads = task_threads_;
+    }
+
+    try {
+      (*task)(thread, n_threads);
+    } catch (...) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (!error_) error_ = std::current_exception();
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (--pending_ == 0) done_.notify_one();
+    }
+  }
+}
+
+inline ParallelSettings& parallel_settings() {
+  static ParallelSettings settings = {{ExecutionPolicy::Serial}, {65536}};
+  return settings;
+}
+
+inline ThreadPool& thread_pool() {
+  static ThreadPool pool(0);
+  return pool;
+}
+
+inline bool& in_parallel_region() {
+  static thread_local bool in_region = false;
+  return in_region;
+}
+
+inline IOThread::IOThread()
+    : thread_(), mutex_(), ready_(), tasks_(), stop_(false) {
+  thread_ = std::thread(&IOThread::work, this);
+}
+
+inline IOThread::~IOThread() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  ready_.notify_one();
+  thread_.join();
+}
+
+template <class R>
+std::future<R> IOThread::submit(std::function<R()> task) {
+  // packaged_task can only be moved, so it is shared with the queued call
+  auto packaged = std::make_shared<std::packaged_task<R()>>(std::move(task));
+  std::future<R> result = packaged->get_future();
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    tasks_.push_back([packaged]() { (*packaged)(); });
+  }
+  ready_.notify_one();
+
+  return result;
+}
+
+inline void IOThread::work() {
+  while (true) {
+    std::function<void()> task;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      ready_.wait(lock, [this]() { return stop_ || !tasks_.empty(); });
+      if (tasks_.empty()) return;
+      task = std::move(tasks_.front());
+      tasks_.pop_front();
+    }
+
+    // Exceptions are stored in the future by the packaged_task
+    task();
+  }
+}
+
+inline IOThread& io_thread() {
+  static IOThread thread;
+  return thread;
+}
+
+template <class F>
+void parallel_chunks(size_t n, size_t grain, size_t n_elements, F f) {
+  if (n == 0) return;
+
+  if (parallel_settings().policy.load() == ExecutionPolicy::Serial ||
+      n_elements < parallel_settings().threshold.load() ||
+      in_parallel_region()) {
+    f(0, n);
+    return;
+  }
+
+  ThreadPool& pool = thread_pool();
+  if (pool.size() < 2) {
+    f(0, n);
+    return;
+  }
+
+  // Chunks are sized from the number of threads which run the task, so that
+  // thread t always receives chunk t, even if the pool was resized since
+  // its size was last read
+  std::function<void(size_t, size_t)> task = [&](size_t thread,
+                                                 size_t n_threads) {
+    size_t chunk = (n + n_threads - 1) / n_threads;
+    chunk = ((chunk + grain - 1) / grain) * grain;
+    const size_t begin = thread * chunk;
+    if (begin >= n) return;
+    f(begin, std::min(chunk, n - begin));
+  };
+
+  if (!pool.run(task)) f(0, n);
+}
+
+template <class F>
+void parallel_for(size_t n, size_t element_size, F f) {
+  // Chunks are whole pages, so that no page is shared between threads
+  const size_t page = std::max<size_t>(1, 4096 / element_size);
+  parallel_chunks(n, page, n, f);
+}
+
+template <class F>
+void parallel_tasks(size_t n, size_t n_elements, F f) {
+  ThreadPool& pool = thread_pool();
+  if (parallel_settings().policy.load() == ExecutionPolicy::Serial ||
+      n_elements < parallel_settings().threshold.load() ||
+      in_parallel_region() || n < 2 || pool.size() < 2) {
+    for (size_t i = 0; i < n; i++) f(i);
+    return;
+  }
+
+  std::atomic<size_t> next(0);
+  std::function<void(size_t, size_t)> task = [&](size_t, size_t) {
+    for (size_t i = next++; i < n; i = next++) f(i);
+  };
+
+  if (!pool.run(task)) {
+    for (size_t i = 0; i < n; i++) f(i);
+  }
+}
+
+// Kernels whose elements are split among threads by parallel_for
+template <class T, class C>
+void parallel_array_add(T* a, const C* b, size_t n) {
+  parallel_for(n, sizeof(T),
+               [=](size_t i, size_t m) { array_add(a + i, b + i, m); });
+}
+
+template <class T, class C>
+void parallel_array_subtract(T* a, const C* b, size_t n) {
+  parallel_for(n, sizeof(T),
+               [=](size_t i, size_t m) { array_subtract(a + i, b + i, m); });
+}
+
+template <class T, class C>
+void parallel_array_multiply(T* a, const C* b, size_t n) {
+  parallel_for(n, sizeof(T),
+               [=](size_t i, size_t m) { array_multiply(a + i, b + i, m); });
+}
+
+template <class T, class C>
+void parallel_array_divide(T* a, const C* b, size_t n) {
+  parallel_for(n, sizeof(T),
+               [=](size_t i, size_t m) { array_divide(a + i, b + i, m); });
+}
+
+template <class T, class C>
+void parallel_constant_add(T* a, const C& c, size_t n) {
+  parallel_for(n, sizeof(T),
+               [=, &c](size_t i, size_t m) { constant_add(a + i, c, m); });
+}
+
+template <class T, class C>
+void parallel_constant_subtract(T* a, const C& c, size_t n) {
+  parallel_for(n, sizeof(T), [=, &c](size_t i, size_t m) {
+    constant_subtract(a + i, c, m);
+  });
+}
+
+template <class T, class C>
+void parallel_constant_multiply(T* a, const C& c, size_t n) {
+  parallel_for(n, sizeof(T), [=, &c](size_t i, size_t m) {
+    constant_multiply(a + i, c, m);
+  });
+}
+
+template <class T, class C>
+void parallel_constant_divide(T* a, const C& c, size_t n) {
+  parallel_for(n, sizeof(T),
+               [=, &c](size_t i, size_t m) { constant_divide(a + i, c, m); });
+}
+
+template <class T, class C>
+void parallel_fill(T* a, const C& val, size_t n) {
+  parallel_for(n, sizeof(T),
+               [=, &val](size_t i, size_t m) { fill(a + i, val, m); });
+}
+
+// Converts the n elements of b to the type of a
+template <class T, class C>
+void parallel_convert(T* a, const C* b, size_t n) {
+  parallel_for(n, sizeof(T),
+               [=](size_t i, size_t m) { convert(a + i, b + i, m); });
+}
+
+// Converts the n elements of b to the type of a, clamping them to the range
+// of a if it is an integer type
+template <class T, class C>
+void parallel_saturate(T* a, const C* b, size_t n) {
+  parallel_for(n, sizeof(T), [=](size_t i, size_t m) {
+    saturate(a + i, b + i, m, std::is_integral<T>());
+  });
+}
+
+// Whether the allocator A leaves elements constructed without arguments
+// uninitialized
+template <class A>
+struct default_initializes : std::false_type {};
+
+template <class T, size_t Alignment>
+struct default_initializes<AlignedAllocator<T, Alignment>> : std::true_type {};
+
+// Resizes v to n elements, where any new elements are value initialized
+// whichever allocator is used. They are zeroed in parallel, which also places
+// the pages near the threads which will later work on them.
+template <class T, class A>
+void resize_zeroed(std::vector<T, A>& v, size_t n) {
+  const size_t old_size = v.size();
+  v.resize(n);
+  if (default_initializes<A>::value && n > old_size) {
+    parallel_fill(v.data() + old_size, T(), n - old_size);
+  }
+}
+
+}  // namespace ndarray_detail
+
+inline void set_execution_policy(ExecutionPolicy policy) {
+  ndarray_detail::parallel_settings().policy.store(policy);
+}
+
+inline ExecutionPolicy execution_policy() {
+  return ndarray_detail::parallel_settings().policy.load();
+}
+
+inline void set_parallel_threshold(size_t n_elements) {
+  ndarray_detail::parallel_settings().threshold.store(n_elements);
+}
+
+inline size_t parallel_threshold() {
+  return ndarray_detail::parallel_settings().threshold.load();
+}
+
+inline void set_num_threads(size_t n_threads) {
+  ndarray_detail::thread_pool().resize(n_threads);
+}
+
+inline size_t num_threads() { return ndarray_detail::thread_pool().size(); }
+
+//==============================================================================
+// Instrumentation
+//
+// When NDARRAY_INSTRUMENT is defined, the library counts the bytes of .npy
+// headers and data it reads and writes (before any compression), the time
+// spent in load_npy, write_npy and byte swapping, the allocations made by
+// AlignedAllocator for arrays, and the deep copies of NDArray. The counters
+// are atomic, and are shared by all threads. Otherwise the counters are
+// compiled out, and always read as zero.
+
+// Snapshot of the counters of the library. Times are in nanoseconds.
+struct NDArrayStats {
+  uint64_t bytes_read;
+  uint64_t bytes_written;
+  uint64_t load_npy_calls;
+  uint64_t load_npy_ns;
+  uint64_t write_npy_calls;
+  uint64_t write_npy_ns;
+  uint64_t bytes_swapped;
+  uint64_t swap_bytes_ns;
+  uint64_t allocations;
+  uint64_t allocated_bytes;
+  uint64_t deep_copies;
+  uint64_t deep_copy_bytes;
+};
+
+// Callback which is given a snapshot of the counters
+typedef std::function<void(const NDArrayStats&)> NDArrayStatsCallback;
+
+// Returns the current value of the counters.
+NDArrayStats ndarray_stats();
+
+// Sets all of the counters to zero.
+void reset_ndarray_stats();
+
+// Sets the callback which is given the counters after every call to
+// load_npy or write_npy, the close of an NpyWriter, and every call to
+// report_ndarray_stats, replacing any previous one. An empty function removes
+// the callback. It is called on the thread which did the work, and is never
+// called unless NDARRAY_INSTRUMENT is defined.
+void set_ndarray_stats_callback(NDArrayStatsCallback callback);
+
+// Gives the counters to the callback, if one is set.
+void report_ndarray_stats();
+
+namespace ndarray_detail {
+
+// Counters of the library
+struct StatsCounters {
+  std::atomic<uint64_t> bytes_read;
+  std::atomic<uint64_t> bytes_written;
+  std::atomic<uint64_t> load_npy_calls;
+  std::atomic<uint64_t> load_npy_ns;
+  std::atomic<uint64_t> write_npy_calls;
+  std::atomic<uint64_t> write_npy_ns;
+  std::atomic<uint64_t> bytes_swapped;
+  std::atomic<uint64_t> swap_bytes_ns;
+  std::atomic<uint64_t> allocations;
+  std::atomic<uint64_t> allocated_bytes;
+  std::atomic<uint64_t> deep_copies;
+  std::atomic<uint64_t> deep_copy_bytes;
+};
+
+StatsCounters& stats_counters();
+
+// Adds the time from its construction to its destruction to a counter
+class StatsTimer {
+ public:
+  explicit StatsTimer(std::atomic<uint64_t>& counter)
+      : counter_(counter), start_(std::chrono::steady_clock::now()) {}
+  ~StatsTimer() {
+    const auto elapsed = std::chrono::steady_clock::now() - start_;
+    counter_.fetch_add(static_cast<uint64_t>(
+                           std::chrono::duration_cast<std::chrono::nanoseconds>(
+                               elapsed)
+                               .count()),
+                       std::memory_order_relaxed);
+  }
+
+  StatsTimer(const StatsTimer&) = delete;
+  StatsTimer& operator=(const StatsTimer&) = delete;
+
+ private:
+  std::atomic<uint64_t>& counter_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+}  // namespace ndarray_detail
+
+// Macros through which the library updates the counters, which expand to
+// nothing unless NDARRAY_INSTRUMENT is defined. NDARRAY_STATS_TIMER times the
+// rest of the enclosing scope.
+#if defined(NDARRAY_INSTRUMENT)
+#define NDARRAY_STATS_ADD(counter, n)                   \
+  ndarray_detail::stats_counters().counter.fetch_add(   \
+      static_cast<uint64_t>(n), std::memory_order_relaxed)
+#define NDARRAY_STATS_TIMER(counter)            \
+  ndarray_detail::StatsTimer ndarray_stats_timer_( \
+      ndarray_detail::stats_counters().counter)
+#define NDARRAY_STATS_REPORT() report_ndarray_stats()
+#else
+#define NDARRAY_STATS_ADD(counter, n) ((void)0)
+#define NDARRAY_STATS_TIMER(counter) ((void)0)
+#define NDARRAY_STATS_REPORT() ((void)0)
+#endif
+
+//==============================================================================
+// Instrumentation Implementation
+namespace ndarray_detail {
+
+inline StatsCounters& stats_counters() {
+  static StatsCounters counters = {{0}, {0}, {0}, {0}, {0}, {0},
+                                   {0}, {0}, {0}, {0}, {0}, {0}};
+  return counters;
+}
+
+// Callback of the counters, and the mutex which guards it
+struct StatsCallback {
+  std::mutex mutex;
+  NDArrayStatsCallback callback;
+};
+
+inline StatsCallback& stats_callback() {
+  static StatsCallback callback;
+  return callback;
+}
+
+}  // namespace ndarray_detail
+
+inline NDArrayStats ndarray_stats() {
+  const ndarray_detail::StatsCounters& c = ndarray_detail::stats_counters();
+  NDArrayStats stats;
+  stats.bytes_read = c.bytes_read.load(std::memory_order_relaxed);
+  stats.bytes_written = c.bytes_written.load(std::memory_order_relaxed);
+  stats.load_npy_calls = c.load_npy_calls.load(std::memory_order_relaxed);
+  stats.load_npy_ns = c.load_npy_ns.load(std::memory_order_relaxed);
+  stats.write_npy_calls = c.write_npy_calls.load(std::memory_order_relaxed);
+  stats.write_npy_ns = c.write_npy_ns.load(std::memory_order_relaxed);
+  stats.bytes_swapped = c.bytes_swapped.load(std::memory_order_relaxed);
+  stats.swap_bytes_ns = c.swap_bytes_ns.load(std::memory_order_relaxed);
+  stats.allocations = c.allocations.load(std::memory_order_relaxed);
+  stats.allocated_bytes = c.allocated_bytes.load(std::memory_order_relaxed);
+  stats.deep_copies = c.deep_copies.load(std::memory_order_relaxed);
+  stats.deep_copy_bytes = c.deep_copy_bytes.load(std::memory_order_relaxed);
+  return stats;
+}
+
+inline void reset_ndarray_stats() {
+  ndarray_detail::StatsCounters& c = ndarray_detail::stats_counters();
+  c.bytes_read.store(0, std::memory_order_relaxed);
+  c.bytes_written.store(0, std::memory_order_relaxed);
+  c.load_npy_calls.store(0, std::memory_order_relaxed);
+  c.load_npy_ns.store(0, std::memory_order_relaxed);
+  c.write_npy_calls.store(0, std::memory_order_relaxed);
+  c.write_npy_ns.store(0, std::memory_order_relaxed);
+  c.bytes_swapped.store(0, std::memory_order_relaxed);
+  c.swap_bytes_ns.store(0, std::memory_order_relaxed);
+  c.allocations.store(0, std::memory_order_relaxed);
+  c.allocated_bytes.store(0, std::memory_order_relaxed);
+  c.deep_copies.store(0, std::memory_order_relaxed);
+  c.deep_copy_bytes.store(0, std::memory_order_relaxed);
+}
+
+inline void set_ndarray_stats_callback(NDArrayStatsCallback callback) {
+  ndarray_detail::StatsCallback& s = ndarray_detail::stats_callback();
+  std::lock_guard<std::mutex> lock(s.mutex);
+  s.callback = std::move(callback);
+}
+
+inline void report_ndarray_stats() {
+#if defined(NDARRAY_INSTRUMENT)
+  // The callback is copied, so that it may itself replace the callback
+  NDArrayStatsCallback callback;
+  {
+    ndarray_detail::StatsCallback& s = ndarray_detail::stats_callback();
+    std::lock_guard<std::mutex> lock(s.mutex);
+    callback = s.callback;
+  }
+  if (callback) callback(ndarray_stats());
+#endif
+}
+
+//==============================================================================
+// Reduction Kernels
+//
+// Sums and products are computed by pairwise reduction of contiguous runs of
+// elements, and by Kahan summation when many strided rows are reduced
+// together. Results only depend on the shape and layout of the array, and
+// never on the number of threads.
+namespace ndarray_detail {
+
+// Number of elements in each block of a reduction over contiguous elements.
+// Blocks are reduced independently, possibly in parallel, and their results
+// are then combined in order.
+const size_t reduction_block = 4096;
+
+// Functions which combine two partial results of a reduction
+struct SumOp {
+  static const bool compensated = true;
+
+  template <class R>
+  static R combine(const R& a, const R& b) {
+    return a + b;
+  }
+};
+
+struct ProdOp {
+  static const bool compensated = false;
+
+  template <class R>
+  static R combine(const R& a, const R& b) {
+    return a * b;
+  }
+};
+
+// For comparisons, better(b, a) is true if b should replace a. NaN values
+// always replace other values, so that they are propagated.
+struct MinOp {
+  static const bool compensated = false;
+
+  template <class R>
+  static bool better(const R& b, const R& a) {
+    return b < a || (b != b && a == a);
+  }
+
+  template <class R>
+  static R combine(const R& a, const R& b) {
+    return better(b, a) ? b : a;
+  }
+};
+
+struct MaxOp {
+  static const bool compensated = false;
+
+  template <class R>
+  static bool better(const R& b, const R& a) {
+    return a < b || (b != b && a == a);
+  }
+
+  template <class R>
+  static R combine(const R& a, const R& b) {
+    return better(b, a) ? b : a;
+  }
+};
+
+// Returns |x|^2 as the real type R
+template <class R, class T>
+R squared_magnitude(const T& x) {
+  return R(x) * R(x);
+}
+
+template <class R, class T>
+R squared_magnitude(const std::complex<T>& x) {
+  return R(x.real()) * R(x.real()) + R(x.imag()) * R(x.imag());
+}
+
+// Transformations applied to every element x of row j before it is reduced
+template <class R>
+struct CastTo {
+  template <class T>
+  R operator()(const T& x, size_t) const {
+    return R(x);
+  }
+};
+
+template <class R>
+struct SquaredMagnitude {
+  template <class T>
+  R operator()(const T& x, size_t) const {
+    return squared_magnitude<R>(x);
+  }
+};
+
+// Reduces the n > 0 values f(p[0]), f(p[stride]), ... with OP. Runs of up to
+// 128 values are reduced into eight interleaved partial results, which the
+// compiler may keep in one vector register, and longer runs are split in
+// half.
+template <class OP, class R, class T, class F>
+R pairwise_reduce(const T* p, size_t n, size_t stride, const F& f) {
+  if (n < 8) {
+    R res = f(p[0]);
+    for (size_t i = 1; i < n; i++) {
+      res = OP::combine(res, R(f(p[i * stride])));
+    }
+    return res;
+  }
+
+  if (n <= 128) {
+    R r[8];
+    size_t i = 8;
+    if (stride == 1) {
+      for (size_t j = 0; j < 8; j++) r[j] = f(p[j]);
+      for (; i + 8 <= n; i += 8) {
+        for (size_t j = 0; j < 8; j++) {
+          r[j] = OP::combine(r[j], R(f(p[i + j])));
+        }
+      }
+    } else {
+      for (size_t j = 0; j < 8; j++) r[j] = f(p[j * stride]);
+      for (; i + 8 <= n; i += 8) {
+        for (size_t j = 0; j < 8; j++) {
+          r[j] = OP::combine(r[j], R(f(p[(i + j) * stride])));
+        }
+      }
+    }
+
+    R res = OP::combine(OP::combine(OP::combine(r[0], r[1]),
+                                    OP::combine(r[2], r[3])),
+                        OP::combine(OP::combine(r[4], r[5]),
+                                    OP::combine(r[6], r[7])));
+    for (; i < n; i++) {
+      res = OP::combine(res, R(f(p[i * stride])));
+    }
+    return res;
+  }
+
+  const size_t half = (n / 2) - (n / 2) % 8;
+  return OP::combine(
+      pairwise_reduce<OP, R>(p, half, stride, f),
+      pairwise_reduce<OP, R>(p + half * stride, n - half, stride, f));
+}
+
+// Reduces the n > 0 contiguous values f(p[i], 0) with OP, in blocks of
+// reduction_block elements
+template <class OP, class R, class T, class F>
+R blocked_reduce(const T* p, size_t n, const F& f) {
+  auto g = [&f](const T& x) -> R { return f(x, 0); };
+  if (n <= reduction_block) return pairwise_reduce<OP, R>(p, n, 1, g);
+
+  const size_t n_blocks = (n + reduction_block - 1) / reduction_block;
+  std::vector<R> partial(n_blocks);
+  parallel_chunks(n, reduction_block, n, [&](size_t begin, size_t count) {
+    for (size_t b = begin; b < begin + count; b += reduction_block) {
+      const size_t len = std::min(reduction_block, n - b);
+      partial[b / reduction_block] = pairwise_reduce<OP, R>(p + b, len, 1, g);
+    }
+  });
+
+  return pairwise_reduce<OP, R>(partial.data(), n_blocks, 1,
+                                [](const R& x) { return x; });
+}
+
+// Sets out[j] to the reduction with OP of the len > 0 values
+// f(p[offsets[j] + k * stride], j), for every row j. Each row is reduced
+// pairwise on its own, which suits rows of contiguous elements.
+template <class OP, class R, class T, class F>
+void reduce_rows(const T* p, const std::vector<size_t>& offsets, size_t len,
+                 size_t stride, const F& f, R* out) {
+  parallel_chunks(
+      offsets.size(), 1, offsets.size() * len, [&](size_t begin, size_t count) {
+        for (size_t j = begin; j < begin + count; j++) {
+          auto g = [&f, j](const T& x) -> R { return f(x, j); };
+          out[j] = pairwise_reduce<OP, R>(p + offsets[j], len, stride, g);
+        }
+      });
+}
+
+// Computes the same as reduce_rows, but advances a tile of rows together, so
+// that neighbouring rows are read from the same cache lines when the rows
+// themselves are strided. Sums use Kahan compensated summation.
+template <class OP, class R, class T, class F>
+void reduce_lanes(const T* p, const std::vector<size_t>& offsets, size_t len,
+                  size_t stride, const F& f, R* out) {
+  const size_t tile = 256;
+  parallel_chunks(
+      offsets.size(), tile, offsets.size() * len,
+      [&](size_t begin, size_t count) {
+        std::vector<R> error(tile);
+        for (size_t t0 = begin; t0 < begin + count; t0 += tile) {
+          const size_t t1 = std::min(t0 + tile, begin + count);
+          for (size_t j = t0; j < t1; j++) {
+            out[j] = f(p[offsets[j]], j);
+            error[j - t0] = R(0);
+          }
+
+          for (size_t k = 1; k < len; k++) {
+            const T* q = p + k * stride;
+            for (size_t j = t0; j < t1; j++) {
+              const R x = f(q[offsets[j]], j);
+              if (OP::compensated) {
+                const R y = x - error[j - t0];
+                const R s = out[j] + y;
+                error[j - t0] = (s - out[j]) - y;
+                out[j] = s;
+              } else {
+                out[j] = OP::combine(out[j], x);
+              }
+            }
+          }
+        }
+      });
+}
+
+// Position and value of the best element found by a search
+template <class T>
+struct ArgResult {
+  size_t index;
+  T value;
+};
+
+// Returns the first k in [0, n) for which p[k * stride] is the best value
+// according to OP, along with that value. n must not be zero.
+template <class OP, class T>
+ArgResult<T> arg_search(const T* p, size_t n, size_t stride) {
+  ArgResult<T> res = {0, p[0]};
+  for (size_t k = 1; k < n; k++) {
+    if (OP::better(p[k * stride], res.value)) {
+      res.index = k;
+      res.value = p[k * stride];
+    }
+  }
+  return res;
+}
+
+// Returns the index of the first best value of the n > 0 contiguous values
+// p[i], searching blocks of reduction_block elements in parallel
+template <class OP, class T>
+size_t blocked_arg_search(const T* p, size_t n) {
+  if (n <= reduction_block) return arg_search<OP>(p, n, 1).index;
+
+  const size_t n_blocks = (n + reduction_block - 1) / reduction_block;
+  std::vector<ArgResult<T>> partial(n_blocks);
+  parallel_chunks(n, reduction_block, n, [&](size_t begin, size_t count) {
+    for (size_t b = begin; b < begin + count; b += reduction_block) {
+      const size_t len = std::min(reduction_block, n - b);
+      ArgResult<T> res = arg_search<OP>(p + b, len, 1);
+      res.index += b;
+      partial[b / reduction_block] = res;
+    }
+  });
+
+  // Earlier blocks win ties, so the first best value is found
+  ArgResult<T> res = partial[0];
+  for (size_t i = 1; i < n_blocks; i++) {
+    if (OP::better(partial[i].value, res.value)) res = partial[i];
+  }
+  return res.index;
+}
+
+// Sets out[j] to the index k of the first best value of the len > 0 values
+// p[offsets[j] + k * stride], for every row j
+template <class OP, class T>
+void arg_search_rows(const T* p, const std::vector<size_t>& offsets,
+                     size_t len, size_t stride, size_t* out) {
+  parallel_chunks(
+      offsets.size(), 1, offsets.size() * len, [&](size_t begin, size_t count) {
+        for (size_t j = begin; j < begin + count; j++) {
+          out[j] = arg_search<OP>(p + offsets[j], len, stride).index;
+        }
+      });
+}
+
+// Computes the same as arg_search_rows, advancing a tile of rows together
+// like reduce_lanes
+template <class OP, class T>
+void arg_search_lanes(const T* p, const std::vector<size_t>& offsets,
+                      size_t len, size_t stride, size_t* out) {
+  const size_t tile = 256;
+  parallel_chunks(
+      offsets.size(), tile, offsets.size() * len,
+      [&](size_t begin, size_t count) {
+        std::vector<T> best(tile);
+        for (size_t t0 = begin; t0 < begin + count; t0 += tile) {
+          const size_t t1 = std::min(t0 + tile, begin + count);
+          for (size_t j = t0; j < t1; j++) {
+            out[j] = 0;
+            best[j - t0] = p[offsets[j]];
+          }
+
+          for (size_t k = 1; k < len; k++) {
+            const T* q = p + k * stride;
+            for (size_t j = t0; j < t1; j++) {
+              if (OP::better(q[offsets[j]], best[j - t0])) {
+                out[j] = k;
+                best[j - t0] = q[offsets[j]];
+              }
+            }
+          }
+        }
+      });
+}
+
+}  // namespace ndarray_detail
+
+//==============================================================================
+// Transpose Kernels
+//
+// Copy the elements of a strided array into a new layout, as for a transpose
+// or a change of storage order. Axes which are adjacent in both layouts are
+// merged first, so that most copies reduce to contiguous rows or to a 2D
+// transpose. A transpose is done in square tiles which fit in L1, so that
+// every cache line which is read or written is used in full, and each tile is
+// moved as blocks transposed in SIMD registers when the source has an axis of
+// unit stride.
+namespace ndarray_detail {
+
+// Side of the square tiles of a transpose, in elements
+const size_t transpose_tile_size = 32;
+
+// Writes a[i * a_stride + j] = b[j * b_stride + i] for the block of
+// block x block elements, which are all words of the same size.
+typedef void (*TransposeBlockKernel)(void* a, size_t a_stride, const void* b,
+                                     size_t b_stride);
+
+struct TransposeKernel {
+  TransposeBlockKernel kernel;
+  size_t block;
+};
+
+#if defined(NDARRAY_SIMD_X86)
+__attribute__((target("avx2"))) inline void avx2_transpose_8x8(
+    void* a, size_t a_stride, const void* b, size_t b_stride) {
+  float* pa = static_cast<float*>(a);
+  const float* pb = static_cast<const float*>(b);
+
+  __m256 r0 = _mm256_loadu_ps(pb);
+  __m256 r1 = _mm256_loadu_ps(pb + b_stride);
+  __m256 r2 = _mm256_loadu_ps(pb + 2 * b_stride);
+  __m256 r3 = _mm256_loadu_ps(pb + 3 * b_stride);
+  __m256 r4 = _mm256_loadu_ps(pb + 4 * b_stride);
+  __m256 r5 = _mm256_loadu_ps(pb + 5 * b_stride);
+  __m256 r6 = _mm256_loadu_ps(pb + 6 * b_stride);
+  __m256 r7 = _mm256_loadu_ps(pb + 7 * b_stride);
+
+  __m256 t0 = _mm256_unpacklo_ps(r0, r1);
+  __m256 t1 = _mm256_unpackhi_ps(r0, r1);
+  __m256 t2 = _mm256_unpacklo_ps(r2, r3);
+  __m256 t3 = _mm256_unpackhi_ps(r2, r3);
+  __m256 t4 = _mm256_unpacklo_ps(r4, r5);
+  __m256 t5 = _mm256_unpackhi_ps(r4, r5);
+  __m256 t6 = _mm256_unpacklo_ps(r6, r7);
+  __m256 t7 = _mm256_unpackhi_ps(r6, r7);
+
+  r0 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0));
+  r1 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+  r2 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0));
+  r3 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2));
+  r4 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(1, 0, 1, 0));
+  r5 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(3, 2, 3, 2));
+  r6 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(1, 0, 1, 0));
+  r7 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(3, 2, 3, 2));
+
+  _mm256_storeu_ps(pa, _mm256_permute2f128_ps(r0, r4, 0x20));
+  _mm256_storeu_ps(pa + a_stride, _mm256_permute2f128_ps(r1, r5, 0x20));
+  _mm256_storeu_ps(pa + 2 * a_stride, _mm256_permute2f128_ps(r2, r6, 0x20));
+  _mm256_storeu_ps(pa + 3 * a_stride, _mm256_permute2f128_ps(r3, r7, 0x20));
+  _mm256_storeu_ps(pa + 4 * a_stride, _mm256_permute2f128_ps(r0, r4, 0x31));
+  _mm256_storeu_ps(pa + 5 * a_stride, _mm256_permute2f128_ps(r1, r5, 0x31));
+  _mm256_storeu_ps(pa + 6 * a_stride, _mm256_permute2f128_ps(r2, r6, 0x31));
+  _mm256_storeu_ps(pa + 7 * a_stride, _mm256_permute2f128_ps(r3, r7, 0x31));
+}
+
+__attribute__((target("avx2"))) inline void avx2_transpose_4x4(
+    void* a, size_t a_stride, const void* b, size_t b_stride) {
+  double* pa = static_cast<double*>(a);
+  const double* pb = static_cast<const double*>(b);
+
+  __m256d r0 = _mm256_loadu_pd(pb);
+  __m256d r1 = _mm256_loadu_pd(pb + b_stride);
+  __m256d r2 = _mm256_loadu_pd(pb + 2 * b_stride);
+  __m256d r3 = _mm256_loadu_pd(pb + 3 * b_stride);
+
+  __m256d t0 = _mm256_unpacklo_pd(r0, r1);
+  __m256d t1 = _mm256_unpackhi_pd(r0, r1);
+  __m256d t2 = _mm256_unpacklo_pd(r2, r3);
+  __m256d t3 = _mm256_unpackhi_pd(r2, r3);
+
+  _mm256_storeu_pd(pa, _mm256_permute2f128_pd(t0, t2, 0x20));
+  _mm256_storeu_pd(pa + a_stride, _mm256_permute2f128_pd(t1, t3, 0x20));
+  _mm256_storeu_pd(pa + 2 * a_stride, _mm256_permute2f128_pd(t0, t2, 0x31));
+  _mm256_storeu_pd(pa + 3 * a_stride, _mm256_permute2f128_pd(t1, t3, 0x31));
+}
+#elif defined(NDARRAY_SIMD_NEON)
+inline void neon_transpose_4x4(void* a, size_t a_stride, const void* b,
+                               size_t b_stride) {
+  uint32_t* pa = static_cast<uint32_t*>(a);
+  const uint32_t* pb = static_cast<const uint32_t*>(b);
+
+  uint32x4x2_t p = vtrnq_u32(vld1q_u32(pb), vld1q_u32(pb + b_stride));
+  uint32x4x2_t q =
+      vtrnq_u32(vld1q_u32(pb + 2 * b_stride), vld1q_u32(pb + 3 * b_stride));
+
+  vst1q_u32(pa, vcombine_u32(vget_low_u32(p.val[0]), vget_low_u32(q.val[0])));
+  vst1q_u32(pa + a_stride,
+            vcombine_u32(vget_low_u32(p.val[1]), vget_low_u32(q.val[1])));
+  vst1q_u32(pa + 2 * a_stride,
+            vcombine_u32(vget_high_u32(p.val[0]), vget_high_u32(q.val[0])));
+  vst1q_u32(pa + 3 * a_stride,
+            vcombine_u32(vget_high_u32(p.val[1]), vget_high_u32(q.val[1])));
+}
+
+inline void neon_transpose_2x2(void* a, size_t a_stride, const void* b,
+                               size_t b_stride) {
+  uint64_t* pa = static_cast<uint64_t*>(a);
+  const uint64_t* pb = static_cast<const uint64_t*>(b);
+
+  uint64x2_t r0 = vld1q_u64(pb);
+  uint64x2_t r1 = vld1q_u64(pb + b_stride);
+  vst1q_u64(pa, vtrn1q_u64(r0, r1));
+  vst1q_u64(pa + a_stride, vtrn2q_u64(r0, r1));
+}
+#endif
+
+// Returns the block kernel for words of element_size bytes, which is null if
+// there is none.
+inline TransposeKernel transpose_kernel(size_t element_size) {
+  TransposeKernel none = {nullptr, 1};
+#if defined(NDARRAY_SIMD_X86)
+  if (simd_level() == SIMDLevel::Scalar) return none;
+  if (element_size == 4) {
+    TransposeKernel k = {&avx2_transpose_8x8, 8};
+    return k;
+  }
+  if (element_size == 8) {
+    TransposeKernel k = {&avx2_transpose_4x4, 4};
+    return k;
+  }
+#elif defined(NDARRAY_SIMD_NEON)
+  if (element_size == 4) {
+    TransposeKernel k = {&neon_transpose_4x4, 4};
+    return k;
+  }
+  if (element_size == 8) {
+    TransposeKernel k = {&neon_transpose_2x2, 2};
+    return k;
+  }
+#else
+  (void)element_size;
+#endif
+  return none;
+}
+
+// Writes a[i * a_stride + j] = b[i * b_row + j * b_col] for the tile of
+// rows x cols elements. Whole blocks are moved by the kernel, if b_row is 1.
+template <class T>
+void transpose_tile(T* a, size_t a_stride, const T* b, size_t b_row,
+                    size_t b_col, size_t rows, size_t cols,
+                    const TransposeKernel& k) {
+  size_t i = 0;
+  if (k.kernel && b_row == 1) {
+    for (; i + k.block <= rows; i += k.block) {
+      size_t j = 0;
+      for (; j + k.block <= cols; j += k.block) {
+        k.kernel(a + i * a_stride + j, a_stride, b + i + j * b_col, b_col);
+      }
+      for (size_t ii = i; ii < i + k.block; ii++) {
+        for (size_t jj = j; jj < cols; jj++) {
+          a[ii * a_stride + jj] = b[ii + jj * b_col];
+        }
+      }
+    }
+  }
+  for (; i < rows; i++) {
+    for (size_t j = 0; j < cols; j++) {
+      a[i * a_stride + j] = b[i * b_row + j * b_col];
+    }
+  }
+}
+
+// Odometer over some axes of an array, which tracks the offsets of the
+// current position in a destination and a source with different strides.
+class CopyOdometer {
+ public:
+  // Starts at the i'th position, counting in C order over the given axes
+  CopyOdometer(const std::vector<size_t>& axes,
+               const std::vector<size_t>& shape,
+               const std::vector<size_t>& a_strides,
+               const std::vector<size_t>& b_strides, size_t i)
+      : axes_(axes),
+        shape_(shape),
+        a_strides_(a_strides),
+        b_strides_(b_strides),
+        index_(axes.size(), 0),
+        a_offset_(0),
+        b_offset_(0) {
+    for (size_t m = axes_.size(); m-- > 0;) {
+      const size_t axis = axes_[m];
+      index_[m] = i % shape_[axis];
+      i /= shape_[axis];
+      a_offset_ += index_[m] * a_strides_[axis];
+      b_offset_ += index_[m] * b_strides_[axis];
+    }
+  }
+
+  size_t a_offset() const { return a_offset_; }
+  size_t b_offset() const { return b_offset_; }
+
+  void next() {
+    for (size_t m = axes_.size(); m-- > 0;) {
+      const size_t axis = axes_[m];
+      a_offset_ += a_strides_[axis];
+      b_offset_ += b_strides_[axis];
+      if (++index_[m] < shape_[axis]) return;
+      a_offset_ -= shape_[axis] * a_strides_[axis];
+      b_offset_ -= shape_[axis] * b_strides_[axis];
+      index_[m] = 0;
+    }
+  }
+
+ private:
+  const std::vector<size_t>& axes_;
+  const std::vector<size_t>& shape_;
+  const std::vector<size_t>& a_strides_;
+  const std::vector<size_t>& b_strides_;
+  std::vector<size_t> index_;
+  size_t a_offset_;
+  size_t b_offset_;
+};
+
+// Copies the elements of the array at b, with the given shape and strides
+// in elements, to a in C order. Rows along the last axis are copied
+// directly when it has the smallest stride in b, and the array is otherwise
+// transposed in tiles between the last axis and the axis of b with the
+// smallest stride. Rows or tiles are divided between threads.
+template <class T>
+void strided_copy(T* a, const T* b, const std::vector<size_t>& shape,
+                  const std::vector<size_t>& strides) {
+  // Axes of length one are dropped, and an axis is merged into the previous
+  // one when the two are contiguous in b (they always are in a)
+  std::vector<size_t> n, s;
+  size_t total = 1;
+  for (size_t i = 0; i < shape.size(); i++) {
+    total *= shape[i];
+    if (shape[i] == 1) continue;
+    if (!n.empty() && s.back() == strides[i] * shape[i]) {
+      n.back() *= shape[i];
+      s.back() = strides[i];
+    } else {
+      n.push_back(shape[i]);
+      s.push_back(strides[i]);
+    }
+  }
+  if (total == 0) return;
+  if (n.empty()) {
+    a[0] = b[0];
+    return;
+  }
+
+  const size_t d = n.size();
+  std::vector<size_t> a_strides(d, 1);
+  for (size_t i = d - 1; i-- > 0;) a_strides[i] = a_strides[i + 1] * n[i + 1];
+
+  size_t k = d - 1;
+  for (size_t i = 0; i + 1 < d; i++) {
+    if (s[i] < s[k]) k = i;
+  }
+  const size_t cols = n[d - 1];
+  const size_t b_col = s[d - 1];
+
+  std::vector<size_t> outer;
+  for (size_t i = 0; i + 1 < d; i++) {
+    if (i != k) outer.push_back(i);
+  }
+
+  if (k == d - 1) {
+    parallel_chunks(total / cols, 1, total, [&](size_t begin, size_t count) {
+      CopyOdometer position(outer, n, a_strides, s, begin);
+      for (size_t r = 0; r < count; r++, position.next()) {
+        T* ap = a + position.a_offset();
+        const T* bp = b + position.b_offset();
+        if (b_col == 1) {
+          std::copy(bp, bp + cols, ap);
+        } else {
+          for (size_t j = 0; j < cols; j++) ap[j] = bp[j * b_col];
+        }
+      }
+    });
+    return;
+  }
+
+  TransposeKernel kernel = {nullptr, 1};
+  if (std::is_trivially_copyable<T>::value) {
+    kernel = transpose_kernel(sizeof(T));
+  }
+  const size_t rows = n[k];
+  const size_t a_stride = a_strides[k];
+  const size_t b_row = s[k];
+  const size_t row_tiles =
+      (rows + transpose_tile_size - 1) / transpose_tile_size;
+  const size_t n_tasks = (total / (rows * cols)) * row_tiles;
+
+  parallel_chunks(n_tasks, 1, total, [&](size_t begin, size_t count) {
+    CopyOdometer position(outer, n, a_strides, s, begin / row_tiles);
+    size_t tile = begin % row_tiles;
+    for (size_t t = 0; t < count; t++) {
+      const size_t i = tile * transpose_tile_size;
+      const size_t n_rows = std::min(transpose_tile_size, rows - i);
+      T* ap = a + position.a_offset() + i * a_stride;
+      const T* bp = b + position.b_offset() + i * b_row;
+      for (size_t j = 0; j < cols; j += transpose_tile_size) {
+        transpose_tile(ap + j, a_stride, bp + j * b_col, b_row, b_col, n_rows,
+                       std::min(transpose_tile_size, cols - j), kernel);
+      }
+
+      if (++tile == row_tiles) {
+        tile = 0;
+        position.next();
+      }
+    }
+  });
+}
+
+}  // namespace ndarray_detail
+
+//==============================================================================
+// Matrix Multiplication Kernels
+//
+// Add the product of two matrices, which may have any row and column strides,
+// to a matrix with rows of contiguous elements. Following Goto and van de
+// Geijn, blocks of A and panels of B are packed into contiguous buffers which
+// stay in the L2 and L3 caches, and each MR x NR tile of the product is
+// accumulated in registers by a micro-kernel. Blocks of rows of A are divided
+// between threads. With NDARRAY_USE_BLAS, matrices of float, double and
+// complex numbers are multiplied by the BLAS instead, provided each has an
+// axis of unit stride.
+namespace ndarray_detail {
+
+// Number of rows of A (gemm_mc), of the inner dimension (gemm_kc), and of
+// columns of B (gemm_nc) in each packed block, which are multiples of the
+// tile sizes of every micro-kernel.
+const size_t gemm_mc = 96;
+const size_t gemm_kc = 256;
+const size_t gemm_nc = 2048;
+
+// Micro-kernel which adds the product of the packed mr x kc block a and the
+// packed kc x nr block b to the tile at c, whose rows are ldc elements apart.
+template <class T>
+struct GemmKernel {
+  void (*kernel)(size_t kc, const T* a, const T* b, T* c, size_t ldc);
+  size_t mr;
+  size_t nr;
+};
+
+template <class T, size_t MR, size_t NR>
+void scalar_gemm_kernel(size_t kc, const T* a, const T* b, T* c, size_t ldc) {
+  T acc[MR][NR];
+  for (size_t i = 0; i < MR; i++) {
+    for (size_t j = 0; j < NR; j++) acc[i][j] = T(0);
+  }
+
+  for (size_t l = 0; l < kc; l++, a += MR, b += NR) {
+    for (size_t i = 0; i < MR; i++) {
+      const T ai = a[i];
+      for (size_t j = 0; j < NR; j++) acc[i][j] += ai * b[j];
+    }
+  }
+
+  for (size_t i = 0; i < MR; i++) {
+    for (size_t j = 0; j < NR; j++) c[i * ldc + j] += acc[i][j];
+  }
+}
+
+// Accumulates row I of a 6 x 2W tile, in the registers cI0 and cI1
+#define NDARRAY_GEMM_ROW(I, VEC, SET1, FMADD) \
+  {                                           \
+    const VEC ai = SET1(a[I]);                \
+    c##I##0 = FMADD(ai, b0, c##I##0);         \
+    c##I##1 = FMADD(ai, b1, c##I##1);         \
+  }
+
+// Adds row I of a 6 x 2W tile to the matrix at c
+#define NDARRAY_GEMM_STORE(I, W, LOAD, STORE, ADD)                          \
+  STORE(c + I * ldc, ADD(LOAD(c + I * ldc), c##I##0));                     \
+  STORE(c + I * ldc + W, ADD(LOAD(c + I * ldc + W), c##I##1));
+
+// Defines the micro-kernel NAME for a 6 x 2W tile of type T, held in twelve
+// vectors of W elements of type VEC. FMADD(a, b, c) returns a * b + c.
+#define NDARRAY_GEMM_KERNEL(NAME, TARGET, T, VEC, W, LOAD, STORE, SET1, FMADD, \
+                            ADD)                                              \
+  TARGET inline void NAME(size_t kc, const T* a, const T* b, T* c,            \
+                          size_t ldc) {                                       \
+    VEC c00 = SET1(T(0)), c01 = c00, c10 = c00, c11 = c00, c20 = c00,         \
+        c21 = c00, c30 = c00, c31 = c00, c40 = c00, c41 = c00, c50 = c00,     \
+        c51 = c00;                                                            \
+    for (size_t l = 0; l < kc; l++, a += 6, b += 2 * W) {                     \
+      const VEC b0 = LOAD(b);                                                 \
+      const VEC b1 = LOAD(b + W);                                             \
+      NDARRAY_GEMM_ROW(0, VEC, SET1, FMADD)                                   \
+      NDARRAY_GEMM_ROW(1, VEC, SET1, FMADD)                                   \
+      NDARRAY_GEMM_ROW(2, VEC, SET1, FMADD)                                   \
+      NDARRAY_GEMM_ROW(3, VEC, SET1, FMADD)                                   \
+      NDARRAY_GEMM_ROW(4, VEC, SET1, FMADD)                                   \
+      NDARRAY_GEMM_ROW(5, VEC, SET1, FMADD)                                   \
+    }                                                                         \
+    NDARRAY_GEMM_STORE(0, W, LOAD, STORE, ADD)                                \
+    NDARRAY_GEMM_STORE(1, W, LOAD, STORE, ADD)                                \
+    NDARRAY_GEMM_STORE(2, W, LOAD, STORE, ADD)                                \
+    NDARRAY_GEMM_STORE(3, W, LOAD, STORE, ADD)                                \
+    NDARRAY_GEMM_STORE(4, W, LOAD, STORE, ADD)                                \
+    NDARRAY_GEMM_STORE(5, W, LOAD, STORE, ADD)                                \
+  }
+
+#if defined(NDARRAY_SIMD_X86)
+inline bool cpu_has_fma() {
+  static const bool has_fma =
+      (__builtin_cpu_init(), __builtin_cpu_supports("fma") != 0);
+  return has_fma;
+}
+
+#define NDARRAY_TARGET_AVX2 __attribute__((target("avx2,fma")))
+NDARRAY_GEMM_KERNEL(avx2_gemm_kernel, NDARRAY_TARGET_AVX2, float, __m256, 8,
+                    _mm256_loadu_ps, _mm256_storeu_ps, _mm256_set1_ps,
+                    _mm256_fmadd_ps, _mm256_add_ps)
+NDARRAY_GEMM_KERNEL(avx2_gemm_kernel, NDARRAY_TARGET_AVX2, double, __m256d, 4,
+                    _mm256_loadu_pd, _mm256_storeu_pd, _mm256_set1_pd,
+                    _mm256_fmadd_pd, _mm256_add_pd)
+#undef NDARRAY_TARGET_AVX2
+
+#define NDARRAY_TARGET_AVX512 __attribute__((target("avx512f")))
+NDARRAY_GEMM_KERNEL(avx512_gemm_kernel, NDARRAY_TARGET_AVX512, float, __m512,
+                    16, _mm512_loadu_ps, _mm512_storeu_ps, _mm512_set1_ps,
+                    _mm512_fmadd_ps, _mm512_add_ps)
+NDARRAY_GEMM_KERNEL(avx512_gemm_kernel, NDARRAY_TARGET_AVX512, double,
+                    __m512d, 8, _mm512_loadu_pd, _mm512_storeu_pd,
+                    _mm512_set1_pd, _mm512_fmadd_pd, _mm512_add_pd)
+#undef NDARRAY_TARGET_AVX512
+#elif defined(NDARRAY_SIMD_NEON)
+inline float32x4_t neon_fmadd(float32x4_t a, float32x4_t b, float32x4_t c) {
+  return vfmaq_f32(c, a, b);
+}
+
+inline float64x2_t neon_fmadd(float64x2_t a, float64x2_t b, float64x2_t c) {
+  return vfmaq_f64(c, a, b);
+}
+
+#define NDARRAY_TARGET_NEON
+NDARRAY_GEMM_KERNEL(neon_gemm_kernel, NDARRAY_TARGET_NEON, float, float32x4_t,
+                    4, vld1q_f32, vst1q_f32, vdupq_n_f32, neon_fmadd,
+                    vaddq_f32)
+NDARRAY_GEMM_KERNEL(neon_gemm_kernel, NDARRAY_TARGET_NEON, double,
+                    float64x2_t, 2, vld1q_f64, vst1q_f64, vdupq_n_f64,
+                    neon_fmadd, vaddq_f64)
+#undef NDARRAY_TARGET_NEON
+#endif
+
+#undef NDARRAY_GEMM_KERNEL
+#undef NDARRAY_GEMM_STORE
+#undef NDARRAY_GEMM_ROW
+
+// Returns the micro-kernel for elements of type T
+template <class T>
+GemmKernel<T> gemm_kernel() {
+  GemmKernel<T> k = {&scalar_gemm_kernel<T, 4, 4>, 4, 4};
+  return k;
+}
+
+// Defines gemm_kernel for T, where the AVX2 kernel has tiles of 6 x NR
+// elements and the AVX-512 kernel tiles of 6 x 2NR
+#if defined(NDARRAY_SIMD_X86)
+#define NDARRAY_GEMM_DISPATCH(T, NR)                        \
+  template <>                                               \
+  inline GemmKernel<T> gemm_kernel<T>() {                   \
+    if (simd_level() == SIMDLevel::AVX512) {                \
+      GemmKernel<T> k = {&avx512_gemm_kernel, 6, 2 * NR};   \
+      return k;                                             \
+    }                                                       \
+    if (simd_level() == SIMDLevel::AVX2 && cpu_has_fma()) { \
+      GemmKernel<T> k = {&avx2_gemm_kernel, 6, NR};         \
+      return k;                                             \
+    }                                                       \
+    GemmKernel<T> k = {&scalar_gemm_kernel<T, 4, 4>, 4, 4}; \
+    return k;                                               \
+  }
+NDARRAY_GEMM_DISPATCH(float, 16)
+NDARRAY_GEMM_DISPATCH(double, 8)
+#undef NDARRAY_GEMM_DISPATCH
+#elif defined(NDARRAY_SIMD_NEON)
+template <>
+inline GemmKernel<float> gemm_kernel<float>() {
+  GemmKernel<float> k = {&neon_gemm_kernel, 6, 8};
+  return k;
+}
+
+template <>
+inline GemmKernel<double> gemm_kernel<double>() {
+  GemmKernel<double> k = {&neon_gemm_kernel, 6, 4};
+  return k;
+}
+#endif
+
+// Packs the mc x kc block of A at a, with row stride rs and column stride cs,
+// into panels of mr rows, where the mr elements of each column are adjacent.
+// The last panel is padded with zeros.
+template <class T>
+void pack_a(T* p, const T* a, size_t rs, size_t cs, size_t mc, size_t kc,
+            size_t mr) {
+  for (size_t i = 0; i < mc; i += mr) {
+    const size_t m = std::min(mr, mc - i);
+    for (size_t l = 0; l < kc; l++, p += mr) {
+      for (size_t r = 0; r < m; r++) p[r] = a[(i + r) * rs + l * cs];
+      for (size_t r = m; r < mr; r++) p[r] = T(0);
+    }
+  }
+}
+
+// Packs the kc x nc block of B at b into panels of nr columns, where the nr
+// elements of each row are adjacent. The last panel is padded with zeros.
+template <class T>
+void pack_b(T* p, const T* b, size_t rs, size_t cs, size_t kc, size_t nc,
+            size_t nr) {
+  for (size_t j = 0; j < nc; j += nr) {
+    const size_t n = std::min(nr, nc - j);
+    for (size_t l = 0; l < kc; l++, p += nr) {
+      for (size_t r = 0; r < n; r++) p[r] = b[l * rs + (j + r) * cs];
+      for (size_t r = n; r < nr; r++) p[r] = T(0);
+    }
+  }
+}
+
+// Adds the product of the m x k matrix at a and the k x n matrix at b, with
+// the given row and column strides, to the m x n matrix at c, whose rows are
+// ldc elements apart.
+template <class T>
+void builtin_gemm(size_t m, size_t n, size_t k, const T* a, size_t a_rs,
+                  size_t a_cs, const T* b, size_t b_rs, size_t b_cs, T* c,
+                  size_t ldc) {
+  const GemmKernel<T> kernel = gemm_kernel<T>();
+  const size_t mr = kernel.mr;
+  const size_t nr = kernel.nr;
+  const size_t m_blocks = (m + gemm_mc - 1) / gemm_mc;
+
+  std::vector<T, AlignedAllocator<T>> b_pack(
+      std::min(gemm_kc, k) * std::min(gemm_nc, (n + nr - 1) / nr * nr));
+
+  for (size_t jc = 0; jc < n; jc += gemm_nc) {
+    const size_t nc = std::min(gemm_nc, n - jc);
+    for (size_t pc = 0; pc < k; pc += gemm_kc) {
+      const size_t kc = std::min(gemm_kc, k - pc);
+      pack_b(b_pack.data(), b + pc * b_rs + jc * b_cs, b_rs, b_cs, kc, nc, nr);
+
+      parallel_chunks(
+          m_blocks, 1, m * nc * kc, [&](size_t begin, size_t count) {
+            std::vector<T, AlignedAllocator<T>> a_pack(gemm_mc * kc);
+            std::vector<T> tile(mr * nr);
+
+            for (size_t block = begin; block < begin + count; block++) {
+              const size_t ic = block * gemm_mc;
+              const size_t mc = std::min(gemm_mc, m - ic);
+              pack_a(a_pack.data(), a + ic * a_rs + pc * a_cs, a_rs, a_cs, mc,
+                     kc, mr);
+
+              for (size_t jr = 0; jr < nc; jr += nr) {
+                const size_t n_cols = std::min(nr, nc - jr);
+                for (size_t ir = 0; ir < mc; ir += mr) {
+                  const size_t n_rows = std::min(mr, mc - ir);
+                  const T* ap = a_pack.data() + ir * kc;
+                  const T* bp = b_pack.data() + jr * kc;
+                  T* cp = c + (ic + ir) * ldc + jc + jr;
+
+                  if (n_rows == mr && n_cols == nr) {
+                    kernel.kernel(kc, ap, bp, cp, ldc);
+                    continue;
+                  }
+
+                  // Edge tiles are accumulated in a buffer of a whole tile
+                  std::fill(tile.begin(), tile.end(), T(0));
+                  kernel.kernel(kc, ap, bp, tile.data(), nr);
+                  for (size_t i = 0; i < n_rows; i++) {
+                    for (size_t j = 0; j < n_cols; j++) {
+                      cp[i * ldc + j] += tile[i * nr + j];
+                    }
+                  }
+                }
+              }
+            }
+          });
+    }
+  }
+}
+
+#if defined(NDARRAY_USE_BLAS)
+// Types which are multiplied by the BLAS
+template <class T>
+struct is_blas_type : std::false_type {};
+template <>
+struct is_blas_type<float> : std::true_type {};
+template <>
+struct is_blas_type<double> : std::true_type {};
+template <>
+struct is_blas_type<std::complex<float>> : std::true_type {};
+template <>
+struct is_blas_type<std::complex<double>> : std::true_type {};
+
+// Finds the BLAS transpose flag and leading dimension of a rows x cols
+// matrix with the given strides, for a row-major call. Returns false if
+// neither axis has unit stride.
+inline bool blas_layout(size_t rows, size_t cols, size_t rs, size_t cs,
+                        CBLAS_TRANSPOSE& trans, size_t& ld) {
+  if ((cs == 1 || cols == 1) && (rows == 1 || rs >= cols)) {
+    trans = CblasNoTrans;
+    ld = rows == 1 ? cols : rs;
+    return true;
+  }
+  if ((rs == 1 || rows == 1) && (cols == 1 || cs >= rows)) {
+    trans = CblasTrans;
+    ld = cols == 1 ? rows : cs;
+    return true;
+  }
+  return false;
+}
+
+inline void blas_gemm_call(CBLAS_TRANSPOSE ta, CBLAS_TRANSPOSE tb, int m,
+                           int n, int k, const float* a, int lda,
+                           const float* b, int ldb, float* c, int ldc) {
+  cblas_sgemm(CblasRowMajor, ta, tb, m, n, k, 1.f, a, lda, b, ldb, 1.f, c,
+              ldc);
+}
+
+inline void blas_gemm_call(CBLAS_TRANSPOSE ta, CBLAS_TRANSPOSE tb, int m,
+                           int n, int k, const double* a, int lda,
+                           const double* b, int ldb, double* c, int ldc) {
+  cblas_dgemm(CblasRowMajor, ta, tb, m, n, k, 1., a, lda, b, ldb, 1., c, ldc);
+}
+
+inline void blas_gemm_call(CBLAS_TRANSPOSE ta, CBLAS_TRANSPOSE tb, int m,
+                           int n, int k, const std::complex<float>* a, int lda,
+                           const std::complex<float>* b, int ldb,
+                           std::complex<float>* c, int ldc) {
+  const std::complex<float> one(1.f);
+  cblas_cgemm(CblasRowMajor, ta, tb, m, n, k, &one, a, lda, b, ldb, &one, c,
+              ldc);
+}
+
+inline void blas_gemm_call(CBLAS_TRANSPOSE ta, CBLAS_TRANSPOSE tb, int m,
+                           int n, int k, const std::complex<double>* a,
+                           int lda, const std::complex<double>* b, int ldb,
+                           std::complex<double>* c, int ldc) {
+  const std::complex<double> one(1.);
+  cblas_zgemm(CblasRowMajor, ta, tb, m, n, k, &one, a, lda, b, ldb, &one, c,
+              ldc);
+}
+
+template <class T>
+bool blas_gemm(size_t m, size_t n, size_t k, const T* a, size_t a_rs,
+               size_t a_cs, const T* b, size_t b_rs, size_t b_cs, T* c,
+               size_t ldc, std::true_type) {
+  const size_t int_max = static_cast<size_t>(std::numeric_limits<int>::max());
+  CBLAS_TRANSPOSE ta, tb;
+  size_t lda, ldb;
+  if (m == 0 || n == 0 || k == 0 || !blas_layout(m, k, a_rs, a_cs, ta, lda) ||
+      !blas_layout(k, n, b_rs, b_cs, tb, ldb) ||
+      std::max(std::max(m, n), std::max(k, std::max(lda, ldb))) > int_max ||
+      ldc > int_max) {
+    return false;
+  }
+
+  blas_gemm_call(ta, tb, static_cast<int>(m), static_cast<int>(n),
+                 static_cast<int>(k), a, static_cast<int>(lda), b,
+                 static_cast<int>(ldb), c, static_cast<int>(ldc));
+  return true;
+}
+
+template <class T>
+bool blas_gemm(size_t, size_t, size_t, const T*, size_t, size_t, const T*,
+               size_t, size_t, T*, size_t, std::false_type) {
+  return false;
+}
+#endif
+
+// Adds the product of the m x k matrix at a and the k x n matrix at b to the
+// m x n matrix at c, with the BLAS if possible and otherwise builtin_gemm.
+template <class T>
+void gemm(size_t m, size_t n, size_t k, const T* a, size_t a_rs, size_t a_cs,
+          const T* b, size_t b_rs, size_t b_cs, T* c, size_t ldc) {
+#if defined(NDARRAY_USE_BLAS)
+  if (blas_gemm(m, n, k, a, a_rs, a_cs, b, b_rs, b_cs, c, ldc,
+                is_blas_type<T>())) {
+    return;
+  }
+#endif
+  builtin_gemm(m, n, k, a, a_rs, a_cs, b, b_rs, b_cs, c, ldc);
+}
+
+// Returns the sum of a[i * a_stride] * b[i * b_stride] for the n elements,
+// accumulated in eight independent partial sums for each block of
+// reduction_block elements.
+template <class T>
+T inner_product(const T* a, size_t a_stride, const T* b, size_t b_stride,
+                size_t n) {
+  const size_t n_blocks = (n + reduction_block - 1) / reduction_block;
+  std::vector<T> partial(n_blocks);
+  parallel_chunks(n, reduction_block, n, [&](size_t begin, size_t count) {
+    for (size_t c = begin; c < begin + count; c += reduction_block) {
+      const size_t len = std::min(reduction_block, n - c);
+      const T* p = a + c * a_stride;
+      const T* q = b + c * b_stride;
+
+      T acc[8];
+      for (size_t j = 0; j < 8; j++) acc[j] = T(0);
+      size_t i = 0;
+      for (; i + 8 <= len; i += 8) {
+        for (size_t j = 0; j < 8; j++) {
+          acc[j] += p[(i + j) * a_stride] * q[(i + j) * b_stride];
+        }
+      }
+      for (; i < len; i++) acc[i % 8] += p[i * a_stride] * q[i * b_stride];
+
+      partial[c / reduction_block] = ((acc[0] + acc[1]) + (acc[2] + acc[3])) +
+                                     ((acc[4] + acc[5]) + (acc[6] + acc[7]));
+    }
+  });
+
+  T sum = T(0);
+  for (size_t c = 0; c < n_blocks; c++) sum += partial[c];
+  return sum;
+}
+
+}  // namespace ndarray_detail
+
+//==============================================================================
+// Stencil Kernels
+namespace ndarray_detail {
+
+// Number of rows along the second last axis in each tile of a stencil
+const size_t stencil_tile = 16;
+
+// Finds the index s, along an axis of n elements, of the element at index i
+// along the same axis with a halo of radius elements on each side. Returns
+// false if i lies in the halo and mode is BoundaryMode::Constant.
+inline bool halo_source(size_t i, size_t n, size_t radius, BoundaryMode mode,
+                        size_t& s) {
+  if (i >= radius && i - radius < n) {
+    s = i - radius;
+    return true;
+  }
+
+  switch (mode) {
+    case BoundaryMode::Clamp:
+      s = i < radius ? 0 : n - 1;
+      return true;
+    case BoundaryMode::Periodic: {
+      const ptrdiff_t x =
+          static_cast<ptrdiff_t>(i) - static_cast<ptrdiff_t>(radius);
+      const ptrdiff_t m = static_cast<ptrdiff_t>(n);
+      s = static_cast<size_t>(((x % m) + m) % m);
+      return true;
+    }
+    default:
+      return false;
+  }
+}
+
+}  // namespace ndarray_detail
+
+//==============================================================================
+// AlignedAllocator Implementation
+template <class T, size_t Alignment>
+T* AlignedAllocator<T, Alignment>::allocate(size_t n) {
+  if (n == 0) return nullptr;
+  if (n > std::numeric_limits<size_t>::max() / sizeof(T)) {
+    throw std::bad_alloc();
+  }
+
+  // posix_memalign requires a multiple of sizeof(void*)
+  const size_t alignment =
+      std::max(std::max(Alignment, alignof(T)), sizeof(void*));
+  void* p = nullptr;
+#if defined(_WIN32)
+  p = _aligned_malloc(n * sizeof(T), alignment);
+#else
+  if (posix_memalign(&p, alignment, n * sizeof(T)) != 0) p = nullptr;
+#endif
+
+  if (p == nullptr) throw std::bad_alloc();
+  NDARRAY_STATS_ADD(allocations, 1);
+  NDARRAY_STATS_ADD(allocated_bytes, n * sizeof(T));
+  return static_cast<T*>(p);
+}
+
+template <class T, size_t Alignment>
+void AlignedAllocator<T, Alignment>::deallocate(T* p, size_t) noexcept {
+#if defined(_WIN32)
+  _aligned_free(p);
+#else
+  std::free(p);
+#endif
+}
+
+//==============================================================================
+// NDArray Implementation
+template <class T, class Allocator>
+NDArray<T, Allocator>::NDArray()
+    : data_{}, shape_{}, strides_{}, c_continuous_{true}, dimensions_{0} {}
+
+template <class T, class Allocator>
+NDArray<T, Allocator>::NDArray(const std::vector<size_t>& init_shape,
+                               bool c_continuous) {
+  if (init_shape.size() > 0) {
+    shape_ = init_shape;
+    dimensions_ = shape_.size();
+
+    size_t ne = init_shape[0];
+    for (size_t i = 1; i < dimensions_; i++) {
+      ne *= init_shape[i];
+    }
+
+    ndarray_detail::resize_zeroed(data_, ne);
+
+    c_continuous_ = c_continuous;
+    compute_strides();
+
+  } else {
+    std::string mssg = "NDArray shape vector must have at least one element.";
+    throw std::runtime_error(mssg);
+  }
+}
+
+template <class T, class Allocator>
+template <std::size_t N_dimension_>
+NDArray<T, Allocator>::NDArray(
+    boost::container::static_vector<std::size_t, N_dimension_>& init_shape,
+    bool c_continuous) {
+  if (init_shape.size() > 0) {
+    shape_.clear();
+    shape_.reserve( init_shape.size() );
+
+    for (std::size_t c : init_shape) {
+        shape_.push_back(c);
+    }
+
+    dimensions_ = shape_.size();
+
+    std::size_t ne = init_shape[0];
+    for (std::size_t i = 1; i < dimensions_; i++) {
+        ne *= init_shape[i];
+    }
+
+    ndarray_detail::resize_zeroed(data_, ne);
+
+    c_continuous_ = c_continuous;
+    compute_strides();
+  } else {
+    std::string mssg = "NDArray shape vector must have at least one element.";
+    throw std::runtime_error(mssg);
+  }
+}
+
+template <class T, class Allocator>
+NDArray<T, Allocator>::NDArray(const std::vector<T, Allocator>& data,
+                               const std::vector<size_t>& init_shape,
+                               bool c_continuous) {
+  if (init_shape.size() > 0) {
+    shape_ = init_shape;
+    dimensions_ = shape_.size();
+
+    size_t ne = init_shape[0];
+    for (size_t i = 1; i < dimensions_; i++) {
+      ne *= init_shape[i];
+    }
+
+    if (ne != data.size()) {
+      std::string mssg =
+          "Shape is incompatible with number of elements provided for NDArray.";
+      throw std::runtime_error(mssg);
+    }
+
+    data_ = data;
+
+    c_continuous_ = c_continuous;
+    compute_strides();
+
+  } else {
+    std::string mssg =
+        "Shape vector must have at least one element for NDArray.";
+    throw std::runtime_error(mssg);
+  }
+}
+
+template <class T, class Allocator>
+NDArray<T, Allocator>::NDArray(std::vector<T, Allocator>&& data,
+                               const std::vector<size_t>& init_shape,
+                               bool c_continuous) {
+  if (init_shape.size() > 0) {
+    shape_ = init_shape;
+    dimensions_ = shape_.size();
+
+    size_t ne = init_shape[0];
+    for (size_t i = 1; i < dimensions_; i++) {
+      ne *= init_shape[i];
+    }
+
+    if (ne != data.size()) {
+      std::string mssg =
+          "Shape is incompatible with number of elements provided for NDArray.";
+      throw std::runtime_error(mssg);
+    }
+
+    data_ = std::move(data);
+
+    c_continuous_ = c_continuous;
+    compute_strides();
+
+  } else {
+    std::string mssg =
+        "Shape vector must have at least one element for NDArray.";
+    throw std::runtime_error(mssg);
+  }
+}
+
+template <class T, class Allocator>
+template <class A>
+NDArray<T, Allocator>::NDArray(const std::vector<T, A>& data,
+                               const std::vector<size_t>& init_shape,
+                               bool c_continuous)
+    : NDArray(std::vector<T, Allocator>(data.begin(), data.end()), init_shape,
+              c_continuous) {}
+
+template <class T, class Allocator>
+template <class A>
+NDArray<T, Allocator>::NDArray(std::vector<T, A>&& data,
+                               const std::vector<size_t>& init_shape,
+                               bool c_continuous)
+    : NDArray(std::vector<T, Allocator>(std::make_move_iterator(data.begin()),
+                                        std::make_move_iterator(data.end())),
+              init_shape, c_continuous) {
+  std::vector<T, A>().swap(data);
+}
+
+
+template <class T, class Allocator>
+NDArray<T, Allocator>::NDArray(const NDArray& other)
+    : data_{other.data_},
+      shape_{other.shape_},
+      strides_{other.strides_},
+      c_continuous_{other.c_continuous_},
+      dimensions_{other.dimensions_} {
+  NDARRAY_STATS_ADD(deep_copies, 1);
+  NDARRAY_STATS_ADD(deep_copy_bytes, data_.size() * sizeof(T));
+}
+
+template <class T, class Allocator>
+NDArray<T, Allocator>& NDArray<T, Allocator>::operator=(const NDArray& other) {
+  if (this != &other) {
+    data_ = other.data_;
+    shape_ = other.shape_;
+    strides_ = other.strides_;
+    c_continuous_ = other.c_continuous_;
+    dimensions_ = other.dimensions_;
+    NDARRAY_STATS_ADD(deep_copies, 1);
+    NDARRAY_STATS_ADD(deep_copy_bytes, data_.size() * sizeof(T));
+  }
+  return *this;
+}
+
+template <class T, class Allocator>
+constexpr DType NDArray<T, Allocator>::npy_dtype() {
+  static_assert(dtype_of<T>::supported,
+                "The datatype is not supported for NDArray; dtype_of must be "
+                "specialized for it to be read from or written to a file.");
+  return dtype_of<T>::value;
+}
+
+template <class T, class Allocator>
+template <class E>
+NDArray<T, Allocator>::NDArray(const NDExpression<E>& expression)
+    : data_{}, shape_{}, strides_{}, c_continuous_{true}, dimensions_{0} {
+  const E& e = expression.self();
+
+  shape_ = e.shape();
+  dimensions_ = shape_.size();
+  c_continuous_ = e.c_continuous();
+  compute_strides();
+
+  size_t ne = shape_[0];
+  for (size_t i = 1; i < dimensions_; i++) {
+    ne *= shape_[i];
+  }
+  data_.resize(ne);
+
+  evaluate(e);
+}
+
+template <class T, class Allocator>
+template <class E>
+NDArray<T, Allocator>& NDArray<T, Allocator>::operator=(
+    const NDExpression<E>& expression) {
+  const E& e = expression.self();
+
+  if (shape_ == e.shape() && c_continuous_ == e.c_continuous() &&
+      !e.overlaps(data_.data(), sizeof(T), strides_)) {
+    // Each element only depends on the same element of the operands, which
+    // either do not share memory with this array or are this array itself
+    evaluate(e);
+  } else {
+    // Evaluate into a new array, as an operand may be a permuted, sliced or
+    // broadcast view of this array
+    *this = NDArray(expression);
+  }
+
+  return *this;
+}
+
+template <class T, class Allocator>
+NDArray<T, Allocator> NDArray<T, Allocator>::load(const std::string &fname) {
+  NDArray return_object;
+  load_into(fname, return_object);
+  return return_object;
+}
+
+template <class T, class Allocator>
+std::future<NDArray<T, Allocator>> NDArray<T, Allocator>::load_async(
+    const std::string& fname) {
+  return ndarray_detail::io_thread().submit<NDArray>(
+      [fname]() { return NDArray::load(fname); });
+}
+
+template <class T, class Allocator>
+void NDArray<T, Allocator>::load_into(const std::string& fname,
+                                      NDArray& array) {
+  // Get expected DType according to T
+  DType expected_dtype = npy_dtype();
+
+  // Variables to send to npy function
+  std::vector<size_t> data_shape;
+  DType data_dtype;
+  bool data_c_continuous;
+
+  // Check the header, then size the array so the data is read straight into
+  // its storage
+  bool allocated = false;
+  auto allocate = [&array, &allocated, expected_dtype](
+                      const std::vector<size_t>& shape, DType dtype,
+                      bool c_contiguous) -> char* {
+    // Ensure DType variables match
+    if (!npy_dtype_matches(expected_dtype, dtype)) {
+      std::string mssg =
+          "NDArray template datatype does not match specified datatype in npy "
+          "file.";
+      throw std::runtime_error(mssg);
+    }
+
+    if (shape.size() < 1) {
+      std::string mssg =
+          "Shape vector must have at least one element for NDArray.";
+      throw std::runtime_error(mssg);
+    }
+
+    // The order is set first, as it determines the strides
+    allocated = true;
+    array.c_continuous_ = c_contiguous;
+    array.allocate_for_overwrite(shape);
+    return reinterpret_cast<char*>(array.data_.data());
+  };
+
+  // Load data into array. If the data can not be read, the array is emptied
+  // so that it does not hold the new shape with partial data.
+  try {
+    load_npy(fname, allocate, data_shape, data_dtype, data_c_continuous);
+  } catch (...) {
+    if (allocated) {
+      array.data_.clear();
+      array.shape_.clear();
+      array.strides_.clear();
+      array.c_continuous_ = true;
+      array.dimensions_ = 0;
+    }
+    throw;
+  }
+}
+
+template <class T, class Allocator>
+MappedNDArray<const T> NDArray<T, Allocator>::load_mmap(
+    const std::string& fname) {
+  return MappedNDArray<const T>(fname, MMapMode::ReadOnly);
+}
+
+template <class T, class Allocator>
+MappedNDArray<T> NDArray<T, Allocator>::load_mmap(const std::string& fname,
+                                                  MMapMode mode) {
+  return MappedNDArray<T>(fname, mode);
+}
+
+template <class T, class Allocator>
+NDARRAY_INLINE T& NDArray<T, Allocator>::operator()(
+    const std::vector<size_t>& indices) {
+  return data_[element_index(indices)];
+}
+
+template <class T, class Allocator>
+NDARRAY_INLINE const T& NDArray<T, Allocator>::operator()(
+    const std::vector<size_t>& indices) const {
+  return data_[element_index(indices)];
+}
+
+template <class T, class Allocator>
+template <typename std::size_t ND_>
+NDARRAY_INLINE T& NDArray<T, Allocator>::operator()(
+    const boost::container::static_vector<size_t, ND_>& indices) {
+  return data_[element_index(indices)];
+}
+
+template <class T, class Allocator>
+template <typename std::size_t ND_>
+NDARRAY_INLINE const T& NDArray<T, Allocator>::operator()(
+    const boost::container::static_vector<size_t, ND_>& indices) const {
+  return data_[element_index(indices)];
+}
+
+template <class T, class Allocator>
+template <typename... INDS>
+NDARRAY_INLINE T& NDArray<T, Allocator>::operator()(INDS... inds) {
+  std::array<size_t, sizeof...(inds)> indices{static_cast<size_t>(inds)...};
+  return data_[element_index(indices)];
+}
+
+template <class T, class Allocator>
+template <typename... INDS>
+NDARRAY_INLINE const T& NDArray<T, Allocator>::operator()(INDS... inds) const {
+  std::array<size_t, sizeof...(inds)> indices{static_cast<size_t>(inds)...};
+  return data_[element_index(indices)];
+}
+
+template <class T, class Allocator>
+NDARRAY_INLINE T& NDArray<T, Allocator>::at(
+    const std::vector<size_t>& indices) {
+  return data_[checked_index(indices)];
+}
+
+template <class T, class Allocator>
+NDARRAY_INLINE const T& NDArray<T, Allocator>::at(
+    const std::vector<size_t>& indices) const {
+  return data_[checked_index(indices)];
+}
+
+template <class T, class Allocator>
+template <typename... INDS>
+NDARRAY_INLINE T& NDArray<T, Allocator>::at(INDS... inds) {
+  std::array<size_t, sizeof...(inds)> indices{static_cast<size_t>(inds)...};
+  return data_[checked_index(indices)];
+}
+
+template <class T, class Allocator>
+template <typename... INDS>
+NDARRAY_INLINE const T& NDArray<T, Allocator>::at(INDS... inds) const {
+  std::array<size_t, sizeof...(inds)> indices{static_cast<size_t>(inds)...};
+  return data_[checked_index(indices)];
+}
+
+template <class T, class Allocator>
+NDARRAY_INLINE T& NDArray<T, Allocator>::operator[](size_t i) {
+  return data_[i];
+}
+
+template <class T, class Allocator>
+NDARRAY_INLINE const T& NDArray<T, Allocator>::operator[](size_t i) const {
+  return data_[i];
+}
+
+template <class T, class Allocator>
+NDARRAY_INLINE std::vector<T, Allocator>& NDArray<T, Allocator>::data_vector() {
+  return data_;
+}
+
+template <class T, class Allocator>
+NDARRAY_INLINE const std::vector<T, Allocator>&
+NDArray<T, Allocator>::data_vector() const {
+  return data_;
+}
+
+template <class T, class Allocator>
+NDARRAY_INLINE T* NDArray<T, Allocator>::data() {
+  return data_.data();
+}
+
+template <class T, class Allocator>
+NDARRAY_INLINE const T* NDArray<T, Allocator>::data() const {
+  return data_.data();
+}
+
+template <class T, class Allocator>
+NDARRAY_INLINE const std::vector<size_t>& NDArray<T, Allocator>::shape() const {
+  return shape_;
+}
+
+template <class T, class Allocator>
+NDARRAY_INLINE size_t NDArray<T, Allocator>::size() const {
+  return data_.size();
+}
+
+template <class T, class Allocator>
+NDARRAY_INLINE const std::vector<size_t>&
+NDArray<T, Allocator>::strides() const {
+  return strides_;
+}
+
+template <class T, class Allocator>
+NDARRAY_INLINE size_t
+NDArray<T, Allocator>::linear_index(const std::vector<size_t>& indices) const {
+  return element_index(indices);
+}
+
+template <class T, class Allocator>
+template <typename... INDS>
+NDARRAY_INLINE size_t NDArray<T, Allocator>::linear_index(INDS... inds) const {
+  std::array<size_t, sizeof...(inds)> indices{static_cast<size_t>(inds)...};
+  return element_index(indices);
+}
+
+template <class T, class Allocator>
+NDARRAY_INLINE bool NDArray<T, Allocator>::c_continuous() const {
+  return c_continuous_;
+}
+
+template <class T, class Allocator>
+NDArrayView<T> NDArray<T, Allocator>::view() {
+  return NDArrayView<T>(data_.data(), shape_, strides_);
+}
+
+template <class T, class Allocator>
+NDArrayView<const T> NDArray<T, Allocator>::view() const {
+  return NDArrayView<const T>(data_.data(), shape_, strides_);
+}
+
+template <class T, class Allocator>
+NDArray<T, Allocator> NDArray<T, Allocator>::to_c_order() const {
+  if (c_continuous_) return *this;
+
+  NDArray<T, Allocator> new_array;
+  new_array.allocate_for_overwrite(shape_);
+  ndarray_detail::strided_copy(new_array.data_.data(), data_.data(), shape_,
+                               strides_);
+  return new_array;
+}
+
+template <class T, class Allocator>
+NDArray<T, Allocator> NDArray<T, Allocator>::to_fortran_order() const {
+  if (!c_continuous_) return *this;
+
+  // Fortran order is the C order of the reversed axes
+  NDArray<T, Allocator> new_array;
+  new_array.c_continuous_ = false;
+  new_array.allocate_for_overwrite(shape_);
+  std::vector<size_t> reversed_shape(shape_.rbegin(), shape_.rend());
+  std::vector<size_t> reversed_strides(strides_.rbegin(), strides_.rend());
+  ndarray_detail::strided_copy(new_array.data_.data(), data_.data(),
+                               reversed_shape, reversed_strides);
+  return new_array;
+}
+
+template <class T, class Allocator>
+NDArray<T, Allocator> NDArray<T, Allocator>::transpose() const {
+  std::vector<size_t> axes(dimensions_);
+  for (size_t i = 0; i < dimensions_; i++) axes[i] = dimensions_ - 1 - i;
+  return transpose(axes);
+}
+
+template <class T, class Allocator>
+NDArray<T, Allocator> NDArray<T, Allocator>::transpose(
+    const std::vector<size_t>& axes) const {
+  NDArrayView<const T> transposed = view().transpose(axes);
+
+  NDArray<T, Allocator> new_array;
+  new_array.allocate_for_overwrite(transposed.shape());
+  ndarray_detail::strided_copy(new_array.data_.data(), data_.data(),
+                               transposed.shape(), transposed.strides());
+  return new_array;
+}
+
+template <class T, class Allocator>
+void NDArray<T, Allocator>::save(const std::string& fname) const {
+  // Get expected DType according to T
+  DType dtype = npy_dtype();
+
+  // Write data to file
+  write_npy(fname, reinterpret_cast<const char*>(data_.data()), shape_, dtype,
+            c_continuous_);
+}
+
+template <class T, class Allocator>
+std::future<void> NDArray<T, Allocator>::save_async(
+    const std::string& fname) const& {
+  auto snapshot = std::make_shared<const NDArray>(*this);
+  return ndarray_detail::io_thread().submit<void>(
+      [snapshot, fname]() { snapshot->save(fname); });
+}
+
+template <class T, class Allocator>
+std::future<void> NDArray<T, Allocator>::save_async(
+    const std::string& fname) && {
+  auto snapshot = std::make_shared<const NDArray>(std::move(*this));
+  return ndarray_detail::io_thread().submit<void>(
+      [snapshot, fname]() { snapshot->save(fname); });
+}
+
+template <class T, class Allocator>
+T NDArray<T, Allocator>::sum() const {
+  return view().sum();
+}
+
+template <class T, class Allocator>
+NDArray<T> NDArray<T, Allocator>::sum(size_t axis) const {
+  return view().sum(axis);
+}
+
+template <class T, class Allocator>
+T NDArray<T, Allocator>::prod() const {
+  return view().prod();
+}
+
+template <class T, class Allocator>
+NDArray<T> NDArray<T, Allocator>::prod(size_t axis) const {
+  return view().prod(axis);
+}
+
+template <class T, class Allocator>
+T NDArray<T, Allocator>::min() const {
+  return view().min();
+}
+
+template <class T, class Allocator>
+NDArray<T> NDArray<T, Allocator>::min(size_t axis) const {
+  return view().min(axis);
+}
+
+template <class T, class Allocator>
+T NDArray<T, Allocator>::max() const {
+  return view().max();
+}
+
+template <class T, class Allocator>
+NDArray<T> NDArray<T, Allocator>::max(size_t axis) const {
+  return view().max(axis);
+}
+
+template <class T, class Allocator>
+size_t NDArray<T, Allocator>::argmin() const {
+  return view().argmin();
+}
+
+template <class T, class Allocator>
+NDArray<size_t> NDArray<T, Allocator>::argmin(size_t axis) const {
+  return view().argmin(axis);
+}
+
+template <class T, class Allocator>
+size_t NDArray<T, Allocator>::argmax() const {
+  return view().argmax();
+}
+
+template <class T, class Allocator>
+NDArray<size_t> NDArray<T, Allocator>::argmax(size_t axis) const {
+  return view().argmax(axis);
+}
+
+template <class T, class Allocator>
+typename NDMeanType<T>::type NDArray<T, Allocator>::mean() const {
+  return view().mean();
+}
+
+template <class T, class Allocator>
+NDArray<typename NDMeanType<T>::type> NDArray<T, Allocator>::mean(
+    size_t axis) const {
+  return view().mean(axis);
+}
+
+template <class T, class Allocator>
+typename NDRealType<T>::type NDArray<T, Allocator>::var() const {
+  return view().var();
+}
+
+template <class T, class Allocator>
+NDArray<typename NDRealType<T>::type> NDArray<T, Allocator>::var(
+    size_t axis) const {
+  return view().var(axis);
+}
+
+template <class T, class Allocator>
+typename NDRealType<T>::type NDArray<T, Allocator>::norm() const {
+  return view().norm();
+}
+
+template <class T, class Allocator>
+NDArray<typename NDRealType<T>::type> NDArray<T, Allocator>::norm(
+    size_t axis) const {
+  return view().norm(axis);
+}
+
+template <class T, class Allocator>
+typename NDArray<T, Allocator>::iterator NDArray<T, Allocator>::begin() {
+  return data_.data();
+}
+
+template <class T, class Allocator>
+typename NDArray<T, Allocator>::iterator NDArray<T, Allocator>::end() {
+  return data_.data() + data_.size();
+}
+
+template <class T, class Allocator>
+typename NDArray<T, Allocator>::const_iterator NDArray<T, Allocator>::begin()
+    const {
+  return data_.data();
+}
+
+template <class T, class Allocator>
+typename NDArray<T, Allocator>::const_iterator NDArray<T, Allocator>::end()
+    const {
+  return data_.data() + data_.size();
+}
+
+template <class T, class Allocator>
+template <class F>
+void NDArray<T, Allocator>::for_each_index(F f) {
+  view().for_each_index(f);
+}
+
+template <class T, class Allocator>
+template <class F>
+void NDArray<T, Allocator>::for_each_index(F f) const {
+  view().for_each_index(f);
+}
+
+template <class T, class Allocator>
+template <class F>
+void NDArray<T, Allocator>::apply_along_axis(size_t axis, F f) {
+  view().apply_along_axis(axis, f);
+}
+
+template <class T, class Allocator>
+template <class F>
+void NDArray<T, Allocator>::apply_along_axis(size_t axis, F f) const {
+  view().apply_along_axis(axis, f);
+}
+
+template <class T, class Allocator>
+template <class F>
+NDArray<typename NDStencilResult<T, F>::type> NDArray<T, Allocator>::stencil(
+    size_t radius, F f, BoundaryMode mode, const T& constant) const {
+  return view().stencil(radius, f, mode, constant);
+}
+
+template <class T, class Allocator>
+void NDArray<T, Allocator>::fill(const T& val) {
+  ndarray_detail::parallel_fill(data_.data(), val, data_.size());
+}
+
+template <class T, class Allocator>
+void NDArray<T, Allocator>::reshape(const std::vector<size_t>& new_shape) {
+  // Ensure new shape has proper dimensions
+  if (new_shape.size() < 1) {
+    std::string mssg =
+        "Shape vector must have at least one element to"
+        " reshpae NDArray.";
+    throw std::runtime_error(mssg);
+  } else {
+    size_t ne = new_shape[0];
+
+    for (size_t i = 1; i < new_shape.size(); i++) {
+      ne *= new_shape[i];
+    }
+
+    if (ne == data_.size()) {
+      shape_ = new_shape;
+      dimensions_ = shape_.size();
+      compute_strides();
+    } else {
+      std::string mssg =
+          "Shape is incompatible with number of elements in"
+          " NDArray.";
+      throw std::runtime_error(mssg);
+    }
+  }
+}
+
+template <class T, class Allocator>
+void NDArray<T, Allocator>::reallocate(const std::vector<size_t>& new_shape) {
+  // Ensure new shape has proper dimensions
+  if (new_shape.size() < 1) {
+    std::string mssg =
+        "Shape vector must have at least one element to"
+        " reallocate NDArray.";
+    throw std::runtime_error(mssg);
+  } else {
+    size_t ne = new_shape[0];
+
+    for (size_t i = 1; i < new_shape.size(); i++) {
+      ne *= new_shape[i];
+    }
+
+    shape_ = new_shape;
+    dimensions_ = shape_.size();
+    compute_strides();
+    ndarray_detail::resize_zeroed(data_, ne);
+  }
+}
+
+template <class T, class Allocator>
+void NDArray<T, Allocator>::allocate_for_overwrite(
+    const std::vector<size_t>& new_shape) {
+  if (new_shape.size() < 1) {
+    std::string mssg =
+        "Shape vector must have at least one element to"
+        " reallocate NDArray.";
+    throw std::runtime_error(mssg);
+  }
+
+  size_t ne = new_shape[0];
+  for (size_t i = 1; i < new_shape.size(); i++) {
+    ne *= new_shape[i];
+  }
+
+  shape_ = new_shape;
+  dimensions_ = shape_.size();
+  compute_strides();
+  data_.resize(ne);
+}
+
+template <class T, class Allocator>
+template <std::size_t N_dimension_>
+void NDArray<T, Allocator>::reallocate(
+    const boost::container::static_vector<size_t, N_dimension_>& new_shape) {
+  // Ensure new shape has proper dimensions
+  if (new_shape.size() < 1) {
+    std::string mssg =
+        "Shape vector must have at least one element to"
+        " reallocate NDArray.";
+    throw std::runtime_error(mssg);
+  } else {
+    size_t ne = new_shape[0];
+
+    for (size_t i = 1; i < new_shape.size(); i++) {
+      ne *= new_shape[i];
+    }
+    shape_.clear();
+    shape_.reserve( new_shape.size() );
+    for( std::size_t c : new_shape){
+      shape_.push_back(c);
+    }
+    dimensions_ = shape_.size();
+    compute_strides();
+    ndarray_detail::resize_zeroed(data_, ne);
+  }
+}
+
+
+template <class T, class Allocator>
+template <class C, class A>
+NDArray<T, Allocator>& NDArray<T, Allocator>::operator+=(
+    const NDArray<C, A>& a) {
+  // Arrays of different shapes or storage orders are broadcast and matched
+  // by their indices
+  if (shape_ != a.shape_ || c_continuous_ != a.c_continuous_) {
+    view() += a.view();
+    return *this;
+  }
+
+  // Do addition
+  ndarray_detail::parallel_array_add(data_.data(), a.data_.data(),
+                                     data_.size());
+
+  return *this;
+}
+
+template <class T, class Allocator>
+template <class C, class A>
+NDArray<T, Allocator>& NDArray<T, Allocator>::operator-=(
+    const NDArray<C, A>& a) {
+  // Arrays of different shapes or storage orders are broadcast and matched
+  // by their indices
+  if (shape_ != a.shape_ || c_continuous_ != a.c_continuous_) {
+    view() -= a.view();
+    return *this;
+  }
+
+  // Do subtraction
+  ndarray_detail::parallel_array_subtract(data_.data(), a.data_.data(),
+                                          data_.size());
+
+  return *this;
+}
+
+template <class T, class Allocator>
+template <class C, class A>
+NDArray<T, Allocator>& NDArray<T, Allocator>::operator*=(
+    const NDArray<C, A>& a) {
+  // Arrays of different shapes or storage orders are broadcast and matched
+  // by their indices
+  if (shape_ != a.shape_ || c_continuous_ != a.c_continuous_) {
+    view() *= a.view();
+    return *this;
+  }
+
+  // Do multiplication
+  ndarray_detail::parallel_array_multiply(data_.data(), a.data_.data(),
+                                          data_.size());
+
+  return *this;
+}
+
+template <class T, class Allocator>
+template <class C, class A>
+NDArray<T, Allocator>& NDArray<T, Allocator>::operator/=(
+    const NDArray<C, A>& a) {
+  // Arrays of different shapes or storage orders are broadcast and matched
+  // by their indices
+  if (shape_ != a.shape_ || c_continuous_ != a.c_continuous_) {
+    view() /= a.view();
+    return *this;
+  }
+
+  // Do division
+  ndarray_detail::parallel_array_divide(data_.data(), a.data_.data(),
+                                        data_.size());
+
+  return *this;
+}
+
+template <class T, class Allocator>
+template <class C>
+NDArray<T, Allocator>& NDArray<T, Allocator>::operator+=(
+    const NDArrayView<C>& a) {
+  view() += a;
+  return *this;
+}
+
+template <class T, class Allocator>
+template <class C>
+NDArray<T, Allocator>& NDArray<T, Allocator>::operator-=(
+    const NDArrayView<C>& a) {
+  view() -= a;
+  return *this;
+}
+
+template <class T, class Allocator>
+template <class C>
+NDArray<T, Allocator>& NDArray<T, Allocator>::operator*=(
+    const NDArrayView<C>& a) {
+  view() *= a;
+  return *this;
+}
+
+template <class T, class Allocator>
+template <class C>
+NDArray<T, Allocator>& NDArray<T, Allocator>::operator/=(
+    const NDArrayView<C>& a) {
+  view() /= a;
+  return *this;
+}
+
+template <class T, class Allocator>
+template <class C>
+NDArray<T, Allocator>& NDArray<T, Allocator>::operator+=(const C& c) {
+  // Do addition
+  ndarray_detail::parallel_constant_add(data_.data(), c, data_.size());
+
+  return *this;
+}
+
+template <class T, class Allocator>
+template <class C>
+NDArray<T, Allocator>& NDArray<T, Allocator>::operator-=(const C& c) {
+  // Do subtraction
+  ndarray_detail::parallel_constant_subtract(data_.data(), c, data_.size());
+
+  return *this;
+}
+
+template <class T, class Allocator>
+template <class C>
+NDArray<T, Allocator>& NDArray<T, Allocator>::operator*=(const C& c) {
+  // Do multiplication
+  ndarray_detail::parallel_constant_multiply(data_.data(), c, data_.size());
+
+  return *this;
+}
+
+template <class T, class Allocator>
+template <class C>
+NDArray<T, Allocator>& NDArray<T, Allocator>::operator/=(const C& c) {
+  // Do division
+  ndarray_detail::parallel_constant_divide(data_.data(), c, data_.size());
+
+  return *this;
+}
+
+template <class T, class Allocator>
+template <class C, class A>
+NDArray<C, A> NDArray<T, Allocator>::astype(ConversionMode mode) const {
+  NDArray<C, A> new_array;
+  new_array.c_continuous_ = c_continuous_;
+  new_array.allocate_for_overwrite(shape_);
+
+  if (mode == ConversionMode::Saturate) {
+    ndarray_detail::parallel_saturate(new_array.data_.data(), data_.data(),
+                                      data_.size());
+  } else {
+    ndarray_detail::parallel_convert(new_array.data_.data(), data_.data(),
+                                     data_.size());
+  }
+
+  return new_array;
+}
+
+template <class T, class Allocator>
+template <class C, class A>
+NDArray<T, Allocator>::operator NDArray<C, A>() const {
+  return astype<C, A>();
+}
+
+template <class T, class Allocator>
+void NDArray<T, Allocator>::compute_strides() {
+  strides_.assign(dimensions_, 1);
+
+  if (dimensions_ == 0) return;
+
+  if (c_continuous_) {
+    // Last index varies fastest for row-major order
+    for (size_t i = dimensions_ - 1; i > 0; i--) {
+      strides_[i - 1] = strides_[i] * shape_[i];
+    }
+  } else {
+    // First index varies fastest for column-major order
+    for (size_t i = 1; i < dimensions_; i++) {
+      strides_[i] = strides_[i - 1] * shape_[i - 1];
+    }
+  }
+}
+
+template <class T, class Allocator>
+template <class E>
+void NDArray<T, Allocator>::evaluate(const E& e) {
+  const size_t ne = data_.size();
+  if (ne == 0) return;
+
+  T* out = data_.data();
+
+  // Operands with the same storage order as this array are evaluated with a
+  // single linear index, so that the loop may be vectorized
+  if (e.contiguous(c_continuous_)) {
+    for (size_t i = 0; i < ne; i++) {
+      out[i] = e.linear_value(i);
+    }
+    return;
+  }
+
+  // Otherwise the elements are visited in memory order, while keeping track
+  // of the indices of each element
+  std::vector<size_t> indices(dimensions_, 0);
+  for (size_t i = 0; i < ne; i++) {
+    out[i] = e.indexed_value(indices.data());
+
+    if (c_continuous_) {
+      for (size_t d = dimensions_; d > 0; d--) {
+        if (++indices[d - 1] < shape_[d - 1]) break;
+        indices[d - 1] = 0;
+      }
+    } else {
+      for (size_t d = 0; d < dimensions_; d++) {
+        if (++indices[d] < shape_[d]) break;
+        indices[d] = 0;
+      }
+    }
+  }
+}
+
+template <class T, class Allocator>
+template <class INDICES>
+NDARRAY_INLINE size_t
+NDArray<T, Allocator>::element_index(const INDICES& indices) const {
+#if defined(NDARRAY_NO_BOUNDS_CHECK)
+  return unchecked_index(indices);
+#else
+  return checked_index(indices);
+#endif
+}
+
+template <class T, class Allocator>
+template <class INDICES>
+NDARRAY_INLINE size_t
+NDArray<T, Allocator>::checked_index(const INDICES& indices) const {
+  // Make sure proper number of indices
+  if (indices.size() != dimensions_) {
+    std::string mssg = "Improper number of indicies provided to NDArray.";
+    throw std::runtime_error(mssg);
+  }
+
+  for (size_t i = 0; i < dimensions_; i++) {
+    if (indices[i] >= shape_[i]) {
+      std::string mssg = "Index provided to NDArray out of range.";
+      throw std::out_of_range(mssg);
+    }
+  }
+
+  return unchecked_index(indices);
+}
+
+template <class T, class Allocator>
+template <class INDICES>
+NDARRAY_INLINE size_t
+NDArray<T, Allocator>::unchecked_index(const INDICES& indices) const {
+  size_t indx = 0;
+  for (size_t i = 0; i < dimensions_; i++) {
+    indx += indices[i] * strides_[i];
+  }
+  return indx;
+}
+
+template <class T, class Allocator>
+template <class I, size_t D>
+NDARRAY_INLINE size_t
+NDArray<T, Allocator>::unchecked_index(const std::array<I, D>& indices) const {
+  // Number of indices is known at compile time, so this loop is unrolled
+  const size_t* strides = strides_.data();
+  size_t indx = 0;
+  for (size_t i = 0; i < D; i++) {
+    indx += indices[i] * strides[i];
+  }
+  return indx;
+}
+
+//==============================================================================
+// NDArrayView Implementation
+template <class T>
+NDArrayView<T>::NDArrayView()
+    : data_{nullptr}, shape_{}, strides_{}, dimensions_{0} {}
+
+template <class T>
+NDArrayView<T>::NDArrayView(T* data, const std::vector<size_t>& shape,
+                            const std::vector<size_t>& strides)
+    : data_{data}, shape_{shape}, strides_{strides}, dimensions_{0} {
+  if (shape_.size() < 1) {
+    std::string mssg =
+        "Shape vector must have at least one element for NDArrayView.";
+    throw std::runtime_error(mssg);
+  }
+
+  if (strides_.size() != shape_.size()) {
+    std::string mssg =
+        "Strides vector must have one element per axis for NDArrayView.";
+    throw std::runtime_error(mssg);
+  }
+
+  dimensions_ = shape_.size();
+}
+
+template <class T>
+NDArrayView<T>::NDArrayView(T* data, const std::vector<size_t>& shape,
+                            bool c_continuous)
+    : data_{data}, shape_{shape}, strides_{}, dimensions_{0} {
+  if (shape_.size() < 1) {
+    std::string mssg =
+        "Shape vector must have at least one element for NDArrayView.";
+    throw std::runtime_error(mssg);
+  }
+
+  dimensions_ = shape_.size();
+
+  strides_.assign(dimensions_, 1);
+  if (c_continuous) {
+    for (size_t i = dimensions_ - 1; i > 0; i--) {
+      strides_[i - 1] = strides_[i] * shape_[i];
+    }
+  } else {
+    for (size_t i = 1; i < dimensions_; i++) {
+      strides_[i] = strides_[i - 1] * shape_[i - 1];
+    }
+  }
+}
+
+template <class T>
+template <class C, typename>
+NDArrayView<T>::NDArrayView(const NDArrayView<C>& other)
+    : data_{other.data_},
+      shape_{other.shape_},
+      strides_{other.strides_},
+      dimensions_{other.dimensions_} {}
+
+template <class T>
+NDARRAY_INLINE T& NDArrayView<T>::operator()(
+    const std::vector<size_t>& indices) const {
+  return data_[element_index(indices)];
+}
+
+template <class T>
+template <typename std::size_t ND_>
+NDARRAY_INLINE T& NDArrayView<T>::operator()(
+    const boost::container::static_vector<size_t, ND_>& indices) const {
+  return data_[element_index(indices)];
+}
+
+template <class T>
+template <typename... INDS>
+NDARRAY_INLINE T& NDArrayView<T>::operator()(INDS... inds) const {
+  std::array<size_t, sizeof...(inds)> indices{static_cast<size_t>(inds)...};
+  return data_[element_index(indices)];
+}
+
+template <class T>
+NDARRAY_INLINE T& NDArrayView<T>::at(
+    const std::vector<size_t>& indices) const {
+  return data_[checked_index(indices)];
+}
+
+template <class T>
+template <typename... INDS>
+NDARRAY_INLINE T& NDArrayView<T>::at(INDS... inds) const {
+  std::array<size_t, sizeof...(inds)> indices{static_cast<size_t>(inds)...};
+  return data_[checked_index(indices)];
+}
+
+template <class T>
+NDARRAY_INLINE T* NDArrayView<T>::data() const {
+  return data_;
+}
+
+template <class T>
+NDARRAY_INLINE const std::vector<size_t>& NDArrayView<T>::shape() const {
+  return shape_;
+}
+
+template <class T>
+NDARRAY_INLINE const std::vector<size_t>& NDArrayView<T>::strides() const {
+  return strides_;
+}
+
+template <class T>
+NDARRAY_INLINE size_t NDArrayView<T>::size() const {
+  if (dimensions_ == 0) return 0;
+
+  size_t ne = shape_[0];
+  for (size_t i = 1; i < dimensions_; i++) {
+    ne *= shape_[i];
+  }
+  return ne;
+}
+
+template <class T>
+NDARRAY_INLINE size_t
+NDArrayView<T>::linear_index(const std::vector<size_t>& indices) const {
+  return element_index(indices);
+}
+
+template <class T>
+template <typename... INDS>
+NDARRAY_INLINE size_t NDArrayView<T>::linear_index(INDS... inds) const {
+  std::array<size_t, sizeof...(inds)> indices{static_cast<size_t>(inds)...};
+  return element_index(indices);
+}
+
+template <class T>
+bool NDArrayView<T>::c_continuous() const {
+  // Axes of length one may have any stride
+  size_t expected = 1;
+  for (size_t i = dimensions_; i > 0; i--) {
+    if (shape_[i - 1] != 1 && strides_[i - 1] != expected) return false;
+    expected *= shape_[i - 1];
+  }
+  return true;
+}
+
+template <class T>
+bool NDArrayView<T>::fortran_continuous() const {
+  // Axes of length one may have any stride
+  size_t expected = 1;
+  for (size_t i = 0; i < dimensions_; i++) {
+    if (shape_[i] != 1 && strides_[i] != expected) return false;
+    expected *= shape_[i];
+  }
+  return true;
+}
+
+template <class T>
+NDArrayView<T> NDArrayView<T>::slice(size_t axis, size_t start, size_t stop,
+                                     size_t step) const {
+  if (axis >= dimensions_) {
+    std::string mssg = "Axis provided to NDArrayView::slice out of range.";
+    throw std::out_of_range(mssg);
+  }
+
+  if (start > stop || stop > shape_[axis]) {
+    std::string mssg = "Indices provided to NDArrayView::slice out of range.";
+    throw std::out_of_range(mssg);
+  }
+
+  if (step == 0) {
+    std::string mssg = "Step provided to NDArrayView::slice must be nonzero.";
+    throw std::runtime_error(mssg);
+  }
+
+  NDArrayView<T> sliced(*this);
+  sliced.data_ += start * strides_[axis];
+  sliced.shape_[axis] = (stop - start + step - 1) / step;
+  sliced.strides_[axis] *= step;
+  return sliced;
+}
+
+template <class T>
+NDArrayView<T> NDArrayView<T>::transpose() const {
+  NDArrayView<T> transposed(*this);
+  std::reverse(transposed.shape_.begin(), transposed.shape_.end());
+  std::reverse(transposed.strides_.begin(), transposed.strides_.end());
+  return transposed;
+}
+
+template <class T>
+NDArrayView<T> NDArrayView<T>::transpose(
+    const std::vector<size_t>& axes) const {
+  if (axes.size() != dimensions_) {
+    std::string mssg =
+        "Improper number of axes provided to NDArrayView::transpose.";
+    throw std::runtime_error(mssg);
+  }
+
+  NDArrayView<T> transposed(*this);
+  std::vector<bool> used(dimensions_, false);
+  for (size_t i = 0; i < dimensions_; i++) {
+    if (axes[i] >= dimensions_ || used[axes[i]]) {
+      std::string mssg =
+          "Axes provided to NDArrayView::transpose are not a permutation.";
+      throw std::runtime_error(mssg);
+    }
+    used[axes[i]] = true;
+
+    transposed.shape_[i] = shape_[axes[i]];
+    transposed.strides_[i] = strides_[axes[i]];
+  }
+  return transposed;
+}
+
+template <class T>
+NDArrayView<T> NDArrayView<T>::squeeze() const {
+  NDArrayView<T> squeezed(*this);
+  squeezed.shape_.clear();
+  squeezed.strides_.clear();
+  for (size_t i = 0; i < dimensions_; i++) {
+    if (shape_[i] != 1) {
+      squeezed.shape_.push_back(shape_[i]);
+      squeezed.strides_.push_back(strides_[i]);
+    }
+  }
+
+  // A view of a single element keeps one axis
+  if (squeezed.shape_.empty()) {
+    squeezed.shape_.push_back(1);
+    squeezed.strides_.push_back(1);
+  }
+
+  squeezed.dimensions_ = squeezed.shape_.size();
+  return squeezed;
+}
+
+template <class T>
+NDArrayView<T> NDArrayView<T>::broadcast_to(
+    const std::vector<size_t>& shape) const {
+  std::vector<size_t> strides;
+  if (!ndarray_detail::broadcast_strides(shape_, strides_, shape, strides)) {
+    std::string mssg = "NDArrayView cannot be broadcast to the given shape.";
+    throw std::runtime_error(mssg);
+  }
+  return NDArrayView(data_, shape, strides);
+}
+
+template <class T>
+NDArray<typename std::remove_const<T>::type> NDArrayView<T>::copy() const {
+  typedef typename std::remove_const<T>::type value_type;
+
+  NDArray<value_type> new_array;
+  new_array.allocate_for_overwrite(shape_);
+  ndarray_detail::strided_copy(new_array.data(),
+                               static_cast<const value_type*>(data_), shape_,
+                               strides_);
+  return new_array;
+}
+
+template <class T>
+typename NDArrayView<T>::value_type NDArrayView<T>::sum() const {
+  if (size() == 0) return value_type(0);
+  return reduce<value_type, ndarray_detail::SumOp>(
+      ndarray_detail::CastTo<value_type>());
+}
+
+template <class T>
+NDArray<typename NDArrayView<T>::value_type> NDArrayView<T>::sum(
+    size_t axis) const {
+  return reduce<value_type, ndarray_detail::SumOp>(
+      axis, value_type(0), ndarray_detail::CastTo<value_type>());
+}
+
+template <class T>
+typename NDArrayView<T>::value_type NDArrayView<T>::prod() const {
+  if (size() == 0) return value_type(1);
+  return reduce<value_type, ndarray_detail::ProdOp>(
+      ndarray_detail::CastTo<value_type>());
+}
+
+template <class T>
+NDArray<typename NDArrayView<T>::value_type> NDArrayView<T>::prod(
+    size_t axis) const {
+  return reduce<value_type, ndarray_detail::ProdOp>(
+      axis, value_type(1), ndarray_detail::CastTo<value_type>());
+}
+
+template <class T>
+typename NDArrayView<T>::value_type NDArrayView<T>::min() const {
+  check_not_empty("minimum");
+  return reduce<value_type, ndarray_detail::MinOp>(
+      ndarray_detail::CastTo<value_type>());
+}
+
+template <class T>
+NDArray<typename NDArrayView<T>::value_type> NDArrayView<T>::min(
+    size_t axis) const {
+  check_axis(axis);
+  if (shape_[axis] == 0) check_not_empty("minimum");
+  return reduce<value_type, ndarray_detail::MinOp>(
+      axis, value_type(), ndarray_detail::CastTo<value_type>());
+}
+
+template <class T>
+typename NDArrayView<T>::value_type NDArrayView<T>::max() const {
+  check_not_empty("maximum");
+  return reduce<value_type, ndarray_detail::MaxOp>(
+      ndarray_detail::CastTo<value_type>());
+}
+
+template <class T>
+NDArray<typename NDArrayView<T>::value_type> NDArrayView<T>::max(
+    size_t axis) const {
+  check_axis(axis);
+  if (shape_[axis] == 0) check_not_empty("maximum");
+  return reduce<value_type, ndarray_detail::MaxOp>(
+      axis, value_type(), ndarray_detail::CastTo<value_type>());
+}
+
+template <class T>
+size_t NDArrayView<T>::argmin() const {
+  return arg_search<ndarray_detail::MinOp>("argmin");
+}
+
+template <class T>
+NDArray<size_t> NDArrayView<T>::argmin(size_t axis) const {
+  return arg_search<ndarray_detail::MinOp>(axis, "argmin");
+}
+
+template <class T>
+size_t NDArrayView<T>::argmax() const {
+  return arg_search<ndarray_detail::MaxOp>("argmax");
+}
+
+template <class T>
+NDArray<size_t> NDArrayView<T>::argmax(size_t axis) const {
+  return arg_search<ndarray_detail::MaxOp>(axis, "argmax");
+}
+
+template <class T>
+typename NDMeanType<typename NDArrayView<T>::value_type>::type
+NDArrayView<T>::mean() const {
+  typedef typename NDMeanType<value_type>::type M;
+  typedef typename NDRealType<value_type>::type V;
+
+  // The mean of no elements is NaN, as 0 / 0
+  M s(0);
+  if (size() > 0) {
+    s = reduce<M, ndarray_detail::SumOp>(ndarray_detail::CastTo<M>());
+  }
+  return s / V(size());
+}
+
+template <class T>
+NDArray<typename NDMeanType<typename NDArrayView<T>::value_type>::type>
+NDArrayView<T>::mean(size_t axis) const {
+  typedef typename NDMeanType<value_type>::type M;
+  typedef typename NDRealType<value_type>::type V;
+
+  NDArray<M> result = reduce<M, ndarray_detail::SumOp>(
+      axis, M(0), ndarray_detail::CastTo<M>());
+  result /= V(shape_[axis]);
+  return result;
+}
+
+template <class T>
+typename NDRealType<typename NDArrayView<T>::value_type>::type
+NDArrayView<T>::var() const {
+  typedef typename NDMeanType<value_type>::type M;
+  typedef typename NDRealType<value_type>::type V;
+
+  // Deviations are taken from the mean in a second pass, which is more
+  // accurate than accumulating the squares of the elements
+  const M m = mean();
+  V s(0);
+  if (size() > 0) {
+    s = reduce<V, ndarray_detail::SumOp>([m](const value_type& x, size_t) {
+      return ndarray_detail::squared_magnitude<V>(M(x) - m);
+    });
+  }
+  return s / V(size());
+}
+
+template <class T>
+NDArray<typename NDRealType<typename NDArrayView<T>::value_type>::type>
+NDArrayView<T>::var(size_t axis) const {
+  typedef typename NDMeanType<value_type>::type M;
+  typedef typename NDRealType<value_type>::type V;
+
+  // The means are ordered like the result, so row j has the mean m[j]
+  const NDArray<M> means = mean(axis);
+  const M* m = means.data();
+  NDArray<V> result = reduce<V, ndarray_detail::SumOp>(
+      axis, V(0), [m](const value_type& x, size_t j) {
+        return ndarray_detail::squared_magnitude<V>(M(x) - m[j]);
+      });
+  result /= V(shape_[axis]);
+  return result;
+}
+
+template <class T>
+typename NDRealType<typename NDArrayView<T>::value_type>::type
+NDArrayView<T>::norm() const {
+  typedef typename NDRealType<value_type>::type V;
+
+  V s(0);
+  if (size() > 0) {
+    s = reduce<V, ndarray_detail::SumOp>(
+        ndarray_detail::SquaredMagnitude<V>());
+  }
+  return std::sqrt(s);
+}
+
+template <class T>
+NDArray<typename NDRealType<typename NDArrayView<T>::value_type>::type>
+NDArrayView<T>::norm(size_t axis) const {
+  typedef typename NDRealType<value_type>::type V;
+
+  NDArray<V> result = reduce<V, ndarray_detail::SumOp>(
+      axis, V(0), ndarray_detail::SquaredMagnitude<V>());
+  V* r = result.data();
+  for (size_t i = 0; i < result.size(); i++) {
+    r[i] = std::sqrt(r[i]);
+  }
+  return result;
+}
+
+template <class T>
+typename NDArrayView<T>::iterator NDArrayView<T>::begin() const {
+  return iterator::first(*this);
+}
+
+template <class T>
+typename NDArrayView<T>::iterator NDArrayView<T>::end() const {
+  return iterator::past_end(*this);
+}
+
+template <class T>
+template <class F>
+void NDArrayView<T>::for_each_index(F f) const {
+  if (size() == 0) return;
+
+  // Axes ordered from the largest stride to the smallest, so that the last
+  // is traversed by the inner loop and the others advance like an odometer
+  std::vector<size_t> order(dimensions_);
+  for (size_t i = 0; i < dimensions_; i++) order[i] = i;
+  std::stable_sort(order.begin(), order.end(), [this](size_t a, size_t b) {
+    return strides_[a] > strides_[b];
+  });
+
+  const size_t inner = order.back();
+  const size_t n_inner = shape_[inner];
+  const size_t s_inner = strides_[inner];
+  std::vector<size_t> index(dimensions_, 0);
+  const std::vector<size_t>& const_index = index;
+  T* p = data_;
+
+  while (true) {
+    for (size_t i = 0; i < n_inner; i++) {
+      index[inner] = i;
+      f(const_index, p[i * s_inner]);
+    }
+    index[inner] = 0;
+
+    size_t d = dimensions_ - 1;
+    while (true) {
+      if (d == 0) return;
+      const size_t axis = order[--d];
+
+      if (++index[axis] < shape_[axis]) {
+        p += strides_[axis];
+        break;
+      }
+
+      p -= strides_[axis] * (shape_[axis] - 1);
+      index[axis] = 0;
+    }
+  }
+}
+
+template <class T>
+template <class F>
+void NDArrayView<T>::apply_along_axis(size_t axis, F f) const {
+  if (axis >= dimensions_) {
+    std::string mssg = "Axis provided to apply_along_axis out of range.";
+    throw std::out_of_range(mssg);
+  }
+  if (size() == 0) return;
+
+  const std::vector<size_t> offsets = row_offsets(axis, true);
+  const size_t n = shape_[axis];
+  const size_t stride = strides_[axis];
+  ndarray_detail::parallel_chunks(
+      offsets.size(), 1, size(), [&](size_t begin, size_t count) {
+        for (size_t r = begin; r < begin + count; r++) {
+          f(data_ + offsets[r], n, stride);
+        }
+      });
+}
+
+template <class T>
+template <class F>
+NDArray<typename NDStencilResult<typename NDArrayView<T>::value_type, F>::type>
+NDArrayView<T>::stencil(size_t radius, F f, BoundaryMode mode,
+                        const value_type& constant) const {
+  typedef typename NDStencilResult<value_type, F>::type R;
+  if (size() == 0) return NDArray<R>(shape_);
+
+  const std::vector<ptrdiff_t> strides(strides_.begin(), strides_.end());
+  const value_type* data = data_;
+
+  NDArray<R> result;
+  result.allocate_for_overwrite(shape_);
+  const std::vector<size_t>& result_strides = result.strides();
+  R* out = result.data();
+
+  // Returns true if index i along an axis of n elements is within radius of
+  // an edge
+  auto near_edge = [radius](size_t i, size_t n) {
+    return i < radius || i + radius >= n;
+  };
+
+  // Evaluates the points from begin to end along the last axis, whose other
+  // indices are those of point
+  const size_t last = dimensions_ - 1;
+  const size_t n_last = shape_[last];
+  const ptrdiff_t s_last = strides[last];
+  auto evaluate_row = [&](StencilPoint<value_type>& point, size_t begin,
+                          size_t end) {
+    const value_type* p = data + static_cast<ptrdiff_t>(begin) * s_last;
+    R* q = out + begin;
+    bool row_near_edge = false;
+    for (size_t i = 0; i < last; i++) {
+      p += static_cast<ptrdiff_t>(point.index_[i]) * strides[i];
+      q += point.index_[i] * result_strides[i];
+      row_near_edge = row_near_edge || near_edge(point.index_[i], shape_[i]);
+    }
+
+    // Points from interior_begin to interior_end are at least radius from
+    // every edge, and the rest are read from gathered rows. These bounds are
+    // held in locals, as the stores to the index of the point could
+    // otherwise alias them.
+    size_t interior_begin = end, interior_end = end;
+    if (!row_near_edge && n_last > 2 * radius) {
+      interior_begin = std::min(std::max(begin, radius), end);
+      interior_end = std::max(interior_begin, std::min(n_last - radius, end));
+    }
+    if (begin < interior_begin) point.gather(begin, interior_begin);
+    if (interior_end < end) point.gather(interior_end, end);
+
+    const ptrdiff_t step = s_last;
+    size_t& k_index = point.index_[last];
+    for (size_t k = begin; k < end; k++, p += step, q++) {
+      k_index = k;
+      if (k < interior_begin || k >= interior_end) {
+        point.move_gathered(k);
+      } else {
+        point.move_interior(p);
+      }
+      *q = f(static_cast<const StencilPoint<value_type>&>(point));
+    }
+  };
+
+  if (dimensions_ == 1) {
+    ndarray_detail::parallel_chunks(
+        n_last, ndarray_detail::stencil_tile * ndarray_detail::stencil_tile,
+        n_last, [&](size_t begin, size_t count) {
+          StencilPoint<value_type> point(data, shape_, strides, radius, mode,
+                                         &constant);
+          evaluate_row(point, begin, begin + count);
+        });
+    return result;
+  }
+
+  // Tiles along the second last axis each sweep through the leading axes,
+  // so that the neighbouring rows are still in cache
+  const size_t t = dimensions_ - 2;
+  const size_t tile = ndarray_detail::stencil_tile;
+  const size_t n_tiles = (shape_[t] + tile - 1) / tile;
+  ndarray_detail::parallel_chunks(
+      n_tiles, 1, size(), [&](size_t begin, size_t count) {
+        StencilPoint<value_type> point(data, shape_, strides, radius, mode,
+                                       &constant);
+        for (size_t n = begin; n < begin + count; n++) {
+          const size_t j_end = std::min(shape_[t], (n + 1) * tile);
+          std::fill(point.index_.begin(), point.index_.end(), 0);
+
+          bool done = false;
+          while (!done) {
+            for (size_t j = n * tile; j < j_end; j++) {
+              point.index_[t] = j;
+              evaluate_row(point, 0, n_last);
+            }
+
+            // Advance the leading axes like an odometer
+            done = true;
+            for (size_t d = t; d-- > 0;) {
+              if (++point.index_[d] < shape_[d]) {
+                done = false;
+                break;
+              }
+              point.index_[d] = 0;
+            }
+          }
+        }
+      });
+
+  return result;
+}
+
+template <class T>
+NDArrayView<T>::iterator::iterator()
+    : p_(nullptr), shape_(), strides_(), index_(), position_(0) {}
+
+template <class T>
+typename NDArrayView<T>::iterator NDArrayView<T>::iterator::first(
+    const NDArrayView& view) {
+  iterator it;
+  it.p_ = view.data_;
+  it.shape_ = view.shape_;
+  it.strides_ = view.strides_;
+  it.index_.assign(view.dimensions_, 0);
+  return it;
+}
+
+// Only the position of an iterator past the end is needed, to compare it
+template <class T>
+typename NDArrayView<T>::iterator NDArrayView<T>::iterator::past_end(
+    const NDArrayView& view) {
+  iterator it;
+  it.position_ = view.size();
+  return it;
+}
+
+template <class T>
+T& NDArrayView<T>::iterator::operator*() const {
+  return *p_;
+}
+
+template <class T>
+T* NDArrayView<T>::iterator::operator->() const {
+  return p_;
+}
+
+template <class T>
+typename NDArrayView<T>::iterator& NDArrayView<T>::iterator::operator++() {
+  position_++;
+
+  // Advance the indices like an odometer, starting from the last axis
+  size_t d = index_.size();
+  if (d == 0) return *this;
+  if (++index_[d - 1] < shape_[d - 1]) {
+    p_ += strides_[d - 1];
+    return *this;
+  }
+  carry();
+  return *this;
+}
+
+template <class T>
+void NDArrayView<T>::iterator::carry() {
+  for (size_t d = index_.size(); d-- > 0;) {
+    if (index_[d] < shape_[d]) {
+      p_ += strides_[d];
+      return;
+    }
+    p_ -= strides_[d] * (shape_[d] - 1);
+    index_[d] = 0;
+    if (d > 0) index_[d - 1]++;
+  }
+}
+
+template <class T>
+typename NDArrayView<T>::iterator NDArrayView<T>::iterator::operator++(int) {
+  iterator previous(*this);
+  ++(*this);
+  return previous;
+}
+
+template <class T>
+const std::vector<size_t>& NDArrayView<T>::iterator::index() const {
+  return index_;
+}
+
+template <class T>
+bool NDArrayView<T>::iterator::operator==(const iterator& other) const {
+  return position_ == other.position_;
+}
+
+template <class T>
+bool NDArrayView<T>::iterator::operator!=(const iterator& other) const {
+  return position_ != other.position_;
+}
+
+template <class T>
+void NDArrayView<T>::fill(const T& val) {
+  if (contiguous()) {
+    ndarray_detail::parallel_fill(data_, val, size());
+  } else {
+    for_each([&val](T& x) { x = val; });
+  }
+}
+
+template <class T>
+template <class C>
+NDArrayView<T>& NDArrayView<T>::operator+=(const NDArrayView<C>& a) {
+  NDArray<typename std::remove_const<C>::type> copy;
+  const NDArrayView<C> b = broadcast_operand(a, "add", copy);
+  if (contiguous_with(b)) {
+    ndarray_detail::parallel_array_add(data_, b.data(), size());
+  } else if (!broadcast_apply(
+                 b,
+                 [](T* p, const C* q, size_t n) {
+                   ndarray_detail::array_add(p, q, n);
+                 },
+                 [](T* p, const C& c, size_t n) {
+                   ndarray_detail::constant_add(p, c, n);
+                 })) {
+    for_each(b, [](T& x, const C& y) { x += y; });
+  }
+  return *this;
+}
+
+template <class T>
+template <class C>
+NDArrayView<T>& NDArrayView<T>::operator-=(const NDArrayView<C>& a) {
+  NDArray<typename std::remove_const<C>::type> copy;
+  const NDArrayView<C> b = broadcast_operand(a, "subtract", copy);
+  if (contiguous_with(b)) {
+    ndarray_detail::parallel_array_subtract(data_, b.data(), size());
+  } else if (!broadcast_apply(
+                 b,
+                 [](T* p, const C* q, size_t n) {
+                   ndarray_detail::array_subtract(p, q, n);
+                 },
+                 [](T* p, const C& c, size_t n) {
+                   ndarray_detail::constant_subtract(p, c, n);
+                 })) {
+    for_each(b, [](T& x, const C& y) { x -= y; });
+  }
+  return *this;
+}
+
+template <class T>
+template <class C>
+NDArrayView<T>& NDArrayView<T>::operator*=(const NDArrayView<C>& a) {
+  NDArray<typename std::remove_const<C>::type> copy;
+  const NDArrayView<C> b = broadcast_operand(a, "multiply", copy);
+  if (contiguous_with(b)) {
+    ndarray_detail::parallel_array_multiply(data_, b.data(), size());
+  } else if (!broadcast_apply(
+                 b,
+                 [](T* p, const C* q, size_t n) {
+                   ndarray_detail::array_multiply(p, q, n);
+                 },
+                 [](T* p, const C& c, size_t n) {
+                   ndarray_detail::constant_multiply(p, c, n);
+                 })) {
+    for_each(b, [](T& x, const C& y) { x *= y; });
+  }
+  return *this;
+}
+
+template <class T>
+template <class C>
+NDArrayView<T>& NDArrayView<T>::operator/=(const NDArrayView<C>& a) {
+  NDArray<typename std::remove_const<C>::type> copy;
+  const NDArrayView<C> b = broadcast_operand(a, "divide", copy);
+  if (contiguous_with(b)) {
+    ndarray_detail::parallel_array_divide(data_, b.data(), size());
+  } else if (!broadcast_apply(
+                 b,
+                 [](T* p, const C* q, size_t n) {
+                   ndarray_detail::array_divide(p, q, n);
+                 },
+                 [](T* p, const C& c, size_t n) {
+                   ndarray_detail::constant_divide(p, c, n);
+                 })) {
+    for_each(b, [](T& x, const C& y) { x /= y; });
+  }
+  return *this;
+}
+
+template <class T>
+template <class C, class A>
+NDArrayView<T>& NDArrayView<T>::operator+=(const NDArray<C, A>& a) {
+  return *this += a.view();
+}
+
+template <class T>
+template <class C, class A>
+NDArrayView<T>& NDArrayView<T>::operator-=(const NDArray<C, A>& a) {
+  return *this -= a.view();
+}
+
+template <class T>
+template <class C, class A>
+NDArrayView<T>& NDArrayView<T>::operator*=(const NDArray<C, A>& a) {
+  return *this *= a.view();
+}
+
+template <class T>
+template <class C, class A>
+NDArrayView<T>& NDArrayView<T>::operator/=(const NDArray<C, A>& a) {
+  return *this /= a.view();
+}
+
+template <class T>
+template <class C>
+NDArrayView<T>& NDArrayView<T>::operator+=(const C& c) {
+  if (contiguous()) {
+    ndarray_detail::parallel_constant_add(data_, c, size());
+  } else {
+    for_each([&c](T& x) { x += c; });
+  }
+  return *this;
+}
+
+template <class T>
+template <class C>
+NDArrayView<T>& NDArrayView<T>::operator-=(const C& c) {
+  if (contiguous()) {
+    ndarray_detail::parallel_constant_subtract(data_, c, size());
+  } else {
+    for_each([&c](T& x) { x -= c; });
+  }
+  return *this;
+}
+
+template <class T>
+template <class C>
+NDArrayView<T>& NDArrayView<T>::operator*=(const C& c) {
+  if (contiguous()) {
+    ndarray_detail::parallel_constant_multiply(data_, c, size());
+  } else {
+    for_each([&c](T& x) { x *= c; });
+  }
+  return *this;
+}
+
+template <class T>
+template <class C>
+NDArrayView<T>& NDArrayView<T>::operator/=(const C& c) {
+  if (contiguous()) {
+    ndarray_detail::parallel_constant_divide(data_, c, size());
+  } else {
+    for_each([&c](T& x) { x /= c; });
+  }
+  return *this;
+}
+
+template <class T>
+template <class INDICES>
+NDARRAY_INLINE size_t
+NDArrayView<T>::element_index(const INDICES& indices) const {
+#if defined(NDARRAY_NO_BOUNDS_CHECK)
+  return unchecked_index(indices);
+#else
+  return checked_index(indices);
+#endif
+}
+
+template <class T>
+template <class INDICES>
+NDARRAY_INLINE size_t
+NDArrayView<T>::checked_index(const INDICES& indices) const {
+  // Make sure proper number of indices
+  if (indices.size() != dimensions_) {
+    std::string mssg = "Improper number of indicies provided to NDArrayView.";
+    throw std::runtime_error(mssg);
+  }
+
+  for (size_t i = 0; i < dimensions_; i++) {
+    if (indices[i] >= shape_[i]) {
+      std::string mssg = "Index provided to NDArrayView out of range.";
+      throw std::out_of_range(mssg);
+    }
+  }
+
+  return unchecked_index(indices);
+}
+
+template <class T>
+template <class INDICES>
+NDARRAY_INLINE size_t
+NDArrayView<T>::unchecked_index(const INDICES& indices) const {
+  size_t indx = 0;
+  for (size_t i = 0; i < dimensions_; i++) {
+    indx += indices[i] * strides_[i];
+  }
+  return indx;
+}
+
+template <class T>
+template <class I, size_t D>
+NDARRAY_INLINE size_t
+NDArrayView<T>::unchecked_index(const std::array<I, D>& indices) const {
+  // Number of indices is known at compile time, so this loop is unrolled
+  const size_t* strides = strides_.data();
+  size_t indx = 0;
+  for (size_t i = 0; i < D; i++) {
+    indx += indices[i] * strides[i];
+  }
+  return indx;
+}
+
+template <class T>
+template <class C>
+NDArrayView<C> NDArrayView<T>::broadcast_operand(
+    const NDArrayView<C>& a, const std::string& operation,
+    NDArray<typename std::remove_const<C>::type>& copy) const {
+  std::vector<size_t> strides = a.strides_;
+  if (a.shape_ != shape_ &&
+      !ndarray_detail::broadcast_strides(a.shape_, a.strides_, shape_,
+                                         strides)) {
+    std::string mssg = "Cannot " + operation +
+                       " two NDArrays with shapes which do not broadcast.";
+    throw std::runtime_error(mssg);
+  }
+
+  if (!ndarray_detail::overlaps_differently(data_, sizeof(T), strides_,
+                                            a.data_, sizeof(C), strides,
+                                            shape_)) {
+    return NDArrayView<C>(a.data_, shape_, strides);
+  }
+
+  copy = a.copy();
+  ndarray_detail::broadcast_strides(copy.shape(), copy.strides(), shape_,
+                                    strides);
+  return NDArrayView<C>(copy.data(), shape_, strides);
+}
+
+template <class T>
+template <class C, class ArrayOp, class ConstantOp>
+bool NDArrayView<T>::broadcast_apply(const NDArrayView<C>& a,
+                                     ArrayOp array_op,
+                                     ConstantOp constant_op) {
+  const bool c_order = c_continuous();
+  if (!c_order && !fortran_continuous()) return false;
+  if (size() == 0) return true;
+
+  // Axes from the fastest varying in memory to the slowest
+  std::vector<size_t> axes(dimensions_);
+  for (size_t i = 0; i < dimensions_; i++) {
+    axes[i] = c_order ? dimensions_ - 1 - i : i;
+  }
+
+  // The inner block is made of the fastest axes, for as long as a is either
+  // laid out like this view along them (a row) or has a stride of zero (a
+  // column, or a single value if it covers all axes)
+  bool row = false;
+  bool column = false;
+  size_t inner = 1;
+  size_t n_inner_axes = 0;
+  for (; n_inner_axes < dimensions_; n_inner_axes++) {
+    const size_t d = axes[n_inner_axes];
+    if (shape_[d] == 1) continue;
+
+    if (a.strides_[d] == 0 && !row) {
+      column = true;
+    } else if (a.strides_[d] == inner && !column) {
+      row = true;
+    } else {
+      break;
+    }
+    inner *= shape_[d];
+  }
+  if (inner == 1 && n_inner_axes < dimensions_) return false;
+
+  T* p = data_;
+  C* q = a.data_;
+  const size_t n_outer = size() / inner;
+
+  // A single block is split between threads, and otherwise whole blocks are
+  if (n_outer == 1) {
+    ndarray_detail::parallel_for(inner, sizeof(T), [=](size_t i, size_t m) {
+      if (row) {
+        array_op(p + i, q + i, m);
+      } else {
+        constant_op(p + i, *q, m);
+      }
+    });
+    return true;
+  }
+
+  ndarray_detail::parallel_chunks(
+      n_outer, 1, size(), [&](size_t begin, size_t count) {
+        for (size_t block = begin; block < begin + count; block++) {
+          // Offset of the block in a, from its indices along the outer axes
+          size_t offset = 0;
+          size_t rest = block;
+          for (size_t k = n_inner_axes; k < dimensions_; k++) {
+            const size_t d = axes[k];
+            offset += (rest % shape_[d]) * a.strides_[d];
+            rest /= shape_[d];
+          }
+
+          if (row) {
+            array_op(p + block * inner, q + offset, inner);
+          } else {
+            constant_op(p + block * inner, q[offset], inner);
+          }
+        }
+      });
+  return true;
+}
+
+template <class T>
+void NDArrayView<T>::check_axis(size_t axis) const {
+  if (axis >= dimensions_) {
+    std::string mssg = "Axis provided to reduction of NDArray out of range.";
+    throw std::out_of_range(mssg);
+  }
+}
+
+template <class T>
+void NDArrayView<T>::check_not_empty(const std::string& operation) const {
+  if (size() == 0) {
+    std::string mssg = "Cannot find the " + operation + " of an empty NDArray.";
+    throw std::runtime_error(mssg);
+  }
+}
+
+template <class T>
+std::vector<size_t> NDArrayView<T>::reduced_shape(size_t axis) const {
+  std::vector<size_t> new_shape;
+  for (size_t i = 0; i < dimensions_; i++) {
+    if (i != axis) new_shape.push_back(shape_[i]);
+  }
+
+  // NDArrays must have at least one dimension
+  if (new_shape.empty()) new_shape.push_back(1);
+  return new_shape;
+}
+
+template <class T>
+bool NDArrayView<T>::reduced_c_continuous() const {
+  return c_continuous() || !fortran_continuous();
+}
+
+template <class T>
+std::vector<size_t> NDArrayView<T>::row_offsets(size_t axis,
+                                                bool c_order) const {
+  // Remaining axes, starting with the one which varies fastest
+  std::vector<size_t> axes;
+  size_t n_rows = 1;
+  for (size_t i = 0; i < dimensions_; i++) {
+    if (i != axis) {
+      axes.push_back(i);
+      n_rows *= shape_[i];
+    }
+  }
+  if (c_order) std::reverse(axes.begin(), axes.end());
+
+  std::vector<size_t> offsets(n_rows);
+  std::vector<size_t> index(axes.size(), 0);
+  size_t offset = 0;
+  for (size_t r = 0; r < n_rows; r++) {
+    offsets[r] = offset;
+
+    // Advance to the next row like an odometer
+    for (size_t i = 0; i < axes.size(); i++) {
+      const size_t d = axes[i];
+      offset += strides_[d];
+      if (++index[i] < shape_[d]) break;
+      offset -= strides_[d] * shape_[d];
+      index[i] = 0;
+    }
+  }
+
+  return offsets;
+}
+
+template <class T>
+template <class R, class OP, class F>
+R NDArrayView<T>::reduce(const F& f) const {
+  if (contiguous()) {
+    return ndarray_detail::blocked_reduce<OP, R>(data_, size(), f);
+  }
+
+  // Otherwise, the rows along the axis with the smallest stride are
+  // reduced, and their results are then combined
+  size_t axis = dimensions_ - 1;
+  for (size_t i = 0; i < dimensions_; i++) {
+    if (shape_[i] > 1 && (shape_[axis] == 1 || strides_[i] < strides_[axis])) {
+      axis = i;
+    }
+  }
+
+  const std::vector<size_t> offsets = row_offsets(axis, true);
+  std::vector<R> partial(offsets.size());
+  ndarray_detail::reduce_rows<OP, R>(data_, offsets, shape_[axis],
+                                     strides_[axis], f, partial.data());
+  return ndarray_detail::pairwise_reduce<OP, R>(
+      partial.data(), partial.size(), 1, [](const R& x) { return x; });
+}
+
+template <class T>
+template <class R, class OP, class F>
+NDArray<R> NDArrayView<T>::reduce(size_t axis, const R& empty,
+                                  const F& f) const {
+  check_axis(axis);
+
+  const bool c_order = reduced_c_continuous();
+  NDArray<R> result(reduced_shape(axis), c_order);
+  const size_t len = shape_[axis];
+  if (len == 0) {
+    result.fill(empty);
+    return result;
+  }
+
+  // Contiguous rows are reduced one at a time, and strided rows together
+  const std::vector<size_t> offsets = row_offsets(axis, c_order);
+  if (strides_[axis] == 1 || offsets.size() == 1) {
+    ndarray_detail::reduce_rows<OP, R>(data_, offsets, len, strides_[axis],
+                                       f, result.data());
+  } else {
+    ndarray_detail::reduce_lanes<OP, R>(data_, offsets, len, strides_[axis],
+                                        f, result.data());
+  }
+
+  return result;
+}
+
+template <class T>
+template <class OP>
+size_t NDArrayView<T>::arg_search(const std::string& operation) const {
+  check_not_empty(operation);
+
+  if (contiguous()) {
+    return ndarray_detail::blocked_arg_search<OP>(data_, size());
+  }
+
+  // Otherwise, the rows along the last axis are searched, so that the index
+  // of the best row gives the row-major index
+  const size_t axis = dimensions_ - 1;
+  const size_t len = shape_[axis];
+  const size_t stride = strides_[axis];
+  const std::vector<size_t> offsets = row_offsets(axis, true);
+  std::vector<size_t> index(offsets.size());
+  ndarray_detail::arg_search_rows<OP>(data_, offsets, len, stride,
+                                      index.data());
+
+  size_t best = 0;
+  for (size_t r = 1; r < offsets.size(); r++) {
+    if (OP::better(data_[offsets[r] + index[r] * stride],
+                   data_[offsets[best] + index[best] * stride])) {
+      best = r;
+    }
+  }
+  return best * len + index[best];
+}
+
+template <class T>
+template <class OP>
+NDArray<size_t> NDArrayView<T>::arg_search(
+    size_t axis, const std::string& operation) const {
+  check_axis(axis);
+  if (shape_[axis] == 0) check_not_empty(operation);
+
+  const bool c_order = reduced_c_continuous();
+  NDArray<size_t> result(reduced_shape(axis), c_order);
+  const size_t len = shape_[axis];
+  const std::vector<size_t> offsets = row_offsets(axis, c_order);
+  if (strides_[axis] == 1 || offsets.size() == 1) {
+    ndarray_detail::arg_search_rows<OP>(data_, offsets, len, strides_[axis],
+                                        result.data());
+  } else {
+    ndarray_detail::arg_search_lanes<OP>(data_, offsets, len, strides_[axis],
+                                         result.data());
+  }
+
+  return result;
+}
+
+template <class T>
+bool NDArrayView<T>::contiguous() const {
+  return c_continuous() || fortran_continuous();
+}
+
+template <class T>
+template <class C>
+bool NDArrayView<T>::contiguous_with(const NDArrayView<C>& a) const {
+  return (c_continuous() && a.c_continuous()) ||
+         (fortran_continuous() && a.fortran_continuous());
+}
+
+template <class T>
+template <class OP>
+void NDArrayView<T>::for_each(OP op) {
+  if (size() == 0) return;
+
+  // Contiguous views are traversed as a single run of elements
+  if (contiguous()) {
+    const size_t ne = size();
+    for (size_t i = 0; i < ne; i++) {
+      op(data_[i]);
+    }
+    return;
+  }
+
+  // Otherwise, the last axis is traversed by the inner loop, and the
+  // remaining indices are advanced like an odometer.
+  const size_t inner = dimensions_ - 1;
+  const size_t n_inner = shape_[inner];
+  const size_t s_inner = strides_[inner];
+  std::vector<size_t> index(dimensions_, 0);
+  T* p = data_;
+
+  while (true) {
+    for (size_t i = 0; i < n_inner; i++) {
+      op(p[i * s_inner]);
+    }
+
+    size_t d = inner;
+    while (true) {
+      if (d == 0) return;
+      d--;
+
+      if (++index[d] < shape_[d]) {
+        p += strides_[d];
+        break;
+      }
+
+      p -= strides_[d] * (shape_[d] - 1);
+      index[d] = 0;
+    }
+  }
+}
+
+template <class T>
+template <class C, class OP>
+void NDArrayView<T>::for_each(const NDArrayView<C>& a, OP op) {
+  if (size() == 0) return;
+
+  // Views with identical contiguous layouts are traversed as a single run of
+  // elements
+  if (contiguous_with(a)) {
+    const size_t ne = size();
+    C* q = a.data_;
+    for (size_t i = 0; i < ne; i++) {
+      op(data_[i], q[i]);
+    }
+    return;
+  }
+
+  // Otherwise, the last axis is traversed by the inner loop, and the
+  // remaining indices are advanced like an odometer.
+  const size_t inner = dimensions_ - 1;
+  const size_t n_inner = shape_[inner];
+  const size_t s_inner = strides_[inner];
+  const size_t a_s_inner = a.strides_[inner];
+  std::vector<size_t> index(dimensions_, 0);
+  T* p = data_;
+  C* q = a.data_;
+
+  while (true) {
+    for (size_t i = 0; i < n_inner; i++) {
+      op(p[i * s_inner], q[i * a_s_inner]);
+    }
+
+    size_t d = inner;
+    while (true) {
+      if (d == 0) return;
+      d--;
+
+      if (++index[d] < shape_[d]) {
+        p += strides_[d];
+        q += a.strides_[d];
+        break;
+      }
+
+      p -= strides_[d] * (shape_[d] - 1);
+      q -= a.strides_[d] * (shape_[d] - 1);
+      index[d] = 0;
+    }
+  }
+}
+
+//==============================================================================
+// StencilPoint Implementation
+template <class T>
+StencilPoint<T>::StencilPoint(const T* data, const std::vector<size_t>& shape,
+                              const std::vector<ptrdiff_t>& strides,
+                              size_t radius, BoundaryMode mode,
+                              const T* constant)
+    : p_(data),
+      strides_(strides.data()),
+      index_(shape.size(), 0),
+      radius_(radius),
+      data_(data),
+      shape_(shape),
+      data_strides_(strides),
+      mode_(mode),
+      constant_(constant),
+      sources_(),
+      sources_begin_(shape.size() + 1, 0),
+      rows_(),
+      rows_strides_(shape.size(), 1),
+      rows_centre_(static_cast<ptrdiff_t>(radius)),
+      digits_(shape.size(), 0) {
+  const size_t d = shape.size();
+  for (size_t i = 0; i < d; i++) {
+    sources_begin_[i + 1] = sources_begin_[i] + shape[i] + 2 * radius;
+  }
+
+  sources_.resize(sources_begin_[d]);
+  for (size_t i = 0; i < d; i++) {
+    for (size_t j = 0; j < shape[i] + 2 * radius; j++) {
+      size_t s = 0;
+      sources_[sources_begin_[i] + j] =
+          ndarray_detail::halo_source(j, shape[i], radius, mode, s)
+              ? static_cast<ptrdiff_t>(s) * strides[i]
+              : -1;
+    }
+  }
+
+  // The rows are each as long as the last axis with its halo, and there is
+  // one for every displacement along the other axes
+  const ptrdiff_t width = static_cast<ptrdiff_t>(2 * radius + 1);
+  if (d > 1) {
+    rows_strides_[d - 2] = static_cast<ptrdiff_t>(shape[d - 1] + 2 * radius);
+  }
+  for (size_t i = d - 1; i-- > 1;) {
+    rows_strides_[i - 1] = rows_strides_[i] * width;
+  }
+  for (size_t i = 0; i + 1 < d; i++) {
+    rows_centre_ += static_cast<ptrdiff_t>(radius) * rows_strides_[i];
+  }
+  rows_.resize(static_cast<size_t>(d > 1 ? rows_strides_[0] * width : 0) +
+               shape[d - 1] + 2 * radius);
+}
+
+template <class T>
+template <typename... DISPS>
+NDARRAY_INLINE const T& StencilPoint<T>::operator()(DISPS... disps) const {
+  const std::array<ptrdiff_t, sizeof...(disps)> d{
+      {static_cast<ptrdiff_t>(disps)...}};
+
+#if !defined(NDARRAY_NO_BOUNDS_CHECK)
+  if (d.size() != index_.size()) {
+    std::string mssg =
+        "Improper number of displacements provided to StencilPoint.";
+    throw std::runtime_error(mssg);
+  }
+
+  const ptrdiff_t radius = static_cast<ptrdiff_t>(radius_);
+  for (size_t i = 0; i < d.size(); i++) {
+    if (d[i] > radius || d[i] < -radius) {
+      std::string mssg =
+          "Displacement provided to StencilPoint beyond the radius of the "
+          "stencil.";
+      throw std::out_of_range(mssg);
+    }
+  }
+#endif
+
+  ptrdiff_t offset = 0;
+  for (size_t i = 0; i < d.size(); i++) offset += d[i] * strides_[i];
+  return p_[offset];
+}
+
+template <class T>
+NDARRAY_INLINE void StencilPoint<T>::move_interior(const T* p) {
+  p_ = p;
+  strides_ = data_strides_.data();
+}
+
+template <class T>
+void StencilPoint<T>::gather(size_t begin, size_t end) {
+  const size_t last = index_.size() - 1;
+  const size_t width = 2 * radius_ + 1;
+  const ptrdiff_t* last_sources = sources_.data() + sources_begin_[last];
+
+  std::fill(digits_.begin(), digits_.end(), 0);
+  T* row = rows_.data();
+  bool done = false;
+  while (!done) {
+    // Offset of the row, or -1 if it lies in a constant halo
+    ptrdiff_t offset = 0;
+    for (size_t i = 0; i < last && offset >= 0; i++) {
+      const ptrdiff_t s = sources_[sources_begin_[i] + index_[i] + digits_[i]];
+      offset = s < 0 ? -1 : offset + s;
+    }
+
+    for (size_t j = begin; j < end + 2 * radius_; j++) {
+      const ptrdiff_t s = last_sources[j];
+      row[j] = (offset < 0 || s < 0) ? *constant_ : data_[offset + s];
+    }
+
+    if (last > 0) row += rows_strides_[last - 1];
+    done = true;
+    for (size_t i = last; i-- > 0;) {
+      if (++digits_[i] < width) {
+        done = false;
+        break;
+      }
+      digits_[i] = 0;
+    }
+  }
+}
+
+template <class T>
+NDARRAY_INLINE void StencilPoint<T>::move_gathered(size_t k) {
+  p_ = rows_.data() + rows_centre_ + static_cast<ptrdiff_t>(k);
+  strides_ = rows_strides_.data();
+}
+
+template <class T>
+NDARRAY_INLINE const T& StencilPoint<T>::center() const {
+  return *p_;
+}
+
+template <class T>
+NDARRAY_INLINE const std::vector<size_t>& StencilPoint<T>::index() const {
+  return index_;
+}
+
+//==============================================================================
+// FixedNDArray Implementation
+template <class T, size_t N>
+FixedNDArray<T, N>::FixedNDArray()
+    : data_{}, shape_(), strides_(), c_continuous_{true} {
+  shape_.fill(0);
+  strides_.fill(0);
+}
+
+template <class T, size_t N>
+FixedNDArray<T, N>::FixedNDArray(const std::array<size_t, N>& init_shape,
+                                 bool c_continuous)
+    : data_{}, shape_(), strides_(), c_continuous_{c_continuous} {
+  ndarray_detail::resize_zeroed(data_, set_shape(init_shape));
+}
+
+template <class T, size_t N>
+FixedNDArray<T, N>::FixedNDArray(const std::vector<T, allocator_type>& data,
+                                 const std::array<size_t, N>& init_shape,
+                                 bool c_continuous)
+    : data_{}, shape_(), strides_(), c_continuous_{c_continuous} {
+  if (set_shape(init_shape) != data.size()) {
+    std::string mssg =
+        "Shape is incompatible with number of elements provided for NDArray.";
+    throw std::runtime_error(mssg);
+  }
+
+  data_ = data;
+}
+
+template <class T, size_t N>
+FixedNDArray<T, N>::FixedNDArray(std::vector<T, allocator_type>&& data,
+                                 const std::array<size_t, N>& init_shape,
+                                 bool c_continuous)
+    : data_{}, shape_(), strides_(), c_continuous_{c_continuous} {
+  if (set_shape(init_shape) != data.size()) {
+    std::string mssg =
+        "Shape is incompatible with number of elements provided for NDArray.";
+    throw std::runtime_error(mssg);
+  }
+
+  data_ = std::move(data);
+}
+
+template <class T, size_t N>
+template <class A>
+FixedNDArray<T, N>::FixedNDArray(const std::vector<T, A>& data,
+                                 const std::array<size_t, N>& init_shape,
+                                 bool c_continuous)
+    : FixedNDArray(std::vector<T, allocator_type>(data.begin(), data.end()),
+                   init_shape, c_continuous) {}
+
+template <class T, size_t N>
+template <class A>
+FixedNDArray<T, N>::FixedNDArray(std::vector<T, A>&& data,
+                                 const std::array<size_t, N>& init_shape,
+                                 bool c_continuous)
+    : FixedNDArray(std::vector<T, allocator_type>(
+                       std::make_move_iterator(data.begin()),
+                       std::make_move_iterator(data.end())),
+                   init_shape, c_continuous) {
+  std::vector<T, A>().swap(data);
+}
+
+template <class T, size_t N>
+FixedNDArray<T, N>::FixedNDArray(const NDArray<T>& a)
+    : data_{}, shape_(), strides_(), c_continuous_{a.c_continuous()} {
+  if (a.shape().size() != N) {
+    std::string mssg =
+        "NDArray must have the same number of dimensions as FixedNDArray.";
+    throw std::runtime_error(mssg);
+  }
+
+  std::array<size_t, N> init_shape{};
+  std::copy(a.shape().begin(), a.shape().end(), init_shape.begin());
+  set_shape(init_shape);
+  data_ = a.data_vector();
+}
+
+template <class T, size_t N>
+FixedNDArray<T, N>::FixedNDArray(NDArray<T>&& a)
+    : data_{}, shape_(), strides_(), c_continuous_{a.c_continuous()} {
+  if (a.shape().size() != N) {
+    std::string mssg =
+        "NDArray must have the same number of dimensions as FixedNDArray.";
+    throw std::runtime_error(mssg);
+  }
+
+  std::array<size_t, N> init_shape{};
+  std::copy(a.shape().begin(), a.shape().end(), init_shape.begin());
+  set_shape(init_shape);
+
+  // Take the data, leaving a as an empty array
+  NDArray<T> moved(std::move(a));
+  data_ = std::move(moved.data_vector());
+}
+
+template <class T, size_t N>
+FixedNDArray<T, N> FixedNDArray<T, N>::load(const std::string& fname) {
+  return FixedNDArray<T, N>(NDArray<T>::load(fname));
+}
+
+template <class T, size_t N>
+NDARRAY_INLINE T& FixedNDArray<T, N>::operator()(
+    const std::array<size_t, N>& indices) {
+  return data_[element_index(indices)];
+}
+
+template <class T, size_t N>
+NDARRAY_INLINE const T& FixedNDArray<T, N>::operator()(
+    const std::array<size_t, N>& indices) const {
+  return data_[element_index(indices)];
+}
+
+template <class T, size_t N>
+template <typename... INDS>
+NDARRAY_INLINE T& FixedNDArray<T, N>::operator()(INDS... inds) {
+  static_assert(sizeof...(INDS) == N,
+                "Improper number of indicies provided to FixedNDArray.");
+  std::array<size_t, N> indices{{static_cast<size_t>(inds)...}};
+  return data_[element_index(indices)];
+}
+
+template <class T, size_t N>
+template <typename... INDS>
+NDARRAY_INLINE const T& FixedNDArray<T, N>::operator()(INDS... inds) const {
+  static_assert(sizeof...(INDS) == N,
+                "Improper number of indicies provided to FixedNDArray.");
+  std::array<size_t, N> indices{{static_cast<size_t>(inds)...}};
+  return data_[element_index(indices)];
+}
+
+template <class T, size_t N>
+NDARRAY_INLINE T& FixedNDArray<T, N>::at(
+    const std::array<size_t, N>& indices) {
+  return data_[checked_index(indices)];
+}
+
+template <class T, size_t N>
+NDARRAY_INLINE const T& FixedNDArray<T, N>::at(
+    const std::array<size_t, N>& indices) const {
+  return data_[checked_index(indices)];
+}
+
+template <class T, size_t N>
+template <typename... INDS>
+NDARRAY_INLINE T& FixedNDArray<T, N>::at(INDS... inds) {
+  static_assert(sizeof...(INDS) == N,
+                "Improper number of indicies provided to FixedNDArray.");
+  std::array<size_t, N> indices{{static_cast<size_t>(inds)...}};
+  return data_[checked_index(indices)];
+}
+
+template <class T, size_t N>
+template <typename... INDS>
+NDARRAY_INLINE const T& FixedNDArray<T, N>::at(INDS... inds) const {
+  static_assert(sizeof...(INDS) == N,
+                "Improper number of indicies provided to FixedNDArray.");
+  std::array<size_t, N> indices{{static_cast<size_t>(inds)...}};
+  return data_[checked_index(indices)];
+}
+
+template <class T, size_t N>
+NDARRAY_INLINE T& FixedNDArray<T, N>::operator[](size_t i) {
+  return data_[i];
+}
+
+template <class T, size_t N>
+NDARRAY_INLINE const T& FixedNDArray<T, N>::operator[](size_t i) const {
+  return data_[i];
+}
+
+template <class T, size_t N>
+NDARRAY_INLINE std::vector<T, typename FixedNDArray<T, N>::allocator_type>&
+FixedNDArray<T, N>::data_vector() {
+  return data_;
+}
+
+template <class T, size_t N>
+NDARRAY_INLINE const std::vector<T,
+                                 typename FixedNDArray<T, N>::allocator_type>&
+FixedNDArray<T, N>::data_vector() const {
+  return data_;
+}
+
+template <class T, size_t N>
+NDARRAY_INLINE T* FixedNDArray<T, N>::data() {
+  return data_.data();
+}
+
+template <class T, size_t N>
+NDARRAY_INLINE const T* FixedNDArray<T, N>::data() const {
+  return data_.data();
+}
+
+template <class T, size_t N>
+NDARRAY_INLINE const std::array<size_t, N>& FixedNDArray<T, N>::shape() const {
+  return shape_;
+}
+
+template <class T, size_t N>
+NDARRAY_INLINE const std::array<size_t, N>& FixedNDArray<T, N>::strides()
+    const {
+  return strides_;
+}
+
+template <class T, size_t N>
+NDARRAY_INLINE size_t FixedNDArray<T, N>::size() const {
+  return data_.size();
+}
+
+template <class T, size_t N>
+NDARRAY_INLINE size_t
+FixedNDArray<T, N>::linear_index(const std::array<size_t, N>& indices) const {
+  return element_index(indices);
+}
+
+template <class T, size_t N>
+template <typename... INDS>
+NDARRAY_INLINE size_t FixedNDArray<T, N>::linear_index(INDS... inds) const {
+  static_assert(sizeof...(INDS) == N,
+                "Improper number of indicies provided to FixedNDArray.");
+  std::array<size_t, N> indices{{static_cast<size_t>(inds)...}};
+  return element_index(indices);
+}
+
+template <class T, size_t N>
+NDARRAY_INLINE bool FixedNDArray<T, N>::c_continuous() const {
+  return c_continuous_;
+}
+
+template <class T, size_t N>
+NDArrayView<T> FixedNDArray<T, N>::view() {
+  return NDArrayView<T>(data_.data(),
+                        std::vector<size_t>(shape_.begin(), shape_.end()),
+                        std::vector<size_t>(strides_.begin(), strides_.end()));
+}
+
+template <class T, size_t N>
+NDArrayView<const T> FixedNDArray<T, N>::view() const {
+  return NDArrayView<const T>(
+      data_.data(), std::vector<size_t>(shape_.begin(), shape_.end()),
+      std::vector<size_t>(strides_.begin(), strides_.end()));
+}
+
+template <class T, size_t N>
+void FixedNDArray<T, N>::save(const std::string& fname) const {
+  write_npy(fname, reinterpret_cast<const char*>(data_.data()),
+            std::vector<size_t>(shape_.begin(), shape_.end()),
+            NDArray<T>::npy_dtype(), c_continuous_);
+}
+
+template <class T, size_t N>
+void FixedNDArray<T, N>::fill(const T& val) {
+  ndarray_detail::parallel_fill(data_.data(), val, data_.size());
+}
+
+template <class T, size_t N>
+void FixedNDArray<T, N>::reshape(const std::array<size_t, N>& new_shape) {
+  size_t ne = new_shape[0];
+  for (size_t i = 1; i < N; i++) {
+    ne *= new_shape[i];
+  }
+
+  if (ne != data_.size()) {
+    std::string mssg =
+        "Shape is incompatible with number of elements in"
+        " NDArray.";
+    throw std::runtime_error(mssg);
+  }
+
+  set_shape(new_shape);
+}
+
+template <class T, size_t N>
+void FixedNDArray<T, N>::reallocate(const std::array<size_t, N>& new_shape) {
+  ndarray_detail::resize_zeroed(data_, set_shape(new_shape));
+}
+
+template <class T, size_t N>
+template <class C>
+FixedNDArray<T, N>& FixedNDArray<T, N>::operator+=(
+    const FixedNDArray<C, N>& a) {
+  check_shape(a, "add");
+
+  // Corresponding elements only have the same linear index if both arrays
+  // have the same storage order, and are otherwise found through the strides
+  if (c_continuous_ != a.c_continuous_ && N > 1) {
+    view() += a.view();
+    return *this;
+  }
+
+  // Do addition
+  ndarray_detail::parallel_array_add(data_.data(), a.data_.data(),
+                                     data_.size());
+
+  return *this;
+}
+
+template <class T, size_t N>
+template <class C>
+FixedNDArray<T, N>& FixedNDArray<T, N>::operator-=(
+    const FixedNDArray<C, N>& a) {
+  check_shape(a, "subtract");
+
+  // Corresponding elements only have the same linear index if both arrays
+  // have the same storage order, and are otherwise found through the strides
+  if (c_continuous_ != a.c_continuous_ && N > 1) {
+    view() -= a.view();
+    return *this;
+  }
+
+  // Do subtraction
+  ndarray_detail::parallel_array_subtract(data_.data(), a.data_.data(),
+                                          data_.size());
+
+  return *this;
+}
+
+template <class T, size_t N>
+template <class C>
+FixedNDArray<T, N>& FixedNDArray<T, N>::operator*=(
+    const FixedNDArray<C, N>& a) {
+  check_shape(a, "multiply");
+
+  // Corresponding elements only have the same linear index if both arrays
+  // have the same storage order, and are otherwise found through the strides
+  if (c_continuous_ != a.c_continuous_ && N > 1) {
+    view() *= a.view();
+    return *this;
+  }
+
+  // Do multiplication
+  ndarray_detail::parallel_array_multiply(data_.data(), a.data_.data(),
+                                          data_.size());
+
+  return *this;
+}
+
+template <class T, size_t N>
+template <class C>
+FixedNDArray<T, N>& FixedNDArray<T, N>::operator/=(
+    const FixedNDArray<C, N>& a) {
+  check_shape(a, "divide");
+
+  // Corresponding elements only have the same linear index if both arrays
+  // have the same storage order, and are otherwise found through the strides
+  if (c_continuous_ != a.c_continuous_ && N > 1) {
+    view() /= a.view();
+    return *this;
+  }
+
+  // Do division
+  ndarray_detail::parallel_array_divide(data_.data(), a.data_.data(),
+                                        data_.size());
+
+  return *this;
+}
+
+template <class T, size_t N>
+template <class C>
+FixedNDArray<T, N>& FixedNDArray<T, N>::operator+=(const C& c) {
+  // Do addition
+  ndarray_detail::parallel_constant_add(data_.data(), c, data_.size());
+
+  return *this;
+}
+
+template <class T, size_t N>
+template <class C>
+FixedNDArray<T, N>& FixedNDArray<T, N>::operator-=(const C& c) {
+  // Do subtraction
+  ndarray_detail::parallel_constant_subtract(data_.data(), c, data_.size());
+
+  return *this;
+}
+
+template <class T, size_t N>
+template <class C>
+FixedNDArray<T, N>& FixedNDArray<T, N>::operator*=(const C& c) {
+  // Do multiplication
+  ndarray_detail::parallel_constant_multiply(data_.data(), c, data_.size());
+
+  return *this;
+}
+
+template <class T, size_t N>
+template <class C>
+FixedNDArray<T, N>& FixedNDArray<T, N>::operator/=(const C& c) {
+  // Do division
+  ndarray_detail::parallel_constant_divide(data_.data(), c, data_.size());
+
+  return *this;
+}
+
+template <class T, size_t N>
+FixedNDArray<T, N>::operator NDArray<T>() const& {
+  return NDArray<T>(data_, std::vector<size_t>(shape_.begin(), shape_.end()),
+                    c_continuous_);
+}
+
+template <class T, size_t N>
+FixedNDArray<T, N>::operator NDArray<T>() && {
+  std::vector<size_t> shape(shape_.begin(), shape_.end());
+  return NDArray<T>(std::move(data_), shape, c_continuous_);
+}
+
+template <class T, size_t N>
+size_t FixedNDArray<T, N>::set_shape(const std::array<size_t, N>& shape) {
+  shape_ = shape;
+
+  strides_.fill(1);
+  if (c_continuous_) {
+    // Last index varies fastest for row-major order
+    for (size_t i = N - 1; i > 0; i--) {
+      strides_[i - 1] = strides_[i] * shape_[i];
+    }
+  } else {
+    // First index varies fastest for column-major order
+    for (size_t i = 1; i < N; i++) {
+      strides_[i] = strides_[i - 1] * shape_[i - 1];
+    }
+  }
+
+  size_t ne = shape_[0];
+  for (size_t i = 1; i < N; i++) {
+    ne *= shape_[i];
+  }
+  return ne;
+}
+
+template <class T, size_t N>
+template <class C>
+void FixedNDArray<T, N>::check_shape(const FixedNDArray<C, N>& a,
+                                     const std::string& operation) const {
+  for (size_t i = 0; i < N; i++) {
+    if (shape_[i] != a.shape_[i]) {
+      std::string mssg =
+          "Cannot " + operation + " two NDArrays with different shapes";
+      throw std::runtime_error(mssg);
+    }
+  }
+}
+
+template <class T, size_t N>
+NDARRAY_INLINE size_t
+FixedNDArray<T, N>::element_index(const std::array<size_t, N>& indices) const {
+#if defined(NDARRAY_NO_BOUNDS_CHECK)
+  return dot(indices, strides_, std::integral_constant<size_t, N>());
+#else
+  return checked_index(indices);
+#endif
+}
+
+template <class T, size_t N>
+NDARRAY_INLINE size_t
+FixedNDArray<T, N>::checked_index(const std::array<size_t, N>& indices) const {
+  for (size_t i = 0; i < N; i++) {
+    if (indices[i] >= shape_[i]) {
+      std::string mssg = "Index provided to NDArray out of range.";
+      throw std::out_of_range(mssg);
+    }
+  }
+
+  return dot(indices, strides_, std::integral_constant<size_t, N>());
+}
+
+template <class T, size_t N>
+template <size_t I>
+NDARRAY_INLINE size_t FixedNDArray<T, N>::dot(
+    const std::array<size_t, N>& indices, const std::array<size_t, N>& strides,
+    std::integral_constant<size_t, I>) {
+  return indices[I - 1] * strides[I - 1] +
+         dot(indices, strides, std::integral_constant<size_t, I - 1>());
+}
+
+template <class T, size_t N>
+NDARRAY_INLINE size_t FixedNDArray<T, N>::dot(
+    const std::array<size_t, N>&, const std::array<size_t, N>&,
+    std::integral_constant<size_t, 0>) {
+  return 0;
+}
+
+//==============================================================================
+// Expression Template Implementation
+template <class E>
+NDARRAY_INLINE const E& NDExpression<E>::self() const {
+  return static_cast<const E&>(*this);
+}
+
+template <class T>
+template <class A>
+NDArrayTerminal<T>::NDArrayTerminal(const NDArray<T, A>& a)
+    : data_{a.data()},
+      shape_{&a.shape()},
+      strides_{&a.strides()},
+      c_order_{a.c_continuous() || a.shape().size() == 1},
+      c_continuous_{a.c_continuous() || a.shape().size() == 1},
+      fortran_continuous_{!a.c_continuous() || a.shape().size() == 1},
+      broadcast_{false},
+      broadcast_shape_{},
+      broadcast_strides_{} {}
+
+template <class T>
+template <class U>
+NDArrayTerminal<T>::NDArrayTerminal(const NDArrayView<U>& a)
+    : data_{a.data()},
+      shape_{&a.shape()},
+      strides_{&a.strides()},
+      c_order_{a.c_continuous() || !a.fortran_continuous()},
+      c_continuous_{a.c_continuous()},
+      fortran_continuous_{a.fortran_continuous()},
+      broadcast_{false},
+      broadcast_shape_{},
+      broadcast_strides_{} {}
+
+template <class T>
+NDARRAY_INLINE const std::vector<size_t>& NDArrayTerminal<T>::shape() const {
+  return broadcast_ ? broadcast_shape_ : *shape_;
+}
+
+template <class T>
+NDARRAY_INLINE bool NDArrayTerminal<T>::c_continuous() const {
+  return c_order_;
+}
+
+template <class T>
+NDARRAY_INLINE bool NDArrayTerminal<T>::contiguous(bool c_order) const {
+  return c_order ? c_continuous_ : fortran_continuous_;
+}
+
+template <class T>
+NDARRAY_INLINE const T& NDArrayTerminal<T>::linear_value(size_t i) const {
+  return data_[i];
+}
+
+template <class T>
+NDARRAY_INLINE const T& NDArrayTerminal<T>::indexed_value(
+    const size_t* indices) const {
+  const std::vector<size_t>& stride_vector =
+      broadcast_ ? broadcast_strides_ : *strides_;
+  const size_t* strides = stride_vector.data();
+  const size_t dimensions = stride_vector.size();
+
+  size_t indx = 0;
+  for (size_t i = 0; i < dimensions; i++) {
+    indx += indices[i] * strides[i];
+  }
+  return data_[indx];
+}
+
+template <class T>
+void NDArrayTerminal<T>::broadcast(const std::vector<size_t>& shape) {
+  if (shape == this->shape()) return;
+
+  std::vector<size_t> strides;
+  if (!ndarray_detail::broadcast_strides(this->shape(),
+                                         broadcast_ ? broadcast_strides_
+                                                    : *strides_,
+                                         shape, strides)) {
+    std::string mssg = "Cannot broadcast NDArray to the shape of expression.";
+    throw std::runtime_error(mssg);
+  }
+
+  broadcast_ = true;
+  broadcast_shape_ = shape;
+  broadcast_strides_ = strides;
+  c_continuous_ = false;
+  fortran_continuous_ = false;
+}
+
+template <class T>
+bool NDArrayTerminal<T>::overlaps(const void* data, size_t element_size,
+                                  const std::vector<size_t>& strides) const {
+  return ndarray_detail::overlaps_differently(
+      data, element_size, strides, data_, sizeof(T),
+      broadcast_ ? broadcast_strides_ : *strides_, shape());
+}
+
+template <class F, class E>
+NDUnaryExpression<F, E>::NDUnaryExpression(const F& f, const E& e)
+    : f_(f), e_(e) {}
+
+template <class F, class E>
+NDARRAY_INLINE const std::vector<size_t>& NDUnaryExpression<F, E>::shape()
+    const {
+  return e_.shape();
+}
+
+template <class F, class E>
+NDARRAY_INLINE bool NDUnaryExpression<F, E>::c_continuous() const {
+  return e_.c_continuous();
+}
+
+template <class F, class E>
+NDARRAY_INLINE bool NDUnaryExpression<F, E>::contiguous(bool c_order) const {
+  return e_.contiguous(c_order);
+}
+
+template <class F, class E>
+NDARRAY_INLINE typename NDUnaryExpression<F, E>::value_type
+NDUnaryExpression<F, E>::linear_value(size_t i) const {
+  return f_(e_.linear_value(i));
+}
+
+template <class F, class E>
+NDARRAY_INLINE typename NDUnaryExpression<F, E>::value_type
+NDUnaryExpression<F, E>::indexed_value(const size_t* indices) const {
+  return f_(e_.indexed_value(indices));
+}
+
+template <class F, class E>
+void NDUnaryExpression<F, E>::broadcast(const std::vector<size_t>& shape) {
+  e_.broadcast(shape);
+}
+
+template <class F, class E>
+bool NDUnaryExpression<F, E>::overlaps(
+    const void* data, size_t element_size,
+    const std::vector<size_t>& strides) const {
+  return e_.overlaps(data, element_size, strides);
+}
+
+template <class F, class L, class R>
+NDBinaryExpression<F, L, R>::NDBinaryExpression(const F& f, const L& l,
+                                                const R& r)
+    : f_(f), l_(l), r_(r) {
+  if (l_.shape() == r_.shape()) return;
+
+  // Both operands are broadcast to the common shape, after which l_ has the
+  // shape of the expression
+  std::vector<size_t> shape;
+  if (!ndarray_detail::broadcast_shape(l_.shape(), r_.shape(), shape)) {
+    std::string mssg = std::string("Cannot ") + F::name() +
+                       " two NDArrays with shapes which do not broadcast.";
+    throw std::runtime_error(mssg);
+  }
+  l_.broadcast(shape);
+  r_.broadcast(shape);
+}
+
+template <class F, class L, class R>
+NDARRAY_INLINE const std::vector<size_t>& NDBinaryExpression<F, L, R>::shape()
+    const {
+  return l_.shape();
+}
+
+template <class F, class L, class R>
+NDARRAY_INLINE bool NDBinaryExpression<F, L, R>::c_continuous() const {
+  return l_.c_continuous();
+}
+
+template <class F, class L, class R>
+NDARRAY_INLINE bool NDBinaryExpression<F, L, R>::contiguous(
+    bool c_order) const {
+  return l_.contiguous(c_order) && r_.contiguous(c_order);
+}
+
+template <class F, class L, class R>
+NDARRAY_INLINE typename NDBinaryExpression<F, L, R>::value_type
+NDBinaryExpression<F, L, R>::linear_value(size_t i) const {
+  return f_(l_.linear_value(i), r_.linear_value(i));
+}
+
+template <class F, class L, class R>
+NDARRAY_INLINE typename NDBinaryExpression<F, L, R>::value_type
+NDBinaryExpression<F, L, R>::indexed_value(const size_t* indices) const {
+  return f_(l_.indexed_value(indices), r_.indexed_value(indices));
+}
+
+template <class F, class L, class R>
+void NDBinaryExpression<F, L, R>::broadcast(const std::vector<size_t>& shape) {
+  l_.broadcast(shape);
+  r_.broadcast(shape);
+}
+
+template <class F, class L, class R>
+bool NDBinaryExpression<F, L, R>::overlaps(
+    const void* data, size_t element_size,
+    const std::vector<size_t>& strides) const {
+  return l_.overlaps(data, element_size, strides) ||
+         r_.overlaps(data, element_size, strides);
+}
+
+//==============================================================================
+// Linear Algebra Implementation
+template <class T, class A, class B>
+NDArray<T> matmul(const NDArray<T, A>& a, const NDArray<T, B>& b) {
+  return matmul(a.view(), b.view());
+}
+
+template <class T1, class T2>
+NDArray<typename NDArrayView<T1>::value_type> matmul(const NDArrayView<T1>& a,
+                                                     const NDArrayView<T2>& b) {
+  typedef typename NDArrayView<T1>::value_type T;
+  static_assert(
+      std::is_same<T, typename NDArrayView<T2>::value_type>::value,
+      "The operands of matmul must have the same element type.");
+
+  // A 1D a is a 1 x k matrix, and a 1D b is a k x 1 matrix
+  std::vector<size_t> a_shape = a.shape();
+  std::vector<size_t> a_strides = a.strides();
+  std::vector<size_t> b_shape = b.shape();
+  std::vector<size_t> b_strides = b.strides();
+  const bool a_vector = a_shape.size() == 1;
+  const bool b_vector = b_shape.size() == 1;
+  if (a_vector) {
+    a_shape.insert(a_shape.begin(), 1);
+    a_strides.insert(a_strides.begin(), 0);
+  }
+  if (b_vector) {
+    b_shape.push_back(1);
+    b_strides.push_back(0);
+  }
+
+  const size_t m = a_shape[a_shape.size() - 2];
+  const size_t k = a_shape.back();
+  const size_t n = b_shape.back();
+  if (b_shape[b_shape.size() - 2] != k) {
+    std::string mssg =
+        "Cannot multiply NDArrays with shapes which do not align.";
+    throw std::runtime_error(mssg);
+  }
+
+  const std::vector<size_t> a_batch(a_shape.begin(), a_shape.end() - 2);
+  const std::vector<size_t> b_batch(b_shape.begin(), b_shape.end() - 2);
+  std::vector<size_t> batch, a_batch_strides, b_batch_strides;
+  if (!ndarray_detail::broadcast_shape(a_batch, b_batch, batch)) {
+    std::string mssg =
+        "Cannot multiply NDArrays with leading axes which do not broadcast.";
+    throw std::runtime_error(mssg);
+  }
+  ndarray_detail::broadcast_strides(
+      a_batch, std::vector<size_t>(a_strides.begin(), a_strides.end() - 2),
+      batch, a_batch_strides);
+  ndarray_detail::broadcast_strides(
+      b_batch, std::vector<size_t>(b_strides.begin(), b_strides.end() - 2),
+      batch, b_batch_strides);
+
+  std::vector<size_t> shape = batch;
+  if (!a_vector) shape.push_back(m);
+  if (!b_vector) shape.push_back(n);
+  if (shape.empty()) shape.push_back(1);
+  NDArray<T> c(shape);
+
+  size_t n_batches = 1;
+  for (size_t i = 0; i < batch.size(); i++) n_batches *= batch[i];
+
+  const size_t a_rs = a_strides[a_strides.size() - 2];
+  const size_t a_cs = a_strides.back();
+  const size_t b_rs = b_strides[b_strides.size() - 2];
+  const size_t b_cs = b_strides.back();
+  const T* a_data = a.data();
+  const T* b_data = b.data();
+  T* c_data = c.data();
+
+  // Each product of a stack is computed by one thread, when there are
+  // enough of them to occupy every thread
+  std::vector<size_t> axes(batch.size());
+  for (size_t i = 0; i < axes.size(); i++) axes[i] = i;
+  auto multiply = [&](size_t begin, size_t count) {
+    ndarray_detail::CopyOdometer position(axes, batch, a_batch_strides,
+                                          b_batch_strides, begin);
+    for (size_t i = begin; i < begin + count; i++, position.next()) {
+      ndarray_detail::gemm(m, n, k, a_data + position.a_offset(), a_rs, a_cs,
+                           b_data + position.b_offset(), b_rs, b_cs,
+                           c_data + i * m * n, n);
+    }
+  };
+  if (n_batches > 1 && n_batches >= num_threads()) {
+    ndarray_detail::parallel_chunks(n_batches, 1, n_batches * m * n * k,
+                                    multiply);
+  } else {
+    multiply(0, n_batches);
+  }
+
+  return c;
+}
+
+template <class T, class A, class B>
+T dot(const NDArray<T, A>& a, const NDArray<T, B>& b) {
+  return dot(a.view(), b.view());
+}
+
+template <class T1, class T2>
+typename NDArrayView<T1>::value_type dot(const NDArrayView<T1>& a,
+                                         const NDArrayView<T2>& b) {
+  typedef typename NDArrayView<T1>::value_type T;
+  static_assert(std::is_same<T, typename NDArrayView<T2>::value_type>::value,
+                "The operands of dot must have the same element type.");
+
+  if (a.shape().size() != 1 || b.shape().size() != 1 ||
+      a.shape()[0] != b.shape()[0]) {
+    std::string mssg = "dot requires two 1D NDArrays of the same length.";
+    throw std::runtime_error(mssg);
+  }
+
+  return ndarray_detail::inner_product<T>(a.data(), a.strides()[0], b.data(),
+                                          b.strides()[0], a.shape()[0]);
+}
+
+//==============================================================================
+// MappedNDArray Implementation
+template <class T>
+MappedNDArray<T>::MappedNDArray()
+    : map_base_{nullptr},
+      map_length_{0},
+      data_{},
+      view_{},
+      size_{0},
+      c_continuous_{true},
+      mode_{MMapMode::ReadOnly} {}
+
+template <class T>
+MappedNDArray<T>::MappedNDArray(const std::string& fname, MMapMode mode)
+    : MappedNDArray() {
+  if (mode == MMapMode::ReadOnly && !std::is_const<T>::value) {
+    std::string mssg =
+        "MappedNDArray of a MMapMode::ReadOnly mapping must have const "
+        "elements.";
+    throw std::runtime_error(mssg);
+  }
+  mode_ = mode;
+
+  // Get expected DType according to T
+  DType expected_dtype = NDArray<value_type>::npy_dtype();
+
+  // Parse header to find where the data begins
+  std::ifstream file(fname, std::ios::binary);
+  std::vector<size_t> shape;
+  DType data_dtype;
+  bool data_is_little_endian = true;
+  size_t data_offset = read_npy_header(file, fname, shape, data_dtype,
+                                       c_continuous_, data_is_little_endian);
+  file.close();
+
+  // Ensure DType variables match
+  if (!npy_dtype_matches(expected_dtype, data_dtype)) {
+    std::string mssg =
+        "NDArray template datatype does not match specified datatype in npy "
         "file.";
     throw std::runtime_error(mssg);
   }
 
-  if (data_shape.size() < 1) {
-    std::string mssg =
-        "Shape vector must have at least one element for NDArray.";
+  size_ = shape[0];
+  for (size_t i = 1; i < shape.size(); i++) {
+    size_ *= shape[i];
+  }
+
+  // Data can only be used in place if it needs no byte swap, and is
+  // suitably aligned for T
+  bool map_file = (system_is_little_endian() == data_is_little_endian) &&
+                  (data_offset % alignof(T) == 0);
+
+#if defined(NDARRAY_HAS_MMAP)
+  if (map_file) {
+    int fd = ::open(fname.c_str(), O_RDONLY);
+    if (fd < 0) {
+      std::string mssg = "Could not open " + fname + ".";
+      throw std::runtime_error(mssg);
+    }
+
+    struct stat file_stat;
+    if (::fstat(fd, &file_stat) != 0) {
+      ::close(fd);
+      std::string mssg = "Could not determine the size of " + fname + ".";
+      throw std::runtime_error(mssg);
+    }
+
+    size_t file_length = static_cast<size_t>(file_stat.st_size);
+    if (file_length < data_offset + size_ * sizeof(T)) {
+      ::close(fd);
+      std::string mssg = fname + " is smaller than its header specifies.";
+      throw std::runtime_error(mssg);
+    }
+
+    int protection = PROT_READ;
+    int flags = MAP_SHARED;
+    if (mode_ == MMapMode::CopyOnWrite) {
+      protection |= PROT_WRITE;
+      flags = MAP_PRIVATE;
+    }
+
+    // The mapping remains valid once the file descriptor is closed
+    void* base = ::mmap(nullptr, file_length, protection, flags, fd, 0);
+    ::close(fd);
+    if (base == MAP_FAILED) {
+      std::string mssg = "Could not memory map " + fname + ".";
+      throw std::runtime_error(mssg);
+    }
+
+    map_base_ = base;
+    map_length_ = file_length;
+    view_ = NDArrayView<T>(
+        reinterpret_cast<T*>(static_cast<char*>(base) + data_offset), shape,
+        c_continuous_);
+  }
+#else
+  map_file = false;
+#endif
+
+  if (!map_file) {
+    // Fall back to reading the data into memory
+    NDArray<value_type> array = NDArray<value_type>::load(fname);
+    data_ = std::move(array.data_);
+    view_ = NDArrayView<T>(data_.data(), shape, c_continuous_);
+  }
+}
+
+template <class T>
+MappedNDArray<T>::~MappedNDArray() {
+  unmap();
+}
+
+template <class T>
+MappedNDArray<T>::MappedNDArray(MappedNDArray&& other)
+    : map_base_{other.map_base_},
+      map_length_{other.map_length_},
+      data_{std::move(other.data_)},
+      view_{other.view_},
+      size_{other.size_},
+      c_continuous_{other.c_continuous_},
+      mode_{other.mode_} {
+  other.map_base_ = nullptr;
+  other.map_length_ = 0;
+  other.view_ = NDArrayView<T>();
+  other.size_ = 0;
+}
+
+template <class T>
+MappedNDArray<T>& MappedNDArray<T>::operator=(MappedNDArray&& other) {
+  if (this != &other) {
+    unmap();
+
+    map_base_ = other.map_base_;
+    map_length_ = other.map_length_;
+    data_ = std::move(other.data_);
+    view_ = other.view_;
+    size_ = other.size_;
+    c_continuous_ = other.c_continuous_;
+    mode_ = other.mode_;
+
+    other.map_base_ = nullptr;
+    other.map_length_ = 0;
+    other.view_ = NDArrayView<T>();
+    other.size_ = 0;
+  }
+
+  return *this;
+}
+
+template <class T>
+NDARRAY_INLINE T& MappedNDArray<T>::operator()(
+    const std::vector<size_t>& indices) {
+  return view_(indices);
+}
+
+template <class T>
+NDARRAY_INLINE const T& MappedNDArray<T>::operator()(
+    const std::vector<size_t>& indices) const {
+  return view_(indices);
+}
+
+template <class T>
+template <typename... INDS>
+NDARRAY_INLINE T& MappedNDArray<T>::operator()(INDS... inds) {
+  return view_(inds...);
+}
+
+template <class T>
+template <typename... INDS>
+NDARRAY_INLINE const T& MappedNDArray<T>::operator()(INDS... inds) const {
+  return view_(inds...);
+}
+
+template <class T>
+NDARRAY_INLINE T& MappedNDArray<T>::at(const std::vector<size_t>& indices) {
+  return view_.at(indices);
+}
+
+template <class T>
+NDARRAY_INLINE const T& MappedNDArray<T>::at(
+    const std::vector<size_t>& indices) const {
+  return view_.at(indices);
+}
+
+template <class T>
+template <typename... INDS>
+NDARRAY_INLINE T& MappedNDArray<T>::at(INDS... inds) {
+  return view_.at(inds...);
+}
+
+template <class T>
+template <typename... INDS>
+NDARRAY_INLINE const T& MappedNDArray<T>::at(INDS... inds) const {
+  return view_.at(inds...);
+}
+
+template <class T>
+NDARRAY_INLINE T& MappedNDArray<T>::operator[](size_t i) {
+  return view_.data()[i];
+}
+
+template <class T>
+NDARRAY_INLINE const T& MappedNDArray<T>::operator[](size_t i) const {
+  return view_.data()[i];
+}
+
+template <class T>
+NDARRAY_INLINE T* MappedNDArray<T>::data() {
+  return view_.data();
+}
+
+template <class T>
+NDARRAY_INLINE const T* MappedNDArray<T>::data() const {
+  return view_.data();
+}
+
+template <class T>
+NDARRAY_INLINE const std::vector<size_t>& MappedNDArray<T>::shape() const {
+  return view_.shape();
+}
+
+template <class T>
+NDARRAY_INLINE size_t MappedNDArray<T>::size() const {
+  return size_;
+}
+
+template <class T>
+NDARRAY_INLINE size_t
+MappedNDArray<T>::linear_index(const std::vector<size_t>& indices) const {
+  return view_.linear_index(indices);
+}
+
+template <class T>
+template <typename... INDS>
+NDARRAY_INLINE size_t MappedNDArray<T>::linear_index(INDS... inds) const {
+  return view_.linear_index(inds...);
+}
+
+template <class T>
+NDARRAY_INLINE bool MappedNDArray<T>::c_continuous() const {
+  return c_continuous_;
+}
+
+template <class T>
+NDARRAY_INLINE bool MappedNDArray<T>::is_mapped() const {
+  return map_base_ != nullptr;
+}
+
+template <class T>
+NDARRAY_INLINE MMapMode MappedNDArray<T>::mode() const {
+  return mode_;
+}
+
+template <class T>
+NDARRAY_INLINE NDArrayView<T> MappedNDArray<T>::view() {
+  return view_;
+}
+
+template <class T>
+NDARRAY_INLINE NDArrayView<const T> MappedNDArray<T>::view() const {
+  return view_;
+}
+
+template <class T>
+void MappedNDArray<T>::unmap() {
+#if defined(NDARRAY_HAS_MMAP)
+  if (map_base_ != nullptr) {
+    ::munmap(map_base_, map_length_);
+  }
+#endif
+  map_base_ = nullptr;
+  map_length_ = 0;
+}
+
+//==============================================================================
+// ChunkedNDArray Implementation
+template <class T>
+ChunkedNDArray<T>::ChunkedNDArray()
+    : shape_{},
+      chunk_shape_{},
+      chunk_bits_{},
+      grid_strides_{},
+      chunk_strides_{},
+      chunks_{},
+      size_{0},
+      chunk_size_{0},
+      n_allocated_{0},
+      dimensions_{0},
+      fill_value_{} {}
+
+template <class T>
+ChunkedNDArray<T>::ChunkedNDArray(const std::vector<size_t>& shape,
+                                  const T& fill_value)
+    : ChunkedNDArray() {
+  // Chunks need not extend beyond the next power of two of each axis
+  std::vector<size_t> chunk_shape = default_chunk_shape(shape.size());
+  for (size_t i = 0; i < shape.size(); i++) {
+    size_t extent = 1;
+    while (extent < shape[i] && extent < chunk_shape[i]) extent *= 2;
+    chunk_shape[i] = extent;
+  }
+  *this = ChunkedNDArray(shape, chunk_shape, fill_value);
+}
+
+template <class T>
+ChunkedNDArray<T>::ChunkedNDArray(const std::vector<size_t>& shape,
+                                  const std::vector<size_t>& chunk_shape,
+                                  const T& fill_value)
+    : ChunkedNDArray() {
+  if (shape.size() < 1) {
+    std::string mssg =
+        "Shape vector must have at least one element for ChunkedNDArray.";
+    throw std::runtime_error(mssg);
+  }
+
+  if (chunk_shape.size() != shape.size()) {
+    std::string mssg =
+        "Chunk shape of ChunkedNDArray must have as many dimensions as its "
+        "shape.";
+    throw std::runtime_error(mssg);
+  }
+
+  shape_ = shape;
+  chunk_shape_ = chunk_shape;
+  dimensions_ = shape.size();
+  fill_value_ = fill_value;
+
+  chunk_bits_.assign(dimensions_, 0);
+  for (size_t i = 0; i < dimensions_; i++) {
+    if (chunk_shape[i] == 0 || (chunk_shape[i] & (chunk_shape[i] - 1)) != 0) {
+      std::string mssg =
+          "Chunk shape of ChunkedNDArray must only have powers of two.";
+      throw std::runtime_error(mssg);
+    }
+    while ((size_t(1) << chunk_bits_[i]) < chunk_shape[i]) chunk_bits_[i]++;
+  }
+
+  // Chunks and the elements within each are both in C order
+  grid_strides_.assign(dimensions_, 1);
+  chunk_strides_.assign(dimensions_, 1);
+  for (size_t i = dimensions_ - 1; i > 0; i--) {
+    const size_t grid_extent =
+        (shape_[i] + chunk_shape_[i] - 1) >> chunk_bits_[i];
+    grid_strides_[i - 1] = grid_strides_[i] * grid_extent;
+    chunk_strides_[i - 1] = chunk_strides_[i] * chunk_shape_[i];
+  }
+
+  size_ = shape_[0];
+  for (size_t i = 1; i < dimensions_; i++) size_ *= shape_[i];
+  chunk_size_ = chunk_strides_[0] * chunk_shape_[0];
+
+  const size_t n_chunks =
+      size_ == 0 ? 0
+                 : grid_strides_[0] *
+                       ((shape_[0] + chunk_shape_[0] - 1) >> chunk_bits_[0]);
+  chunks_.resize(n_chunks);
+}
+
+template <class T>
+ChunkedNDArray<T>::ChunkedNDArray(const ChunkedNDArray& other)
+    : shape_{other.shape_},
+      chunk_shape_{other.chunk_shape_},
+      chunk_bits_{other.chunk_bits_},
+      grid_strides_{other.grid_strides_},
+      chunk_strides_{other.chunk_strides_},
+      chunks_(other.chunks_.size()),
+      size_{other.size_},
+      chunk_size_{other.chunk_size_},
+      n_allocated_{other.n_allocated_},
+      dimensions_{other.dimensions_},
+      fill_value_{other.fill_value_} {
+  for (size_t n = 0; n < chunks_.size(); n++) {
+    if (other.chunks_[n]) {
+      chunks_[n].reset(new T[chunk_size_]);
+      std::copy(other.chunks_[n].get(), other.chunks_[n].get() + chunk_size_,
+                chunks_[n].get());
+    }
+  }
+}
+
+template <class T>
+ChunkedNDArray<T>& ChunkedNDArray<T>::operator=(const ChunkedNDArray& other) {
+  if (this != &other) *this = ChunkedNDArray(other);
+  return *this;
+}
+
+template <class T>
+NDARRAY_INLINE T& ChunkedNDArray<T>::operator()(
+    const std::vector<size_t>& indices) {
+  size_t chunk, offset;
+  locate(indices, chunk, offset);
+  return element(chunk, offset);
+}
+
+template <class T>
+NDARRAY_INLINE const T& ChunkedNDArray<T>::operator()(
+    const std::vector<size_t>& indices) const {
+  size_t chunk, offset;
+  locate(indices, chunk, offset);
+  return element(chunk, offset);
+}
+
+template <class T>
+template <typename... INDS>
+NDARRAY_INLINE T& ChunkedNDArray<T>::operator()(INDS... inds) {
+  std::array<size_t, sizeof...(inds)> indices{static_cast<size_t>(inds)...};
+  size_t chunk, offset;
+  locate(indices, chunk, offset);
+  return element(chunk, offset);
+}
+
+template <class T>
+template <typename... INDS>
+NDARRAY_INLINE const T& ChunkedNDArray<T>::operator()(INDS... inds) const {
+  std::array<size_t, sizeof...(inds)> indices{static_cast<size_t>(inds)...};
+  size_t chunk, offset;
+  locate(indices, chunk, offset);
+  return element(chunk, offset);
+}
+
+template <class T>
+NDARRAY_INLINE T& ChunkedNDArray<T>::at(const std::vector<size_t>& indices) {
+  size_t chunk, offset;
+  checked_locate(indices, chunk, offset);
+  return element(chunk, offset);
+}
+
+template <class T>
+NDARRAY_INLINE const T& ChunkedNDArray<T>::at(
+    const std::vector<size_t>& indices) const {
+  size_t chunk, offset;
+  checked_locate(indices, chunk, offset);
+  return element(chunk, offset);
+}
+
+template <class T>
+template <typename... INDS>
+NDARRAY_INLINE T& ChunkedNDArray<T>::at(INDS... inds) {
+  std::array<size_t, sizeof...(inds)> indices{static_cast<size_t>(inds)...};
+  size_t chunk, offset;
+  checked_locate(indices, chunk, offset);
+  return element(chunk, offset);
+}
+
+template <class T>
+template <typename... INDS>
+NDARRAY_INLINE const T& ChunkedNDArray<T>::at(INDS... inds) const {
+  std::array<size_t, sizeof...(inds)> indices{static_cast<size_t>(inds)...};
+  size_t chunk, offset;
+  checked_locate(indices, chunk, offset);
+  return element(chunk, offset);
+}
+
+template <class T>
+T& ChunkedNDArray<T>::operator[](size_t i) {
+  std::vector<size_t> indices(dimensions_);
+  for (size_t d = dimensions_; d-- > 0;) {
+    indices[d] = i % shape_[d];
+    i /= shape_[d];
+  }
+  size_t chunk, offset;
+  unchecked_locate(indices, chunk, offset);
+  return element(chunk, offset);
+}
+
+template <class T>
+const T& ChunkedNDArray<T>::operator[](size_t i) const {
+  std::vector<size_t> indices(dimensions_);
+  for (size_t d = dimensions_; d-- > 0;) {
+    indices[d] = i % shape_[d];
+    i /= shape_[d];
+  }
+  size_t chunk, offset;
+  unchecked_locate(indices, chunk, offset);
+  return element(chunk, offset);
+}
+
+template <class T>
+void ChunkedNDArray<T>::fill(const T& val) {
+  for (size_t n = 0; n < chunks_.size(); n++) chunks_[n].reset();
+  n_allocated_ = 0;
+  fill_value_ = val;
+}
+
+template <class T>
+void ChunkedNDArray<T>::save(const std::string& fname) const {
+  NpyWriter writer(fname, shape_, NDArray<T>::npy_dtype());
+
+  // Each slab is within a single layer of chunks along the leading axis,
+  // and holds no more than about a million elements where possible
+  const size_t row_size = size_ / std::max<size_t>(shape_[0], 1);
+  size_t slab_rows = chunk_shape_[0];
+  while (slab_rows > 1 && slab_rows * row_size > (size_t(1) << 20)) {
+    slab_rows /= 2;
+  }
+
+  std::vector<T, AlignedAllocator<T>> slab(slab_rows * row_size);
+  for (size_t begin = 0; begin < shape_[0]; begin += slab_rows) {
+    const size_t end = std::min(shape_[0], begin + slab_rows);
+    densify_rows(begin, end, slab.data());
+    writer.append(reinterpret_cast<const char*>(slab.data()), end - begin);
+  }
+  writer.close();
+}
+
+template <class T>
+NDARRAY_INLINE const std::vector<size_t>& ChunkedNDArray<T>::shape() const {
+  return shape_;
+}
+
+template <class T>
+NDARRAY_INLINE size_t ChunkedNDArray<T>::size() const {
+  return size_;
+}
+
+template <class T>
+NDARRAY_INLINE const std::vector<size_t>& ChunkedNDArray<T>::chunk_shape()
+    const {
+  return chunk_shape_;
+}
+
+template <class T>
+NDARRAY_INLINE const T& ChunkedNDArray<T>::fill_value() const {
+  return fill_value_;
+}
+
+template <class T>
+NDARRAY_INLINE size_t ChunkedNDArray<T>::n_chunks() const {
+  return chunks_.size();
+}
+
+template <class T>
+NDARRAY_INLINE size_t ChunkedNDArray<T>::n_allocated_chunks() const {
+  return n_allocated_;
+}
+
+template <class T>
+size_t ChunkedNDArray<T>::allocated_bytes() const {
+  return n_allocated_ * chunk_size_ * sizeof(T) +
+         chunks_.size() * sizeof(std::unique_ptr<T[]>);
+}
+
+template <class T>
+std::vector<size_t> ChunkedNDArray<T>::default_chunk_shape(size_t dimensions) {
+  const size_t bits = dimensions == 0 ? 0 : 15 / dimensions;
+  return std::vector<size_t>(dimensions, size_t(1) << bits);
+}
+
+template <class T>
+template <class INDICES>
+NDARRAY_INLINE void ChunkedNDArray<T>::locate(const INDICES& indices,
+                                              size_t& chunk,
+                                              size_t& offset) const {
+#if defined(NDARRAY_NO_BOUNDS_CHECK)
+  unchecked_locate(indices, chunk, offset);
+#else
+  checked_locate(indices, chunk, offset);
+#endif
+}
+
+template <class T>
+template <class INDICES>
+void ChunkedNDArray<T>::checked_locate(const INDICES& indices, size_t& chunk,
+                                       size_t& offset) const {
+  // Make sure proper number of indices
+  if (indices.size() != dimensions_) {
+    std::string mssg =
+        "Improper number of indicies provided to ChunkedNDArray.";
+    throw std::runtime_error(mssg);
+  }
+
+  for (size_t i = 0; i < dimensions_; i++) {
+    if (indices[i] >= shape_[i]) {
+      std::string mssg = "Index provided to ChunkedNDArray out of range.";
+      throw std::out_of_range(mssg);
+    }
+  }
+
+  unchecked_locate(indices, chunk, offset);
+}
+
+template <class T>
+template <class INDICES>
+NDARRAY_INLINE void ChunkedNDArray<T>::unchecked_locate(const INDICES& indices,
+                                                        size_t& chunk,
+                                                        size_t& offset) const {
+  chunk = 0;
+  offset = 0;
+  for (size_t i = 0; i < indices.size(); i++) {
+    const size_t index = static_cast<size_t>(indices[i]);
+    chunk += (index >> chunk_bits_[i]) * grid_strides_[i];
+    offset += (index & (chunk_shape_[i] - 1)) * chunk_strides_[i];
+  }
+}
+
+template <class T>
+NDARRAY_INLINE T& ChunkedNDArray<T>::element(size_t chunk, size_t offset) {
+  T* data = chunks_[chunk].get();
+  if (data == nullptr) {
+    data = new T[chunk_size_];
+    std::fill(data, data + chunk_size_, fill_value_);
+    chunks_[chunk].reset(data);
+    n_allocated_++;
+  }
+  return data[offset];
+}
+
+template <class T>
+NDARRAY_INLINE const T& ChunkedNDArray<T>::element(size_t chunk,
+                                                   size_t offset) const {
+  const T* data = chunks_[chunk].get();
+  return data == nullptr ? fill_value_ : data[offset];
+}
+
+template <class T>
+void ChunkedNDArray<T>::densify_rows(size_t begin, size_t end, T* out) const {
+  const size_t last = dimensions_ - 1;
+  if (begin >= end || size_ == 0) return;
+
+  std::vector<size_t> out_strides(dimensions_, 1);
+  for (size_t i = last; i > 0; i--) {
+    out_strides[i - 1] = out_strides[i] * shape_[i];
+  }
+
+  // Extent of the rows along each axis
+  std::vector<size_t> lower(dimensions_, 0), upper(shape_);
+  lower[0] = begin;
+  upper[0] = end;
+
+  // Visit each chunk overlapping the rows, copying each of its lines along
+  // the last axis which lies within them
+  std::vector<size_t> grid_index(dimensions_);
+  for (size_t i = 0; i < dimensions_; i++) {
+    grid_index[i] = lower[i] >> chunk_bits_[i];
+  }
+  std::vector<size_t> lo(dimensions_), hi(dimensions_), index(dimensions_);
+
+  bool chunks_done = false;
+  while (!chunks_done) {
+    size_t n = 0;
+    for (size_t i = 0; i < dimensions_; i++) {
+      lo[i] = std::max(lower[i], grid_index[i] << chunk_bits_[i]);
+      hi[i] = std::min(upper[i], (grid_index[i] + 1) << chunk_bits_[i]);
+      n += grid_index[i] * grid_strides_[i];
+    }
+    const T* data = chunks_[n].get();
+    const size_t line = hi[last] - lo[last];
+
+    index = lo;
+    bool done = false;
+    while (!done) {
+      size_t o = 0, e = 0;
+      for (size_t i = 0; i < dimensions_; i++) {
+        o += (index[i] - lower[i]) * out_strides[i];
+        e += (index[i] & (chunk_shape_[i] - 1)) * chunk_strides_[i];
+      }
+      if (data != nullptr) {
+        std::copy(data + e, data + e + line, out + o);
+      } else {
+        std::fill(out + o, out + o + line, fill_value_);
+      }
+
+      // Advance the axes before the last like an odometer
+      done = true;
+      for (size_t i = last; i-- > 0;) {
+        if (++index[i] < hi[i]) {
+          done = false;
+          break;
+        }
+        index[i] = lo[i];
+      }
+    }
+
+    chunks_done = true;
+    for (size_t i = dimensions_; i-- > 0;) {
+      if (++grid_index[i] <= (upper[i] - 1) >> chunk_bits_[i]) {
+        chunks_done = false;
+        break;
+      }
+      grid_index[i] = lower[i] >> chunk_bits_[i];
+    }
+  }
+}
+
+//==============================================================================
+// SharedNDArray Implementation
+template <class T, class Allocator>
+SharedNDArray<T, Allocator>::SharedNDArray()
+    : array_{std::make_shared<NDArray<T, Allocator>>()} {}
+
+template <class T, class Allocator>
+SharedNDArray<T, Allocator>::SharedNDArray(const NDArray<T, Allocator>& a)
+    : array_{std::make_shared<NDArray<T, Allocator>>(a)} {}
+
+template <class T, class Allocator>
+SharedNDArray<T, Allocator>::SharedNDArray(NDArray<T, Allocator>&& a)
+    : array_{std::make_shared<NDArray<T, Allocator>>(std::move(a))} {}
+
+template <class T, class Allocator>
+NDARRAY_INLINE T& SharedNDArray<T, Allocator>::operator()(
+    const std::vector<size_t>& indices) {
+  detach();
+  return (*array_)(indices);
+}
+
+template <class T, class Allocator>
+NDARRAY_INLINE const T& SharedNDArray<T, Allocator>::operator()(
+    const std::vector<size_t>& indices) const {
+  return array()(indices);
+}
+
+template <class T, class Allocator>
+template <typename... INDS>
+NDARRAY_INLINE T& SharedNDArray<T, Allocator>::operator()(INDS... inds) {
+  detach();
+  return (*array_)(inds...);
+}
+
+template <class T, class Allocator>
+template <typename... INDS>
+NDARRAY_INLINE const T& SharedNDArray<T, Allocator>::operator()(
+    INDS... inds) const {
+  return array()(inds...);
+}
+
+template <class T, class Allocator>
+NDARRAY_INLINE T& SharedNDArray<T, Allocator>::at(
+    const std::vector<size_t>& indices) {
+  detach();
+  return array_->at(indices);
+}
+
+template <class T, class Allocator>
+NDARRAY_INLINE const T& SharedNDArray<T, Allocator>::at(
+    const std::vector<size_t>& indices) const {
+  return array().at(indices);
+}
+
+template <class T, class Allocator>
+template <typename... INDS>
+NDARRAY_INLINE T& SharedNDArray<T, Allocator>::at(INDS... inds) {
+  detach();
+  return array_->at(inds...);
+}
+
+template <class T, class Allocator>
+template <typename... INDS>
+NDARRAY_INLINE const T& SharedNDArray<T, Allocator>::at(INDS... inds) const {
+  return array().at(inds...);
+}
+
+template <class T, class Allocator>
+NDARRAY_INLINE T& SharedNDArray<T, Allocator>::operator[](size_t i) {
+  detach();
+  return (*array_)[i];
+}
+
+template <class T, class Allocator>
+NDARRAY_INLINE const T& SharedNDArray<T, Allocator>::operator[](
+    size_t i) const {
+  return array()[i];
+}
+
+template <class T, class Allocator>
+template <class C>
+SharedNDArray<T, Allocator>& SharedNDArray<T, Allocator>::operator+=(
+    const C& c) {
+  detach();
+  *array_ += c;
+  return *this;
+}
+
+template <class T, class Allocator>
+template <class C>
+SharedNDArray<T, Allocator>& SharedNDArray<T, Allocator>::operator-=(
+    const C& c) {
+  detach();
+  *array_ -= c;
+  return *this;
+}
+
+template <class T, class Allocator>
+template <class C>
+SharedNDArray<T, Allocator>& SharedNDArray<T, Allocator>::operator*=(
+    const C& c) {
+  detach();
+  *array_ *= c;
+  return *this;
+}
+
+template <class T, class Allocator>
+template <class C>
+SharedNDArray<T, Allocator>& SharedNDArray<T, Allocator>::operator/=(
+    const C& c) {
+  detach();
+  *array_ /= c;
+  return *this;
+}
+
+template <class T, class Allocator>
+template <class C, class A>
+SharedNDArray<T, Allocator>& SharedNDArray<T, Allocator>::operator+=(
+    const SharedNDArray<C, A>& a) {
+  detach();
+  *array_ += a.array();
+  return *this;
+}
+
+template <class T, class Allocator>
+template <class C, class A>
+SharedNDArray<T, Allocator>& SharedNDArray<T, Allocator>::operator-=(
+    const SharedNDArray<C, A>& a) {
+  detach();
+  *array_ -= a.array();
+  return *this;
+}
+
+template <class T, class Allocator>
+template <class C, class A>
+SharedNDArray<T, Allocator>& SharedNDArray<T, Allocator>::operator*=(
+    const SharedNDArray<C, A>& a) {
+  detach();
+  *array_ *= a.array();
+  return *this;
+}
+
+template <class T, class Allocator>
+template <class C, class A>
+SharedNDArray<T, Allocator>& SharedNDArray<T, Allocator>::operator/=(
+    const SharedNDArray<C, A>& a) {
+  detach();
+  *array_ /= a.array();
+  return *this;
+}
+
+template <class T, class Allocator>
+void SharedNDArray<T, Allocator>::fill(const T& val) {
+  if (is_shared()) {
+    std::shared_ptr<NDArray<T, Allocator>> filled =
+        std::make_shared<NDArray<T, Allocator>>();
+    filled->c_continuous_ = array_->c_continuous_;
+    filled->allocate_for_overwrite(array_->shape_);
+    array_ = std::move(filled);
+  }
+  array_->fill(val);
+}
+
+template <class T, class Allocator>
+NDArray<T, Allocator>& SharedNDArray<T, Allocator>::mutable_array() {
+  detach();
+  return *array_;
+}
+
+template <class T, class Allocator>
+NDARRAY_INLINE T* SharedNDArray<T, Allocator>::data() {
+  detach();
+  return array_->data();
+}
+
+template <class T, class Allocator>
+NDArrayView<T> SharedNDArray<T, Allocator>::view() {
+  detach();
+  return array_->view();
+}
+
+template <class T, class Allocator>
+NDARRAY_INLINE const NDArray<T, Allocator>& SharedNDArray<T, Allocator>::array()
+    const {
+  return *array_;
+}
+
+template <class T, class Allocator>
+NDARRAY_INLINE const T* SharedNDArray<T, Allocator>::data() const {
+  return array().data();
+}
+
+template <class T, class Allocator>
+NDArrayView<const T> SharedNDArray<T, Allocator>::view() const {
+  return array().view();
+}
+
+template <class T, class Allocator>
+NDARRAY_INLINE const std::vector<size_t>& SharedNDArray<T, Allocator>::shape()
+    const {
+  return array_->shape();
+}
+
+template <class T, class Allocator>
+NDARRAY_INLINE size_t SharedNDArray<T, Allocator>::size() const {
+  return array_->size();
+}
+
+template <class T, class Allocator>
+NDARRAY_INLINE const std::vector<size_t>&
+SharedNDArray<T, Allocator>::strides() const {
+  return array_->strides();
+}
+
+template <class T, class Allocator>
+NDARRAY_INLINE bool SharedNDArray<T, Allocator>::c_continuous() const {
+  return array_->c_continuous();
+}
+
+template <class T, class Allocator>
+NDARRAY_INLINE size_t SharedNDArray<T, Allocator>::use_count() const {
+  return static_cast<size_t>(array_.use_count());
+}
+
+template <class T, class Allocator>
+NDARRAY_INLINE bool SharedNDArray<T, Allocator>::is_shared() const {
+  return array_.use_count() > 1;
+}
+
+template <class T, class Allocator>
+void SharedNDArray<T, Allocator>::save(const std::string& fname) const {
+  array_->save(fname);
+}
+
+template <class T, class Allocator>
+NDARRAY_INLINE void SharedNDArray<T, Allocator>::detach() {
+  if (array_.use_count() > 1) {
+    array_ = std::make_shared<NDArray<T, Allocator>>(*array_);
+  } else {
+    // The count is read without ordering. Once it is one, this fence orders
+    // the writes which follow after the reads made by any copy which has
+    // since released the array, as its release of the count was ordered.
+    std::atomic_thread_fence(std::memory_order_acquire);
+  }
+}
+
+//==============================================================================
+// NPY Function Definitions
+namespace ndarray_detail {
+
+// Single pass parser of the Python dictionary literal in the header of a
+// .npy file, which never reads beyond the end of the header.
+class NpyHeaderParser {
+ public:
+  NpyHeaderParser(const char* begin, const char* end, const std::string& fname)
+      : p_(begin), end_(end), fname_(fname) {}
+
+  void parse(std::vector<size_t>& shape, DType& dtype, bool& c_contiguous,
+             bool& little_endian) {
+    bool has_descr = false, has_order = false, has_shape = false;
+
+    expect('{');
+    while (true) {
+      skip_space();
+      if (peek() == '}') break;
+
+      const char* key;
+      size_t key_length;
+      parse_string(key, key_length);
+      expect(':');
+      skip_space();
+
+      if (matches(key, key_length, "descr")) {
+        const char* descr;
+        size_t descr_length;
+        parse_string(descr, descr_length);
+        parse_descr(descr, descr_length, dtype, little_endian);
+        has_descr = true;
+      } else if (matches(key, key_length, "fortran_order")) {
+        c_contiguous = !parse_bool();
+        has_order = true;
+      } else if (matches(key, key_length, "shape")) {
+        parse_shape(shape);
+        has_shape = true;
+      } else {
+        fail();
+      }
+
+      skip_space();
+      if (peek() == ',') {
+        p_++;
+      } else if (peek() != '}') {
+        fail();
+      }
+    }
+
+    if (!has_descr || !has_order || !has_shape) fail();
+  }
+
+ private:
+  const char* p_;
+  const char* end_;
+  const std::string& fname_;
+
+  void fail() const {
+    std::string mssg = fname_ + " has an invalid .npy header.";
+    throw std::runtime_error(mssg);
+  }
+
+  char peek() const {
+    if (p_ == end_) fail();
+    return *p_;
+  }
+
+  void skip_space() {
+    while (p_ != end_ && (*p_ == ' ' || *p_ == '\t' || *p_ == '\n')) p_++;
+  }
+
+  void expect(char c) {
+    skip_space();
+    if (peek() != c) fail();
+    p_++;
+  }
+
+  static bool matches(const char* s, size_t length, const char* word) {
+    return std::strlen(word) == length && std::memcmp(s, word, length) == 0;
+  }
+
+  // Strings are quoted with either ' or ", and contain no escapes
+  void parse_string(const char*& s, size_t& length) {
+    char quote = peek();
+    if (quote != '\'' && quote != '"') fail();
+    s = ++p_;
+    while (peek() != quote) p_++;
+    length = static_cast<size_t>(p_ - s);
+    p_++;
+  }
+
+  bool parse_bool() {
+    if (end_ - p_ >= 4 && std::memcmp(p_, "True", 4) == 0) {
+      p_ += 4;
+      return true;
+    }
+    if (end_ - p_ >= 5 && std::memcmp(p_, "False", 5) == 0) {
+      p_ += 5;
+      return false;
+    }
+    fail();
+    return false;
+  }
+
+  void parse_descr(const char* descr, size_t length, DType& dtype,
+                   bool& little_endian) {
+    if (length < 2) fail();
+    switch (descr[0]) {
+      case '<':
+        little_endian = true;
+        break;
+      case '>':
+        little_endian = false;
+        break;
+      case '|':
+      case '=':
+        little_endian = system_is_little_endian();
+        break;
+      default:
+        fail();
+    }
+    dtype = descr_to_DType(std::string(descr + 1, length - 1));
+  }
+
+  // An empty tuple is the shape of a scalar, held as one element
+  void parse_shape(std::vector<size_t>& shape) {
+    shape.clear();
+    expect('(');
+    while (true) {
+      skip_space();
+      if (peek() == ')') break;
+
+      if (peek() < '0' || peek() > '9') fail();
+      size_t value = 0;
+      while (p_ != end_ && *p_ >= '0' && *p_ <= '9') {
+        size_t digit = static_cast<size_t>(*p_ - '0');
+        if (value > (std::numeric_limits<size_t>::max() - digit) / 10) fail();
+        value = 10 * value + digit;
+        p_++;
+      }
+      // Python 2 may write long integers with a trailing L
+      if (p_ != end_ && *p_ == 'L') p_++;
+      shape.push_back(value);
+
+      skip_space();
+      if (peek() == ',') {
+        p_++;
+      } else if (peek() != ')') {
+        fail();
+      }
+    }
+    p_++;
+
+    if (shape.empty()) shape.push_back(1);
+  }
+};
+
+}  // namespace ndarray_detail
+
+inline size_t read_npy_header(std::istream& file, const std::string& fname,
+                              std::vector<size_t>& shape, DType& dtype,
+                              bool& c_contiguous, bool& little_endian) {
+  // Read magic string, version, and the first two bytes of the length
+  char preamble[12];
+  file.read(preamble, 10);
+
+  // Ensure magic string has right value
+  if (!file || std::memcmp(preamble, "\x93NUMPY", 6) != 0) {
+    std::string mssg = fname + " is an invalid .npy file.";
+    throw std::runtime_error(mssg);
+  }
+
+  // Version 1 stores the length of the header in two bytes, and later
+  // versions in four. The value is stored as little endian.
+  const unsigned char major_version = static_cast<unsigned char>(preamble[6]);
+  size_t preamble_length = 10;
+  if (major_version >= 0x02) {
+    file.read(preamble + 10, 2);
+    preamble_length = 12;
+  }
+  if (!file || major_version < 0x01) {
+    std::string mssg = fname + " is an invalid .npy file.";
     throw std::runtime_error(mssg);
   }
 
-  // Number of elements
-  size_t ne = data_shape[0];
-  for (size_t i = 1; i < data_shape.size(); i++) {
-    ne *= data_shape[i];
+  uint32_t length_of_header = 0;
+  for (size_t i = preamble_length; i-- > 8;) {
+    length_of_header = (length_of_header << 8) |
+                       static_cast<unsigned char>(preamble[i]);
   }
 
-  data_vector = {reinterpret_cast<T*>(data_ptr),
-                 reinterpret_cast<T*>(data_ptr) + ne};
+  // The header is read into a buffer on the stack, unless it is very long
+  char small_header[4096];
+  std::vector<char> large_header;
+  char* header = small_header;
+  if (length_of_header > sizeof(small_header)) {
+    large_header.resize(length_of_header);
+    header = large_header.data();
+  }
 
-  // Free data_ptr
-  delete[] data_ptr;
+  file.read(header, length_of_header);
+  if (static_cast<uint32_t>(file.gcount()) != length_of_header) {
+    std::string mssg = fname + " is an invalid .npy file.";
+    throw std::runtime_error(mssg);
+  }
 
-  // Create NDArray object
-  NDArray<T> return_object(std::move(data_vector), data_shape);
-  return_object.c_continuous_ = data_c_continuous;
+  ndarray_detail::NpyHeaderParser(header, header + length_of_header, fname)
+      .parse(shape, dtype, c_contiguous, little_endian);
 
-  // Return object
-  return return_object;
+  NDARRAY_STATS_ADD(bytes_read, preamble_length + length_of_header);
+  return preamble_length + length_of_header;
 }
 
-template <class T>
-NDARRAY_INLINE T& NDArray<T>::operator()(const std::vector<size_t>& indices) {
-  size_t indx;
-  if (c_continuous_) {
-    // Get linear index for row-major order
-    indx = c_continuous_index(indices);
-  } else {
-    // Get linear index for column-major order
-    indx = fortran_continuous_index(indices);
+inline NpyHeaderInfo npy_header_info(const std::string& fname) {
+  std::ifstream file(fname, std::ios::binary);
+  if (!file) {
+    std::string mssg = "Could not open " + fname + ".";
+    throw std::runtime_error(mssg);
   }
-  return data_[indx];
+
+  NpyHeaderInfo info;
+  bool c_contiguous = true;
+  info.data_offset = read_npy_header(file, fname, info.shape, info.dtype,
+                                     c_contiguous, info.little_endian);
+  info.fortran_order = !c_contiguous;
+  return info;
 }
 
-template <class T>
-NDARRAY_INLINE const T& NDArray<T>::operator()(
-    const std::vector<size_t>& indices) const {
-  size_t indx;
-  if (c_continuous_) {
-    // Get linear index for row-major order
-    indx = c_continuous_index(indices);
+inline void load_npy(const std::string& fname, char*& data_ptr,
+                     std::vector<size_t>& shape, DType& dtype,
+                     bool& c_contiguous) {
+  char* data = nullptr;
+  auto allocate = [&data](const std::vector<size_t>& data_shape,
+                          DType data_dtype, bool) -> char* {
+    size_t n_elements = data_shape[0];
+    for (size_t j = 1; j < data_shape.size(); j++) n_elements *= data_shape[j];
+    data = new char[n_elements * size_of_DType(data_dtype)];
+    return data;
+  };
+
+  try {
+    load_npy(fname, allocate, shape, dtype, c_contiguous);
+  } catch (...) {
+    delete[] data;
+    throw;
+  }
+
+  // Set pointer reference
+  data_ptr = data;
+}
+
+inline void load_npy(const std::string& fname, const NPYAllocate& allocate,
+                     std::vector<size_t>& shape, DType& dtype,
+                     bool& c_contiguous) {
+  {
+    NDARRAY_STATS_TIMER(load_npy_ns);
+
+    // Open file
+    std::ifstream file(fname, std::ios::binary);
+    if (!file) {
+      std::string mssg = "Could not open " + fname + ".";
+      throw std::runtime_error(mssg);
+    }
+
+    // Parse header, leaving the stream at the beginning of the data
+    bool data_is_little_endian = true;
+    read_npy_header(file, fname, shape, dtype, c_contiguous,
+                    data_is_little_endian);
+
+    // Get number of elements to be read into system
+    size_t n_elements = shape[0];
+    for (size_t j = 1; j < shape.size(); j++) n_elements *= shape[j];
+    char* data = allocate(shape, dtype, c_contiguous);
+    read_npy_data(file, fname, data, n_elements, dtype, data_is_little_endian);
+
+    // Close file
+    file.close();
+  }
+  NDARRAY_STATS_ADD(load_npy_calls, 1);
+  NDARRAY_STATS_REPORT();
+}
+
+inline void read_npy_data(std::istream& file, const std::string& fname,
+                          char* data, uint64_t n_elements, DType dtype,
+                          bool little_endian) {
+  std::streamsize n_bytes_to_read =
+      static_cast<std::streamsize>(n_elements * size_of_DType(dtype));
+
+  // If byte order of data different from byte order of system, swap data
+  // bytes. This is done chunk by chunk as the data is read, while each chunk
+  // is still in cache.
+  size_t swap_size = 1;
+  std::streamsize chunk = n_bytes_to_read;
+  if (system_is_little_endian() != little_endian) {
+    swap_size = scalar_size_of_DType(dtype);
+    chunk = static_cast<std::streamsize>(
+        ndarray_detail::byte_swap_chunk / swap_size * swap_size);
+  }
+  ndarray_detail::ByteSwapKernel swap =
+      ndarray_detail::byte_swap_kernel(swap_size);
+
+  std::streamsize n_bytes_read = 0;
+  while (n_bytes_read < n_bytes_to_read) {
+    std::streamsize count = std::min(chunk, n_bytes_to_read - n_bytes_read);
+    file.read(data + n_bytes_read, count);
+
+    if (file.gcount() != count) {
+      std::string mssg = fname + " is truncated; expected " +
+                         std::to_string(n_bytes_to_read) + " bytes of data.";
+      throw std::runtime_error(mssg);
+    }
+    NDARRAY_STATS_ADD(bytes_read, count);
+
+    if (swap_size > 1) {
+      NDARRAY_STATS_TIMER(swap_bytes_ns);
+      NDARRAY_STATS_ADD(bytes_swapped, count);
+      swap(data + n_bytes_read, static_cast<uint64_t>(count) / swap_size);
+    }
+    n_bytes_read += count;
+  }
+}
+
+inline void write_npy(const std::string& fname, const char* data_ptr,
+                      const std::vector<size_t>& shape, DType dtype,
+                      bool c_contiguous) {
+  {
+    NDARRAY_STATS_TIMER(write_npy_ns);
+
+    // Calculate number of elements from the shape
+    size_t n_elements = shape[0];
+    for (size_t j = 1; j < shape.size(); j++) {
+      n_elements *= shape[j];
+    }
+
+    // Open file
+    std::ofstream file(fname, std::ios::binary);
+    if (!file) {
+      std::string mssg = "Could not open " + fname + " for writing.";
+      throw std::runtime_error(mssg);
+    }
+
+    // Write magic string, version and header
+    std::string preamble = npy_preamble(shape, dtype, c_contiguous);
+    file.write(preamble.data(), static_cast<std::streamsize>(preamble.size()));
+    if (!file) {
+      std::string mssg = "Could not write to " + fname + ".";
+      throw std::runtime_error(mssg);
+    }
+
+    // Write all data to file
+    std::streamsize n_bytes =
+        static_cast<std::streamsize>(n_elements * size_of_DType(dtype));
+    file.write(data_ptr, n_bytes);
+    if (!file) {
+      std::string mssg = "Could not write to " + fname + ".";
+      throw std::runtime_error(mssg);
+    }
+    NDARRAY_STATS_ADD(bytes_written,
+                      preamble.size() + static_cast<size_t>(n_bytes));
+
+    // Close file, which flushes any buffered data
+    file.close();
+    if (!file) {
+      std::string mssg = "Could not write to " + fname + ".";
+      throw std::runtime_error(mssg);
+    }
+  }
+  NDARRAY_STATS_ADD(write_npy_calls, 1);
+  NDARRAY_STATS_REPORT();
+}
+
+inline std::string npy_preamble(const std::vector<size_t>& shape, DType dtype,
+                                bool c_contiguous, size_t min_length) {
+  // First make the header. This is needed to know what version number to use
+  std::string header = "{'descr': '";
+  // Get system endianness, which void types do not have
+  if (dtype == DType::BFLOAT16 || dtype == DType::VOID16)
+    header += "|";
+  else if (system_is_little_endian())
+    header += "<";
+  else
+    header += ">";
+  header += DType_to_descr(dtype) + "', ";
+
+  // Fortran ordering
+  header += "'fortran_order': ";
+  if (c_contiguous)
+    header += "False, ";
+  else
+    header += "True, ";
+
+  // Shape
+  header += "'shape': (";
+  for (const auto& e : shape) {
+    header += std::to_string(e) + ",";
+  }
+  header += "), }";
+
+  // Padding, ending with a newline, is added until the data is aligned.
+  // Based on the padded header length, get version. Version 1 stores the
+  // length of the header in two bytes, and version 2 in four.
+  char major_version = 0x01;
+  size_t beginning_length = 6 + 2 + 2;
+  size_t total_length = 0;
+  for (int attempt = 0; attempt < 2; attempt++) {
+    total_length = std::max(beginning_length + header.size() + 1, min_length);
+    total_length += (64 - total_length % 64) % 64;
+    if (total_length - beginning_length <= 65535) break;
+    major_version = 0x02;
+    beginning_length += 2;
+  }
+  header.append(total_length - beginning_length - header.size() - 1, '\x20');
+  header += '\n';
+
+  std::string preamble = "\x93NUMPY";
+  char minor_version = 0x00;
+  preamble += major_version;
+  preamble += minor_version;
+
+  // Inf for len of header
+  if (major_version == 0x01) {
+    uint16_t len = static_cast<uint16_t>(header.size());
+    if (!system_is_little_endian()) {
+      swap_two_bytes((char*)&len);
+    }
+    preamble.append((char*)&len, 2);
   } else {
-    // Get linear index for column-major order
-    indx = fortran_continuous_index(indices);
+    uint32_t len = static_cast<uint32_t>(header.size());
+    if (!system_is_little_endian()) {
+      swap_four_bytes((char*)&len);
+    }
+    preamble.append((char*)&len, 4);
   }
-  return data_[indx];
+
+  return preamble + header;
+}
+
+//==============================================================================
+// NpyWriter Implementation
+inline NpyWriter::NpyWriter(const std::string& fname,
+                            const std::vector<size_t>& shape, DType dtype)
+    : NpyWriter(fname, shape, dtype, false) {}
+
+inline NpyWriter NpyWriter::open_ended(const std::string& fname,
+                                       const std::vector<size_t>& row_shape,
+                                       DType dtype) {
+  std::vector<size_t> shape(1, 0);
+  shape.insert(shape.end(), row_shape.begin(), row_shape.end());
+  return NpyWriter(fname, shape, dtype, true);
+}
+
+inline NpyWriter::NpyWriter(const std::string& fname,
+                            const std::vector<size_t>& shape, DType dtype,
+                            bool open_ended)
+    : file_{},
+      fname_{fname},
+      shape_{shape},
+      dtype_{dtype},
+      row_bytes_{size_of_DType(dtype)},
+      rows_written_{0},
+      preamble_length_{0},
+      open_ended_{open_ended} {
+  if (shape_.size() < 1) {
+    std::string mssg =
+        "Shape vector must have at least one element for NpyWriter.";
+    throw std::runtime_error(mssg);
+  }
+
+  for (size_t i = 1; i < shape_.size(); i++) row_bytes_ *= shape_[i];
+
+  // An open ended file reserves room in the header for the longest possible
+  // length of the leading axis, so the header keeps its size when the
+  // length is written on close.
+  size_t min_length = 0;
+  if (open_ended_) {
+    std::vector<size_t> longest_shape = shape_;
+    longest_shape[0] = std::numeric_limits<size_t>::max();
+    min_length = npy_preamble(longest_shape, dtype_, true).size();
+  }
+  std::string preamble = npy_preamble(shape_, dtype_, true, min_length);
+  preamble_length_ = preamble.size();
+
+  file_.open(fname_, std::ios::binary);
+  file_.write(preamble.data(), static_cast<std::streamsize>(preamble.size()));
+  NDARRAY_STATS_ADD(bytes_written, preamble.size());
+  if (!file_) {
+    std::string mssg = "Could not open " + fname_ + " for writing.";
+    throw std::runtime_error(mssg);
+  }
+}
+
+inline NpyWriter::~NpyWriter() {
+  if (file_.is_open()) {
+    try {
+      close();
+    } catch (...) {
+    }
+  }
+}
+
+inline void NpyWriter::append(const char* data, size_t n_rows) {
+  if (!file_.is_open()) {
+    std::string mssg = "Cannot append to " + fname_ + " after it is closed.";
+    throw std::runtime_error(mssg);
+  }
+
+  if (!open_ended_ && rows_written_ + n_rows > shape_[0]) {
+    std::string mssg = "Cannot append " + std::to_string(n_rows) +
+                       " rows to " + fname_ + ", which has " +
+                       std::to_string(shape_[0] - rows_written_) +
+                       " rows remaining.";
+    throw std::runtime_error(mssg);
+  }
+
+  file_.write(data, static_cast<std::streamsize>(n_rows * row_bytes_));
+  NDARRAY_STATS_ADD(bytes_written, n_rows * row_bytes_);
+  if (!file_) {
+    std::string mssg = "Could not write to " + fname_ + ".";
+    throw std::runtime_error(mssg);
+  }
+  rows_written_ += n_rows;
 }
 
 template <class T>
-template <typename std::size_t ND_>
-T& NDArray<T>::operator()(const boost::container::static_vector<size_t, ND_>& static_indices){
-  
-  std::vector<size_t> indices;
-  indices.reserve( static_indices.size() ); 
-  for ( auto& c : static_indices ){
-    indices.push_back(c);
+void NpyWriter::append(const NDArrayView<T>& chunk) {
+  typedef typename NDArrayView<T>::value_type value_type;
+
+  if (!npy_dtype_matches(NDArray<value_type>::npy_dtype(), dtype_)) {
+    std::string mssg =
+        "Cannot append an NDArray whose datatype does not match the datatype "
+        "of " + fname_ + ".";
+    throw std::runtime_error(mssg);
+  }
+
+  const std::vector<size_t>& chunk_shape = chunk.shape();
+  bool same_shape = chunk_shape.size() == shape_.size();
+  for (size_t i = 1; same_shape && i < shape_.size(); i++) {
+    same_shape = chunk_shape[i] == shape_[i];
+  }
+  if (!same_shape) {
+    std::string mssg = "Cannot append an NDArray whose shape does not match "
+                       "the shape of " + fname_ + " after the leading axis.";
+    throw std::runtime_error(mssg);
+  }
+
+  if (chunk.size() == 0) return;
+
+  if (chunk.c_continuous()) {
+    append(reinterpret_cast<const char*>(chunk.data()), chunk_shape[0]);
+    return;
+  }
+
+  // Copy the elements into C order
+  std::vector<value_type> buffer;
+  buffer.reserve(chunk.size());
+  std::vector<size_t> index(chunk_shape.size(), 0);
+  for (size_t i = 0; i < chunk.size(); i++) {
+    buffer.push_back(chunk(index));
+
+    for (size_t d = index.size(); d-- > 0;) {
+      if (++index[d] < chunk_shape[d]) break;
+      index[d] = 0;
+    }
+  }
+  append(reinterpret_cast<const char*>(buffer.data()), chunk_shape[0]);
+}
+
+template <class T, class A>
+void NpyWriter::append(const NDArray<T, A>& chunk) {
+  append(chunk.view());
+}
+
+inline void NpyWriter::close() {
+  if (!file_.is_open()) return;
+
+  if (open_ended_) {
+    // Rewrite the header with the number of rows appended
+    shape_[0] = rows_written_;
+    std::string preamble =
+        npy_preamble(shape_, dtype_, true, preamble_length_);
+    file_.seekp(0);
+    file_.write(preamble.data(),
+                static_cast<std::streamsize>(preamble.size()));
+  }
+
+  bool failed = !file_;
+  file_.close();
+
+  if (failed || file_.fail()) {
+    std::string mssg = "Could not write to " + fname_ + ".";
+    throw std::runtime_error(mssg);
+  }
+
+  if (rows_written_ != shape_[0]) {
+    std::string mssg = fname_ + " was closed after " +
+                       std::to_string(rows_written_) + " of " +
+                       std::to_string(shape_[0]) + " rows were appended.";
+    throw std::runtime_error(mssg);
+  }
+  NDARRAY_STATS_REPORT();
+}
+
+inline size_t NpyWriter::rows_written() const { return rows_written_; }
+
+inline bool NpyWriter::is_open() const { return file_.is_open(); }
+
+//==============================================================================
+// NpyReader Implementation
+inline NpyReader::NpyReader(const std::string& fname)
+    : fname_{fname},
+      shape_{},
+      dtype_{},
+      c_contiguous_{true},
+      little_endian_{true},
+      data_offset_{0},
+      row_bytes_{0} {
+#if defined(NDARRAY_HAS_MMAP)
+  fd_ = -1;
+#endif
+
+  // Parse header to find where the data begins
+  std::ifstream file(fname_, std::ios::binary);
+  data_offset_ = read_npy_header(file, fname_, shape_, dtype_, c_contiguous_,
+                                 little_endian_);
+
+  // Ensure the file holds all of the data
+  file.seekg(0, std::ios::end);
+  uint64_t file_length = static_cast<uint64_t>(file.tellg());
+  file.close();
+  if (file_length < data_offset_ + size() * size_of_DType(dtype_)) {
+    std::string mssg = fname_ + " is smaller than its header specifies.";
+    throw std::runtime_error(mssg);
+  }
+
+  row_bytes_ = size_of_DType(dtype_);
+  for (size_t i = 0; i < shape_.size(); i++) {
+    if (i != slab_axis()) row_bytes_ *= shape_[i];
+  }
+
+#if defined(NDARRAY_HAS_MMAP)
+  fd_ = ::open(fname_.c_str(), O_RDONLY);
+  if (fd_ < 0) {
+    std::string mssg = "Could not open " + fname_ + ".";
+    throw std::runtime_error(mssg);
+  }
+#else
+  file_.open(fname_, std::ios::binary);
+  if (!file_) {
+    std::string mssg = "Could not open " + fname_ + ".";
+    throw std::runtime_error(mssg);
+  }
+#endif
+}
+
+inline NpyReader::~NpyReader() { close(); }
+
+inline NpyReader::NpyReader(NpyReader&& other)
+    : fname_{std::move(other.fname_)},
+      shape_{std::move(other.shape_)},
+      dtype_{other.dtype_},
+      c_contiguous_{other.c_contiguous_},
+      little_endian_{other.little_endian_},
+      data_offset_{other.data_offset_},
+      row_bytes_{other.row_bytes_},
+#if defined(NDARRAY_HAS_MMAP)
+      fd_{other.fd_} {
+  other.fd_ = -1;
+}
+#else
+      file_{std::move(other.file_)} {
+}
+#endif
+
+inline NpyReader& NpyReader::operator=(NpyReader&& other) {
+  if (this != &other) {
+    close();
+
+    fname_ = std::move(other.fname_);
+    shape_ = std::move(other.shape_);
+    dtype_ = other.dtype_;
+    c_contiguous_ = other.c_contiguous_;
+    little_endian_ = other.little_endian_;
+    data_offset_ = other.data_offset_;
+    row_bytes_ = other.row_bytes_;
+#if defined(NDARRAY_HAS_MMAP)
+    fd_ = other.fd_;
+    other.fd_ = -1;
+#else
+    file_ = std::move(other.file_);
+#endif
   }
 
-  /*size_t size_static_indices = static_indices.size();
+  return *this;
+}
+
+inline const std::vector<size_t>& NpyReader::shape() const { return shape_; }
+
+inline DType NpyReader::dtype() const { return dtype_; }
+
+inline bool NpyReader::fortran_order() const { return !c_contiguous_; }
+
+inline size_t NpyReader::size() const {
+  size_t ne = shape_[0];
+  for (size_t i = 1; i < shape_.size(); i++) ne *= shape_[i];
+  return ne;
+}
+
+inline size_t NpyReader::slab_axis() const {
+  return c_contiguous_ ? 0 : shape_.size() - 1;
+}
+
+inline size_t NpyReader::n_rows() const { return shape_[slab_axis()]; }
 
-  std::array<std::size_t, size_static_indices> indices;
-  indices.fill(0);
+inline size_t NpyReader::data_offset() const { return data_offset_; }
 
-  for( std::size_t i = 0; i < size_static_indices; i++){
-    indices[i] = static_indices[i];
-  }*/
-  
-  size_t indx;
-  if (c_continuous_) {
-    // Get linear index for row-major order
-    indx = c_continuous_index(indices);
-  } else {
-    // Get linear index for column-major order
-    indx = fortran_continuous_index(indices);
+inline void NpyReader::read_slab(size_t start, size_t count,
+                                 char* data) const {
+  if (start > n_rows() || count > n_rows() - start) {
+    std::string mssg = "Slab read from " + fname_ + " out of range.";
+    throw std::out_of_range(mssg);
   }
-  return data_[indx];
-}
 
-template <class T>
-template <typename std::size_t ND_>
-const T& NDArray<T>::operator()(const boost::container::static_vector<size_t, ND_>& static_indices) const{
+  read_bytes(data, data_offset_ + static_cast<uint64_t>(start) * row_bytes_,
+             static_cast<uint64_t>(count) * row_bytes_);
+}
 
-  std::vector<size_t> indices;
-  indices.reserve( static_indices.size() ); 
-  for ( auto& c : static_indices ){
-    indices.push_back(c);
+template <class T, class A>
+void NpyReader::read_slab(size_t start, size_t count,
+                          NDArray<T, A>& array) const {
+  if (!npy_dtype_matches(NDArray<T, A>::npy_dtype(), dtype_)) {
+    std::string mssg =
+        "NDArray template datatype does not match specified datatype in npy "
+        "file.";
+    throw std::runtime_error(mssg);
   }
-  /*size_t size_static_indices = static_indices.size();
 
-  std::array<std::size_t, size_static_indices> indices;
-  indices.fill(0);
-
-  for( std::size_t i = 0; i < size_static_indices; i++){
-    indices[i] = static_indices[i];
-  }*/
-    
-  size_t indx;
-  if (c_continuous_) {
-    // Get linear index for row-major order
-    indx = c_continuous_index(indices);
-  } else {
-    // Get linear index for column-major order
-    indx = fortran_continuous_index(indices);
+  if (start > n_rows() || count > n_rows() - start) {
+    std::string mssg = "Slab read from " + fname_ + " out of range.";
+    throw std::out_of_range(mssg);
   }
-  return data_[indx];
+
+  array.c_continuous_ = c_contiguous_;
+  array.allocate_for_overwrite(slab_shape(count));
+  read_slab(start, count, reinterpret_cast<char*>(array.data_.data()));
 }
 
 template <class T>
-template <typename... INDS>
-NDARRAY_INLINE T& NDArray<T>::operator()(INDS... inds) {
-  std::array<size_t, sizeof...(inds)> indices{static_cast<size_t>(inds)...};
+NDArray<T> NpyReader::read_slab(size_t start, size_t count) const {
+  NDArray<T> slab;
+  read_slab(start, count, slab);
+  return slab;
+}
 
-  size_t indx;
-  if (c_continuous_) {
-    // Get linear index for row-major order
-    indx = c_continuous_index(indices);
-  } else {
-    // Get linear index for column-major order
-    indx = fortran_continuous_index(indices);
+template <class T>
+NpyReader::Chunks<T> NpyReader::chunks(size_t chunk_rows) const {
+  if (chunk_rows == 0) {
+    std::string mssg = "Chunks of an NpyReader must have at least one row.";
+    throw std::runtime_error(mssg);
   }
-  return data_[indx];
+
+  return Chunks<T>(this, chunk_rows);
 }
 
-template <class T>
-template <typename... INDS>
-NDARRAY_INLINE const T& NDArray<T>::operator()(INDS... inds) const {
-  std::array<size_t, sizeof...(inds)> indices{static_cast<size_t>(inds)...};
+inline void NpyReader::read_bytes(char* data, uint64_t offset,
+                                  uint64_t n_bytes) const {
+  // If byte order of data different from byte order of system, swap data
+  // bytes chunk by chunk as it is read
+  size_t swap_size = 1;
+  uint64_t chunk = n_bytes;
+  if (system_is_little_endian() != little_endian_) {
+    swap_size = scalar_size_of_DType(dtype_);
+    chunk = ndarray_detail::byte_swap_chunk / swap_size * swap_size;
+  }
+  ndarray_detail::ByteSwapKernel swap =
+      ndarray_detail::byte_swap_kernel(swap_size);
+
+  uint64_t n_bytes_read = 0;
+  while (n_bytes_read < n_bytes) {
+    uint64_t count = std::min(chunk, n_bytes - n_bytes_read);
+    char* destination = data + n_bytes_read;
+
+#if defined(NDARRAY_HAS_MMAP)
+    // pread may return fewer bytes than requested
+    uint64_t count_read = 0;
+    while (count_read < count) {
+      ssize_t result = ::pread(fd_, destination + count_read,
+                               static_cast<size_t>(count - count_read),
+                               static_cast<off_t>(offset + n_bytes_read +
+                                                  count_read));
+      if (result <= 0) break;
+      count_read += static_cast<uint64_t>(result);
+    }
+#else
+    file_.clear();
+    file_.seekg(static_cast<std::streamoff>(offset + n_bytes_read));
+    file_.read(destination, static_cast<std::streamsize>(count));
+    uint64_t count_read = static_cast<uint64_t>(file_.gcount());
+#endif
 
-  size_t indx;
-  if (c_continuous_) {
-    // Get linear index for row-major order
-    indx = c_continuous_index(indices);
-  } else {
-    // Get linear index for column-major order
-    indx = fortran_continuous_index(indices);
+    if (count_read != count) {
+      std::string mssg = "Could not read from " + fname_ + ".";
+      throw std::runtime_error(mssg);
+    }
+    NDARRAY_STATS_ADD(bytes_read, count);
+
+    if (swap_size > 1) {
+      NDARRAY_STATS_TIMER(swap_bytes_ns);
+      NDARRAY_STATS_ADD(bytes_swapped, count);
+      swap(destination, count / swap_size);
+    }
+    n_bytes_read += count;
   }
-  return data_[indx];
 }
 
-template <class T>
-NDARRAY_INLINE T& NDArray<T>::operator[](size_t i) {
-  return data_[i];
+inline std::vector<size_t> NpyReader::slab_shape(size_t count) const {
+  std::vector<size_t> shape = shape_;
+  shape[slab_axis()] = count;
+  return shape;
 }
 
-template <class T>
-NDARRAY_INLINE const T& NDArray<T>::operator[](size_t i) const {
-  return data_[i];
+inline void NpyReader::close() {
+#if defined(NDARRAY_HAS_MMAP)
+  if (fd_ >= 0) ::close(fd_);
+  fd_ = -1;
+#else
+  if (file_.is_open()) file_.close();
+#endif
 }
 
 template <class T>
-NDARRAY_INLINE std::vector<T>& NDArray<T>::data_vector() {
-  return data_;
-}
+NpyReader::ChunkIterator<T>::ChunkIterator(const NpyReader* reader,
+                                           size_t position, size_t chunk_rows)
+    : reader_{reader},
+      position_{position},
+      chunk_rows_{chunk_rows},
+      chunk_{},
+      loaded_{false} {}
 
 template <class T>
-NDARRAY_INLINE const std::vector<T>& NDArray<T>::data_vector() const {
-  return data_;
-}
+const NDArray<T>& NpyReader::ChunkIterator<T>::operator*() const {
+  if (!loaded_) {
+    size_t count = std::min(chunk_rows_, reader_->n_rows() - position_);
+    reader_->read_slab(position_, count, chunk_);
+    loaded_ = true;
+  }
 
-template <class T>
-NDARRAY_INLINE T* NDArray<T>::data() {
-  return data_.data();
+  return chunk_;
 }
 
 template <class T>
-NDARRAY_INLINE const T* NDArray<T>::data() const {
-  return data_.data();
+const NDArray<T>* NpyReader::ChunkIterator<T>::operator->() const {
+  return &**this;
 }
 
 template <class T>
-NDARRAY_INLINE const std::vector<size_t>& NDArray<T>::shape() const {
-  return shape_;
+NpyReader::ChunkIterator<T>& NpyReader::ChunkIterator<T>::operator++() {
+  position_ = std::min(position_ + chunk_rows_, reader_->n_rows());
+  loaded_ = false;
+  return *this;
 }
 
 template <class T>
-NDARRAY_INLINE size_t NDArray<T>::size() const {
-  return data_.size();
+size_t NpyReader::ChunkIterator<T>::position() const {
+  return position_;
 }
 
 template <class T>
-NDARRAY_INLINE size_t
-NDArray<T>::linear_index(const std::vector<size_t>& indices) const {
-  if (c_continuous_) {
-    // Get linear index for row-major order
-    return c_continuous_index(indices);
-  } else {
-    // Get linear index for column-major order
-    return fortran_continuous_index(indices);
-  }
+bool NpyReader::ChunkIterator<T>::operator==(
+    const ChunkIterator& other) const {
+  return reader_ == other.reader_ && position_ == other.position_;
 }
 
 template <class T>
-template <typename... INDS>
-NDARRAY_INLINE size_t NDArray<T>::linear_index(INDS... inds) const {
-  std::array<size_t, sizeof...(inds)> indices{static_cast<size_t>(inds)...};
-
-  if (c_continuous_) {
-    // Get linear index for row-major order
-    return c_continuous_index(indices);
-  } else {
-    // Get linear index for column-major order
-    return fortran_continuous_index(indices);
-  }
+bool NpyReader::ChunkIterator<T>::operator!=(
+    const ChunkIterator& other) const {
+  return !(*this == other);
 }
 
 template <class T>
-NDARRAY_INLINE bool NDArray<T>::c_continuous() const {
-  return c_continuous_;
-}
+NpyReader::Chunks<T>::Chunks(const NpyReader* reader, size_t chunk_rows)
+    : reader_{reader}, chunk_rows_{chunk_rows} {}
 
 template <class T>
-void NDArray<T>::save(const std::string& fname) const {
-  // Get expected DType according to T
-  DType dtype;
-  const char* T_type_name = typeid(T).name();
-
-  if (T_type_name == typeid(char).name())
-    dtype = DType::CHAR;
-  else if (T_type_name == typeid(unsigned char).name())
-    dtype = DType::UCHAR;
-  else if (T_type_name == typeid(uint16_t).name())
-    dtype = DType::UINT16;
-  else if (T_type_name == typeid(uint32_t).name())
-    dtype = DType::UINT32;
-  else if (T_type_name == typeid(uint64_t).name())
-    dtype = DType::UINT64;
-  else if (T_type_name == typeid(int16_t).name())
-    dtype = DType::INT16;
-  else if (T_type_name == typeid(int32_t).name())
-    dtype = DType::INT32;
-  else if (T_type_name == typeid(int64_t).name())
-    dtype = DType::INT64;
-  else if (T_type_name == typeid(float).name())
-    dtype = DType::FLOAT32;
-  else if (T_type_name == typeid(double).name())
-    dtype = DType::DOUBLE64;
-  else if (T_type_name == typeid(std::complex<float>).name())
-    dtype = DType::COMPLEX64;
-  else if (T_type_name == typeid(std::complex<double>).name())
-    dtype = DType::COMPLEX128;
-  else {
-    std::string mssg = "The datatype is not supported for NDArray.";
-    throw std::runtime_error(mssg);
-  }
-
-  // Write data to file
-  write_npy(fname, reinterpret_cast<const char*>(data_.data()), shape_, dtype,
-            c_continuous_);
+NpyReader::ChunkIterator<T> NpyReader::Chunks<T>::begin() const {
+  return ChunkIterator<T>(reader_, 0, chunk_rows_);
 }
 
 template <class T>
-void NDArray<T>::fill(const T& val) {
-  std::fill(data_.begin(), data_.end(), val);
+NpyReader::ChunkIterator<T> NpyReader::Chunks<T>::end() const {
+  return ChunkIterator<T>(reader_, reader_->n_rows(), chunk_rows_);
 }
 
-template <class T>
-void NDArray<T>::reshape(const std::vector<size_t>& new_shape) {
-  // Ensure new shape has proper dimensions
-  if (new_shape.size() < 1) {
-    std::string mssg =
-        "Shape vector must have at least one element to"
-        " reshpae NDArray.";
-    throw std::runtime_error(mssg);
-  } else {
-    size_t ne = new_shape[0];
-
-    for (size_t i = 1; i < new_shape.size(); i++) {
-      ne *= new_shape[i];
-    }
-
-    if (ne == data_.size()) {
-      shape_ = new_shape;
-      dimensions_ = shape_.size();
-    } else {
-      std::string mssg =
-          "Shape is incompatible with number of elements in"
-          " NDArray.";
-      throw std::runtime_error(mssg);
-    }
+//==============================================================================
+// NPZ Archive Helpers
+namespace ndarray_detail {
+
+// Signatures of the records of a zip file
+const uint32_t zip_local_header = 0x04034b50;
+const uint32_t zip_central_header = 0x02014b50;
+const uint32_t zip_end_of_directory = 0x06054b50;
+const uint32_t zip64_end_of_directory = 0x06064b50;
+const uint32_t zip64_end_locator = 0x07064b50;
+
+// Sizes and offsets of at least this value are stored in zip64 extra fields
+const uint64_t zip64_limit = 0xFFFFFFFF;
+
+// Compression methods of zip members
+const uint16_t zip_stored = 0;
+const uint16_t zip_deflated = 8;
+
+// Appends value to bytes in little-endian order
+template <class U>
+void put_little_endian(std::string& bytes, U value) {
+  for (size_t i = 0; i < sizeof(U); i++) {
+    bytes +=
+        static_cast<char>((static_cast<uint64_t>(value) >> (8 * i)) & 0xFF);
   }
 }
 
-template <class T>
-void NDArray<T>::reallocate(const std::vector<size_t>& new_shape) {
-  // Ensure new shape has proper dimensions
-  if (new_shape.size() < 1) {
-    std::string mssg =
-        "Shape vector must have at least one element to"
-        " reallocate NDArray.";
-    throw std::runtime_error(mssg);
-  } else {
-    size_t ne = new_shape[0];
-
-    for (size_t i = 1; i < new_shape.size(); i++) {
-      ne *= new_shape[i];
-    }
-
-    shape_ = new_shape;
-    dimensions_ = shape_.size();
-    data_.resize(ne);
+// Reads a little-endian value from bytes
+template <class U>
+U get_little_endian(const char* bytes) {
+  uint64_t value = 0;
+  for (size_t i = 0; i < sizeof(U); i++) {
+    value |= static_cast<uint64_t>(static_cast<unsigned char>(bytes[i]))
+             << (8 * i);
   }
+  return static_cast<U>(value);
 }
 
-template <class T>
-template <std::size_t N_dimension_>
-void NDArray<T>::reallocate(const boost::container::static_vector<size_t, N_dimension_>& new_shape) {
-  // Ensure new shape has proper dimensions
-  if (new_shape.size() < 1) {
-    std::string mssg =
-        "Shape vector must have at least one element to"
-        " reallocate NDArray.";
-    throw std::runtime_error(mssg);
-  } else {
-    size_t ne = new_shape[0];
-
-    for (size_t i = 1; i < new_shape.size(); i++) {
-      ne *= new_shape[i];
-    }
-    shape_.clear();
-    shape_.reserve( new_shape.size() );
-    for( std::size_t c : new_shape){
-      shape_.push_back(c);
-    }
-    dimensions_ = shape_.size();
-    data_.resize(ne);
+// Updates the CRC-32 crc of a zip member with the next n bytes of data
+#if defined(NDARRAY_USE_ZLIB)
+inline uint32_t crc32(uint32_t crc, const char* data, uint64_t n) {
+  const uint64_t max_block = 1 << 30;
+  while (n > 0) {
+    uInt block = static_cast<uInt>(std::min(n, max_block));
+    crc = static_cast<uint32_t>(::crc32(
+        crc, reinterpret_cast<const Bytef*>(data), block));
+    data += block;
+    n -= block;
   }
+  return crc;
 }
+#else
+// Slicing by eight, where table[k][b] is the CRC of byte b followed by k
+// zero bytes.
+inline const uint32_t (&crc32_table())[8][256] {
+  struct Table {
+    uint32_t entries[8][256];
+
+    Table() {
+      for (uint32_t b = 0; b < 256; b++) {
+        uint32_t c = b;
+        for (int k = 0; k < 8; k++) {
+          c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+        }
+        entries[0][b] = c;
+      }
+      for (uint32_t b = 0; b < 256; b++) {
+        for (int k = 1; k < 8; k++) {
+          uint32_t c = entries[k - 1][b];
+          entries[k][b] = entries[0][c & 0xFF] ^ (c >> 8);
+        }
+      }
+    }
+  };
 
+  static const Table table;
+  return table.entries;
+}
 
-template <class T>
-template <class C>
-NDArray<T>& NDArray<T>::operator+=(const NDArray<C>& a) {
-  // Ensure same number of dimensions
-  if (dimensions_ != a.dimensions_) {
-    std::string mssg = "Cannot add two NDArrays with different dimensions.";
-    throw std::runtime_error(mssg);
-  }
-
-  // Ensure same shape
-  for (size_t i = 0; i < dimensions_; i++) {
-    if (shape_[i] != a.shape_[i]) {
-      std::string mssg = "Cannot add two NDArrays with different shapes";
-      throw std::runtime_error(mssg);
-    }
+inline uint32_t crc32(uint32_t crc, const char* data, uint64_t n) {
+  const uint32_t (&table)[8][256] = crc32_table();
+  const unsigned char* p = reinterpret_cast<const unsigned char*>(data);
+  crc = ~crc;
+
+  for (; n >= 8; n -= 8, p += 8) {
+    uint32_t low = crc ^ (static_cast<uint32_t>(p[0]) |
+                          static_cast<uint32_t>(p[1]) << 8 |
+                          static_cast<uint32_t>(p[2]) << 16 |
+                          static_cast<uint32_t>(p[3]) << 24);
+    crc = table[7][low & 0xFF] ^ table[6][(low >> 8) & 0xFF] ^
+          table[5][(low >> 16) & 0xFF] ^ table[4][low >> 24] ^
+          table[3][p[4]] ^ table[2][p[5]] ^ table[1][p[6]] ^ table[0][p[7]];
   }
+  for (; n > 0; n--, p++) crc = table[0][(crc ^ *p) & 0xFF] ^ (crc >> 8);
 
-  // Do addition
-  for (size_t i = 0; i < data_.size(); i++) {
-    data_[i] += a.data_[i];
-  }
+  return ~crc;
+}
+#endif
 
-  return *this;
+// Throws the exception for an archive which needs zlib
+inline void require_zlib(const std::string& fname) {
+  std::string mssg = "Compressed .npz archive " + fname +
+                     " requires NDArray to be built with NDARRAY_USE_ZLIB.";
+  throw std::runtime_error(mssg);
 }
 
-template <class T>
-template <class C>
-NDArray<T>& NDArray<T>::operator-=(const NDArray<C>& a) {
-  // Ensure same number of dimensions
-  if (dimensions_ != a.dimensions_) {
-    std::string mssg =
-        "Cannot subtract two NDArrays with different dimensions.";
+// Returns the raw deflate stream of the concatenation of the n_parts parts,
+// each given by a pointer and a number of bytes.
+inline std::string deflate_parts(const std::string& fname,
+                                 const char* const* parts,
+                                 const uint64_t* part_bytes, size_t n_parts) {
+#if defined(NDARRAY_USE_ZLIB)
+  z_stream stream;
+  std::memset(&stream, 0, sizeof(stream));
+  if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8,
+                   Z_DEFAULT_STRATEGY) != Z_OK) {
+    std::string mssg = "Could not initialize compression for " + fname + ".";
     throw std::runtime_error(mssg);
   }
 
-  // Ensure same shape
-  for (size_t i = 0; i < dimensions_; i++) {
-    if (shape_[i] != a.shape_[i]) {
-      std::string mssg = "Cannot subtract two NDArrays with different shapes";
-      throw std::runtime_error(mssg);
-    }
+  uint64_t total = 0;
+  for (size_t i = 0; i < n_parts; i++) total += part_bytes[i];
+
+  std::string compressed;
+  compressed.resize(static_cast<size_t>(
+      deflateBound(&stream, static_cast<uLong>(total))));
+  stream.next_out = reinterpret_cast<Bytef*>(&compressed[0]);
+  stream.avail_out = static_cast<uInt>(compressed.size());
+
+  const uint64_t max_block = 1 << 30;
+  int status = Z_OK;
+  for (size_t i = 0; i < n_parts; i++) {
+    const char* data = parts[i];
+    uint64_t remaining = part_bytes[i];
+    bool last_part = (i + 1 == n_parts);
+
+    do {
+      uint64_t block = std::min(remaining, max_block);
+      stream.next_in =
+          reinterpret_cast<Bytef*>(const_cast<char*>(data));
+      stream.avail_in = static_cast<uInt>(block);
+      data += block;
+      remaining -= block;
+      int flush = (last_part && remaining == 0) ? Z_FINISH : Z_NO_FLUSH;
+
+      do {
+        if (stream.avail_out == 0) {
+          size_t used = compressed.size();
+          compressed.resize(2 * used);
+          stream.next_out = reinterpret_cast<Bytef*>(&compressed[used]);
+          stream.avail_out = static_cast<uInt>(
+              std::min<size_t>(used, std::numeric_limits<uInt>::max()));
+        }
+        status = deflate(&stream, flush);
+      } while (stream.avail_in > 0 ||
+               (flush == Z_FINISH && status != Z_STREAM_END));
+    } while (remaining > 0);
   }
 
-  // Do subtraction
-  for (size_t i = 0; i < data_.size(); i++) {
-    data_[i] -= a.data_[i];
+  compressed.resize(static_cast<size_t>(
+      reinterpret_cast<char*>(stream.next_out) - &compressed[0]));
+  deflateEnd(&stream);
+
+  if (status != Z_STREAM_END) {
+    std::string mssg = "Could not compress a member of " + fname + ".";
+    throw std::runtime_error(mssg);
   }
 
-  return *this;
+  return compressed;
+#else
+  (void)parts;
+  (void)part_bytes;
+  (void)n_parts;
+  require_zlib(fname);
+  return std::string();
+#endif
 }
 
-template <class T>
-template <class C>
-NDArray<T>& NDArray<T>::operator*=(const NDArray<C>& a) {
-  // Ensure same number of dimensions
-  if (dimensions_ != a.dimensions_) {
-    std::string mssg =
-        "Cannot multiply two NDArrays with different dimensions.";
-    throw std::runtime_error(mssg);
-  }
+// Stream buffer which reads the contents of one member of a zip file from
+// file, positioned at the beginning of its data, decompressing them if they
+// are deflated. The CRC-32 of the contents is computed as they are read.
+// Large reads are decompressed straight into the destination.
+class ZipMemberBuf : public std::streambuf {
+ public:
+  ZipMemberBuf(std::istream& file, const std::string& fname,
+               uint64_t compressed_size, bool deflated);
+  ~ZipMemberBuf();
 
-  // Ensure same shape
-  for (size_t i = 0; i < dimensions_; i++) {
-    if (shape_[i] != a.shape_[i]) {
-      std::string mssg = "Cannot multiply two NDArrays with different shapes";
-      throw std::runtime_error(mssg);
-    }
-  }
+  ZipMemberBuf(const ZipMemberBuf&) = delete;
+  ZipMemberBuf& operator=(const ZipMemberBuf&) = delete;
 
-  // Do multiplication
-  for (size_t i = 0; i < data_.size(); i++) {
-    data_[i] *= a.data_[i];
-  }
+  // Returns the CRC-32 of the contents read so far
+  uint32_t crc() const;
 
-  return *this;
-}
+ protected:
+  int_type underflow() override;
+  std::streamsize xsgetn(char* s, std::streamsize n) override;
 
-template <class T>
-template <class C>
-NDArray<T>& NDArray<T>::operator/=(const NDArray<C>& a) {
-  // Ensure same number of dimensions
-  if (dimensions_ != a.dimensions_) {
-    std::string mssg = "Cannot divide two NDArrays with different dimensions.";
-    throw std::runtime_error(mssg);
-  }
+ private:
+  std::istream& file_;
+  std::string fname_;
+  uint64_t remaining_;
+  bool deflated_;
+  bool finished_;
+  uint32_t crc_;
+  std::vector<char> in_;
+  std::vector<char> out_;
+#if defined(NDARRAY_USE_ZLIB)
+  z_stream stream_;
+#endif
 
-  // Ensure same shape
-  for (size_t i = 0; i < dimensions_; i++) {
-    if (shape_[i] != a.shape_[i]) {
-      std::string mssg = "Cannot divide two NDArrays with different shapes";
+  // Writes up to n bytes of the contents to s, returning the number written,
+  // which is only zero at the end of the member.
+  uint64_t produce(char* s, uint64_t n);
+};
+
+inline ZipMemberBuf::ZipMemberBuf(std::istream& file, const std::string& fname,
+                                  uint64_t compressed_size, bool deflated)
+    : file_(file),
+      fname_(fname),
+      remaining_(compressed_size),
+      deflated_(deflated),
+      finished_(false),
+      crc_(0),
+      in_(),
+      out_(1 << 16) {
+#if defined(NDARRAY_USE_ZLIB)
+  std::memset(&stream_, 0, sizeof(stream_));
+  if (deflated_) {
+    in_.resize(1 << 18);
+    if (inflateInit2(&stream_, -MAX_WBITS) != Z_OK) {
+      std::string mssg =
+          "Could not initialize decompression for " + fname_ + ".";
       throw std::runtime_error(mssg);
     }
   }
-
-  // Do division
-  for (size_t i = 0; i < data_.size(); i++) {
-    data_[i] /= a.data_[i];
-  }
-
-  return *this;
+#else
+  if (deflated_) require_zlib(fname_);
+#endif
 }
 
-template <class T>
-template <class C>
-NDArray<T>& NDArray<T>::operator+=(const C& c) {
-  // Do addition
-  for (size_t i = 0; i < data_.size(); i++) {
-    data_[i] += c;
-  }
-
-  return *this;
+inline ZipMemberBuf::~ZipMemberBuf() {
+#if defined(NDARRAY_USE_ZLIB)
+  if (deflated_) inflateEnd(&stream_);
+#endif
 }
 
-template <class T>
-template <class C>
-NDArray<T>& NDArray<T>::operator-=(const C& c) {
-  // Do subtraction
-  for (size_t i = 0; i < data_.size(); i++) {
-    data_[i] -= c;
-  }
+inline uint32_t ZipMemberBuf::crc() const { return crc_; }
 
-  return *this;
-}
+inline ZipMemberBuf::int_type ZipMemberBuf::underflow() {
+  if (gptr() < egptr()) return traits_type::to_int_type(*gptr());
 
-template <class T>
-template <class C>
-NDArray<T>& NDArray<T>::operator*=(const C& c) {
-  // Do multiplication
-  for (size_t i = 0; i < data_.size(); i++) {
-    data_[i] *= c;
-  }
+  uint64_t n = produce(out_.data(), out_.size());
+  if (n == 0) return traits_type::eof();
 
-  return *this;
+  setg(out_.data(), out_.data(), out_.data() + n);
+  return traits_type::to_int_type(*gptr());
 }
 
-template <class T>
-template <class C>
-NDArray<T>& NDArray<T>::operator/=(const C& c) {
-  // Do division
-  for (size_t i = 0; i < data_.size(); i++) {
-    data_[i] /= c;
+inline std::streamsize ZipMemberBuf::xsgetn(char* s, std::streamsize n) {
+  // First use what remains of the buffer
+  std::streamsize count = std::min<std::streamsize>(n, egptr() - gptr());
+  if (count > 0) {
+    std::memcpy(s, gptr(), static_cast<size_t>(count));
+    gbump(static_cast<int>(count));
   }
 
-  return *this;
-}
-
-template <class T>
-template <class C>
-NDArray<T>::operator NDArray<C>() const {
-  // Make array to be returned of same shape
-  NDArray<C> new_array(shape_);
-
-  // Go through all elements
-  for (size_t i = 0; i < data_.size(); i++) {
-    new_array[i] = data_[i];
+  while (count < n) {
+    uint64_t produced = produce(s + count, static_cast<uint64_t>(n - count));
+    if (produced == 0) break;
+    count += static_cast<std::streamsize>(produced);
   }
 
-  return std::move(new_array);
+  return count;
 }
 
-template <class T>
-NDARRAY_INLINE size_t
-NDArray<T>::c_continuous_index(const std::vector<size_t>& indices) const {
-  // Make sure proper number of indices
-  if (indices.size() != dimensions_) {
-    std::string mssg = "Improper number of indicies provided to NDArray.";
-    throw std::runtime_error(mssg);
-  }
-
-  size_t indx = indices[dimensions_ - 1];
-  if (indx >= shape_[dimensions_ - 1]) {
-    std::string mssg = "Index provided to NDArray out of range.";
-    throw std::out_of_range(mssg);
-  }
+inline uint64_t ZipMemberBuf::produce(char* s, uint64_t n) {
+  if (finished_ || n == 0) return 0;
 
-  size_t coeff = 1;
+  uint64_t produced = 0;
+  if (!deflated_) {
+    produced = std::min(n, remaining_);
+    file_.read(s, static_cast<std::streamsize>(produced));
+    if (static_cast<uint64_t>(file_.gcount()) != produced) {
+      std::string mssg = fname_ + " is truncated.";
+      throw std::runtime_error(mssg);
+    }
+    remaining_ -= produced;
+    finished_ = (remaining_ == 0);
+  } else {
+#if defined(NDARRAY_USE_ZLIB)
+    stream_.next_out = reinterpret_cast<Bytef*>(s);
+    stream_.avail_out = static_cast<uInt>(
+        std::min<uint64_t>(n, std::numeric_limits<uInt>::max()));
+
+    // Inflate until some output is produced, or the member ends
+    while (stream_.avail_out > 0 && !finished_) {
+      if (stream_.avail_in == 0) {
+        if (remaining_ == 0) {
+          std::string mssg = fname_ + " is truncated.";
+          throw std::runtime_error(mssg);
+        }
+        uint64_t block = std::min<uint64_t>(in_.size(), remaining_);
+        file_.read(in_.data(), static_cast<std::streamsize>(block));
+        if (static_cast<uint64_t>(file_.gcount()) != block) {
+          std::string mssg = fname_ + " is truncated.";
+          throw std::runtime_error(mssg);
+        }
+        remaining_ -= block;
+        stream_.next_in = reinterpret_cast<Bytef*>(in_.data());
+        stream_.avail_in = static_cast<uInt>(block);
+      }
 
-  for (size_t i = dimensions_ - 1; i > 0; i--) {
-    if (indices[i] >= shape_[i]) {
-      std::string mssg = "Index provided to NDArray out of range.";
-      throw std::out_of_range(mssg);
+      int status = inflate(&stream_, Z_NO_FLUSH);
+      if (status == Z_STREAM_END) {
+        finished_ = true;
+      } else if (status != Z_OK) {
+        std::string mssg = "Could not decompress a member of " + fname_ + ".";
+        throw std::runtime_error(mssg);
+      }
+
+      if (reinterpret_cast<char*>(stream_.next_out) != s) break;
     }
 
-    coeff *= shape_[i];
-    indx += coeff * indices[i - 1];
+    produced = static_cast<uint64_t>(
+        reinterpret_cast<char*>(stream_.next_out) - s);
+#endif
   }
 
-  return indx;
+  crc_ = crc32(crc_, s, produced);
+  return produced;
 }
 
-template <class T>
-NDARRAY_INLINE size_t
-NDArray<T>::fortran_continuous_index(const std::vector<size_t>& indices) const {
-  // Make sure proper number of indices
-  if (indices.size() != dimensions_) {
-    std::string mssg = "Improper number of indicies provided to NDArray.";
-    throw std::runtime_error(mssg);
-  }
+}  // namespace ndarray_detail
 
-  size_t indx = indices[0];
-  if (indx >= shape_[0]) {
-    std::string mssg = "Index provided to NDArray out of range.";
-    throw std::out_of_range(mssg);
+//==============================================================================
+// NpzWriter Implementation
+inline NpzWriter::NpzWriter(const std::string& fname,
+                            NpzCompression compression)
+    : fname_{fname},
+      compression_{compression},
+      members_{},
+      member_names_{},
+      open_{true} {
+#if !defined(NDARRAY_USE_ZLIB)
+  if (compression_ == NpzCompression::Deflate) {
+    ndarray_detail::require_zlib(fname_);
   }
-  size_t coeff = 1;
+#endif
+}
 
-  for (size_t i = 0; i < dimensions_ - 1; i++) {
-    if (indices[i] >= shape_[i]) {
-      std::string mssg = "Index provided to NDArray out of range.";
-      throw std::out_of_range(mssg);
+inline NpzWriter::~NpzWriter() {
+  if (open_) {
+    try {
+      close();
+    } catch (...) {
     }
-
-    coeff *= shape_[i];
-    indx += coeff * indices[i + 1];
   }
-
-  return indx;
 }
 
-template <class T>
-template <size_t D>
-NDARRAY_INLINE size_t
-NDArray<T>::c_continuous_index(const std::array<size_t, D>& indices) const {
-  // Make sure proper number of indices
-  if (indices.size() != dimensions_) {
-    std::string mssg = "Improper number of indicies provided to NDArray.";
+template <class T, class A>
+void NpzWriter::add(const std::string& name, const NDArray<T, A>& array) {
+  if (!open_) {
+    std::string mssg = "Cannot add to " + fname_ + " after it is closed.";
     throw std::runtime_error(mssg);
   }
 
-  size_t indx = indices[dimensions_ - 1];
-  if (indx >= shape_[dimensions_ - 1]) {
-    std::string mssg = "Index provided to NDArray out of range.";
-    throw std::out_of_range(mssg);
+  std::string member_name = name + ".npy";
+  if (!member_names_.insert(member_name).second) {
+    std::string mssg = "An array called " + name + " was already added to " +
+                       fname_ + ".";
+    throw std::runtime_error(mssg);
   }
 
-  size_t coeff = 1;
+  Member m;
+  m.name = member_name;
+  m.preamble = npy_preamble(array.shape(), NDArray<T, A>::npy_dtype(),
+                            array.c_continuous());
+  m.data = reinterpret_cast<const char*>(array.data());
+  m.n_bytes = static_cast<uint64_t>(array.size()) * sizeof(T);
+  members_.push_back(std::move(m));
+}
 
-  for (size_t i = dimensions_ - 1; i > 0; i--) {
-    if (indices[i] >= shape_[i]) {
-      std::string mssg = "Index provided to NDArray out of range.";
-      throw std::out_of_range(mssg);
-    }
+inline void NpzWriter::close() {
+  using namespace ndarray_detail;
 
-    coeff *= shape_[i];
-    indx += coeff * indices[i - 1];
-  }
+  if (!open_) return;
+  open_ = false;
 
-  return indx;
-}
+  // Checksum and compress the members in parallel
+  const size_t n_members = members_.size();
+  std::vector<uint32_t> crcs(n_members, 0);
+  std::vector<std::string> compressed(n_members);
+  uint64_t total_bytes = 0;
+  for (const Member& m : members_) total_bytes += m.n_bytes;
 
-template <class T>
-template <size_t D>
-NDARRAY_INLINE size_t NDArray<T>::fortran_continuous_index(
-    const std::array<size_t, D>& indices) const {
-  // Make sure proper number of indices
-  if (indices.size() != dimensions_) {
-    std::string mssg = "Improper number of indicies provided to NDArray.";
+  parallel_tasks(n_members, static_cast<size_t>(total_bytes), [&](size_t i) {
+    const Member& m = members_[i];
+    crcs[i] = crc32(crc32(0, m.preamble.data(), m.preamble.size()), m.data,
+                    m.n_bytes);
+
+    if (compression_ == NpzCompression::Deflate) {
+      const char* parts[2] = {m.preamble.data(), m.data};
+      const uint64_t part_bytes[2] = {m.preamble.size(), m.n_bytes};
+      compressed[i] = deflate_parts(fname_, parts, part_bytes, 2);
+    }
+  });
+
+  std::ofstream file(fname_, std::ios::binary);
+  if (!file) {
+    std::string mssg = "Could not open " + fname_ + " for writing.";
     throw std::runtime_error(mssg);
   }
 
-  size_t indx = indices[0];
-  if (indx >= shape_[0]) {
-    std::string mssg = "Index provided to NDArray out of range.";
-    throw std::out_of_range(mssg);
-  }
-  size_t coeff = 1;
+  const uint16_t method =
+      compression_ == NpzCompression::Deflate ? zip_deflated : zip_stored;
+  // Time and date of the members, which is 1980-01-01 00:00
+  const uint16_t dos_time = 0;
+  const uint16_t dos_date = (1 << 5) | 1;
+
+  std::string directory;
+  uint64_t offset = 0;
+  for (size_t i = 0; i < n_members; i++) {
+    const Member& m = members_[i];
+    uint64_t uncompressed_size = m.preamble.size() + m.n_bytes;
+    uint64_t compressed_size = compression_ == NpzCompression::Deflate
+                                   ? compressed[i].size()
+                                   : uncompressed_size;
+    bool zip64_sizes =
+        uncompressed_size >= zip64_limit || compressed_size >= zip64_limit;
+    bool zip64_offset = offset >= zip64_limit;
+    uint16_t version = (zip64_sizes || zip64_offset) ? 45 : 20;
+
+    // Local file header, with both sizes in a zip64 extra field if needed
+    std::string local;
+    put_little_endian<uint32_t>(local, zip_local_header);
+    put_little_endian<uint16_t>(local, version);
+    put_little_endian<uint16_t>(local, 0);
+    put_little_endian<uint16_t>(local, method);
+    put_little_endian<uint16_t>(local, dos_time);
+    put_little_endian<uint16_t>(local, dos_date);
+    put_little_endian<uint32_t>(local, crcs[i]);
+    put_little_endian<uint32_t>(local,
+                                zip64_sizes ? zip64_limit : compressed_size);
+    put_little_endian<uint32_t>(local,
+                                zip64_sizes ? zip64_limit : uncompressed_size);
+    put_little_endian<uint16_t>(local, static_cast<uint16_t>(m.name.size()));
+    put_little_endian<uint16_t>(local, zip64_sizes ? 20 : 0);
+    local += m.name;
+    if (zip64_sizes) {
+      put_little_endian<uint16_t>(local, 0x0001);
+      put_little_endian<uint16_t>(local, 16);
+      put_little_endian<uint64_t>(local, uncompressed_size);
+      put_little_endian<uint64_t>(local, compressed_size);
+    }
 
-  for (size_t i = 0; i < dimensions_ - 1; i++) {
-    if (indices[i] >= shape_[i]) {
-      std::string mssg = "Index provided to NDArray out of range.";
-      throw std::out_of_range(mssg);
+    // Central directory entry, with the sizes and offset which do not fit
+    std::string extra;
+    if (uncompressed_size >= zip64_limit) {
+      put_little_endian<uint64_t>(extra, uncompressed_size);
+    }
+    if (compressed_size >= zip64_limit) {
+      put_little_endian<uint64_t>(extra, compressed_size);
+    }
+    if (zip64_offset) put_little_endian<uint64_t>(extra, offset);
+    if (!extra.empty()) {
+      std::string header;
+      put_little_endian<uint16_t>(header, 0x0001);
+      put_little_endian<uint16_t>(header, static_cast<uint16_t>(extra.size()));
+      extra = header + extra;
     }
 
-    coeff *= shape_[i];
-    indx += coeff * indices[i + 1];
+    put_little_endian<uint32_t>(directory, zip_central_header);
+    put_little_endian<uint16_t>(directory, version);
+    put_little_endian<uint16_t>(directory, version);
+    put_little_endian<uint16_t>(directory, 0);
+    put_little_endian<uint16_t>(directory, method);
+    put_little_endian<uint16_t>(directory, dos_time);
+    put_little_endian<uint16_t>(directory, dos_date);
+    put_little_endian<uint32_t>(directory, crcs[i]);
+    put_little_endian<uint32_t>(directory,
+                                std::min(compressed_size, zip64_limit));
+    put_little_endian<uint32_t>(directory,
+                                std::min(uncompressed_size, zip64_limit));
+    put_little_endian<uint16_t>(directory,
+                                static_cast<uint16_t>(m.name.size()));
+    put_little_endian<uint16_t>(directory, static_cast<uint16_t>(extra.size()));
+    put_little_endian<uint16_t>(directory, 0);
+    put_little_endian<uint16_t>(directory, 0);
+    put_little_endian<uint16_t>(directory, 0);
+    put_little_endian<uint32_t>(directory, 0);
+    put_little_endian<uint32_t>(directory, std::min(offset, zip64_limit));
+    directory += m.name;
+    directory += extra;
+
+    // Write the member
+    file.write(local.data(), static_cast<std::streamsize>(local.size()));
+    if (compression_ == NpzCompression::Deflate) {
+      file.write(compressed[i].data(),
+                 static_cast<std::streamsize>(compressed[i].size()));
+      std::string().swap(compressed[i]);
+    } else {
+      file.write(m.preamble.data(),
+                 static_cast<std::streamsize>(m.preamble.size()));
+      file.write(m.data, static_cast<std::streamsize>(m.n_bytes));
+    }
+    NDARRAY_STATS_ADD(bytes_written, m.preamble.size() + m.n_bytes);
+    offset += local.size() + compressed_size;
   }
 
-  return indx;
+  // Write the central directory, and its end records
+  const uint64_t directory_offset = offset;
+  const uint64_t directory_size = directory.size();
+  std::string end;
+  if (n_members >= 0xFFFF || directory_offset >= zip64_limit ||
+      directory_size >= zip64_limit) {
+    put_little_endian<uint32_t>(end, zip64_end_of_directory);
+    put_little_endian<uint64_t>(end, 44);
+    put_little_endian<uint16_t>(end, 45);
+    put_little_endian<uint16_t>(end, 45);
+    put_little_endian<uint32_t>(end, 0);
+    put_little_endian<uint32_t>(end, 0);
+    put_little_endian<uint64_t>(end, n_members);
+    put_little_endian<uint64_t>(end, n_members);
+    put_little_endian<uint64_t>(end, directory_size);
+    put_little_endian<uint64_t>(end, directory_offset);
+
+    put_little_endian<uint32_t>(end, zip64_end_locator);
+    put_little_endian<uint32_t>(end, 0);
+    put_little_endian<uint64_t>(end, directory_offset + directory_size);
+    put_little_endian<uint32_t>(end, 1);
+  }
+  put_little_endian<uint32_t>(end, zip_end_of_directory);
+  put_little_endian<uint16_t>(end, 0);
+  put_little_endian<uint16_t>(end, 0);
+  put_little_endian<uint16_t>(end, std::min<uint64_t>(n_members, 0xFFFF));
+  put_little_endian<uint16_t>(end, std::min<uint64_t>(n_members, 0xFFFF));
+  put_little_endian<uint32_t>(end, std::min(directory_size, zip64_limit));
+  put_little_endian<uint32_t>(end, std::min(directory_offset, zip64_limit));
+  put_little_endian<uint16_t>(end, 0);
+
+  file.write(directory.data(), static_cast<std::streamsize>(directory.size()));
+  file.write(end.data(), static_cast<std::streamsize>(end.size()));
+  file.close();
+  members_.clear();
+  member_names_.clear();
+
+  if (!file) {
+    std::string mssg = "Could not write to " + fname_ + ".";
+    throw std::runtime_error(mssg);
+  }
 }
 
 //==============================================================================
-// NPY Function Definitions
-inline void load_npy(const std::string& fname, char*& data_ptr,
-                     std::vector<size_t>& shape, DType& dtype,
-                     bool& c_contiguous) {
-  // Open file
-  std::ifstream file(fname, std::ios::binary);
-
-  // Read magic string
-  char* magic_string = new char[6];
-  file.read(magic_string, 6);
-
-  // Ensure magic string has right value
-  if (magic_string[0] != '\x93' || magic_string[1] != 'N' ||
-      magic_string[2] != 'U' || magic_string[3] != 'M' ||
-      magic_string[4] != 'P' || magic_string[5] != 'Y') {
-    std::string mssg = fname + " is an invalid .npy file.";
+// NpzReader Implementation
+inline NpzReader::NpzReader(const std::string& fname)
+    : fname_{fname}, names_{}, members_{}, index_{} {
+  using namespace ndarray_detail;
+
+  std::ifstream file(fname_, std::ios::binary);
+  if (!file) {
+    std::string mssg = "Could not open " + fname_ + ".";
     throw std::runtime_error(mssg);
   }
 
-  char major_verison = 0x00;
-  char minor_version = 0x00;
-  file.read(&major_verison, 1);
-  file.read(&minor_version, 1);
-
-  uint32_t length_of_header = 0;
-  // Do any version checks here if required
-  if (major_verison == 0x01) {
-    uint16_t length_temp = 0;
-    file.read((char*)&length_temp, 2);
-
-    // Value is stored as little endian. If system is big-endian, swap bytes
-    if (!system_is_little_endian()) {
-      swap_bytes((char*)&length_temp, 2, 1);
+  // The end of central directory record is within the last 64 KiB, as it
+  // is followed by at most a 64 KiB comment
+  file.seekg(0, std::ios::end);
+  const uint64_t file_length = static_cast<uint64_t>(file.tellg());
+  const uint64_t tail_length = std::min<uint64_t>(file_length, 22 + 0xFFFF);
+  std::vector<char> tail(static_cast<size_t>(tail_length));
+  file.seekg(static_cast<std::streamoff>(file_length - tail_length));
+  file.read(tail.data(), static_cast<std::streamsize>(tail_length));
+
+  size_t end = tail.size();
+  for (size_t i = tail.size() >= 22 ? tail.size() - 22 + 1 : 0; i-- > 0;) {
+    if (get_little_endian<uint32_t>(&tail[i]) == zip_end_of_directory) {
+      end = i;
+      break;
     }
+  }
+  if (end == tail.size()) {
+    std::string mssg = fname_ + " is an invalid .npz file.";
+    throw std::runtime_error(mssg);
+  }
 
-    // Cast to main variable
-    length_of_header = static_cast<uint32_t>(length_temp);
-  } else if (major_verison >= 0x02) {
-    uint32_t length_temp = 0;
-    file.read((char*)&length_temp, 4);
-
-    // Value is stored as little endian. If system is big-endian, swap bytes
-    if (!system_is_little_endian()) {
-      swap_bytes((char*)&length_temp, 4, 1);
+  uint64_t n_members = get_little_endian<uint16_t>(&tail[end + 10]);
+  uint64_t directory_size = get_little_endian<uint32_t>(&tail[end + 12]);
+  uint64_t directory_offset = get_little_endian<uint32_t>(&tail[end + 16]);
+
+  // A zip64 archive has its own end record, found through the locator
+  // preceding the end of central directory record
+  if (end >= 20 &&
+      get_little_endian<uint32_t>(&tail[end - 20]) == zip64_end_locator) {
+    uint64_t record_offset = get_little_endian<uint64_t>(&tail[end - 12]);
+    char record[56];
+    file.seekg(static_cast<std::streamoff>(record_offset));
+    file.read(record, 56);
+    if (!file ||
+        get_little_endian<uint32_t>(record) != zip64_end_of_directory) {
+      std::string mssg = fname_ + " is an invalid .npz file.";
+      throw std::runtime_error(mssg);
     }
-
-    // Set to main variable
-    length_of_header = length_temp;
+    n_members = get_little_endian<uint64_t>(record + 32);
+    directory_size = get_little_endian<uint64_t>(record + 40);
+    directory_offset = get_little_endian<uint64_t>(record + 48);
   }
 
-  // Array for header, and read in
-  char* header_char = new char[length_of_header];
-  file.read(header_char, length_of_header);
-  std::string header(header_char);
-
-  // Parse header to get continuity
-  size_t loc1 = header.find("'fortran_order': ");
-  loc1 += 17;
-  std::string f_order_string = "";
-  size_t i = 0;
-  while (true) {
-    if (header[loc1 + i] != ' ') {
-      if (header[loc1 + i] == ',')
-        break;
-      else
-        f_order_string += header[loc1 + i];
-    }
-    i++;
+  std::vector<char> directory(static_cast<size_t>(directory_size));
+  file.seekg(static_cast<std::streamoff>(directory_offset));
+  file.read(directory.data(), static_cast<std::streamsize>(directory_size));
+  if (!file) {
+    std::string mssg = fname_ + " is an invalid .npz file.";
+    throw std::runtime_error(mssg);
   }
-  if (f_order_string == "False")
-    c_contiguous = true;
-  else
-    c_contiguous = false;
-
-  // Parse header to get type description
-  loc1 = header.find("'descr': ");
-  loc1 += 9;
-  std::string descr_string = "";
-  bool data_is_little_endian = false;
-  if (header[loc1 + 1] == '>')
-    data_is_little_endian = false;
-  else
-    data_is_little_endian = true;
-  i = 2;
-  while (true) {
-    if (header[loc1 + i] != ' ') {
-      if (header[loc1 + i] != '\'') {
-        descr_string += header[loc1 + i];
-      } else
-        break;
+
+  size_t position = 0;
+  for (uint64_t i = 0; i < n_members; i++) {
+    if (position + 46 > directory.size() ||
+        get_little_endian<uint32_t>(&directory[position]) !=
+            zip_central_header) {
+      std::string mssg = fname_ + " is an invalid .npz file.";
+      throw std::runtime_error(mssg);
     }
-    i++;
-  }
-  dtype = descr_to_DType(descr_string);
-  size_t element_size = size_of_DType(dtype);
 
-  // Parse header to get shape
-  loc1 = header.find('(');
-  size_t loc2 = header.find(')');
-  loc1 += 1;
-  // Clear shape vector to ensure it's empty (even though it should already be
-  // empty)
-  shape.clear();
-  if (loc1 == loc2) {
-    shape.push_back(1);
-  } else {
-    std::string temp = "";
-    for (i = loc1; i < loc2; i++) {
-      if (header[i] != ',')
-        temp += header[i];
-      else {
-        if (temp.size() > 0) {
-          shape.push_back(static_cast<size_t>(std::stoul(temp)));
-          temp = "";
+    const char* entry = &directory[position];
+    Member m;
+    m.method = get_little_endian<uint16_t>(entry + 10);
+    m.crc = get_little_endian<uint32_t>(entry + 16);
+    m.compressed_size = get_little_endian<uint32_t>(entry + 20);
+    m.uncompressed_size = get_little_endian<uint32_t>(entry + 24);
+    size_t name_length = get_little_endian<uint16_t>(entry + 28);
+    size_t extra_length = get_little_endian<uint16_t>(entry + 30);
+    size_t comment_length = get_little_endian<uint16_t>(entry + 32);
+    m.offset = get_little_endian<uint32_t>(entry + 42);
+
+    if (position + 46 + name_length + extra_length + comment_length >
+        directory.size()) {
+      std::string mssg = fname_ + " is an invalid .npz file.";
+      throw std::runtime_error(mssg);
+    }
+    std::string name(entry + 46, name_length);
+
+    // Values which did not fit are given in order in the zip64 extra field
+    const char* extra = entry + 46 + name_length;
+    for (size_t e = 0; e + 4 <= extra_length;) {
+      uint16_t id = get_little_endian<uint16_t>(extra + e);
+      uint16_t size = get_little_endian<uint16_t>(extra + e + 2);
+      if (id == 0x0001) {
+        const char* value = extra + e + 4;
+        const char* value_end =
+            value + std::min<size_t>(size, extra_length - e - 4);
+        if (m.uncompressed_size == zip64_limit && value + 8 <= value_end) {
+          m.uncompressed_size = get_little_endian<uint64_t>(value);
+          value += 8;
+        }
+        if (m.compressed_size == zip64_limit && value + 8 <= value_end) {
+          m.compressed_size = get_little_endian<uint64_t>(value);
+          value += 8;
+        }
+        if (m.offset == zip64_limit && value + 8 <= value_end) {
+          m.offset = get_little_endian<uint64_t>(value);
         }
       }
+      e += 4 + size;
     }
-    if (temp.size() > 0) {
-      shape.push_back(static_cast<size_t>(std::stoul(temp)));
-    }
-  }
 
-  // Get number of bytes to be read into system
-  size_t n_elements = shape[0];
-  for (size_t j = 1; j < shape.size(); j++) n_elements *= shape[j];
-  std::streamsize n_bytes_to_read = static_cast<std::streamsize>(n_elements * element_size);
-  char* data = new char[static_cast<std::size_t>(n_bytes_to_read)];
-  file.read(data, n_bytes_to_read);
+    // Arrays are named after their member, without the .npy extension
+    if (name.size() > 4 && name.compare(name.size() - 4, 4, ".npy") == 0) {
+      name.erase(name.size() - 4);
+    }
+    index_[name] = names_.size();
+    names_.push_back(name);
+    members_.push_back(m);
 
-  // If byte order of data different from byte order of system, swap data bytes
-  if (system_is_little_endian() != data_is_little_endian) {
-    swap_bytes(data, n_elements, element_size);
+    position += 46 + name_length + extra_length + comment_length;
   }
+}
 
-  // Set pointer reference
-  data_ptr = data;
+inline const std::vector<std::string>& NpzReader::names() const {
+  return names_;
+}
 
-  // Clear Memory
-  delete[] magic_string;
-  delete[] header_char;
-  file.close();
+inline bool NpzReader::contains(const std::string& name) const {
+  return index_.count(name) > 0;
 }
 
-inline void write_npy(const std::string& fname, const char* data_ptr,
-                      const std::vector<size_t>& shape, DType dtype,
-                      bool c_contiguous) {
-  // Calculate number of elements from the shape
-  size_t n_elements = shape[0];
-  for (size_t j = 1; j < shape.size(); j++) {
-    n_elements *= shape[j];
+inline const NpzReader::Member& NpzReader::member(
+    const std::string& name) const {
+  auto it = index_.find(name);
+  if (it == index_.end()) {
+    std::string mssg = fname_ + " has no array called " + name + ".";
+    throw std::out_of_range(mssg);
   }
 
-  // Open file
-  std::ofstream file(fname, std::ios::binary);
-
-  // First write magic string
-  file << '\x93' << 'N' << 'U' << 'M' << 'P' << 'Y';
+  return members_[it->second];
+}
 
-  // Next make the header. This is needed to know what version number to use
-  std::string header = "{'descr': '";
-  // Get system endianness
-  if (system_is_little_endian())
-    header += "<";
-  else
-    header += ">";
-  header += DType_to_descr(dtype) + "', ";
+template <class T>
+NDArray<T> NpzReader::load(const std::string& name) const {
+  NDArray<T> array;
+  load_into(name, array);
+  return array;
+}
 
-  // Fortran ordering
-  header += "'fortran_order': ";
-  if (c_contiguous)
-    header += "False, ";
-  else
-    header += "True, ";
+template <class T, class A>
+void NpzReader::load_into(const std::string& name,
+                          NDArray<T, A>& array) const {
+  using namespace ndarray_detail;
 
-  // Shape
-  header += "'shape': (";
-  for (const auto& e : shape) {
-    header += std::to_string(e) + ",";
+  const Member& m = member(name);
+  const std::string member_fname = fname_ + "[" + name + "]";
+  if (m.method != zip_stored && m.method != zip_deflated) {
+    std::string mssg =
+        member_fname + " uses an unsupported compression method.";
+    throw std::runtime_error(mssg);
   }
-  header += "), }";
 
-  // Based on header length, get version
-  char major_version;
+  // Skip the local file header, whose extra field may differ from that of
+  // the central directory
+  std::ifstream file(fname_, std::ios::binary);
+  char local[30];
+  file.seekg(static_cast<std::streamoff>(m.offset));
+  file.read(local, 30);
+  if (!file || get_little_endian<uint32_t>(local) != zip_local_header) {
+    std::string mssg = fname_ + " is an invalid .npz file.";
+    throw std::runtime_error(mssg);
+  }
+  file.seekg(get_little_endian<uint16_t>(local + 26) +
+                 get_little_endian<uint16_t>(local + 28),
+             std::ios::cur);
 
-  uint64_t beginning_length = 6 + 2 + 2 + header.size();
-  uint8_t padding_needed = 64 - (beginning_length % 64);
-  if (beginning_length + padding_needed > 65535) {
-    major_version = 0x02;
-    beginning_length += 2;
-  } else
-    major_version = 0x01;
-  // Add padding
-  for (uint8_t p = 0; p < padding_needed - 1; p++) header += '\x20';
-  header += '\n';
+  ZipMemberBuf buffer(file, member_fname, m.compressed_size,
+                      m.method == zip_deflated);
+  std::istream member_stream(&buffer);
+  member_stream.exceptions(std::ios::badbit);
 
-  char minor_version = 0x00;
-  file << major_version << minor_version;
+  std::vector<size_t> shape;
+  DType dtype;
+  bool c_contiguous;
+  bool little_endian;
+  read_npy_header(member_stream, member_fname, shape, dtype, c_contiguous,
+                  little_endian);
 
-  // Inf for len of header
-  if (major_version == 0x01) {
-    uint16_t len = static_cast<uint16_t>(header.size());
-    if (!system_is_little_endian()) {
-      swap_two_bytes((char*)&len);
-    }
-    file << ((char*)&len)[0] << ((char*)&len)[1];
-  } else {
-    uint32_t len = static_cast<uint32_t>(header.size());
-    if (!system_is_little_endian()) {
-      swap_four_bytes((char*)&len);
-    }
-    file << ((char*)&len)[0] << ((char*)&len)[1] << ((char*)&len)[2]
-         << ((char*)&len)[3];
+  if (!npy_dtype_matches(NDArray<T, A>::npy_dtype(), dtype)) {
+    std::string mssg =
+        "NDArray template datatype does not match specified datatype in npy "
+        "file.";
+    throw std::runtime_error(mssg);
   }
 
-  // Write header to file
-  file << header.c_str();
+  array.c_continuous_ = c_contiguous;
+  array.allocate_for_overwrite(shape);
+  read_npy_data(member_stream, member_fname,
+                reinterpret_cast<char*>(array.data_.data()), array.size(),
+                dtype, little_endian);
+
+  // Read anything which follows the data, so the checksum covers the whole
+  // member
+  member_stream.ignore(std::numeric_limits<std::streamsize>::max());
+  if (buffer.crc() != m.crc) {
+    std::string mssg = "CRC-32 of " + member_fname + " does not match.";
+    throw std::runtime_error(mssg);
+  }
+}
 
-  // Write all data to file
-  std::streamsize n_bytes = static_cast<std::streamsize>(n_elements * size_of_DType(dtype));
-  file.write(data_ptr, n_bytes);
+template <class T>
+std::vector<NDArray<T>> NpzReader::load(
+    const std::vector<std::string>& names) const {
+  uint64_t total_bytes = 0;
+  for (const std::string& name : names) {
+    total_bytes += member(name).uncompressed_size;
+  }
 
-  // Close file
-  file.close();
+  std::vector<NDArray<T>> arrays(names.size());
+  ndarray_detail::parallel_tasks(
+      names.size(), static_cast<size_t>(total_bytes / sizeof(T)),
+      [&](size_t i) { load_into(names[i], arrays[i]); });
+  return arrays;
 }
 
 inline DType descr_to_DType(const std::string& dtype) {
-  if (dtype == "b1")
+  if (dtype == "i1")
     return DType::CHAR;
-  else if (dtype == "B1")
+  else if (dtype == "u1" || dtype == "B1")
     return DType::UCHAR;
+  else if (dtype == "b1")
+    return DType::BOOL;
   else if (dtype == "i2")
     return DType::INT16;
   else if (dtype == "i4")
@@ -1297,6 +11611,10 @@ inline DType descr_to_DType(const std::string& dtype) {
     return DType::COMPLEX64;
   else if (dtype == "c16")
     return DType::COMPLEX128;
+  else if (dtype == "f2")
+    return DType::FLOAT16;
+  else if (dtype == "V2")
+    return DType::VOID16;
   else {
     std::string mssg = "Data type " + dtype + " is unknown.";
     throw std::runtime_error(mssg);
@@ -1306,10 +11624,10 @@ inline DType descr_to_DType(const std::string& dtype) {
 inline std::string DType_to_descr(DType dtype) {
   switch (dtype) {
     case DType::CHAR:
-      return "b1"; 
+      return "i1";
       break;
     case DType::UCHAR:
-      return "B1";
+      return "u1";
       break;
     case DType::INT16:
       return "i2";
@@ -1341,6 +11659,18 @@ inline std::string DType_to_descr(DType dtype) {
     case DType::COMPLEX128:
       return "c16";
       break;
+    case DType::FLOAT16:
+      return "f2";
+      break;
+    case DType::BFLOAT16:
+      return "V2";
+      break;
+    case DType::BOOL:
+      return "b1";
+      break;
+    case DType::VOID16:
+      return "V2";
+      break;
     default: {
       std::string mssg = "Unknown DType identifier.";
       throw std::runtime_error(mssg);        
@@ -1349,6 +11679,11 @@ inline std::string DType_to_descr(DType dtype) {
   }
 }
 
+inline bool npy_dtype_matches(DType expected, DType stored) {
+  return expected == stored ||
+         (expected == DType::BFLOAT16 && stored == DType::VOID16);
+}
+
 inline size_t size_of_DType(DType dtype) {
   switch (dtype) {
     case DType::CHAR:
@@ -1387,6 +11722,18 @@ inline size_t size_of_DType(DType dtype) {
     case DType::COMPLEX128:
       return 16;
       break;
+    case DType::FLOAT16:
+      return 2;
+      break;
+    case DType::BFLOAT16:
+      return 2;
+      break;
+    case DType::BOOL:
+      return 1;
+      break;
+    case DType::VOID16:
+      return 2;
+      break;
     default: {
       std::string mssg = "Unknown DType identifier.";
       throw std::runtime_error(mssg);        
@@ -1395,6 +11742,17 @@ inline size_t size_of_DType(DType dtype) {
   }
 }
 
+inline size_t scalar_size_of_DType(DType dtype) {
+  switch (dtype) {
+    case DType::COMPLEX64:
+      return 4;
+    case DType::COMPLEX128:
+      return 8;
+    default:
+      return size_of_DType(dtype);
+  }
+}
+
 inline bool system_is_little_endian() {
   int x = 1;
 
@@ -1405,103 +11763,211 @@ inline bool system_is_little_endian() {
 }
 
 inline void swap_bytes(char* data, uint64_t n_elements, size_t element_size) {
-  // Calculate number of total bytes
-  uint64_t number_of_bytes = n_elements * element_size;
-
-  // Iterate through all elements, and swap their bytes
-  for (uint64_t i = 0; i < number_of_bytes; i += element_size) {
-    switch (element_size) {
-      case 1:
-        // Nothing to do
-        break;
-      case 2:
-        swap_two_bytes(data + i);  
-        break;
-      case 4:
-        swap_four_bytes(data + i);
-        break;
-      case 8:
-        swap_eight_bytes(data + i);
-        break;
-      case 16:
-        swap_sixteen_bytes(data + i);
-        break;
-      default:
-        std::string mssg = "Cannot swap bytes for data types of size " +
-                           std::to_string(element_size);
-        throw std::runtime_error(mssg);
-        break;
-    }
-  }
+  NDARRAY_STATS_TIMER(swap_bytes_ns);
+  NDARRAY_STATS_ADD(bytes_swapped, n_elements * element_size);
+  ndarray_detail::byte_swap_kernel(element_size)(data, n_elements);
 }
 
 inline void swap_two_bytes(char* bytes) {
-  // Temporary array to store original bytes
-  char temp[2];
+  ndarray_detail::scalar_byte_swap<uint16_t>(bytes, 1);
+}
 
-  // Copyr original bytes into temp array
-  std::memcpy(&temp, bytes, 2);
+inline void swap_four_bytes(char* bytes) {
+  ndarray_detail::scalar_byte_swap<uint32_t>(bytes, 1);
+}
 
-  // Set original bytes to new values
-  bytes[0] = temp[1];
-  bytes[1] = temp[0];
+inline void swap_eight_bytes(char* bytes) {
+  ndarray_detail::scalar_byte_swap<uint64_t>(bytes, 1);
 }
 
-inline void swap_four_bytes(char* bytes) {
-  // Temporary array to store original bytes
-  char temp[4];
+inline void swap_sixteen_bytes(char* bytes) {
+  ndarray_detail::scalar_byte_swap_sixteen(bytes, 1);
+}
+
+//==============================================================================
+// NpyBatchLoader Implementation
+template <class T>
+NpyBatchLoader<T>::NpyBatchLoader(const std::vector<std::string>& fnames,
+                                  size_t n_threads, size_t readahead)
+    : fnames_(fnames),
+      headers_(fnames.size()),
+      errors_(fnames.size()),
+      arrays_(fnames.size()),
+      workers_(),
+      mutex_(),
+      ready_(),
+      space_(),
+      done_(),
+      readahead_(readahead),
+      next_file_(0),
+      pending_(0),
+      returned_(0),
+      stop_(false) {
+  if (n_threads == 0) {
+    n_threads = std::max<size_t>(4, std::thread::hardware_concurrency());
+  }
+  n_threads = std::min(n_threads, fnames_.size());
+  if (readahead_ == 0) readahead_ = 2 * n_threads;
 
-  // Copyr original bytes into temp array
-  std::memcpy(&temp, bytes, 4);
+  read_headers(n_threads, readahead_ >= fnames_.size());
 
-  // Set original bytes to new values
-  bytes[0] = temp[3];
-  bytes[1] = temp[2];
-  bytes[2] = temp[1];
-  bytes[3] = temp[0];
+  for (size_t t = 0; t < n_threads; t++) {
+    workers_.emplace_back(&NpyBatchLoader::work, this);
+  }
 }
 
-inline void swap_eight_bytes(char* bytes) {
-  // Temporary array to store original bytes
-  char temp[8];
+template <class T>
+NpyBatchLoader<T>::~NpyBatchLoader() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  space_.notify_all();
 
-  // Copyr original bytes into temp array
-  std::memcpy(&temp, bytes, 8);
+  for (size_t i = 0; i < workers_.size(); i++) {
+    workers_[i].join();
+  }
+}
 
-  // Set original bytes to new values
-  bytes[0] = temp[7];
-  bytes[1] = temp[6];
-  bytes[2] = temp[5];
-  bytes[3] = temp[4];
-  bytes[4] = temp[3];
-  bytes[5] = temp[2];
-  bytes[6] = temp[1];
-  bytes[7] = temp[0];
+template <class T>
+size_t NpyBatchLoader<T>::size() const {
+  return fnames_.size();
 }
 
-inline void swap_sixteen_bytes(char* bytes) {
-  // Temporary array to store original bytes
-  char temp[16];
-
-  // Copyr original bytes into temp array
-  std::memcpy(&temp, bytes, 16);
-
-  // Set original bytes to new values
-  bytes[0] = temp[15];
-  bytes[1] = temp[14];
-  bytes[2] = temp[13];
-  bytes[3] = temp[12];
-  bytes[4] = temp[11];
-  bytes[5] = temp[10];
-  bytes[6] = temp[9];
-  bytes[7] = temp[8];
-  bytes[8] = temp[7];
-  bytes[9] = temp[6];
-  bytes[10] = temp[5];
-  bytes[11] = temp[4];
-  bytes[12] = temp[3];
-  bytes[13] = temp[2];
-  bytes[14] = temp[1];
-  bytes[15] = temp[0];
+template <class T>
+const std::string& NpyBatchLoader<T>::fname(size_t i) const {
+  if (i >= fnames_.size()) {
+    std::string mssg = "Index provided to NpyBatchLoader out of range.";
+    throw std::out_of_range(mssg);
+  }
+  return fnames_[i];
+}
+
+template <class T>
+bool NpyBatchLoader<T>::ok(size_t i) const {
+  if (i >= fnames_.size()) {
+    std::string mssg = "Index provided to NpyBatchLoader out of range.";
+    throw std::out_of_range(mssg);
+  }
+  return !errors_[i];
+}
+
+template <class T>
+const NpyHeaderInfo& NpyBatchLoader<T>::header(size_t i) const {
+  if (!ok(i)) std::rethrow_exception(errors_[i]);
+  return headers_[i];
+}
+
+template <class T>
+uint64_t NpyBatchLoader<T>::total_bytes() const {
+  uint64_t n_bytes = 0;
+  for (size_t i = 0; i < headers_.size(); i++) {
+    if (errors_[i]) continue;
+
+    uint64_t n_elements = 1;
+    for (size_t n : headers_[i].shape) n_elements *= n;
+    n_bytes += n_elements * sizeof(T);
+  }
+  return n_bytes;
+}
+
+template <class T>
+bool NpyBatchLoader<T>::next(NpyBatchResult<T>& result) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (returned_ == fnames_.size()) return false;
+
+  ready_.wait(lock, [this] { return !done_.empty(); });
+  result = std::move(done_.front());
+  done_.pop_front();
+  returned_++;
+  pending_--;
+  lock.unlock();
+
+  space_.notify_one();
+  return true;
+}
+
+template <class T>
+void NpyBatchLoader<T>::read_headers(size_t n_threads, bool allocate) {
+  // Headers are small, so each thread takes the next file as it finishes
+  // one. Errors are kept with their file, to be returned by next.
+  std::atomic<size_t> next_header(0);
+  auto read = [&]() {
+    for (size_t i = next_header++; i < fnames_.size(); i = next_header++) {
+      try {
+        headers_[i] = npy_header_info(fnames_[i]);
+        if (!npy_dtype_matches(NDArray<T>::npy_dtype(), headers_[i].dtype)) {
+          std::string mssg =
+              "NDArray template datatype does not match specified datatype "
+              "in npy file.";
+          throw std::runtime_error(mssg);
+        }
+
+        if (allocate) {
+          arrays_[i].c_continuous_ = !headers_[i].fortran_order;
+          arrays_[i].allocate_for_overwrite(headers_[i].shape);
+        }
+      } catch (...) {
+        errors_[i] = std::current_exception();
+      }
+    }
+  };
+
+  std::vector<std::thread> readers;
+  for (size_t t = 1; t < n_threads; t++) readers.emplace_back(read);
+  read();
+  for (size_t t = 0; t < readers.size(); t++) readers[t].join();
+}
+
+template <class T>
+void NpyBatchLoader<T>::work() {
+  while (true) {
+    size_t i;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      space_.wait(lock, [this] {
+        return stop_ || next_file_ == fnames_.size() || pending_ < readahead_;
+      });
+      if (stop_ || next_file_ == fnames_.size()) return;
+      i = next_file_++;
+      pending_++;
+    }
+
+    NpyBatchResult<T> result;
+    result.fname = fnames_[i];
+    result.index = i;
+    result.array = std::move(arrays_[i]);
+    result.error = errors_[i];
+
+    // The array, if it was allocated from the header, is reused by load_into
+    if (!result.error) {
+      try {
+        NDArray<T>::load_into(fnames_[i], result.array);
+      } catch (...) {
+        result.array = NDArray<T>();
+        result.error = std::current_exception();
+      }
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      done_.push_back(std::move(result));
+    }
+    ready_.notify_one();
+  }
+}
+
+template <class T>
+std::vector<NpyBatchResult<T>> load_npy_batch(
+    const std::vector<std::string>& fnames, size_t n_threads) {
+  NpyBatchLoader<T> loader(fnames, n_threads, fnames.size());
+
+  std::vector<NpyBatchResult<T>> results(fnames.size());
+  NpyBatchResult<T> result;
+  while (loader.next(result)) {
+    const size_t i = result.index;
+    results[i] = std::move(result);
+  }
+  return results;
 }
 #endif  // NP_ARRAY_H